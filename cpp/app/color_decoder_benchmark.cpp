@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <gsl/gsl>
+#include "native/kh_native.h"
+
+namespace kh
+{
+// The size of color frames, which get transformed to the depth camera in K4A_DEPTH_MODE_NFOV_UNBINNED.
+constexpr int WIDTH{640};
+constexpr int HEIGHT{576};
+constexpr int TARGET_BITRATE{4000};
+
+// Writes a frame with a static texture and a brighter block moving over it,
+// so the frames after the keyframe have both skipped and changed macroblocks like a room with a person in it.
+void write_synthetic_frame(const YuvPlanes& planes, int frame_index)
+{
+    const int block_x{(frame_index * 8) % (WIDTH - 160)};
+    const int block_y{HEIGHT / 4 + (frame_index * 4) % (HEIGHT / 2)};
+    for (int y{0}; y < HEIGHT; ++y) {
+        for (int x{0}; x < WIDTH; ++x) {
+            std::uint32_t noise{(static_cast<std::uint32_t>(x) * 73856093u) ^ (static_cast<std::uint32_t>(y) * 19349663u)};
+            noise ^= noise >> 13;
+            const int texture{(x + y) / 4 + static_cast<int>(noise % 32)};
+            const bool in_block{x >= block_x && x < block_x + 160 && y >= block_y && y < block_y + 200};
+            planes.y_plane[y * planes.y_stride + x] = static_cast<std::uint8_t>(std::min(texture + (in_block ? 96 : 0), 255));
+        }
+    }
+    for (int y{0}; y < HEIGHT / 2; ++y) {
+        for (int x{0}; x < WIDTH / 2; ++x) {
+            planes.u_plane[y * planes.u_stride + x] = static_cast<std::uint8_t>(96 + x / 8);
+            planes.v_plane[y * planes.v_stride + x] = static_cast<std::uint8_t>(160 - y / 8);
+        }
+    }
+}
+
+// VP8 frames with COLOR_DECODER_PADDING_SIZE zeroed bytes at the end of each for ColorDecoder::decode_padded(),
+// so only the decoder gets measured.
+std::vector<std::vector<std::byte>> encode_synthetic_frames(int token_partition_count, int frame_count)
+{
+    auto color_encoder{create_color_encoder(ColorCodecId::Vp8, ColorCodecConfig{WIDTH, HEIGHT, TARGET_BITRATE, token_partition_count, 1, false})};
+    std::vector<std::vector<std::byte>> frames;
+    for (int i{0}; i < frame_count; ++i) {
+        write_synthetic_frame(color_encoder->acquire_input_planes(), i);
+        auto frame{color_encoder->encode(i == 0)};
+        frame.resize(frame.size() + COLOR_DECODER_PADDING_SIZE);
+        frames.push_back(std::move(frame));
+    }
+    return frames;
+}
+
+// Decodes the frames in order, from the keyframe, and prints the milliseconds each decode_padded() took.
+void run_decoder(const std::vector<std::vector<std::byte>>& frames, int thread_count)
+{
+    auto color_decoder{create_color_decoder(ColorCodecId::Vp8, thread_count)};
+    std::vector<float> decode_times;
+    for (auto& frame : frames) {
+        const TimePoint decode_start{TimePoint::now()};
+        const auto ffmpeg_frame{color_decoder->decode_padded({frame.data(), frame.size() - COLOR_DECODER_PADDING_SIZE})};
+        decode_times.push_back(decode_start.elapsed_time().ms());
+    }
+
+    // The keyframe is not what the decoder spends most of its time on.
+    const float keyframe_time{decode_times.front()};
+    decode_times.erase(decode_times.begin());
+    std::sort(decode_times.begin(), decode_times.end());
+
+    float decode_time_sum{0.0f};
+    for (float decode_time : decode_times)
+        decode_time_sum += decode_time;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "    threads: " << thread_count
+              << ", mean: " << decode_time_sum / decode_times.size() << " ms"
+              << ", median: " << decode_times[decode_times.size() / 2] << " ms"
+              << ", p95: " << decode_times[decode_times.size() * 95 / 100] << " ms"
+              << ", keyframe: " << keyframe_time << " ms\n";
+}
+
+// Measures the latency of decoding VP8 frames at the resolution of the receivers
+// for each number of token partitions and decoder threads.
+void main(int frame_count)
+{
+    constexpr int TOKEN_PARTITION_COUNTS[]{1, 2, 4, 8};
+    constexpr int THREAD_COUNTS[]{1, 2, 4, 8};
+
+    std::cout << "Decoding " << frame_count << " VP8 frames of " << WIDTH << "x" << HEIGHT
+              << " at " << TARGET_BITRATE << " kbps.\n";
+
+    for (int token_partition_count : TOKEN_PARTITION_COUNTS) {
+        const auto frames{encode_synthetic_frames(token_partition_count, frame_count)};
+        size_t byte_count{0};
+        for (auto& frame : frames)
+            byte_count += frame.size() - COLOR_DECODER_PADDING_SIZE;
+
+        std::cout << "token partitions: " << token_partition_count
+                  << " (" << byte_count / frames.size() << " bytes per frame)\n";
+        for (int thread_count : THREAD_COUNTS)
+            run_decoder(frames, thread_count);
+    }
+}
+}
+
+// The first argument is the number of frames to decode for each setting.
+int main(int argc, char* argv[])
+{
+    std::ios_base::sync_with_stdio(false);
+    kh::main(argc > 1 ? std::stoi(argv[1]) : 300);
+    return 0;
+}
\ No newline at end of file
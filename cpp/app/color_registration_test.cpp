@@ -0,0 +1,192 @@
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_cpu.h"
+#include "native/kh_color_registration.h"
+#include "native/kh_time.h"
+#include "helper/depth_frame_helper.h"
+
+namespace kh
+{
+// The color camera in 1280x720.
+constexpr int COLOR_WIDTH{1280};
+constexpr int COLOR_HEIGHT{720};
+// Rows of the color frame with padding, as frames of the SDK can have.
+constexpr int COLOR_STRIDE{COLOR_WIDTH * 4 + 64};
+// Projections this close to the middle between two color pixels can pick either one with float instead of double.
+constexpr double ROUNDING_MARGIN{0.01};
+
+// A calibration of a Kinect made up without a device: a pinhole depth camera of which the corners are out of
+// its lens model, the depth camera tilted by 6 degrees and 32 mm to the side of the color camera as in the Azure Kinect,
+// and a color camera with the distortion of a wide lens.
+ColorRegistrationCalibration create_synthetic_calibration()
+{
+    constexpr float DEPTH_FOCAL_LENGTH{504.0f};
+    constexpr float MAX_DEPTH_RAY_RADIUS_SQUARED{0.6f};
+
+    ColorRegistrationCalibration calibration;
+    calibration.depth_width = SYNTHETIC_DEPTH_WIDTH;
+    calibration.depth_height = SYNTHETIC_DEPTH_HEIGHT;
+    for (int y{0}; y < SYNTHETIC_DEPTH_HEIGHT; ++y) {
+        for (int x{0}; x < SYNTHETIC_DEPTH_WIDTH; ++x) {
+            const float ray_x{(x - SYNTHETIC_DEPTH_WIDTH / 2.0f) / DEPTH_FOCAL_LENGTH};
+            const float ray_y{(y - SYNTHETIC_DEPTH_HEIGHT / 2.0f) / DEPTH_FOCAL_LENGTH};
+            const bool in_lens{ray_x * ray_x + ray_y * ray_y <= MAX_DEPTH_RAY_RADIUS_SQUARED};
+            calibration.x_with_unit_depth.push_back(in_lens ? ray_x : std::numeric_limits<float>::quiet_NaN());
+            calibration.y_with_unit_depth.push_back(in_lens ? ray_y : std::numeric_limits<float>::quiet_NaN());
+        }
+    }
+
+    const float tilt{6.0f * 3.14159265f / 180.0f};
+    calibration.rotation = {1.0f, 0.0f, 0.0f,
+                            0.0f, std::cos(tilt), -std::sin(tilt),
+                            0.0f, std::sin(tilt), std::cos(tilt)};
+    calibration.translation = {-32.0f, -2.0f, 4.0f};
+    calibration.color_intrinsics = ColorCameraIntrinsics{COLOR_WIDTH, COLOR_HEIGHT,
+                                                         638.5f, 361.5f, 610.0f, 610.0f,
+                                                         {0.08f, -0.05f, 0.01f, 0.01f, 0.002f, 0.001f},
+                                                         0.0005f, -0.0003f, 0.0f, 0.0f, 1.7f};
+    return calibration;
+}
+
+// A color frame of which every pixel differs from its neighbors, so a depth pixel that takes
+// a wrong color pixel shows up in its Y.
+std::vector<std::uint8_t> create_synthetic_color_frame()
+{
+    std::vector<std::uint8_t> color_frame(static_cast<std::size_t>(COLOR_STRIDE) * COLOR_HEIGHT);
+    for (int y{0}; y < COLOR_HEIGHT; ++y) {
+        for (int x{0}; x < COLOR_WIDTH; ++x) {
+            const std::uint32_t bgra{hash_pixel(x, y, 0) | 0xFF000000u};
+            memcpy(color_frame.data() + y * COLOR_STRIDE + x * 4, &bgra, sizeof(bgra));
+        }
+    }
+    return color_frame;
+}
+
+// Y of the color pixel a depth pixel maps to, projected in double precision, or -1 when the projection
+// is too close to the middle between color pixels or the edge of the lens model to tell which one the floats pick.
+int project_reference_y(const ColorRegistrationCalibration& calibration, const std::vector<std::uint8_t>& color_frame,
+                        int index, std::int16_t depth)
+{
+    // Black as k4a::transformation leaves pixels without color.
+    constexpr int BLACK_Y{16};
+
+    const double ray_x{calibration.x_with_unit_depth[index]};
+    const double ray_y{calibration.y_with_unit_depth[index]};
+    if (depth <= 0 || std::isnan(ray_x))
+        return BLACK_Y;
+
+    const auto& r{calibration.rotation};
+    const auto& t{calibration.translation};
+    const double z{static_cast<double>(depth)};
+    const double x{(r[0] * ray_x + r[1] * ray_y + r[2]) * z + t[0]};
+    const double y{(r[3] * ray_x + r[4] * ray_y + r[5]) * z + t[1]};
+    const double zz{(r[6] * ray_x + r[7] * ray_y + r[8]) * z + t[2]};
+    if (zz <= 0.0)
+        return BLACK_Y;
+
+    const auto& intrinsics{calibration.color_intrinsics};
+    const auto& k{intrinsics.k};
+    const double xp{x / zz - intrinsics.codx};
+    const double yp{y / zz - intrinsics.cody};
+    const double rs{xp * xp + yp * yp};
+    const double max_rs{static_cast<double>(intrinsics.metric_radius) * intrinsics.metric_radius};
+    if (std::abs(rs - max_rs) < 1e-4)
+        return -1;
+    if (rs > max_rs)
+        return BLACK_Y;
+
+    const double d{(1.0 + rs * (k[0] + rs * (k[1] + rs * k[2]))) / (1.0 + rs * (k[3] + rs * (k[4] + rs * k[5])))};
+    const double xp_d{xp * d + (rs + 2.0 * xp * xp) * intrinsics.p2 + 2.0 * xp * yp * intrinsics.p1};
+    const double yp_d{yp * d + (rs + 2.0 * yp * yp) * intrinsics.p1 + 2.0 * xp * yp * intrinsics.p2};
+    const double u{(xp_d + intrinsics.codx) * intrinsics.fx + intrinsics.cx};
+    const double v{(yp_d + intrinsics.cody) * intrinsics.fy + intrinsics.cy};
+    if (std::abs(u - std::floor(u) - 0.5) < ROUNDING_MARGIN || std::abs(v - std::floor(v) - 0.5) < ROUNDING_MARGIN)
+        return -1;
+
+    const long ui{std::lround(u)};
+    const long vi{std::lround(v)};
+    if (ui < 0 || ui >= COLOR_WIDTH || vi < 0 || vi >= COLOR_HEIGHT)
+        return BLACK_Y;
+
+    const std::uint8_t* bgra{color_frame.data() + vi * COLOR_STRIDE + ui * 4};
+    return ((66 * bgra[2] + 129 * bgra[1] + 25 * bgra[0] + 128) >> 8) + 16;
+}
+
+// Transforms a synthetic frame with a synthetic calibration, without a device, and checks that
+// every kernel with any number of bands writes the same planes, and that the Y plane has the color pixels
+// a projection in double precision picks.
+bool main()
+{
+    constexpr int BAND_COUNTS[]{1, 3, 4};
+    constexpr int ITERATION_COUNT{30};
+
+    const auto calibration{create_synthetic_calibration()};
+    const auto color_frame{create_synthetic_color_frame()};
+    std::vector<std::int16_t> depth_frame(SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT);
+    write_synthetic_depth_frame(depth_frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, 0);
+    // Depth that is not 16-bit signed, which the kernels read as unsigned.
+    depth_frame[1] = -1;
+
+    std::vector<std::pair<ColorRegistrationKernel, const char*>> kernels{{ColorRegistrationKernel::Scalar, "scalar"}};
+    if (get_cpu_features().sse41)
+        kernels.push_back({ColorRegistrationKernel::Sse41, "SSE4.1"});
+    if (get_cpu_features().avx2)
+        kernels.push_back({ColorRegistrationKernel::Avx2, "AVX2"});
+
+    constexpr int Y_SIZE{SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT};
+    constexpr int UV_SIZE{Y_SIZE / 4};
+    std::vector<std::uint8_t> reference_planes;
+    bool passed{true};
+    for (auto& [kernel, kernel_name] : kernels) {
+        for (int band_count : BAND_COUNTS) {
+            ColorRegistration color_registration{calibration, band_count, kernel};
+            std::vector<std::uint8_t> planes(Y_SIZE + UV_SIZE * 2);
+            const YuvPlanes yuv_planes{planes.data(), planes.data() + Y_SIZE, planes.data() + Y_SIZE + UV_SIZE,
+                                       SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_WIDTH / 2, SYNTHETIC_DEPTH_WIDTH / 2};
+
+            const TimePoint transform_start{TimePoint::now()};
+            for (int i{0}; i < ITERATION_COUNT; ++i)
+                color_registration.transform(depth_frame, color_frame.data(), COLOR_STRIDE, yuv_planes);
+            const float transform_ms{transform_start.elapsed_time().ms() / ITERATION_COUNT};
+
+            if (reference_planes.empty())
+                reference_planes = planes;
+            const bool matched{planes == reference_planes};
+            passed = passed && matched;
+            std::cout << std::fixed << std::setprecision(3)
+                      << "  " << kernel_name << ", bands: " << band_count << ": " << transform_ms << " ms"
+                      << (matched ? "\n" : ", differs from scalar\n");
+        }
+    }
+
+    int checked_count{0};
+    int skipped_count{0};
+    int mismatch_count{0};
+    for (int i{0}; i < Y_SIZE; ++i) {
+        const int reference_y{project_reference_y(calibration, color_frame, i, depth_frame[i])};
+        if (reference_y < 0) {
+            ++skipped_count;
+            continue;
+        }
+        ++checked_count;
+        if (reference_y != reference_planes[i])
+            ++mismatch_count;
+    }
+    std::cout << "Projection in double precision: " << mismatch_count << " of " << checked_count << " pixels differ ("
+              << skipped_count << " too close to call).\n";
+
+    return passed && mismatch_count == 0;
+}
+}
+
+// Returns 1 when the kernels do not match each other or the projection in double precision.
+int main()
+{
+    std::ios_base::sync_with_stdio(false);
+    return kh::main() ? 0 : 1;
+}
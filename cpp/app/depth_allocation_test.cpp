@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_depth_codec.h"
+#include "kh_depth_filter.h"
+#include "kh_depth_quantizer.h"
+#include "helper/depth_frame_helper.h"
+
+// Every allocation of the process, including the ones of the worker threads of the encoders, goes through these.
+std::atomic<long long> allocation_count{0};
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void* pointer{std::malloc(size == 0 ? 1 : size)})
+        return pointer;
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+namespace kh
+{
+// Frames before the counting starts, which take every kind of frame once so that buffers that grow on demand have grown.
+constexpr int WARM_UP_FRAME_COUNT{8};
+constexpr int FRAME_COUNT{WARM_UP_FRAME_COUNT + 24};
+
+// Runs the depth path of KinectVideoSender (the filter, the quantizer for lossy depth, and the encoder)
+// in the pattern of two temporal layers with a long-term reference, and returns the number of allocations
+// after the warm-up frames.
+long long count_depth_path_allocations(DepthCodecId codec_id, bool quantized, bool intra_refresh,
+                                       const std::vector<std::vector<std::int16_t>>& depth_frames)
+{
+    constexpr int INVALID_THRESHOLD{2};
+    constexpr int BAND_COUNT{4};
+    constexpr float ERROR_BOUND{2.0f};
+
+    const auto change_thresholds{create_constant_trvl_change_thresholds(quantized ? 0 : 10)};
+    auto depth_encoder{create_depth_encoder(codec_id, DepthCodecConfig{SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, change_thresholds,
+                                                                       INVALID_THRESHOLD, BAND_COUNT, intra_refresh})};
+    DepthTemporalFilter depth_filter{SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, change_thresholds};
+    std::optional<DepthQuantizer> depth_quantizer;
+    if (quantized)
+        depth_quantizer.emplace(ERROR_BOUND);
+
+    std::vector<std::int16_t> depth_image(SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT);
+    std::vector<std::byte> depth_encoder_buffer(depth_encoder->get_max_frame_size());
+
+    long long warm_up_allocation_count{0};
+    for (int i{0}; i < FRAME_COUNT; ++i) {
+        if (i == WARM_UP_FRAME_COUNT)
+            warm_up_allocation_count = allocation_count;
+
+        std::copy(depth_frames[i].begin(), depth_frames[i].end(), depth_image.begin());
+        depth_filter.filter(depth_image);
+        if (depth_quantizer)
+            depth_quantizer->quantize(depth_image, depth_image);
+
+        // Odd frames are of the upper layer, every eighth frame from the long-term reference,
+        // and the long-term reference gets saved every fourth frame. There is a keyframe after the warm-up too.
+        const bool keyframe{i == 0 || i == WARM_UP_FRAME_COUNT + 2};
+        if (i % 2 == 1) {
+            depth_encoder->encode_non_reference(depth_image, depth_encoder_buffer);
+        } else if (i % 8 == 6) {
+            depth_encoder->encode_long_term_reference(depth_image, depth_encoder_buffer);
+        } else {
+            depth_encoder->encode(depth_image, keyframe, depth_encoder_buffer);
+        }
+        if (i % 4 == 0)
+            depth_encoder->save_long_term_reference();
+    }
+
+    return allocation_count - warm_up_allocation_count;
+}
+
+// Checks that the depth path of the sender does not allocate once its buffers exist.
+bool main()
+{
+    std::vector<std::vector<std::int16_t>> depth_frames;
+    for (int i{0}; i < FRAME_COUNT; ++i) {
+        std::vector<std::int16_t> depth_frame(SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT);
+        write_synthetic_depth_frame(depth_frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, i);
+        depth_frames.push_back(std::move(depth_frame));
+    }
+
+    bool passed{true};
+    for (auto codec_id : get_depth_codec_ids()) {
+        for (bool quantized : {false, true}) {
+            for (bool intra_refresh : {false, true}) {
+                if (intra_refresh && !is_depth_intra_refresh_supported(codec_id))
+                    continue;
+
+                const long long count{count_depth_path_allocations(codec_id, quantized, intra_refresh, depth_frames)};
+                std::cout << get_depth_codec_name(codec_id)
+                          << (quantized ? ", quantized" : ", lossless")
+                          << (intra_refresh ? ", intra refresh" : ", keyframes")
+                          << ": " << count << " allocations in " << FRAME_COUNT - WARM_UP_FRAME_COUNT << " frames\n";
+                passed = passed && count == 0;
+            }
+        }
+    }
+
+    return passed;
+}
+}
+
+// Returns 1 when the depth path allocates.
+int main()
+{
+    std::ios_base::sync_with_stdio(false);
+    return kh::main() ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_trvl.h"
+#include "helper/depth_frame_helper.h"
+
+namespace kh
+{
+constexpr int PIXEL_COUNT{SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT};
+constexpr int FRAME_RATE{30};
+// Pixels from here are far, where the noise of depth is larger than the threshold TRVL used for every pixel.
+constexpr std::int16_t FAR_DEPTH{3000};
+
+// Reads frames of K4A_DEPTH_MODE_NFOV_UNBINNED stored back to back as raw int16_t pixels (e.g., a recorded scene).
+std::vector<std::vector<std::int16_t>> read_depth_frames(const std::string& path, int frame_count)
+{
+    std::ifstream file{path, std::ios::binary};
+    if (!file)
+        throw std::exception("Failed to open the file of depth frames.");
+
+    std::vector<std::vector<std::int16_t>> depth_frames;
+    std::vector<std::int16_t> depth_frame(PIXEL_COUNT);
+    while (gsl::narrow_cast<int>(depth_frames.size()) < frame_count
+           && file.read(reinterpret_cast<char*>(depth_frame.data()), PIXEL_COUNT * sizeof(std::int16_t))) {
+        depth_frames.push_back(depth_frame);
+    }
+    return depth_frames;
+}
+
+std::vector<std::vector<std::int16_t>> create_synthetic_depth_frames(int frame_count, bool noisy)
+{
+    std::vector<std::vector<std::int16_t>> depth_frames;
+    for (int i{0}; i < frame_count; ++i) {
+        std::vector<std::int16_t> depth_frame(PIXEL_COUNT);
+        write_synthetic_depth_frame(depth_frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, i, noisy);
+        depth_frames.push_back(std::move(depth_frame));
+    }
+    return depth_frames;
+}
+
+// Encodes the frames with TRVL as the sender does, starting with a keyframe, decodes them as receivers do,
+// and prints the bitrate and the mean error of the decoded pixels from reference_frames,
+// over the pixels valid in both and over the far ones among them.
+void run_trvl(const std::string& name, const TrvlChangeThresholds& change_thresholds,
+              const std::vector<std::vector<std::int16_t>>& depth_frames,
+              const std::vector<std::vector<std::int16_t>>& reference_frames)
+{
+    constexpr int INVALID_THRESHOLD{2};
+    constexpr int BAND_COUNT{4};
+
+    TrvlEncoder trvl_encoder{SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, change_thresholds, INVALID_THRESHOLD, BAND_COUNT};
+    TrvlDecoder trvl_decoder{SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, BAND_COUNT};
+    std::vector<std::byte> trvl_frame(trvl_encoder.get_max_frame_size());
+    std::vector<std::int16_t> decoded_frame(PIXEL_COUNT);
+
+    std::size_t byte_count{0};
+    double error_sum{0.0};
+    long long error_count{0};
+    double far_error_sum{0.0};
+    long long far_error_count{0};
+    for (gsl::index frame_index{0}; frame_index < gsl::narrow_cast<gsl::index>(depth_frames.size()); ++frame_index) {
+        auto& depth_frame{depth_frames[frame_index]};
+        auto& reference_frame{reference_frames[frame_index]};
+        const bool keyframe{frame_index == 0};
+        const std::size_t trvl_frame_size{trvl_encoder.encode(depth_frame, keyframe, trvl_frame)};
+        byte_count += trvl_frame_size;
+        trvl_decoder.decode_into({trvl_frame.data(), trvl_frame_size}, keyframe,
+                                 decoded_frame.data(), SYNTHETIC_DEPTH_WIDTH * sizeof(std::int16_t));
+
+        for (gsl::index i{0}; i < PIXEL_COUNT; ++i) {
+            if (reference_frame[i] <= 0 || decoded_frame[i] <= 0)
+                continue;
+
+            const int error{std::abs(reference_frame[i] - decoded_frame[i])};
+            error_sum += error;
+            ++error_count;
+            if (reference_frame[i] >= FAR_DEPTH) {
+                far_error_sum += error;
+                ++far_error_count;
+            }
+        }
+    }
+
+    const double mbps{byte_count * 8.0 * FRAME_RATE / depth_frames.size() / 1000000.0};
+    std::cout << std::fixed << std::setprecision(2)
+              << "  " << name
+              << ": " << mbps << " Mbps"
+              << ", mean error: " << error_sum / error_count << " mm"
+              << ", far mean error: " << (far_error_count > 0 ? far_error_sum / far_error_count : 0.0) << " mm\n";
+}
+
+// Compares the bitrate and the error of TRVL with a constant change threshold and with thresholds
+// that grow with depth, on synthetic frames or on a recorded scene.
+// The error of synthetic frames is from the depth without noise, and the one of a recorded scene,
+// which has no depth without noise, is from the recorded depth.
+void main(int frame_count, const std::string& depth_frames_path)
+{
+    const auto depth_frames{depth_frames_path.empty() ? create_synthetic_depth_frames(frame_count, true)
+                                                      : read_depth_frames(depth_frames_path, frame_count)};
+    if (depth_frames.empty())
+        throw std::exception("No depth frames to encode.");
+    const auto reference_frames{depth_frames_path.empty() ? create_synthetic_depth_frames(frame_count, false) : depth_frames};
+
+    std::cout << "Encoding " << depth_frames.size() << " frames of " << SYNTHETIC_DEPTH_WIDTH << "x" << SYNTHETIC_DEPTH_HEIGHT
+              << (depth_frames_path.empty() ? " (synthetic)" : " from " + depth_frames_path) << " at " << FRAME_RATE << " fps.\n";
+
+    run_trvl("constant 5 mm", create_constant_trvl_change_thresholds(5), depth_frames, reference_frames);
+    run_trvl("constant 10 mm", create_constant_trvl_change_thresholds(10), depth_frames, reference_frames);
+    run_trvl("constant 20 mm", create_constant_trvl_change_thresholds(20), depth_frames, reference_frames);
+    run_trvl("2 mm + 1.5 mm/m^2", create_quadratic_trvl_change_thresholds(2.0f, 1.5f), depth_frames, reference_frames);
+    run_trvl("3 mm + 2.5 mm/m^2 (sender)", create_quadratic_trvl_change_thresholds(3.0f, 2.5f), depth_frames, reference_frames);
+    run_trvl("4 mm + 3.5 mm/m^2", create_quadratic_trvl_change_thresholds(4.0f, 3.5f), depth_frames, reference_frames);
+}
+}
+
+// The first argument is the number of frames to encode and the second one is an optional file of recorded depth frames
+// (640x576 int16_t pixels back to back). Synthetic frames get encoded without the file.
+int main(int argc, char* argv[])
+{
+    std::ios_base::sync_with_stdio(false);
+    kh::main(argc > 1 ? std::stoi(argv[1]) : 300, argc > 2 ? argv[2] : "");
+    return 0;
+}
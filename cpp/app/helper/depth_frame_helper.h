@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <gsl/gsl>
+
+namespace kh
+{
+// The size of depth frames in K4A_DEPTH_MODE_NFOV_UNBINNED.
+constexpr int SYNTHETIC_DEPTH_WIDTH{640};
+constexpr int SYNTHETIC_DEPTH_HEIGHT{576};
+
+// A hash of a pixel in a frame, so synthetic frames are the same on every run without a random number generator.
+std::uint32_t hash_pixel(int x, int y, int frame_index)
+{
+    std::uint32_t hash{(static_cast<std::uint32_t>(x) * 73856093u) ^ (static_cast<std::uint32_t>(y) * 19349663u)
+                       ^ (static_cast<std::uint32_t>(frame_index) * 83492791u)};
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// Writes a frame of a floor going from 0.6 m at the bottom to 4.2 m at the top with a box at 1.2 m moving over it,
+// like a room with a person in it. Depth gets noise that grows with the square of depth (0.5 mm + 1.2 mm/m^2)
+// as the one of the camera, and 5% of the pixels are invalid (i.e., zero).
+// Without noise, the frame is the ground truth of the one with noise.
+void write_synthetic_depth_frame(gsl::span<std::int16_t> depth_buffer, int width, int height, int frame_index, bool noisy = true)
+{
+    const int box_x{(frame_index * 8) % (width - 160)};
+    const int box_y{height / 4 + (frame_index * 4) % (height / 2)};
+    for (int y{0}; y < height; ++y) {
+        for (int x{0}; x < width; ++x) {
+            const std::uint32_t hash{hash_pixel(x, y, frame_index)};
+            if (hash % 20 == 0) {
+                depth_buffer[y * width + x] = 0;
+                continue;
+            }
+
+            const bool in_box{x >= box_x && x < box_x + 160 && y >= box_y && y < box_y + 200};
+            const float depth{in_box ? 1200.0f : 600.0f + 3600.0f * (height - 1 - y) / (height - 1)};
+            const float meters{depth / 1000.0f};
+            const float noise_scale{0.5f + 1.2f * meters * meters};
+            // Sum of two uniform values in [-1, 1), which is close enough to the noise of the camera.
+            const float noise{noisy ? ((hash >> 8) % 1024 + (hash >> 18) % 1024) / 512.0f - 2.0f : 0.0f};
+            depth_buffer[y * width + x] = static_cast<std::int16_t>(std::clamp(depth + noise * noise_scale, 1.0f, 32767.0f));
+        }
+    }
+}
+}
@@ -21,10 +21,9 @@ void display_frames()
 
     const int depth_frame_width{calibration.depth_camera_calibration.resolution_width};
     const int depth_frame_height{calibration.depth_camera_calibration.resolution_height};
-    const int depth_frame_size{depth_frame_width * depth_frame_height};
 
-    TrvlEncoder depth_encoder{depth_frame_size, CHANGE_THRESHOLD, INVALID_THRESHOLD};
-    TrvlDecoder depth_decoder{depth_frame_size};
+    TrvlEncoder depth_encoder{depth_frame_width, depth_frame_height, CHANGE_THRESHOLD, INVALID_THRESHOLD};
+    TrvlDecoder depth_decoder{depth_frame_width, depth_frame_height};
     kinect_device.start();
 
     for (;;) {
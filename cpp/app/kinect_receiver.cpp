@@ -11,7 +11,7 @@
 
 namespace kh
 {
-void start_session(const std::string ip_address, const int port, const int session_id)
+void start_session(const std::string ip_address, const int port, const int session_id, const int color_decoder_thread_count)
 {
     constexpr int RECEIVER_RECEIVE_BUFFER_SIZE{128 * 1024};
     constexpr float HEARTBEAT_INTERVAL_SEC{1.0f};
@@ -31,9 +31,11 @@ void start_session(const std::string ip_address, const int port, const int sessi
     // When ping then check if a init packet arrived.
     // Repeat until it happens.
     int ping_count{0};
+    const auto depth_codec_ids{get_depth_codec_ids()};
+    const auto color_codec_ids{get_color_codec_ids()};
 
     for (;;) {
-        udp_socket.send(create_connect_receiver_packet_bytes(session_id, true, true, false), remote_endpoint);
+        udp_socket.send(create_connect_receiver_packet_bytes(session_id, true, true, false, depth_codec_ids, color_codec_ids), remote_endpoint);
         ++ping_count;
         std::cout << "Sent connect packet to " << ip_address << ".\n";
 
@@ -63,7 +65,9 @@ void start_session(const std::string ip_address, const int port, const int sessi
     VideoRendererState video_renderer_state;
     VideoMessageAssembler video_message_assembler{session_id, remote_endpoint};
     AudioPacketReceiver audio_packet_receiver;
-    VideoRenderer video_renderer{session_id, remote_endpoint, init_sender_packet_data.width, init_sender_packet_data.height};
+    VideoRenderer video_renderer{session_id, remote_endpoint, init_sender_packet_data.width, init_sender_packet_data.height,
+                                 init_sender_packet_data.color_codec_id, color_decoder_thread_count, init_sender_packet_data.depth_codec_id,
+                                 init_sender_packet_data.depth_band_count};
     std::map<int, VideoSenderMessageData> video_frame_messages;
 
     for (;;) {
@@ -92,14 +96,16 @@ void start_session(const std::string ip_address, const int port, const int sessi
             std::cout << "UdpSocketRuntimeError:\n  " << e.what() << "\n";
             break;
         }
-        video_renderer.render(udp_socket, video_renderer_state, video_frame_messages);
+        video_renderer.render(udp_socket, video_renderer_state, video_message_assembler, video_frame_messages);
     }
 }
 
-void main()
+void main(int color_decoder_thread_count)
 {
     constexpr int PORT{3773};
 
+    std::cout << "Color decoder threads: " << color_decoder_thread_count << "\n";
+
     for (;;) {
         // Receive IP address from the user.
         std::cout << "Enter an IP address to start receiving frames: ";
@@ -111,14 +117,15 @@ void main()
 
         const int session_id{gsl::narrow_cast<const int>(std::random_device{}() % (static_cast<unsigned int>(INT_MAX) + 1))};
 
-        start_session(ip_address, PORT, session_id);
+        start_session(ip_address, PORT, session_id, color_decoder_thread_count);
     }
 }
 }
 
-int main()
+// The first argument is the number of threads decoding color frames, which is up to their token partitions.
+int main(int argc, char* argv[])
 {
     std::ios_base::sync_with_stdio(false);
-    kh::main();
+    kh::main(argc > 1 ? std::stoi(argv[1]) : 4);
     return 0;
 }
\ No newline at end of file
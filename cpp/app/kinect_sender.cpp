@@ -1,3 +1,4 @@
+#include <exception>
 #include <iostream>
 #include <random>
 #include <tuple>
@@ -27,6 +28,10 @@ void apply_report_packets(std::vector<ReportReceiverPacketData>& report_packet_d
 {
     // Update receiver_state and summary with Report packets.
     for (auto& report_receiver_packet_data : report_packet_data_vector) {
+        // Counts of packets are since the previous report, so they count even from reports out of order.
+        summary.video_packet_count += report_receiver_packet_data.video_packet_count;
+        summary.lost_video_packet_count += report_receiver_packet_data.lost_video_packet_count;
+
         // Ignore if network is somehow out of order and a report comes in out of order.
         if (report_receiver_packet_data.frame_id <= remote_receiver.video_frame_id)
             continue;
@@ -63,6 +68,20 @@ void log_receiver_report_summary(ExampleAppLog& log, ReceiverReportSummary summa
     log.AddLog("Receiver Reported in %f Hz\n", summary.received_report_count / duration.sec());
     log.AddLog("  Decoder Time Average: %f ms\n", summary.decoder_time_ms_sum / summary.received_report_count);
     log.AddLog("  Frame Interval Time Average: %f ms\n", summary.frame_interval_ms_sum / summary.received_report_count);
+    log.AddLog("  Video Packet Loss: %f\n", static_cast<float>(summary.lost_video_packet_count) / summary.video_packet_count);
+}
+
+// Queued frames include the one the stage takes, so a stage that keeps up averages 1.
+void log_video_pipeline_stage_summary(ExampleAppLog& log, const char* stage_name, VideoPipelineStageSummary summary)
+{
+    log.AddLog("  %s Stage: %d frames, %f queued, %d dropped, %f ms in queue, %f ms in stage, %f ms blocked\n",
+               stage_name,
+               summary.frame_count,
+               static_cast<float>(summary.queued_frame_count_sum) / summary.frame_count,
+               summary.dropped_frame_count,
+               summary.queue_ms_sum / summary.frame_count,
+               summary.process_ms_sum / summary.frame_count,
+               summary.blocked_ms_sum / summary.frame_count);
 }
 
 void log_kinect_video_sender_summary(ExampleAppLog& log, KinectVideoSenderSummary summary, TimeDuration duration)
@@ -71,16 +90,71 @@ void log_kinect_video_sender_summary(ExampleAppLog& log, KinectVideoSenderSummar
     log.AddLog("  Frame ID: %d\n", summary.frame_id);
     log.AddLog("  FPS: %f\n", summary.frame_count / duration.sec());
     log.AddLog("  Color Bandwidth: %f Mbps\n", summary.color_byte_count / duration.sec() / (1024.0f * 1024.0f / 8.0f));
+    log.AddLog("  Color Target Bitrate: %d kbps\n", summary.color_target_bitrate);
     log.AddLog("  Depth Bandwidth: %f Mbps\n", summary.depth_byte_count / duration.sec() / (1024.0f * 1024.0f / 8.0f));
     log.AddLog("  Keyframe Ratio: %f\n", static_cast<float>(summary.keyframe_count) / summary.frame_count);
-    log.AddLog("  Shadow Removal Time Average: %f\n", summary.shadow_removal_ms_sum / summary.frame_count);
+    log.AddLog("  Base Layer Ratio: %f\n", static_cast<float>(summary.base_layer_frame_count) / summary.frame_count);
+    log.AddLog("  Recovery Frame Ratio: %f\n", static_cast<float>(summary.recovery_frame_count) / summary.frame_count);
+    // Depth gets preprocessed before the encoder stage skips frames.
+    log.AddLog("  Shadow Removal Time Average: %f\n", summary.shadow_removal_ms_sum / summary.preprocessor_stage.frame_count);
+    log.AddLog("  Depth Filter Time Average: %f\n", summary.depth_filter_ms_sum / summary.preprocessor_stage.frame_count);
     log.AddLog("  Transformation Time Average: %f\n", summary.transformation_ms_sum / summary.frame_count);
-    log.AddLog("  Yuv Conversion Time Average: %f\n", summary.yuv_conversion_ms_sum / summary.frame_count);
     log.AddLog("  Color Encoder Time Average: %f\n", summary.color_encoder_ms_sum / summary.frame_count);
     log.AddLog("  Depth Encoder Time Average: %f\n", summary.depth_encoder_ms_sum / summary.frame_count);
+    log.AddLog("  Color and Depth Time Average: %f\n", summary.encoder_ms_sum / summary.frame_count);
+    log_video_pipeline_stage_summary(log, "Capture", summary.capture_stage);
+    log_video_pipeline_stage_summary(log, "Preprocessor", summary.preprocessor_stage);
+    log_video_pipeline_stage_summary(log, "Encoder", summary.encoder_stage);
+    log_video_pipeline_stage_summary(log, "Packetizer", summary.packetizer_stage);
+    log_video_pipeline_stage_summary(log, "Network", summary.network_stage);
+    log.AddLog("  Latency Average: %f ms\n", summary.latency_ms_sum / summary.network_stage.frame_count);
+}
+
+// Finds the depth codec with the name from the command line (e.g., TMRANS).
+// Opt-in codecs are only found when the command line opts in to them.
+DepthCodecId find_depth_codec_id(const std::string& depth_codec_name, bool depth_codec_opt_in)
+{
+    for (auto depth_codec_id : get_depth_codec_ids()) {
+        if (depth_codec_name != get_depth_codec_name(depth_codec_id))
+            continue;
+
+        if (is_depth_codec_opt_in(depth_codec_id) && !depth_codec_opt_in) {
+            std::cout << "Depth codec " << depth_codec_name << " requires opt-in, using TRVL instead.\n";
+            return DepthCodecId::Trvl;
+        }
+        return depth_codec_id;
+    }
+
+    std::cout << "Unknown depth codec " << depth_codec_name << ", using TRVL instead.\n";
+    return DepthCodecId::Trvl;
+}
+
+// Finds the color codec with the name from the command line (e.g., VP9).
+ColorCodecId find_color_codec_id(const std::string& color_codec_name)
+{
+    for (auto color_codec_id : get_color_codec_ids()) {
+        if (color_codec_name == get_color_codec_name(color_codec_id))
+            return color_codec_id;
+    }
+
+    std::cout << "Unknown color codec " << color_codec_name << ", using VP8 instead.\n";
+    return ColorCodecId::Vp8;
 }
 
-void main()
+// Parses a vertex of the region of interest from the command line in pixels of the depth image (e.g., 120,80).
+k4a_float2_t parse_depth_roi_vertex(const std::string& vertex_text)
+{
+    const auto comma_position{vertex_text.find(',')};
+    if (comma_position == std::string::npos)
+        throw std::exception("Invalid depth ROI vertex.");
+
+    return k4a_float2_t{std::stof(vertex_text.substr(0, comma_position)), std::stof(vertex_text.substr(comma_position + 1))};
+}
+
+void main(const std::string& preferred_depth_codec_name, bool depth_codec_opt_in, float depth_error_bound,
+          bool requested_depth_intra_refresh, std::int16_t min_depth, std::int16_t max_depth, const std::string& preferred_color_codec_name,
+          int color_token_partition_count, int color_temporal_layer_count, bool color_long_term_reference_recovery,
+          const std::vector<k4a_float2_t>& depth_roi_polygon)
 {
     constexpr int PORT{3773};
     constexpr int SENDER_SEND_BUFFER_SIZE{128 * 1024};
@@ -97,6 +171,22 @@ void main()
 
     std::cout << "Start kinect_sender (session_id: " << session_id << ").\n";
 
+    const DepthCodecId preferred_depth_codec_id{find_depth_codec_id(preferred_depth_codec_name, depth_codec_opt_in)};
+    std::cout << "Preferred depth codec: " << get_depth_codec_name(preferred_depth_codec_id) << "\n";
+    const bool depth_intra_refresh{requested_depth_intra_refresh && is_depth_intra_refresh_supported(preferred_depth_codec_id)};
+    if (requested_depth_intra_refresh && !depth_intra_refresh)
+        std::cout << "Depth codec " << get_depth_codec_name(preferred_depth_codec_id) << " has no intra refresh, using keyframes instead.\n";
+    const ColorCodecId preferred_color_codec_id{find_color_codec_id(preferred_color_codec_name)};
+    std::cout << "Preferred color codec: " << get_color_codec_name(preferred_color_codec_id) << "\n";
+    std::cout << "Color token partitions: " << color_token_partition_count << "\n";
+    std::cout << "Color temporal layers: " << color_temporal_layer_count << "\n";
+    std::cout << "Color recovery: " << (color_long_term_reference_recovery ? "long-term reference\n" : "keyframes\n");
+    std::cout << "Depth error bound at 1 m: " << depth_error_bound << " mm" << (depth_error_bound == 0.0f ? " (lossless)\n" : "\n");
+    std::cout << "Depth refresh: " << (depth_intra_refresh ? "intra refresh of TRVL bands\n" : "keyframes\n");
+    std::cout << "Depth range: " << min_depth << " mm to " << max_depth << " mm\n";
+    if (!depth_roi_polygon.empty())
+        std::cout << "Depth ROI polygon with " << depth_roi_polygon.size() << " vertices\n";
+
     std::optional<KinectDevice> kinect_device{create_and_start_kinect_device()};
     if (!kinect_device) {
         std::cout << "Failed to create and start the Kinect device.\n";
@@ -126,8 +216,12 @@ void main()
     const TimePoint session_start_time{TimePoint::now()};
     TimePoint heartbeat_time{TimePoint::now()};
 
-    KinectVideoSender kinect_video_sender{session_id, std::move(*kinect_device)};
-    KinectVideoSenderSummary kinect_video_sender_summary;
+    // Starts capturing and sending video on threads of its own, to the receivers it gets from update_receivers().
+    KinectVideoSender kinect_video_sender{session_id, session_start_time, udp_socket, std::move(*kinect_device),
+                                          preferred_color_codec_id, color_token_partition_count, color_temporal_layer_count,
+                                          color_long_term_reference_recovery,
+                                          preferred_depth_codec_id, depth_error_bound, depth_intra_refresh,
+                                          min_depth, max_depth, depth_roi_polygon};
 
     KinectAudioSender kinect_audio_sender{session_id};
     
@@ -194,6 +288,15 @@ void main()
 
         end_imgui_frame(clear_color);
 
+        // Take the frames the video sender sent for retransmission.
+        // A stage of the video sender that failed (e.g., the Kinect device got disconnected) stops the sender.
+        try {
+            kinect_video_sender.store_sent_frames(video_parity_packet_storage);
+        } catch (std::exception& e) {
+            std::cout << "KinectVideoSender stopped with an exception\n  message: " << e.what() << "\n";
+            break;
+        }
+
         try {
             std::vector<int> receiver_session_ids;
             for (auto& [receiver_session_id, _] : remote_receivers)
@@ -216,7 +319,9 @@ void main()
                                                         connect_packet_info.session_id,
                                                         connect_packet_info.connect_packet_data.video_requested,
                                                         connect_packet_info.connect_packet_data.audio_requested,
-                                                        connect_packet_info.connect_packet_data.floor_requested}});
+                                                        connect_packet_info.connect_packet_data.floor_requested,
+                                                        connect_packet_info.connect_packet_data.depth_codec_ids,
+                                                        connect_packet_info.connect_packet_data.color_codec_ids}});
             }
 
             // Skip the main part of the loop if there is no receiver connected.
@@ -225,8 +330,7 @@ void main()
                 for (auto& [_, remote_receiver] : remote_receivers)
                     remote_endpoints.push_back(remote_receiver.endpoint);
 
-                // Send video/audio packets to the receivers.
-                kinect_video_sender.send(session_start_time, udp_socket, video_parity_packet_storage, remote_receivers, kinect_video_sender_summary);
+                // Send audio packets to the receivers. Video packets get sent by the stages of kinect_video_sender.
                 kinect_audio_sender.send(udp_socket, remote_receivers);
 
                 // Send heartbeat packets to receivers.
@@ -239,6 +343,8 @@ void main()
                 for (auto& [receiver_session_id, receiver_packet_set] : receiver_packet_collection.receiver_packet_sets) {
                     auto remote_receiver_ptr{&remote_receivers.at(receiver_session_id)};
                     if (receiver_packet_set.received_any) {
+                        for (auto& report_receiver_packet_data : receiver_packet_set.report_packet_data_vector)
+                            kinect_video_sender.apply_report(receiver_session_id, report_receiver_packet_data);
                         apply_report_packets(receiver_packet_set.report_packet_data_vector,
                                              *remote_receiver_ptr,
                                              receiver_report_summary);
@@ -269,13 +375,15 @@ void main()
             }
         }
 
+        // The stages of the video sender send to the receivers from their next frame.
+        kinect_video_sender.update_receivers(remote_receivers);
+
         const auto summary_duration{receiver_report_summary.time_point.elapsed_time()};
         if (summary_duration.sec() > SUMMARY_INTERVAL_SEC) {
             log_receiver_report_summary(log, receiver_report_summary, summary_duration);
             receiver_report_summary = ReceiverReportSummary{};
 
-            log_kinect_video_sender_summary(log, kinect_video_sender_summary, summary_duration);
-            kinect_video_sender_summary = KinectVideoSenderSummary{};
+            log_kinect_video_sender_summary(log, kinect_video_sender.take_summary(), summary_duration);
         }
     }
 
@@ -283,9 +391,39 @@ void main()
 }
 }
 
-int main()
+// The preferred depth codec can be chosen with its name as the first argument,
+// followed by ! for codecs that require opt-in since they miss their performance targets (e.g., TMRANS!),
+// and the quality of depth with the error bound at 1 m in millimeters as the second one (zero for lossless).
+// The third one is how depth gets refreshed, either keyframe or intra (i.e., refreshing a band of TRVL per frame).
+// The fourth and fifth ones are the range of depth to send in millimeters (e.g., 500 3000 for 0.5 m to 3 m).
+// The sixth one is the preferred color codec (e.g., VP9) and the seventh one is the number of token partitions
+// of VP8 frames (1, 2, 4, or 8), which is how many threads receivers can decode them with.
+// The eighth one is the number of temporal layers of VP8 frames (1 to 3), which let receivers that fall behind
+// get a half or a quarter of the frames. The ninth one is how receivers that lost frames recover, either ltr
+// (i.e., from the long-term reference, which makes VP8 error resilient) or keyframe,
+// and the rest are the vertices of a polygon in the depth image to send (e.g., 100,50 540,50 540,500 100,500).
+int main(int argc, char* argv[])
 {
     std::ios_base::sync_with_stdio(false);
-    kh::main();
+    std::vector<k4a_float2_t> depth_roi_polygon;
+    for (int i{10}; i < argc; ++i)
+        depth_roi_polygon.push_back(kh::parse_depth_roi_vertex(argv[i]));
+
+    std::string depth_codec_name{argc > 1 ? argv[1] : "TRVL"};
+    const bool depth_codec_opt_in{!depth_codec_name.empty() && depth_codec_name.back() == '!'};
+    if (depth_codec_opt_in)
+        depth_codec_name.pop_back();
+
+    kh::main(depth_codec_name,
+             depth_codec_opt_in,
+             argc > 2 ? std::stof(argv[2]) : 0.0f,
+             argc > 3 && std::string{argv[3]} == "intra",
+             argc > 4 ? gsl::narrow_cast<std::int16_t>(std::stoi(argv[4])) : static_cast<std::int16_t>(0),
+             argc > 5 ? gsl::narrow_cast<std::int16_t>(std::stoi(argv[5])) : static_cast<std::int16_t>(INT16_MAX),
+             argc > 6 ? argv[6] : "VP8",
+             argc > 7 ? std::stoi(argv[7]) : 4,
+             argc > 8 ? std::stoi(argv[8]) : 2,
+             argc <= 9 || std::string{argv[9]} != "keyframe",
+             depth_roi_polygon);
     return 0;
 }
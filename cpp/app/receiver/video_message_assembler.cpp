@@ -5,7 +5,8 @@
 namespace kh
 {
 VideoMessageAssembler::VideoMessageAssembler(const int session_id, const asio::ip::udp::endpoint remote_endpoint)
-    : session_id_{session_id}, remote_endpoint_{remote_endpoint}, video_packet_collections_{}, parity_packet_collections_{}
+    : session_id_{session_id}, remote_endpoint_{remote_endpoint}, video_packet_collections_{}, parity_packet_collections_{},
+      packet_statistics_{}, counted_frame_ids_{}
 {
 }
 
@@ -16,6 +17,8 @@ void VideoMessageAssembler::assemble(UdpSocket& udp_socket,
                                      std::map<int, VideoSenderMessageData>& video_frame_messages)
 {
     std::optional<int> added_frame_id{std::nullopt};
+    packet_statistics_.received_packet_count += gsl::narrow_cast<int>(video_packet_data_vector.size() + parity_packet_data_vector.size());
+
     // Collect the received video packets.
     for (auto& video_sender_packet_data : video_packet_data_vector) {
         if (video_sender_packet_data.frame_id <= video_renderer_state.frame_id)
@@ -59,6 +62,9 @@ void VideoMessageAssembler::assemble(UdpSocket& udp_socket,
             if (frame_id >= added_frame_id)
                 continue;
 
+            // The sender sends a frame after another, so the packets missing here got lost.
+            count_video_packets(frame_id, *video_packets_ptr);
+
             // Find the parity packet collection corresponding to the video packet collection.
             auto parity_packet_collections_ref{parity_packet_collections_.find(frame_id)};
             // Skip if there is no parity packet collection for the video frame.
@@ -177,6 +183,7 @@ void VideoMessageAssembler::assemble(UdpSocket& udp_socket,
                 video_sender_message_data_set[i] = gsl::span<std::byte>{it->second[i]->message_data};
 
             video_frame_messages.insert({it->first, parse_video_sender_message_bytes(merge_video_sender_message_bytes(video_sender_message_data_set))});
+            count_video_packets(it->first, it->second);
             it = video_packet_collections_.erase(it);
         } else {
             ++it;
@@ -200,5 +207,34 @@ void VideoMessageAssembler::assemble(UdpSocket& udp_socket,
             ++it;
         }
     }
+
+    // Clean up counted_frame_ids.
+    for (auto it = counted_frame_ids_.begin(); it != counted_frame_ids_.end();) {
+        if (*it <= video_renderer_state.frame_id) {
+            it = counted_frame_ids_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+VideoPacketStatistics VideoMessageAssembler::take_packet_statistics() noexcept
+{
+    const auto packet_statistics{packet_statistics_};
+    packet_statistics_ = VideoPacketStatistics{};
+    return packet_statistics;
+}
+
+// Counts a frame once, when a newer frame arrived or when all of its packets arrived before that.
+void VideoMessageAssembler::count_video_packets(int frame_id, const std::vector<std::optional<VideoSenderPacketData>>& video_packets)
+{
+    if (!counted_frame_ids_.insert(frame_id).second)
+        return;
+
+    packet_statistics_.video_packet_count += gsl::narrow_cast<int>(video_packets.size());
+    for (auto& video_packet : video_packets) {
+        if (!video_packet)
+            ++packet_statistics_.lost_video_packet_count;
+    }
 }
 }
\ No newline at end of file
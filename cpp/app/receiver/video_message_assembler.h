@@ -1,10 +1,19 @@
 #pragma once
 
 #include <map>
+#include <unordered_set>
 #include "video_renderer_state.h"
 
 namespace kh
 {
+// Counts of packets for the reports to the sender (see ReportReceiverPacketData).
+struct VideoPacketStatistics
+{
+    int video_packet_count{0};
+    int lost_video_packet_count{0};
+    int received_packet_count{0};
+};
+
 class VideoMessageAssembler
 {
 public:
@@ -14,11 +23,18 @@ public:
                   std::vector<ParitySenderPacketData>& parity_packet_data_vector,
                   VideoRendererState video_renderer_state,
                   std::map<int, VideoSenderMessageData>& video_frame_messages);
+    // Returns the counts since the previous call.
+    VideoPacketStatistics take_packet_statistics() noexcept;
 
 private:
+    void count_video_packets(int frame_id, const std::vector<std::optional<VideoSenderPacketData>>& video_packets);
+
     const int session_id_;
     const asio::ip::udp::endpoint remote_endpoint_;
     std::unordered_map<int, std::vector<std::optional<VideoSenderPacketData>>> video_packet_collections_;
     std::unordered_map<int, std::vector<std::optional<ParitySenderPacketData>>> parity_packet_collections_;
+    VideoPacketStatistics packet_statistics_;
+    // Frames that already are in packet_statistics_.
+    std::unordered_set<int> counted_frame_ids_;
 };
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <iostream>
+#include <unordered_set>
+#include "video_message_assembler.h"
 #include "video_renderer_state.h"
 
 namespace kh
@@ -7,67 +10,143 @@ namespace kh
 class VideoRenderer
 {
 public:
-    VideoRenderer(const int session_id, const asio::ip::udp::endpoint remote_endpoint, int width, int height)
+    VideoRenderer(const int session_id, const asio::ip::udp::endpoint remote_endpoint, int width, int height,
+                  ColorCodecId color_codec_id, int color_decoder_thread_count, DepthCodecId depth_codec_id, int depth_band_count)
         : session_id_{session_id}, remote_endpoint_{remote_endpoint}, width_{width}, height_{height},
-        color_decoder_{}, depth_decoder_{width * height}
+        color_codec_id_{color_codec_id}, color_decoder_thread_count_{color_decoder_thread_count},
+        color_decoder_{create_color_decoder(color_codec_id, color_decoder_thread_count)}, depth_codec_config_{width, height, {}, 0, depth_band_count, false}, depth_codec_id_{depth_codec_id},
+        depth_decoder_{create_depth_decoder(depth_codec_id, depth_codec_config_)}, depth_synchronized_{false},
+        decoded_frame_ids_{}, long_term_reference_frame_id_{-1}, depth_image_(width * height)
     {
     }
 
     void render(UdpSocket& udp_socket,
                 VideoRendererState& video_renderer_state,
+                VideoMessageAssembler& video_message_assembler,
                 std::map<int, VideoSenderMessageData>& video_frame_messages)
     {
         if (video_frame_messages.empty())
             return;
 
         std::optional<int> begin_frame_id;
-        // If there is a key frame, use the most recent one.
+        // If there is a key frame or a frame from the long-term reference this receiver has, use the most recent one.
         for (auto& frame_message_pair : video_frame_messages) {
             if (frame_message_pair.first <= video_renderer_state.frame_id)
                 continue;
 
-            if (frame_message_pair.second.keyframe)
+            if (frame_message_pair.second.keyframe || is_from_long_term_reference(frame_message_pair.first, frame_message_pair.second))
                 begin_frame_id = frame_message_pair.first;
         }
 
-        // When there is no key frame, go through all the frames to check
-        // if there is the one right after the previously rendered one.
-        if (!begin_frame_id) {
-            // If a frame message with frame_id == (last_frame_id + 1) is found
-            if (video_frame_messages.find(video_renderer_state.frame_id + 1) != video_frame_messages.end()) {
-                begin_frame_id = video_renderer_state.frame_id + 1;
-            } else {
-                // Wait for more frames if there is way to render without glitches.
-                return;
-            }
-        }
-
+        // When there is no key frame, go through the frames after the previously rendered one in order.
+        // Frames of temporal layers the sender did not send never arrive, so a frame can be decoded
+        // when the frame it references got decoded.
         std::optional<kh::FFmpegFrame> ffmpeg_frame;
-        std::vector<short> depth_image;
+        // Reports tell the sender the last decoded frame, so it knows which receivers have the long-term reference.
+        int decoded_frame_id{-1};
         const auto decoder_start{TimePoint::now()};
-        for (int i = *begin_frame_id; ; ++i) {
-            // break loop is there is no frame with frame_id i.
-            if (video_frame_messages.find(i) == video_frame_messages.end())
-                break;
+        for (auto& [i, frame_message] : video_frame_messages) {
+            if (i <= video_renderer_state.frame_id || (begin_frame_id && i < *begin_frame_id))
+                continue;
+
+            const auto frame_message_pair_ptr{&frame_message};
+            const int reference_frame_id{i - frame_message_pair_ptr->reference_frame_distance};
+            const bool from_long_term_reference{frame_message_pair_ptr->references_long_term_reference};
+            const bool reference_decoded{from_long_term_reference ? is_from_long_term_reference(i, *frame_message_pair_ptr)
+                                                                  : decoded_frame_ids_.count(reference_frame_id) > 0};
+            if (!frame_message_pair_ptr->keyframe && !reference_decoded) {
+                // Wait for the referenced frame if it can still arrive.
+                if (!from_long_term_reference && reference_frame_id > video_renderer_state.frame_id)
+                    break;
+
+                // Otherwise this frame cannot be decoded until a keyframe or a frame from the long-term reference, so it gets passed.
+                video_renderer_state.frame_id = i;
+                continue;
+            }
 
-            const auto frame_message_pair_ptr{&video_frame_messages[i]};
+            // Skipping frames of the base layer leaves the state of the depth decoder behind the one of the encoder.
+            // Keyframes reset the state, but a keyframe with intra refresh only refreshes a band,
+            // so the decoder starts over and gets synchronized as bands get refreshed.
+            if (!reference_decoded) {
+                depth_decoder_ = create_depth_decoder(depth_codec_id_, depth_codec_config_);
+                depth_synchronized_ = false;
+            }
 
             video_renderer_state.frame_id = i;
+            decoded_frame_id = i;
+            decoded_frame_ids_.insert(i);
 
-            // Decoding a Vp8Frame into color pixels.
-            ffmpeg_frame = color_decoder_.decode(frame_message_pair_ptr->color_encoder_frame);
-            // Decompressing a RVL frame into depth pixels.
-            depth_image = depth_decoder_.decode(frame_message_pair_ptr->depth_encoder_frame, frame_message_pair_ptr->keyframe);
+            // The sender switches color codecs with a keyframe.
+            if (frame_message_pair_ptr->color_codec_id != color_codec_id_) {
+                color_codec_id_ = frame_message_pair_ptr->color_codec_id;
+                color_decoder_ = create_color_decoder(color_codec_id_, color_decoder_thread_count_);
+            }
+            // Decoding a color frame into color pixels.
+            ffmpeg_frame = color_decoder_->decode(frame_message_pair_ptr->color_encoder_frame);
+            // The sender switches depth codecs with a keyframe as well.
+            if (frame_message_pair_ptr->depth_codec_id != depth_codec_id_) {
+                depth_codec_id_ = frame_message_pair_ptr->depth_codec_id;
+                depth_decoder_ = create_depth_decoder(depth_codec_id_, depth_codec_config_);
+                depth_synchronized_ = false;
+            }
+            // The sender changes the quantization of depth with a keyframe as well.
+            const float depth_error_bound{frame_message_pair_ptr->depth_error_bound};
+            if (depth_error_bound == 0.0f) {
+                depth_quantizer_ = std::nullopt;
+            } else if (!depth_quantizer_ || depth_quantizer_->error_bound() != depth_error_bound) {
+                depth_quantizer_.emplace(depth_error_bound);
+            }
+            // Decompressing a depth frame into depth pixels.
+            // Frames of the upper temporal layers leave the state of the decoder for the next frame of the base layer.
+            // Frames from the long-term reference continue from the state the decoder saved with it.
+            const auto dequantization_table{depth_quantizer_ ? depth_quantizer_->get_dequantization_table() : gsl::span<const int16_t>{}};
+            if (frame_message_pair_ptr->temporal_layer_id > 0) {
+                depth_decoder_->decode_non_reference_into(frame_message_pair_ptr->depth_encoder_frame,
+                                                          depth_image_.data(), sizeof(short) * width_, dequantization_table);
+            } else if (from_long_term_reference) {
+                depth_decoder_->decode_long_term_reference_into(frame_message_pair_ptr->depth_encoder_frame,
+                                                                depth_image_.data(), sizeof(short) * width_, dequantization_table);
+            } else {
+                depth_decoder_->decode_into(frame_message_pair_ptr->depth_encoder_frame, frame_message_pair_ptr->keyframe,
+                                            depth_image_.data(), sizeof(short) * width_, dequantization_table);
+            }
+            if (frame_message_pair_ptr->long_term_reference) {
+                depth_decoder_->save_long_term_reference();
+                long_term_reference_frame_id_ = i;
+            }
+            if (!depth_synchronized_ && depth_decoder_->is_synchronized()) {
+                std::cout << "Depth synchronized at frame " << i << ".\n";
+                depth_synchronized_ = true;
+            }
         }
 
+        // Wait for more frames if there is no way to render without glitches.
+        if (!ffmpeg_frame)
+            return;
+
+        // Frames reference frames up to this many frames before them, as the pattern of three temporal layers
+        // repeats every 4 frames.
+        constexpr int MAX_REFERENCE_FRAME_DISTANCE{4};
+        for (auto it = decoded_frame_ids_.begin(); it != decoded_frame_ids_.end();) {
+            if (*it < video_renderer_state.frame_id - MAX_REFERENCE_FRAME_DISTANCE) {
+                it = decoded_frame_ids_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        const auto packet_statistics{video_message_assembler.take_packet_statistics()};
         udp_socket.send(create_report_receiver_packet_bytes(session_id_,
-                                                            video_renderer_state.frame_id,
+                                                            decoded_frame_id,
                                                             decoder_start.elapsed_time().ms(),
-                                                            video_renderer_state.last_frame_time_point.elapsed_time().ms()), remote_endpoint_);
+                                                            video_renderer_state.last_frame_time_point.elapsed_time().ms(),
+                                                            packet_statistics.video_packet_count,
+                                                            packet_statistics.lost_video_packet_count,
+                                                            packet_statistics.received_packet_count), remote_endpoint_);
         video_renderer_state.last_frame_time_point = TimePoint::now();
 
         auto color_mat{create_cv_mat_from_yuv_image(createYuvImageFromAvFrame(*ffmpeg_frame->av_frame()))};
-        auto depth_mat{create_cv_mat_from_kinect_depth_image(depth_image.data(), width_, height_)};
+        auto depth_mat{create_cv_mat_from_kinect_depth_image(depth_image_.data(), width_, height_)};
 
         // Rendering the depth pixels.
         cv::imshow("Color", color_mat);
@@ -86,11 +165,28 @@ public:
     }
 
 private:
+    bool is_from_long_term_reference(int frame_id, const VideoSenderMessageData& frame_message) const noexcept
+    {
+        return frame_message.references_long_term_reference
+               && frame_id - frame_message.reference_frame_distance == long_term_reference_frame_id_;
+    }
+
     const int session_id_;
     const asio::ip::udp::endpoint remote_endpoint_;
     int width_;
     int height_;
-    Vp8Decoder color_decoder_;
-    TrvlDecoder depth_decoder_;
+    ColorCodecId color_codec_id_;
+    const int color_decoder_thread_count_;
+    std::unique_ptr<ColorDecoder> color_decoder_;
+    const DepthCodecConfig depth_codec_config_;
+    DepthCodecId depth_codec_id_;
+    std::unique_ptr<DepthDecoder> depth_decoder_;
+    bool depth_synchronized_;
+    // Recently decoded frames, which tell whether the frames that reference them can be decoded.
+    std::unordered_set<int> decoded_frame_ids_;
+    // The last decoded frame that became the long-term reference, which frames that reference it need.
+    int long_term_reference_frame_id_;
+    std::optional<DepthQuantizer> depth_quantizer_;
+    std::vector<short> depth_image_;
 };
 }
\ No newline at end of file
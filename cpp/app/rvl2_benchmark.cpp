@@ -0,0 +1,160 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_cpu.h"
+#include "kh_rvl.h"
+#include "kh_rvl2.h"
+#include "kh_trvl.h"
+#include "native/kh_time.h"
+#include "helper/depth_frame_helper.h"
+
+namespace kh
+{
+constexpr int PIXEL_COUNT{SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT};
+// How much slower than the scalar kernel the default kernel of a format can measure before the benchmark fails,
+// which is for the noise of timing, not for a kernel that is slower.
+constexpr float DEFAULT_KERNEL_TOLERANCE{1.1f};
+
+struct RvlFormat
+{
+    const char* name;
+    rvl::Kernel (*get_default_kernel)() noexcept;
+    std::size_t (*get_max_compressed_size)(int num_pixels) noexcept;
+    std::size_t (*compress_into)(gsl::span<const std::int16_t> input, gsl::span<std::byte> output, rvl::Kernel kernel);
+    void (*decompress_into)(gsl::span<const std::byte> input, gsl::span<std::int16_t> output, rvl::Kernel kernel) noexcept;
+};
+
+constexpr RvlFormat RVL_FORMATS[]{
+    {"RVL", rvl::get_default_kernel, rvl::get_max_compressed_size, rvl::compress_into, rvl::decompress_into},
+    {"RVL2", rvl2::get_default_kernel, rvl2::get_max_compressed_size, rvl2::compress_into, rvl2::decompress_into},
+};
+
+// The kinds of frames RVL gets used for: depth frames of keyframes, the differences of TRVL,
+// and noise as the worst case (e.g., a faulty sensor).
+std::vector<std::pair<std::string, std::vector<std::vector<std::int16_t>>>> create_frame_sets(int frame_count)
+{
+    std::vector<std::vector<std::int16_t>> depth_frames;
+    for (int i{0}; i < frame_count + 1; ++i) {
+        std::vector<std::int16_t> depth_frame(PIXEL_COUNT);
+        write_synthetic_depth_frame(depth_frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, i);
+        depth_frames.push_back(std::move(depth_frame));
+    }
+
+    std::vector<std::vector<std::int16_t>> diff_frames;
+    {
+        constexpr int INVALID_THRESHOLD{2};
+        std::vector<std::int16_t> values(PIXEL_COUNT, 0);
+        std::vector<std::uint8_t> invalid_counts(PIXEL_COUNT, 0);
+        std::vector<std::int16_t> diffs(PIXEL_COUNT);
+        const auto change_thresholds{create_quadratic_trvl_change_thresholds(3.0f, 2.5f)};
+        for (auto& depth_frame : depth_frames) {
+            update_trvl_pixels(values.data(), invalid_counts.data(), depth_frame.data(), diffs.data(),
+                               PIXEL_COUNT, change_thresholds, INVALID_THRESHOLD);
+            diff_frames.push_back(diffs);
+        }
+        // The first one is a keyframe.
+        diff_frames.erase(diff_frames.begin());
+    }
+    depth_frames.pop_back();
+
+    std::vector<std::vector<std::int16_t>> noise_frames;
+    for (int i{0}; i < frame_count; ++i) {
+        std::vector<std::int16_t> noise_frame(PIXEL_COUNT);
+        for (int j{0}; j < PIXEL_COUNT; ++j)
+            noise_frame[j] = static_cast<std::int16_t>(hash_pixel(j, 0, i));
+        noise_frames.push_back(std::move(noise_frame));
+    }
+
+    return {{"depth", std::move(depth_frames)}, {"TRVL differences", std::move(diff_frames)}, {"noise", std::move(noise_frames)}};
+}
+
+struct RvlResult
+{
+    bool matched;
+    float compress_mean;
+    float decompress_mean;
+};
+
+// Compresses and decompresses the frames, checking that they come back as they were,
+// and prints the mean size and the mean times of a frame.
+RvlResult run_format(const RvlFormat& format, rvl::Kernel kernel, const char* kernel_name,
+                     const std::vector<std::vector<std::int16_t>>& frames)
+{
+    std::vector<std::byte> compressed(format.get_max_compressed_size(PIXEL_COUNT));
+    std::vector<std::int16_t> decompressed(PIXEL_COUNT);
+    std::size_t byte_count{0};
+    float compress_time_sum{0.0f};
+    float decompress_time_sum{0.0f};
+    bool matched{true};
+    for (auto& frame : frames) {
+        const TimePoint compress_start{TimePoint::now()};
+        const std::size_t size{format.compress_into(frame, compressed, kernel)};
+        compress_time_sum += compress_start.elapsed_time().ms();
+        byte_count += size;
+
+        const TimePoint decompress_start{TimePoint::now()};
+        format.decompress_into({compressed.data(), size}, decompressed, kernel);
+        decompress_time_sum += decompress_start.elapsed_time().ms();
+        matched = matched && decompressed == frame;
+    }
+
+    const float compress_mean{compress_time_sum / frames.size()};
+    const float decompress_mean{decompress_time_sum / frames.size()};
+    std::cout << std::fixed << std::setprecision(3)
+              << "    " << format.name << " " << kernel_name
+              << ": " << byte_count / frames.size() / 1024 << " KB"
+              << ", compress: " << compress_mean << " ms"
+              << ", decompress: " << decompress_mean << " ms"
+              << " (" << PIXEL_COUNT / decompress_mean / 1000.0f << " Mpixels/s)"
+              << (matched ? "\n" : ", MISMATCH\n");
+    return {matched, compress_mean, decompress_mean};
+}
+
+// Measures the sizes and the throughputs of RVL and RVL2 with each kernel the CPU supports,
+// and checks that the kernel each format uses by default is not slower than the scalar one,
+// so a vectorized kernel that loses to the scalar one does not become a default.
+bool main(int frame_count)
+{
+    std::vector<std::pair<rvl::Kernel, const char*>> kernels{{rvl::Kernel::Scalar, "scalar"}};
+    if (get_cpu_features().sse41)
+        kernels.push_back({rvl::Kernel::Sse41, "SSE4.1"});
+    if (get_cpu_features().avx2)
+        kernels.push_back({rvl::Kernel::Avx2, "AVX2"});
+
+    std::cout << "Compressing " << frame_count << " frames of " << SYNTHETIC_DEPTH_WIDTH << "x" << SYNTHETIC_DEPTH_HEIGHT << ".\n";
+
+    bool passed{true};
+    for (auto& [frame_set_name, frames] : create_frame_sets(frame_count)) {
+        std::cout << frame_set_name << "\n";
+        for (auto& format : RVL_FORMATS) {
+            RvlResult scalar_result{};
+            for (auto& [kernel, kernel_name] : kernels) {
+                const RvlResult result{run_format(format, kernel, kernel_name, frames)};
+                passed = passed && result.matched;
+                if (kernel == rvl::Kernel::Scalar)
+                    scalar_result = result;
+                if (kernel != format.get_default_kernel())
+                    continue;
+
+                if (result.compress_mean > scalar_result.compress_mean * DEFAULT_KERNEL_TOLERANCE
+                    || result.decompress_mean > scalar_result.decompress_mean * DEFAULT_KERNEL_TOLERANCE) {
+                    std::cout << "    " << format.name << " uses " << kernel_name << " by default, which is slower than scalar\n";
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    return passed;
+}
+}
+
+// The first argument is the number of frames of each kind.
+// Returns 1 when a frame does not come back as it was or a default kernel is slower than the scalar one.
+int main(int argc, char* argv[])
+{
+    std::ios_base::sync_with_stdio(false);
+    return kh::main(argc > 1 ? std::stoi(argv[1]) : 100) ? 0 : 1;
+}
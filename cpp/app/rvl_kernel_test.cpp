@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_cpu.h"
+#include "kh_rvl.h"
+#include "helper/depth_frame_helper.h"
+
+namespace kh
+{
+const char* get_kernel_name(rvl::Kernel kernel)
+{
+    switch (kernel) {
+    case rvl::Kernel::Sse41:
+        return "SSE4.1";
+    case rvl::Kernel::Avx2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+// The kernels that the CPU running the test supports, starting with the reference one.
+std::vector<rvl::Kernel> get_supported_kernels()
+{
+    std::vector<rvl::Kernel> kernels{rvl::Kernel::Scalar};
+    if (get_cpu_features().sse41)
+        kernels.push_back(rvl::Kernel::Sse41);
+    if (get_cpu_features().avx2)
+        kernels.push_back(rvl::Kernel::Avx2);
+    return kernels;
+}
+
+// Frames with what the kernels treat differently: depth frames, the differences TRVL compresses,
+// and values of every size, including runs and frames whose lengths are not multiples of the vectors.
+std::vector<std::vector<std::int16_t>> create_test_frames()
+{
+    constexpr int PIXEL_COUNT{SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT};
+
+    std::vector<std::vector<std::int16_t>> frames;
+    for (int frame_index{0}; frame_index < 4; ++frame_index) {
+        std::vector<std::int16_t> frame(PIXEL_COUNT);
+        write_synthetic_depth_frame(frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, frame_index);
+        frames.push_back(std::move(frame));
+    }
+
+    std::vector<std::int16_t> diffs(PIXEL_COUNT);
+    for (int i{0}; i < PIXEL_COUNT; ++i)
+        diffs[i] = frames[1][i] - frames[0][i];
+    frames.push_back(std::move(diffs));
+
+    frames.push_back(std::vector<std::int16_t>(PIXEL_COUNT, 0));
+
+    std::vector<std::int16_t> noise(PIXEL_COUNT);
+    for (int i{0}; i < PIXEL_COUNT; ++i)
+        noise[i] = static_cast<std::int16_t>(hash_pixel(i, 0, 0));
+    frames.push_back(std::move(noise));
+
+    for (int pixel_count{1}; pixel_count <= 100; ++pixel_count) {
+        std::vector<std::int16_t> frame(pixel_count);
+        for (int i{0}; i < pixel_count; ++i) {
+            const std::uint32_t hash{hash_pixel(i, pixel_count, 1)};
+            // Runs of zeros and nonzeros with deltas from a nibble to the whole 16 bits.
+            frame[i] = (hash % 3 == 0) ? 0 : static_cast<std::int16_t>(hash >> (hash % 16));
+        }
+        frames.push_back(std::move(frame));
+    }
+
+    return frames;
+}
+
+// Compresses and decompresses frames with each kernel the CPU supports and checks that
+// every kernel writes the bitstream of the scalar one and decodes back to the same pixels.
+bool main()
+{
+    const auto kernels{get_supported_kernels()};
+    const auto frames{create_test_frames()};
+
+    std::cout << "Checking " << frames.size() << " frames with kernels:";
+    for (auto kernel : kernels)
+        std::cout << " " << get_kernel_name(kernel);
+    std::cout << "\n";
+
+    int failure_count{0};
+    for (gsl::index frame_index{0}; frame_index < gsl::narrow_cast<gsl::index>(frames.size()); ++frame_index) {
+        auto& frame{frames[frame_index]};
+        const int pixel_count{gsl::narrow_cast<int>(frame.size())};
+        std::vector<std::byte> reference(rvl::get_max_compressed_size(pixel_count));
+        reference.resize(rvl::compress_into(frame, reference, rvl::Kernel::Scalar));
+
+        for (auto kernel : kernels) {
+            std::vector<std::byte> compressed(rvl::get_max_compressed_size(pixel_count));
+            compressed.resize(rvl::compress_into(frame, compressed, kernel));
+            if (compressed != reference) {
+                std::cout << "  frame " << frame_index << ": " << get_kernel_name(kernel) << " compression differs from scalar\n";
+                ++failure_count;
+            }
+
+            std::vector<std::int16_t> decompressed(pixel_count);
+            rvl::decompress_into(reference, decompressed, kernel);
+            if (decompressed != frame) {
+                std::cout << "  frame " << frame_index << ": " << get_kernel_name(kernel) << " decompression differs from the frame\n";
+                ++failure_count;
+            }
+
+            // The pieces TrvlDecoder takes rows with, which split runs and vectors.
+            constexpr int PIECE_SIZE{37};
+            std::vector<std::int16_t> pieces(pixel_count);
+            rvl::Decompressor decompressor{reference, kernel};
+            for (int i{0}; i < pixel_count; i += PIECE_SIZE)
+                decompressor.decompress_next(gsl::span<std::int16_t>{pieces}.subspan(i, std::min(PIECE_SIZE, pixel_count - i)));
+            if (pieces != frame) {
+                std::cout << "  frame " << frame_index << ": " << get_kernel_name(kernel) << " Decompressor differs from the frame\n";
+                ++failure_count;
+            }
+        }
+    }
+
+    if (failure_count > 0) {
+        std::cout << failure_count << " checks failed.\n";
+        return false;
+    }
+
+    std::cout << "All kernels are bit-exact with the scalar one.\n";
+    return true;
+}
+}
+
+// Returns 1 when a kernel does not match the scalar one.
+int main()
+{
+    std::ios_base::sync_with_stdio(false);
+    return kh::main() ? 0 : 1;
+}
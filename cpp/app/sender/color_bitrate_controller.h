@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include "native/kh_native.h"
+#include "remote_receiver.h"
+
+namespace kh
+{
+// Adjusts the target bitrate of the color encoder to the network with the reports of the receivers,
+// as the loss-based controller of Google Congestion Control (https://tools.ietf.org/html/draft-ietf-rmcat-gcc-02) does.
+// The bitrate goes down when a receiver loses more than 10% of the video packets or receives packets
+// much slower than the sender sends them, and goes up while the receivers lose less than 2%.
+// A receiver of video that stops reporting counts as losing packets, since congestion drops reports as well.
+// Every receiver gets the same encoded frames, so the worst one decides.
+class ColorBitrateController
+{
+private:
+    // Counts from the reports of a receiver since the last update.
+    struct ReceiverFeedback
+    {
+        // Receivers that do not get the upper temporal layers of color get fewer packets.
+        int sent_packet_count{0};
+        int video_packet_count{0};
+        int lost_video_packet_count{0};
+        int received_packet_count{0};
+        float report_time_ms{0.0f};
+        int report_count{0};
+    };
+
+public:
+    // Bitrates are in kilobits per second. The controller starts from max_bitrate.
+    ColorBitrateController(int min_bitrate, int max_bitrate)
+        : min_bitrate_{min_bitrate}, max_bitrate_{max_bitrate}, target_bitrate_{max_bitrate},
+        receiver_feedbacks_{}, update_time_{TimePoint::now()}
+    {
+    }
+
+    int target_bitrate() const noexcept
+    {
+        return target_bitrate_;
+    }
+
+    // For the video and parity packets of a frame sent to a receiver.
+    void add_sent_packets(int receiver_session_id, int packet_count)
+    {
+        receiver_feedbacks_[receiver_session_id].sent_packet_count += packet_count;
+    }
+
+    void add_report(int receiver_session_id, const ReportReceiverPacketData& report_receiver_packet_data)
+    {
+        auto& feedback{receiver_feedbacks_[receiver_session_id]};
+        feedback.video_packet_count += report_receiver_packet_data.video_packet_count;
+        feedback.lost_video_packet_count += report_receiver_packet_data.lost_video_packet_count;
+        feedback.received_packet_count += report_receiver_packet_data.received_packet_count;
+        feedback.report_time_ms += report_receiver_packet_data.frame_time_ms;
+        ++feedback.report_count;
+    }
+
+    // Returns the new target bitrate when it changed, at most once an update interval.
+    std::optional<int> update(const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+    {
+        constexpr float UPDATE_INTERVAL_MS{500.0f};
+        constexpr float HIGH_LOSS_RATIO{0.1f};
+        constexpr float LOW_LOSS_RATIO{0.02f};
+        // Retransmitted packets get received in addition to the sent ones, so this has a margin.
+        constexpr float MIN_RECEIVE_RATE_RATIO{0.8f};
+        constexpr float INCREASE_FACTOR{1.05f};
+        constexpr float MIN_DECREASE_FACTOR{0.5f};
+
+        const float update_interval_ms{update_time_.elapsed_time().ms()};
+        if (update_interval_ms < UPDATE_INTERVAL_MS)
+            return std::nullopt;
+
+        // Receivers that have not reported yet are still starting and are not missing reports.
+        bool report_missing{false};
+        for (auto& [receiver_session_id, remote_receiver] : remote_receivers) {
+            if (!remote_receiver.video_requested || remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID)
+                continue;
+
+            const auto feedback_iter{receiver_feedbacks_.find(receiver_session_id)};
+            if (feedback_iter == receiver_feedbacks_.end() || feedback_iter->second.report_count == 0)
+                report_missing = true;
+        }
+
+        // The worst receiver of video with any counts. Receivers that report zero counts get ignored.
+        std::optional<float> loss_ratio;
+        std::optional<float> receive_rate_ratio;
+        for (auto& [receiver_session_id, feedback] : receiver_feedbacks_) {
+            const auto remote_receiver_iter{remote_receivers.find(receiver_session_id)};
+            if (remote_receiver_iter == remote_receivers.end() || !remote_receiver_iter->second.video_requested)
+                continue;
+
+            if (feedback.video_packet_count > 0) {
+                const float receiver_loss_ratio{static_cast<float>(feedback.lost_video_packet_count) / feedback.video_packet_count};
+                loss_ratio = std::max(loss_ratio.value_or(0.0f), receiver_loss_ratio);
+            }
+
+            const float send_rate{feedback.sent_packet_count / update_interval_ms};
+            if (feedback.received_packet_count > 0 && feedback.report_time_ms > 0.0f && send_rate > 0.0f) {
+                const float receiver_receive_rate_ratio{feedback.received_packet_count / feedback.report_time_ms / send_rate};
+                receive_rate_ratio = std::min(receive_rate_ratio.value_or(1.0f), receiver_receive_rate_ratio);
+            }
+        }
+
+        receiver_feedbacks_.clear();
+        update_time_ = TimePoint::now();
+
+        if (!report_missing && !loss_ratio && !receive_rate_ratio)
+            return std::nullopt;
+
+        float factor{1.0f};
+        if (report_missing) {
+            factor = MIN_DECREASE_FACTOR;
+        } else if (loss_ratio.value_or(0.0f) > HIGH_LOSS_RATIO) {
+            factor = 1.0f - 0.5f * *loss_ratio;
+        } else if (receive_rate_ratio.value_or(1.0f) < MIN_RECEIVE_RATE_RATIO) {
+            factor = std::max(*receive_rate_ratio, MIN_DECREASE_FACTOR);
+        } else if (loss_ratio.value_or(0.0f) < LOW_LOSS_RATIO) {
+            factor = INCREASE_FACTOR;
+        }
+
+        const int target_bitrate{std::clamp(static_cast<int>(target_bitrate_ * factor), min_bitrate_, max_bitrate_)};
+        if (target_bitrate == target_bitrate_)
+            return std::nullopt;
+
+        target_bitrate_ = target_bitrate;
+        return target_bitrate_;
+    }
+
+private:
+    const int min_bitrate_;
+    const int max_bitrate_;
+    int target_bitrate_;
+    std::unordered_map<int, ReceiverFeedback> receiver_feedbacks_;
+    TimePoint update_time_;
+};
+}
\ No newline at end of file
@@ -1,37 +1,176 @@
 #include "kinect_video_sender.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <exception>
 #include <iostream>
 
 namespace kh
 {
 namespace
 {
-Vp8Encoder create_color_encoder(k4a::calibration calibration)
+// The sender runs on a PC, so this is not limited by HoloLens as the bands of TRVL.
+constexpr int COLOR_REGISTRATION_BAND_COUNT{4};
+// In kilobits per second. Color frames start from the max and ColorBitrateController lowers it on lossy networks.
+constexpr int COLOR_MIN_BITRATE{500};
+constexpr int COLOR_MAX_BITRATE{4000};
+
+ColorCodecConfig create_color_codec_config(k4a::calibration calibration, int color_token_partition_count,
+                                           int color_temporal_layer_count, bool color_long_term_reference_recovery)
+{
+    return ColorCodecConfig{calibration.depth_camera_calibration.resolution_width,
+                            calibration.depth_camera_calibration.resolution_height,
+                            COLOR_MAX_BITRATE,
+                            color_token_partition_count,
+                            color_temporal_layer_count,
+                            color_long_term_reference_recovery};
+}
+
+// VP9 frames do not have temporal layers (see ColorCodecConfig).
+TemporalLayerSelector create_temporal_layer_selector(ColorCodecId color_codec_id, const ColorCodecConfig& color_codec_config)
+{
+    return TemporalLayerSelector{color_codec_id == ColorCodecId::Vp9 ? 1 : color_codec_config.temporal_layer_count};
+}
+
+std::optional<DepthQuantizer> create_depth_quantizer(float depth_error_bound)
+{
+    if (depth_error_bound == 0.0f)
+        return std::nullopt;
+
+    return DepthQuantizer{depth_error_bound};
+}
+
+// Thresholds that follow the noise of depth, which grows with the square of depth,
+// so that near pixels do not keep changes that are noise and far pixels do not flicker with noise.
+// About 5 mm at 1 m, 13 mm at 2 m, and 43 mm at 4 m.
+TrvlChangeThresholds create_depth_adaptive_change_thresholds()
+{
+    constexpr float BASE_THRESHOLD_MM{3.0f};
+    constexpr float THRESHOLD_PER_SQUARE_METER_MM{2.5f};
+
+    return create_quadratic_trvl_change_thresholds(BASE_THRESHOLD_MM, THRESHOLD_PER_SQUARE_METER_MM);
+}
+
+// Gates three times the change thresholds of TRVL, so that the filter smooths the noise that is just over the thresholds
+// while pixels of moving things get through as they are.
+DepthTemporalFilter create_depth_filter(k4a::calibration calibration)
 {
-    return Vp8Encoder{calibration.depth_camera_calibration.resolution_width,
-                      calibration.depth_camera_calibration.resolution_height};
+    constexpr int GATE_PER_CHANGE_THRESHOLD{3};
+
+    TrvlChangeThresholds gates{create_depth_adaptive_change_thresholds()};
+    for (auto& gate : gates)
+        gate = static_cast<std::uint8_t>(std::min(gate * GATE_PER_CHANGE_THRESHOLD, static_cast<int>(UINT8_MAX)));
+
+    return DepthTemporalFilter{calibration.depth_camera_calibration.resolution_width,
+                               calibration.depth_camera_calibration.resolution_height,
+                               gates};
 }
 
-TrvlEncoder create_depth_encoder(k4a::calibration calibration)
+DepthCodecConfig create_depth_codec_config(k4a::calibration calibration, bool quantized, bool intra_refresh)
 {
-    constexpr short CHANGE_THRESHOLD{10};
+    // With quantization, every change of a code gets sent, so pixels stay within the error bound of DepthQuantizer
+    // that the frames carry. The steps already are as large as the noise, which the depth filter smooths before them.
+    // Quantization codes are not depth, so the threshold does not depend on them.
+    const TrvlChangeThresholds CHANGE_THRESHOLDS{quantized ? create_constant_trvl_change_thresholds(0)
+                                                           : create_depth_adaptive_change_thresholds()};
     constexpr int INVALID_THRESHOLD{2};
+    // Bands get encoded in parallel by the sender and decoded in parallel by the receivers,
+    // so this is kept within the number of cores of HoloLens.
+    constexpr int BAND_COUNT{4};
+
+    return DepthCodecConfig{calibration.depth_camera_calibration.resolution_width,
+                            calibration.depth_camera_calibration.resolution_height,
+                            CHANGE_THRESHOLDS, INVALID_THRESHOLD, BAND_COUNT, intra_refresh};
+}
+
+DepthClipper create_depth_clipper(k4a::calibration calibration, std::int16_t min_depth, std::int16_t max_depth,
+                                  gsl::span<const k4a_float2_t> depth_roi_polygon)
+{
+    DepthClipper depth_clipper{calibration.depth_camera_calibration.resolution_width,
+                               calibration.depth_camera_calibration.resolution_height,
+                               min_depth, max_depth};
+    if (!depth_roi_polygon.empty())
+        depth_clipper.set_roi_polygon(depth_roi_polygon);
+
+    return depth_clipper;
+}
+
+// Every receiver supports TRVL, so it is the codec to fall back to.
+DepthCodecId select_depth_codec_id(DepthCodecId preferred_depth_codec_id,
+                                   const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+{
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (!remote_receiver.video_requested)
+            continue;
+
+        const auto& depth_codec_ids{remote_receiver.depth_codec_ids};
+        if (std::find(depth_codec_ids.begin(), depth_codec_ids.end(), preferred_depth_codec_id) == depth_codec_ids.end())
+            return DepthCodecId::Trvl;
+    }
+
+    return preferred_depth_codec_id;
+}
+
+// Every receiver supports VP8, so it is the codec to fall back to.
+ColorCodecId select_color_codec_id(ColorCodecId preferred_color_codec_id,
+                                   const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+{
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (!remote_receiver.video_requested)
+            continue;
+
+        const auto& color_codec_ids{remote_receiver.color_codec_ids};
+        if (std::find(color_codec_ids.begin(), color_codec_ids.end(), preferred_color_codec_id) == color_codec_ids.end())
+            return ColorCodecId::Vp8;
+    }
 
-    return TrvlEncoder{calibration.depth_camera_calibration.resolution_width *
-                       calibration.depth_camera_calibration.resolution_height,
-                       CHANGE_THRESHOLD, INVALID_THRESHOLD};
+    return preferred_color_codec_id;
 }
 
-int get_minimum_receiver_frame_id(std::unordered_map<int, RemoteReceiver>& remote_receivers)
+bool has_new_receiver(const std::unordered_map<int, RemoteReceiver>& remote_receivers)
 {
-    int minimum_frame_id{INT_MAX};
     for (auto& [_, remote_receiver] : remote_receivers) {
-        if (remote_receiver.video_frame_id < minimum_frame_id)
-            minimum_frame_id = remote_receiver.video_frame_id;
+        if (remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID)
+            return true;
     }
 
-    return minimum_frame_id;
+    return false;
+}
+
+// Receivers report the last frame they decoded, and decoding a frame requires the frames it follows,
+// so a receiver has the long-term reference once it reports a frame from it on.
+bool is_long_term_reference_acknowledged(const std::unordered_map<int, RemoteReceiver>& remote_receivers,
+                                         int long_term_reference_frame_id)
+{
+    if (long_term_reference_frame_id == -1)
+        return false;
+
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (!remote_receiver.video_requested)
+            continue;
+
+        if (remote_receiver.video_frame_id < long_term_reference_frame_id)
+            return false;
+    }
+
+    return true;
+}
+
+// The lag of the receiver furthest behind, not counting the frames of the temporal layers a receiver does not get.
+int get_maximum_receiver_frame_lag(const std::unordered_map<int, RemoteReceiver>& remote_receivers,
+                                   const TemporalLayerSelector& temporal_layer_selector, int last_frame_id)
+{
+    int maximum_frame_lag{0};
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID)
+            continue;
+
+        maximum_frame_lag = std::max(maximum_frame_lag, temporal_layer_selector.get_frame_lag(remote_receiver, last_frame_id));
+    }
+
+    return maximum_frame_lag;
 }
 
 std::optional<Samples::Plane> detect_floor_plane_from_kinect_frame(Samples::PointCloudGenerator& point_cloud_generator,
@@ -45,45 +184,322 @@ std::optional<Samples::Plane> detect_floor_plane_from_kinect_frame(Samples::Poin
     auto cloud_points{point_cloud_generator.GetCloudPoints(DOWNSAMPLE_STEP)};
     return Samples::FloorDetector::TryDetectFloorPlane(cloud_points, kinect_frame.imu_sample, calibration, MINIMUM_FLOOR_POINT_COUNT);
 }
+
+// The capture and preprocessor stages hand over only the freshest frame, so a stage that falls behind skips frames
+// instead of sending older and older ones, with a frame in each stage and at most one waiting before each.
+constexpr int CAPTURED_FRAME_QUEUE_CAPACITY{1};
+// Receivers need the frames before an encoded frame to decode it and request the packets they miss,
+// so the queues after the encoder never drop frames. Stages wait for room in them instead,
+// which holds back the encoder and makes the queues before it drop frames.
+constexpr int ENCODED_FRAME_QUEUE_CAPACITY{8};
+// The main thread takes the sent frames once a loop, which follows the refresh rate of the display.
+constexpr int SENT_FRAME_QUEUE_CAPACITY{30};
+// Stages without frames wake up this often to find out the sender stopped.
+constexpr std::chrono::milliseconds STAGE_WAIT_TIMEOUT{100};
+
+// Waits for the next frame of a stage and sets queued_frame_count to the frames in the queue, including it.
+// Returns std::nullopt when the sender stopped.
+template<class T>
+std::optional<T> wait_and_pop(SpscRingBuffer<T>& frames, const std::atomic<bool>& stopped, int& queued_frame_count)
+{
+    while (!stopped) {
+        queued_frame_count = frames.size();
+        if (auto frame{frames.pop()})
+            return frame;
+
+        frames.wait(STAGE_WAIT_TIMEOUT);
+    }
+
+    return std::nullopt;
+}
+
+// Pushes frame into a queue after the encoder once it has room, setting blocked_ms to how long that took.
+// Returns false when the sender stopped first.
+template<class T>
+bool wait_and_push(SpscRingBuffer<T>& frames, T&& frame, const std::atomic<bool>& stopped, float& blocked_ms)
+{
+    const auto wait_start{TimePoint::now()};
+    while (!frames.wait_for_space(STAGE_WAIT_TIMEOUT)) {
+        if (stopped)
+            return false;
+    }
+
+    blocked_ms = wait_start.elapsed_time().ms();
+    frames.push(std::move(frame));
+    return true;
+}
+
+void add_stage_frame(VideoPipelineStageSummary& stage_summary, int queued_frame_count, float queue_ms, float process_ms,
+                     float blocked_ms)
+{
+    ++stage_summary.frame_count;
+    stage_summary.queued_frame_count_sum += queued_frame_count;
+    stage_summary.queue_ms_sum += queue_ms;
+    stage_summary.process_ms_sum += process_ms;
+    stage_summary.blocked_ms_sum += blocked_ms;
+}
 }
 
 // Color encoder also uses the depth width/height since color pixels get transformed to the depth camera.
-KinectVideoSender::KinectVideoSender(const int session_id, KinectDevice&& kinect_device)
+KinectVideoSender::KinectVideoSender(const int session_id, const TimePoint& session_start_time, UdpSocket& udp_socket,
+                                     KinectDevice&& kinect_device, ColorCodecId preferred_color_codec_id,
+                                     int color_token_partition_count, int color_temporal_layer_count, bool color_long_term_reference_recovery,
+                                     DepthCodecId preferred_depth_codec_id, float depth_error_bound, bool depth_intra_refresh, std::int16_t min_depth,
+                                     std::int16_t max_depth, gsl::span<const k4a_float2_t> depth_roi_polygon)
     : session_id_{session_id}
+    , session_start_time_{session_start_time}
+    , udp_socket_{udp_socket}
     , random_number_generator_{std::random_device{}()}
     , kinect_device_{std::move(kinect_device)}
     , calibration_{kinect_device_.getCalibration()}
-    , transformation_{calibration_}
-    , color_encoder_{create_color_encoder(calibration_)}
-    , depth_encoder_{create_depth_encoder(calibration_)}
+    , color_registration_{create_color_registration_calibration(calibration_), COLOR_REGISTRATION_BAND_COUNT}
+    , preferred_color_codec_id_{preferred_color_codec_id}
+    , color_codec_config_{create_color_codec_config(calibration_, color_token_partition_count, color_temporal_layer_count,
+                                                     color_long_term_reference_recovery)}
+    , color_codec_id_{ColorCodecId::Vp8}
+    , color_encoder_{create_color_encoder(color_codec_id_, color_codec_config_)}
+    , color_bitrate_controller_{COLOR_MIN_BITRATE, COLOR_MAX_BITRATE}
+    , temporal_layer_selector_{create_temporal_layer_selector(color_codec_id_, color_codec_config_)}
+    , preferred_depth_codec_id_{preferred_depth_codec_id}
+    , depth_quantizer_{create_depth_quantizer(depth_error_bound)}
+    , depth_codec_config_{create_depth_codec_config(calibration_, depth_quantizer_.has_value(), depth_intra_refresh)}
+    , depth_codec_id_{DepthCodecId::Trvl}
+    , depth_encoder_{create_depth_encoder(depth_codec_id_, depth_codec_config_)}
+    , codec_changed_{false}
+    , long_term_reference_frame_id_{-1}
+    , depth_encoder_buffer_(depth_encoder_->get_max_frame_size())
+    , quantized_depth_image_(depth_codec_config_.width * depth_codec_config_.height)
+    , encoder_thread_pool_{std::make_unique<ThreadPool>(1)}
+    , depth_clipper_{create_depth_clipper(calibration_, min_depth, max_depth, depth_roi_polygon)}
     , occlusion_remover_{calibration_}
+    , depth_filter_{create_depth_filter(calibration_)}
     , point_cloud_generator_{calibration_}
     , last_frame_id_{-1}
     , last_frame_time_{TimePoint::now()}
+    , control_mutex_{}
+    , remote_receivers_{}
+    , summary_mutex_{}
+    , summary_{}
+    , captured_frames_{CAPTURED_FRAME_QUEUE_CAPACITY}
+    , preprocessed_frames_{CAPTURED_FRAME_QUEUE_CAPACITY}
+    , encoded_frames_{ENCODED_FRAME_QUEUE_CAPACITY}
+    , packetized_frames_{ENCODED_FRAME_QUEUE_CAPACITY}
+    , sent_frames_{SENT_FRAME_QUEUE_CAPACITY}
+    , stopped_{false}
+    , stage_exception_{}
+    , stage_threads_{}
 {
+    for (auto run : {&KinectVideoSender::run_capture_stage,
+                     &KinectVideoSender::run_preprocessor_stage,
+                     &KinectVideoSender::run_encoder_stage,
+                     &KinectVideoSender::run_packetizer_stage,
+                     &KinectVideoSender::run_network_stage}) {
+        stage_threads_.emplace_back(&KinectVideoSender::run_stage, this, run);
+    }
 }
 
-void KinectVideoSender::send(const TimePoint& session_start_time,
-                             UdpSocket& udp_socket,
-                             VideoParityPacketStorage& video_parity_packet_storage,
-                             std::unordered_map<int, RemoteReceiver>& remote_receivers,
-                             KinectVideoSenderSummary& summary)
+KinectVideoSender::~KinectVideoSender()
 {
-    // Keep send the init packet until the receiver reports a received frame.
-    for (auto& [_, remote_receiver] : remote_receivers) {
-        if (remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID) {
-            const auto init_packet_bytes{create_init_sender_packet_bytes(session_id_, create_init_sender_packet_data(calibration_))};
-            udp_socket.send(init_packet_bytes, remote_receiver.endpoint);
+    stopped_ = true;
+    for (auto& stage_thread : stage_threads_)
+        stage_thread.join();
+}
+
+void KinectVideoSender::update_receivers(const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+{
+    // RemoteReceiver cannot be assigned, so the copy gets swapped in.
+    auto remote_receivers_copy{remote_receivers};
+    std::lock_guard<std::mutex> lock{control_mutex_};
+    remote_receivers_.swap(remote_receivers_copy);
+}
+
+void KinectVideoSender::apply_report(int receiver_session_id, const ReportReceiverPacketData& report_receiver_packet_data)
+{
+    std::lock_guard<std::mutex> lock{control_mutex_};
+    color_bitrate_controller_.add_report(receiver_session_id, report_receiver_packet_data);
+}
+
+void KinectVideoSender::store_sent_frames(VideoParityPacketStorage& video_parity_packet_storage)
+{
+    {
+        std::lock_guard<std::mutex> lock{control_mutex_};
+        if (stage_exception_)
+            std::rethrow_exception(stage_exception_);
+    }
+
+    while (auto sent_frame{sent_frames_.pop()}) {
+        video_parity_packet_storage.add(sent_frame->frame_id,
+                                        std::move(sent_frame->video_packet_bytes_set),
+                                        std::move(sent_frame->parity_packet_bytes_set));
+    }
+}
+
+KinectVideoSenderSummary KinectVideoSender::take_summary()
+{
+    std::lock_guard<std::mutex> lock{summary_mutex_};
+    KinectVideoSenderSummary summary{std::move(summary_)};
+    summary_ = KinectVideoSenderSummary{};
+    return summary;
+}
+
+void KinectVideoSender::run_stage(void (KinectVideoSender::*run)())
+{
+    try {
+        (this->*run)();
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock{control_mutex_};
+            if (!stage_exception_)
+                stage_exception_ = std::current_exception();
         }
+        stopped_ = true;
     }
+}
 
-    // Try getting a Kinect frame.
-    auto kinect_frame{kinect_device_.getFrame()};
-    if (!kinect_frame) {
-        std::cout << "no kinect frame...\n";
-        return;
+// KinectDevice::getFrame() waits for the next frame of the device, so this stage sets the pace of the others.
+void KinectVideoSender::run_capture_stage()
+{
+    while (!stopped_) {
+        const auto capture_start{TimePoint::now()};
+        auto kinect_frame{kinect_device_.getFrame()};
+        if (!kinect_frame) {
+            std::cout << "no kinect frame...\n";
+            continue;
+        }
+
+        const auto capture_time{TimePoint::now()};
+        const bool dropped{!captured_frames_.push(CapturedVideoFrame{std::move(*kinect_frame), capture_time, capture_time})};
+        update_summary([&](KinectVideoSenderSummary& summary) {
+            add_stage_frame(summary.capture_stage, 0, 0.0f, (capture_time - capture_start).ms(), 0.0f);
+            if (dropped)
+                ++summary.preprocessor_stage.dropped_frame_count;
+        });
     }
+}
+
+void KinectVideoSender::run_preprocessor_stage()
+{
+    int queued_frame_count;
+    while (auto captured_video_frame{wait_and_pop(captured_frames_, stopped_, queued_frame_count)}) {
+        const float queue_ms{captured_video_frame->queue_time.elapsed_time().ms()};
+        const auto process_start{TimePoint::now()};
+        preprocess(*captured_video_frame, get_remote_receivers());
 
+        captured_video_frame->queue_time = TimePoint::now();
+        const bool dropped{!preprocessed_frames_.push(std::move(*captured_video_frame))};
+        update_summary([&](KinectVideoSenderSummary& summary) {
+            add_stage_frame(summary.preprocessor_stage, queued_frame_count, queue_ms, process_start.elapsed_time().ms(), 0.0f);
+            if (dropped)
+                ++summary.encoder_stage.dropped_frame_count;
+        });
+    }
+}
+
+void KinectVideoSender::run_encoder_stage()
+{
+    int queued_frame_count;
+    while (auto captured_video_frame{wait_and_pop(preprocessed_frames_, stopped_, queued_frame_count)}) {
+        const float queue_ms{captured_video_frame->queue_time.elapsed_time().ms()};
+        const auto process_start{TimePoint::now()};
+        auto encoded_video_frame{encode(*captured_video_frame, get_remote_receivers())};
+        const float process_ms{process_start.elapsed_time().ms()};
+
+        float blocked_ms{0.0f};
+        if (encoded_video_frame) {
+            encoded_video_frame->queue_time = TimePoint::now();
+            if (!wait_and_push(encoded_frames_, std::move(*encoded_video_frame), stopped_, blocked_ms))
+                return;
+        }
+        update_summary([&](KinectVideoSenderSummary& summary) {
+            add_stage_frame(summary.encoder_stage, queued_frame_count, queue_ms, process_ms, blocked_ms);
+        });
+    }
+}
+
+void KinectVideoSender::run_packetizer_stage()
+{
+    int queued_frame_count;
+    while (auto encoded_video_frame{wait_and_pop(encoded_frames_, stopped_, queued_frame_count)}) {
+        const float queue_ms{encoded_video_frame->queue_time.elapsed_time().ms()};
+        const auto process_start{TimePoint::now()};
+
+        // Create video/parity packet bytes.
+        const auto message_bytes{create_video_sender_message_bytes(encoded_video_frame->frame_time_stamp,
+                                                                   encoded_video_frame->keyframe,
+                                                                   encoded_video_frame->color_codec_id,
+                                                                   encoded_video_frame->color_frame_layer,
+                                                                   encoded_video_frame->color_encoder_frame,
+                                                                   encoded_video_frame->depth_codec_id,
+                                                                   encoded_video_frame->depth_error_bound,
+                                                                   encoded_video_frame->depth_encoder_frame)};
+        auto video_packet_bytes_set{split_video_sender_message_bytes(session_id_, encoded_video_frame->frame_id, message_bytes)};
+        auto parity_packet_bytes_set{create_parity_sender_packet_bytes_set(session_id_, encoded_video_frame->frame_id,
+                                                                           KH_FEC_PARITY_GROUP_SIZE, video_packet_bytes_set)};
+
+        const float process_ms{process_start.elapsed_time().ms()};
+
+        float blocked_ms;
+        if (!wait_and_push(packetized_frames_,
+                           PacketizedVideoFrame{encoded_video_frame->frame_id,
+                                                std::move(video_packet_bytes_set),
+                                                std::move(parity_packet_bytes_set),
+                                                std::move(encoded_video_frame->destinations),
+                                                encoded_video_frame->capture_time,
+                                                TimePoint::now()},
+                           stopped_, blocked_ms)) {
+            return;
+        }
+        update_summary([&](KinectVideoSenderSummary& summary) {
+            add_stage_frame(summary.packetizer_stage, queued_frame_count, queue_ms, process_ms, blocked_ms);
+        });
+    }
+}
+
+void KinectVideoSender::run_network_stage()
+{
+    int queued_frame_count;
+    while (auto packetized_video_frame{wait_and_pop(packetized_frames_, stopped_, queued_frame_count)}) {
+        const float queue_ms{packetized_video_frame->queue_time.elapsed_time().ms()};
+        const auto process_start{TimePoint::now()};
+
+        // Send video/parity packets to the receivers that get the temporal layer of the frame.
+        // Sending them in a random order makes the packets more robust to packet loss.
+        std::vector<std::vector<std::byte>*> packet_bytes_ptrs;
+        for (auto& video_packet_bytes : packetized_video_frame->video_packet_bytes_set)
+            packet_bytes_ptrs.push_back(&video_packet_bytes);
+
+        for (auto& parity_packet_bytes : packetized_video_frame->parity_packet_bytes_set)
+            packet_bytes_ptrs.push_back(&parity_packet_bytes);
+
+        std::shuffle(packet_bytes_ptrs.begin(), packet_bytes_ptrs.end(), random_number_generator_);
+        for (auto& destination : packetized_video_frame->destinations) {
+            for (auto& packet_bytes_ptr : packet_bytes_ptrs)
+                send_to(*packet_bytes_ptr, destination.endpoint);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{control_mutex_};
+            for (auto& destination : packetized_video_frame->destinations)
+                color_bitrate_controller_.add_sent_packets(destination.receiver_session_id, gsl::narrow_cast<int>(packet_bytes_ptrs.size()));
+        }
+
+        // Save video/parity packet bytes for the main thread to retransmit them.
+        const float process_ms{process_start.elapsed_time().ms()};
+        const float latency_ms{packetized_video_frame->capture_time.elapsed_time().ms()};
+        packetized_video_frame->queue_time = TimePoint::now();
+        float blocked_ms;
+        if (!wait_and_push(sent_frames_, std::move(*packetized_video_frame), stopped_, blocked_ms))
+            return;
+        update_summary([&](KinectVideoSenderSummary& summary) {
+            add_stage_frame(summary.network_stage, queued_frame_count, queue_ms, process_ms, blocked_ms);
+            summary.latency_ms_sum += latency_ms;
+        });
+    }
+}
+
+void KinectVideoSender::preprocess(CapturedVideoFrame& captured_video_frame,
+                                   const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+{
     // Calculate floor from depth frame only when needed.
     bool floor_required_by_any = false;
     for (auto& [_, remote_receiver] : remote_receivers) {
@@ -95,7 +511,7 @@ void KinectVideoSender::send(const TimePoint& session_start_time,
 
     if (floor_required_by_any) {
         // Try sending the floor plane from the Kinect frame.
-        auto floor_plane{detect_floor_plane_from_kinect_frame(point_cloud_generator_, *kinect_frame, calibration_)};
+        auto floor_plane{detect_floor_plane_from_kinect_frame(point_cloud_generator_, captured_video_frame.kinect_frame, calibration_)};
         if (floor_plane) {
             const auto floor_packet_bytes{create_floor_sender_packet_bytes(session_id_,
                                                                            floor_plane->Normal.X,
@@ -104,7 +520,7 @@ void KinectVideoSender::send(const TimePoint& session_start_time,
                                                                            floor_plane->C)};
             for (auto& [_, remote_receiver] : remote_receivers) {
                 if(remote_receiver.floor_requested)
-                    udp_socket.send(floor_packet_bytes, remote_receiver.endpoint);
+                    send_to(floor_packet_bytes, remote_receiver.endpoint);
             }
         }
     }
@@ -117,93 +533,277 @@ void KinectVideoSender::send(const TimePoint& session_start_time,
         }
     }
 
-    // Skip video compression if video is not required by any.
+    // Skip preprocessing depth if video is not required by any.
     if (!video_required_by_any)
         return;
 
+    // Remove the depth pixels that may not have corresponding color information available.
+    auto shadow_removal_start{TimePoint::now()};
+    gsl::span<int16_t> depth_image_span{reinterpret_cast<int16_t*>(captured_video_frame.kinect_frame.depth_image.get_buffer()),
+                                        gsl::narrow_cast<ptrdiff_t>(captured_video_frame.kinect_frame.depth_image.get_size() / sizeof(int16_t))};
+    //occlusion_remover_.remove(depth_image_span);
+    // Clipping the depth outside the capture volume is fused into the occlusion removal.
+    occlusion_remover_.remove2(depth_image_span, depth_clipper_);
+    const float shadow_removal_ms{shadow_removal_start.elapsed_time().ms()};
+
+    // Smooth flickering depth before the color image gets mapped to it and it gets encoded.
+    auto depth_filter_start{TimePoint::now()};
+    depth_filter_.filter(depth_image_span);
+    const float depth_filter_ms{depth_filter_start.elapsed_time().ms()};
+
+    update_summary([&](KinectVideoSenderSummary& summary) {
+        summary.shadow_removal_ms_sum += shadow_removal_ms;
+        summary.depth_filter_ms_sum += depth_filter_ms;
+    });
+}
+
+std::optional<EncodedVideoFrame> KinectVideoSender::encode(CapturedVideoFrame& captured_video_frame,
+                                                          const std::unordered_map<int, RemoteReceiver>& remote_receivers)
+{
+    // Switch the codecs when receivers that do not support the current ones connected or the ones that did not support
+    // the preferred ones left. The frames of the new codecs start with a keyframe.
+    const ColorCodecId color_codec_id{select_color_codec_id(preferred_color_codec_id_, remote_receivers)};
+    if (color_codec_id != color_codec_id_) {
+        std::cout << "Switching the color codec to " << get_color_codec_name(color_codec_id) << ".\n";
+        color_codec_id_ = color_codec_id;
+        color_encoder_ = create_color_encoder(color_codec_id_, color_codec_config_);
+        {
+            std::lock_guard<std::mutex> lock{control_mutex_};
+            color_encoder_->set_target_bitrate(color_bitrate_controller_.target_bitrate());
+        }
+        temporal_layer_selector_ = create_temporal_layer_selector(color_codec_id_, color_codec_config_);
+        codec_changed_ = true;
+    }
+
+    // Lower the bitrate of color frames when receivers lose packets instead of leaving them to fall behind
+    // and wait for keyframes, and raise it back as the network recovers.
+    std::optional<int> target_bitrate;
+    {
+        std::lock_guard<std::mutex> lock{control_mutex_};
+        target_bitrate = color_bitrate_controller_.update(remote_receivers);
+    }
+    if (target_bitrate)
+        color_encoder_->set_target_bitrate(*target_bitrate);
+
+    const DepthCodecId depth_codec_id{select_depth_codec_id(preferred_depth_codec_id_, remote_receivers)};
+    if (depth_codec_id != depth_codec_id_) {
+        std::cout << "Switching the depth codec to " << get_depth_codec_name(depth_codec_id) << ".\n";
+        depth_codec_id_ = depth_codec_id;
+        depth_encoder_ = create_depth_encoder(depth_codec_id_, depth_codec_config_);
+        depth_encoder_buffer_.resize(depth_encoder_->get_max_frame_size());
+        codec_changed_ = true;
+    }
+
+    // Keep send the init packet until the receiver reports a received frame.
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID) {
+            const auto init_packet_bytes{create_init_sender_packet_bytes(session_id_, create_init_sender_packet_data(calibration_,
+                                                                                                                     color_codec_id_,
+                                                                                                                     depth_codec_id_,
+                                                                                                                     depth_codec_config_.band_count))};
+            send_to(init_packet_bytes, remote_receiver.endpoint);
+        }
+    }
+
+    bool video_required_by_any = false;
+    for (auto& [_, remote_receiver] : remote_receivers) {
+        if (remote_receiver.video_requested) {
+            video_required_by_any = true;
+            break;
+        }
+    }
+
+    // Skip video compression if video is not required by any.
+    if (!video_required_by_any)
+        return std::nullopt;
+
     constexpr float AZURE_KINECT_FRAME_RATE = 30.0f;
-    const auto frame_time_point{TimePoint::now()};
+    const auto frame_time_point{captured_video_frame.capture_time};
     const auto frame_time_diff{frame_time_point - last_frame_time_};
-    const int minimum_receiver_frame_id{get_minimum_receiver_frame_id(remote_receivers)};
-    bool has_new_receiver{minimum_receiver_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID};
-    const int frame_id_diff{last_frame_id_ - get_minimum_receiver_frame_id(remote_receivers)};
+    // Receivers that fall behind get fewer temporal layers of color first, so one slow receiver
+    // does not slow down the others as long as it keeps up with the base layer.
+    temporal_layer_selector_.update(remote_receivers, last_frame_id_);
+    const bool new_receiver{has_new_receiver(remote_receivers)};
+    const int frame_id_diff{get_maximum_receiver_frame_lag(remote_receivers, temporal_layer_selector_, last_frame_id_)};
 
     // Skip a frame if there is no new receiver that requires a frame to start
     // and the sender is too much ahead of the receivers.
-    if (!has_new_receiver && (frame_time_diff.sec() * AZURE_KINECT_FRAME_RATE) < std::pow(2, frame_id_diff - 3))
-        return;
+    if (!new_receiver && (frame_time_diff.sec() * AZURE_KINECT_FRAME_RATE) < std::pow(2, frame_id_diff - 3))
+        return std::nullopt;
 
     ++last_frame_id_;
     last_frame_time_ = frame_time_point;
 
-    // Send a keyframe when there is a new receiver or at least a receiver needs to catch up by jumping forward using a keyframe.
-    const bool keyframe{has_new_receiver || frame_id_diff > 5};
+    // A receiver this many frames behind lost frames and jumps forward with a keyframe or a frame from the long-term reference.
+    constexpr int MAX_FRAME_LAG{5};
+    // Frames from the long-term reference get larger as the long-term reference gets older, so a new one gets requested
+    // when every receiver has the current one and it is this many frames old.
+    constexpr int LONG_TERM_REFERENCE_INTERVAL{30};
 
-    // Remove the depth pixels that may not have corresponding color information available.
-    auto shadow_removal_start{TimePoint::now()};
-    gsl::span<int16_t> depth_image_span{reinterpret_cast<int16_t*>(kinect_frame->depth_image.get_buffer()),
-                                        gsl::narrow_cast<ptrdiff_t>(kinect_frame->depth_image.get_size())};
-    //occlusion_remover_.remove(depth_image_span);
-    occlusion_remover_.remove2(depth_image_span);
-    summary.shadow_removal_ms_sum += shadow_removal_start.elapsed_time().ms();
-
-    // Transform the color image to match the depth image in a pixel by pixel manner.
-    auto transformation_start{TimePoint::now()};
-    const auto color_image_from_depth_camera{transformation_.color_image_to_depth_camera(kinect_frame->depth_image, kinect_frame->color_image)};
-    summary.transformation_ms_sum += transformation_start.elapsed_time().ms();
-
-    // Format the color pixels from the Kinect for the Vp8Encoder then encode the pixels with Vp8Encoder.
-    const auto yuv_conversion_start{TimePoint::now()};
-    const auto yuv_image{createYuvImageFromAzureKinectBgraBuffer(color_image_from_depth_camera.get_buffer(),
-                                                                 color_image_from_depth_camera.get_width_pixels(),
-                                                                 color_image_from_depth_camera.get_height_pixels(),
-                                                                 color_image_from_depth_camera.get_stride_bytes())};
-    summary.yuv_conversion_ms_sum += yuv_conversion_start.elapsed_time().ms();
-
-    // VP8 compress the color image.
-    const auto color_encoder_start{TimePoint::now()};
-    const auto vp8_frame{color_encoder_.encode(yuv_image, keyframe)};
-    summary.color_encoder_ms_sum += color_encoder_start.elapsed_time().ms();
+    // Send a keyframe when there is a new receiver, a codec has changed, or a receiver needs to catch up
+    // while not every receiver has the long-term reference. Otherwise, receivers catch up with a frame
+    // that only references the long-term reference, which is much smaller than a keyframe.
+    // The frame replaces the last frame for every receiver, so every receiver has to have the long-term reference.
+    // Without long-term reference recovery, receivers always catch up with keyframes.
+    const bool long_term_reference_acknowledged{color_codec_config_.long_term_reference_recovery
+                                                && is_long_term_reference_acknowledged(remote_receivers, long_term_reference_frame_id_)};
+    const bool keyframe{new_receiver || codec_changed_ || (frame_id_diff > MAX_FRAME_LAG && !long_term_reference_acknowledged)};
+    const bool from_long_term_reference{!keyframe && frame_id_diff > MAX_FRAME_LAG};
+    if (long_term_reference_acknowledged && last_frame_id_ - long_term_reference_frame_id_ >= LONG_TERM_REFERENCE_INTERVAL)
+        color_encoder_->request_long_term_reference();
 
-    // TRVL compress the depth image.
-    const auto depth_encoder_start{TimePoint::now()};
-    const auto depth_encoder_frame{depth_encoder_.encode(depth_image_span, keyframe)};
-    summary.depth_encoder_ms_sum += depth_encoder_start.elapsed_time().ms();
-
-    // Create video/parity packet bytes.
-    const float video_frame_time_stamp{(frame_time_point - session_start_time).ms()};
-    const auto message_bytes{create_video_sender_message_bytes(video_frame_time_stamp, keyframe, vp8_frame, depth_encoder_frame)};
-    auto video_packet_bytes_set{split_video_sender_message_bytes(session_id_, last_frame_id_, message_bytes)};
-    auto parity_packet_bytes_set{create_parity_sender_packet_bytes_set(session_id_, last_frame_id_, KH_FEC_PARITY_GROUP_SIZE, video_packet_bytes_set)};
-    
-    // Send video/parity packets.
-    // Sending them in a random order makes the packets more robust to packet loss.
-    std::vector<std::vector<std::byte>*> packet_bytes_ptrs;
-    for (auto& video_packet_bytes : video_packet_bytes_set)
-        packet_bytes_ptrs.push_back(&video_packet_bytes);
-    
-    for (auto& parity_packet_bytes : parity_packet_bytes_set)
-        packet_bytes_ptrs.push_back(&parity_packet_bytes);
-
-    std::shuffle(packet_bytes_ptrs.begin(), packet_bytes_ptrs.end(), random_number_generator_);
-    for (auto& [_, remote_receiver] : remote_receivers) {
+    const gsl::span<const int16_t> depth_image_span{reinterpret_cast<const int16_t*>(captured_video_frame.kinect_frame.depth_image.get_buffer()),
+                                                    gsl::narrow_cast<ptrdiff_t>(captured_video_frame.kinect_frame.depth_image.get_size() / sizeof(int16_t))};
+
+    // The color chain (transformation and the color encoder) and the depth chain (quantization and the depth encoder)
+    // only share the depth image, which neither changes, so they run at the same time and join before packetization.
+    // Depth follows the temporal layer of color, which the color encoder tells before encoding the frame.
+    const ColorFrameLayer color_frame_layer{color_encoder_->get_next_frame_layer(keyframe, from_long_term_reference)};
+    std::vector<std::byte> color_encoder_frame;
+    std::size_t depth_encoder_frame_size{0};
+    // ThreadPool::parallel_for() takes functions that do not throw, so exceptions get rethrown after the join.
+    std::array<std::exception_ptr, 2> chain_exceptions;
+    const auto encoder_start{TimePoint::now()};
+    encoder_thread_pool_->parallel_for(gsl::narrow_cast<int>(chain_exceptions.size()), [&](int chain) {
+        try {
+            if (chain == 0) {
+                color_encoder_frame = encode_color(captured_video_frame.kinect_frame, depth_image_span, keyframe, from_long_term_reference);
+            } else {
+                depth_encoder_frame_size = encode_depth(depth_image_span, color_frame_layer, keyframe, from_long_term_reference);
+            }
+        } catch (...) {
+            chain_exceptions[chain] = std::current_exception();
+        }
+    });
+    const float encoder_ms{encoder_start.elapsed_time().ms()};
+    for (auto& chain_exception : chain_exceptions) {
+        if (chain_exception)
+            std::rethrow_exception(chain_exception);
+    }
+
+    if (color_frame_layer.long_term_reference)
+        long_term_reference_frame_id_ = last_frame_id_;
+    // The encoder reuses its buffer for the next frame while the later stages still have this one.
+    std::vector<std::byte> depth_encoder_frame(depth_encoder_buffer_.begin(),
+                                               depth_encoder_buffer_.begin() + depth_encoder_frame_size);
+    codec_changed_ = false;
+
+    // The receivers that get the temporal layer of the frame.
+    std::vector<VideoDestination> destinations;
+    for (auto& [receiver_session_id, remote_receiver] : remote_receivers) {
         if (!remote_receiver.video_requested)
             continue;
 
-        for (auto& packet_bytes_ptr : packet_bytes_ptrs) {
-            udp_socket.send(*packet_bytes_ptr, remote_receiver.endpoint);
-        }
+        if (color_frame_layer.temporal_layer_id > temporal_layer_selector_.get_max_temporal_layer_id(receiver_session_id))
+            continue;
+
+        destinations.push_back(VideoDestination{receiver_session_id, remote_receiver.endpoint});
     }
 
-    // Save video/parity packet bytes for retransmission. 
-    video_parity_packet_storage.add(last_frame_id_, std::move(video_packet_bytes_set), std::move(parity_packet_bytes_set));
+    int color_target_bitrate;
+    {
+        std::lock_guard<std::mutex> lock{control_mutex_};
+        color_target_bitrate = color_bitrate_controller_.target_bitrate();
+    }
 
     // Updating variables for profiling.
-    if (keyframe)
-        ++summary.keyframe_count;
-    ++summary.frame_count;
-    summary.color_byte_count += gsl::narrow_cast<int>(vp8_frame.size());
-    summary.depth_byte_count += gsl::narrow_cast<int>(depth_encoder_frame.size());
-    summary.frame_id = last_frame_id_;
+    update_summary([&](KinectVideoSenderSummary& summary) {
+        summary.encoder_ms_sum += encoder_ms;
+        if (keyframe)
+            ++summary.keyframe_count;
+        if (color_frame_layer.temporal_layer_id == 0)
+            ++summary.base_layer_frame_count;
+        if (from_long_term_reference)
+            ++summary.recovery_frame_count;
+        ++summary.frame_count;
+        summary.color_byte_count += gsl::narrow_cast<int>(color_encoder_frame.size());
+        summary.depth_byte_count += gsl::narrow_cast<int>(depth_encoder_frame.size());
+        summary.frame_id = last_frame_id_;
+        summary.color_target_bitrate = color_target_bitrate;
+    });
+
+    return EncodedVideoFrame{last_frame_id_,
+                             (frame_time_point - session_start_time_).ms(),
+                             keyframe,
+                             color_codec_id_,
+                             color_frame_layer,
+                             std::move(color_encoder_frame),
+                             depth_codec_id_,
+                             depth_quantizer_ ? depth_quantizer_->error_bound() : 0.0f,
+                             std::move(depth_encoder_frame),
+                             std::move(destinations),
+                             captured_video_frame.capture_time,
+                             TimePoint{}};
+}
+
+std::vector<std::byte> KinectVideoSender::encode_color(const KinectFrame& kinect_frame, gsl::span<const std::int16_t> depth_image,
+                                                       bool keyframe, bool from_long_term_reference)
+{
+    // Transform the color image to match the depth image in a pixel by pixel manner,
+    // writing the color pixels straight into the image of the color encoder in YUV420.
+    const auto transformation_start{TimePoint::now()};
+    color_registration_.transform(depth_image, kinect_frame.color_image.get_buffer(),
+                                  kinect_frame.color_image.get_stride_bytes(), color_encoder_->acquire_input_planes());
+    const float transformation_ms{transformation_start.elapsed_time().ms()};
+
+    // Compress the color image.
+    const auto color_encoder_start{TimePoint::now()};
+    auto color_encoder_frame{from_long_term_reference ? color_encoder_->encode_long_term_reference()
+                                                      : color_encoder_->encode(keyframe)};
+    const float color_encoder_ms{color_encoder_start.elapsed_time().ms()};
+
+    update_summary([&](KinectVideoSenderSummary& summary) {
+        summary.transformation_ms_sum += transformation_ms;
+        summary.color_encoder_ms_sum += color_encoder_ms;
+    });
+
+    return color_encoder_frame;
+}
+
+std::size_t KinectVideoSender::encode_depth(gsl::span<const std::int16_t> depth_image, ColorFrameLayer color_frame_layer,
+                                            bool keyframe, bool from_long_term_reference)
+{
+    // Compress the depth image, after quantizing it into a buffer of its own when lossy since the color chain reads it.
+    // Depth of the upper temporal layers does not change the state of the encoder,
+    // so receivers that do not get those frames stay synchronized. Depth follows the long-term reference of color.
+    const auto depth_encoder_start{TimePoint::now()};
+    if (depth_quantizer_) {
+        depth_quantizer_->quantize(depth_image, quantized_depth_image_);
+        depth_image = quantized_depth_image_;
+    }
+    std::size_t depth_encoder_frame_size;
+    if (color_frame_layer.temporal_layer_id > 0) {
+        depth_encoder_frame_size = depth_encoder_->encode_non_reference(depth_image, depth_encoder_buffer_);
+    } else if (from_long_term_reference) {
+        depth_encoder_frame_size = depth_encoder_->encode_long_term_reference(depth_image, depth_encoder_buffer_);
+    } else {
+        depth_encoder_frame_size = depth_encoder_->encode(depth_image, keyframe, depth_encoder_buffer_);
+    }
+    if (color_frame_layer.long_term_reference)
+        depth_encoder_->save_long_term_reference();
+    const float depth_encoder_ms{depth_encoder_start.elapsed_time().ms()};
+
+    update_summary([&](KinectVideoSenderSummary& summary) {
+        summary.depth_encoder_ms_sum += depth_encoder_ms;
+    });
+
+    return depth_encoder_frame_size;
+}
+
+std::unordered_map<int, RemoteReceiver> KinectVideoSender::get_remote_receivers()
+{
+    std::lock_guard<std::mutex> lock{control_mutex_};
+    return remote_receivers_;
+}
+
+// Failures get printed instead of stopping the stage. The main thread sends to the same receivers,
+// so it gets the same failures and removes the receivers.
+void KinectVideoSender::send_to(gsl::span<const std::byte> bytes, const asio::ip::udp::endpoint& endpoint)
+{
+    try {
+        udp_socket_.send(bytes, endpoint);
+    } catch (UdpSocketRuntimeError& e) {
+        std::cout << "UdpSocketRuntimeError from KinectVideoSender\n  message: " << e.what() << "\n  endpoint: " << e.endpoint() << "\n";
+    }
 }
 }
\ No newline at end of file
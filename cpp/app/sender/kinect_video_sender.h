@@ -1,7 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <random>
+#include <thread>
 #include "native/kh_native.h"
+#include "color_bitrate_controller.h"
+#include "spsc_ring_buffer.h"
+#include "temporal_layer_selector.h"
 #include "video_sender_utils.h"
 
 // These header files are from a Microsoft's Azure Kinect sample project.
@@ -10,42 +17,210 @@
 
 namespace kh
 {
+// Counters of a stage of the pipeline of KinectVideoSender.
+struct VideoPipelineStageSummary
+{
+    int frame_count{0};
+    // Frames in the queue before the stage when it took one, including that one.
+    int queued_frame_count_sum{0};
+    // Frames the queue before the stage dropped for newer ones. Only the queues before the encoder drop frames.
+    int dropped_frame_count{0};
+    // How long frames waited in the queue before the stage.
+    float queue_ms_sum{0.0f};
+    float process_ms_sum{0.0f};
+    // How long the stage waited for room in the queue after it, which the queues after the encoder make it do.
+    float blocked_ms_sum{0.0f};
+};
+
 struct KinectVideoSenderSummary
 {
     TimePoint start_time{TimePoint::now()};
     float shadow_removal_ms_sum{0.0f};
+    float depth_filter_ms_sum{0.0f};
+    // Includes the conversion to YUV, which ColorRegistration does in the same pass.
     float transformation_ms_sum{0.0f};
-    float yuv_conversion_ms_sum{0.0f};
     float color_encoder_ms_sum{0.0f};
     float depth_encoder_ms_sum{0.0f};
+    // The wall time of the color and depth chains, which run at the same time, so it is less than the sum of their stages.
+    float encoder_ms_sum{0.0f};
     int frame_count{0};
     int color_byte_count{0};
     int depth_byte_count{0};
     int keyframe_count{0};
+    // Frames of the temporal layer of color every receiver gets.
+    int base_layer_frame_count{0};
+    // Frames from the long-term reference, which receivers that fell behind get instead of keyframes.
+    int recovery_frame_count{0};
     int frame_id{0};
+    int color_target_bitrate{0};
+    VideoPipelineStageSummary capture_stage;
+    VideoPipelineStageSummary preprocessor_stage;
+    VideoPipelineStageSummary encoder_stage;
+    VideoPipelineStageSummary packetizer_stage;
+    VideoPipelineStageSummary network_stage;
+    // From capturing frames to sending their packets.
+    float latency_ms_sum{0.0f};
+};
+
+// A receiver that gets the packets of a frame.
+struct VideoDestination
+{
+    int receiver_session_id;
+    asio::ip::udp::endpoint endpoint;
+};
+
+// Frames in the queues of the pipeline of KinectVideoSender. queue_time is when the frame got into its current queue.
+struct CapturedVideoFrame
+{
+    KinectFrame kinect_frame;
+    TimePoint capture_time;
+    TimePoint queue_time;
 };
 
+struct EncodedVideoFrame
+{
+    int frame_id;
+    float frame_time_stamp;
+    bool keyframe;
+    ColorCodecId color_codec_id;
+    ColorFrameLayer color_frame_layer;
+    std::vector<std::byte> color_encoder_frame;
+    DepthCodecId depth_codec_id;
+    float depth_error_bound;
+    std::vector<std::byte> depth_encoder_frame;
+    std::vector<VideoDestination> destinations;
+    TimePoint capture_time;
+    TimePoint queue_time;
+};
+
+struct PacketizedVideoFrame
+{
+    int frame_id;
+    std::vector<std::vector<std::byte>> video_packet_bytes_set;
+    std::vector<std::vector<std::byte>> parity_packet_bytes_set;
+    std::vector<VideoDestination> destinations;
+    TimePoint capture_time;
+    TimePoint queue_time;
+};
+
+// Sends the frames of a Kinect device through a pipeline of five stages, each on a thread of its own:
+// capturing, preprocessing depth, encoding color and depth, packetizing with FEC, and sending the packets.
+// A stage works on a frame while the others work on the frames before and after it, so a frame takes as long
+// as the slowest stage instead of as all of them. The SpscRingBuffers before the encoder drop their oldest frames,
+// so a stage that falls behind takes the freshest frame next instead of delaying every stage. The ones after it
+// make the stages wait for room instead, since receivers need every encoded frame.
+// The main thread keeps handling the receivers and hands them to the stages with update_receivers().
 class KinectVideoSender
 {
 public:
     // Color encoder also uses the depth width/height since color pixels get transformed to the depth camera.
-    KinectVideoSender(const int session_id, KinectDevice&& kinect_device);
-    void send(const TimePoint& session_start_time,
-              UdpSocket& udp_socket,
-              VideoParityPacketStorage& video_parity_packet_storage,
-              std::unordered_map<int, RemoteReceiver>& remote_receivers,
-              KinectVideoSenderSummary& summary);
+    // The preferred codecs get used while all receivers of video support them, otherwise VP8 and TRVL get used.
+    // VP8 frames get color_token_partition_count token partitions for receivers to decode them in parallel
+    // and color_temporal_layer_count temporal layers for receivers that fall behind to get fewer frames.
+    // With color_long_term_reference_recovery, receivers that lost frames recover from the long-term reference
+    // instead of keyframes (see ColorCodecConfig).
+    // Depth frames get quantized by DepthQuantizer with depth_error_bound unless it is zero.
+    // With depth_intra_refresh, TRVL refreshes a band per frame instead of encoding keyframes,
+    // which keeps new receivers from causing frames as large as keyframes.
+    // Depth pixels outside [min_depth, max_depth] millimeters or outside depth_roi_polygon, unless it is empty,
+    // get zeroed by DepthClipper.
+    // The stages start sending with the constructor and stop with the destructor. udp_socket has to outlive this.
+    KinectVideoSender(const int session_id, const TimePoint& session_start_time, UdpSocket& udp_socket,
+                      KinectDevice&& kinect_device, ColorCodecId preferred_color_codec_id,
+                      int color_token_partition_count, int color_temporal_layer_count, bool color_long_term_reference_recovery,
+                      DepthCodecId preferred_depth_codec_id, float depth_error_bound, bool depth_intra_refresh, std::int16_t min_depth,
+                      std::int16_t max_depth, gsl::span<const k4a_float2_t> depth_roi_polygon);
+    ~KinectVideoSender();
+    KinectVideoSender(const KinectVideoSender&) = delete;
+    KinectVideoSender& operator=(const KinectVideoSender&) = delete;
+    // The stages send to a copy of remote_receivers from the next frame on.
+    void update_receivers(const std::unordered_map<int, RemoteReceiver>& remote_receivers);
+    // For the color bitrate to follow the network.
+    void apply_report(int receiver_session_id, const ReportReceiverPacketData& report_receiver_packet_data);
+    // Moves the packets of the frames the network stage sent into video_parity_packet_storage for retransmission.
+    // Rethrows the exception that stopped a stage.
+    void store_sent_frames(VideoParityPacketStorage& video_parity_packet_storage);
+    // Returns the summary since the last call.
+    KinectVideoSenderSummary take_summary();
 private:
+    // The loops of the threads of the stages.
+    void run_capture_stage();
+    void run_preprocessor_stage();
+    void run_encoder_stage();
+    void run_packetizer_stage();
+    void run_network_stage();
+    // Runs the loop of a stage, stopping every stage when it throws.
+    void run_stage(void (KinectVideoSender::*run)());
+
+    void preprocess(CapturedVideoFrame& captured_video_frame, const std::unordered_map<int, RemoteReceiver>& remote_receivers);
+    // Returns std::nullopt for frames that get skipped.
+    std::optional<EncodedVideoFrame> encode(CapturedVideoFrame& captured_video_frame,
+                                            const std::unordered_map<int, RemoteReceiver>& remote_receivers);
+    // The color chain and the depth chain of encode(), which run on two threads.
+    std::vector<std::byte> encode_color(const KinectFrame& kinect_frame, gsl::span<const std::int16_t> depth_image,
+                                        bool keyframe, bool from_long_term_reference);
+    std::size_t encode_depth(gsl::span<const std::int16_t> depth_image, ColorFrameLayer color_frame_layer,
+                             bool keyframe, bool from_long_term_reference);
+    std::unordered_map<int, RemoteReceiver> get_remote_receivers();
+    void send_to(gsl::span<const std::byte> bytes, const asio::ip::udp::endpoint& endpoint);
+
+    template<class Function>
+    void update_summary(Function&& function)
+    {
+        std::lock_guard<std::mutex> lock{summary_mutex_};
+        function(summary_);
+    }
+
     const int session_id_;
+    const TimePoint session_start_time_;
+    UdpSocket& udp_socket_;
     std::mt19937 random_number_generator_;
     KinectDevice kinect_device_;
     k4a::calibration calibration_;
-    k4a::transformation transformation_;
-    Vp8Encoder color_encoder_;
-    TrvlEncoder depth_encoder_;
+    ColorRegistration color_registration_;
+    const ColorCodecId preferred_color_codec_id_;
+    const ColorCodecConfig color_codec_config_;
+    ColorCodecId color_codec_id_;
+    std::unique_ptr<ColorEncoder> color_encoder_;
+    ColorBitrateController color_bitrate_controller_;
+    TemporalLayerSelector temporal_layer_selector_;
+    const DepthCodecId preferred_depth_codec_id_;
+    const std::optional<DepthQuantizer> depth_quantizer_;
+    const DepthCodecConfig depth_codec_config_;
+    DepthCodecId depth_codec_id_;
+    std::unique_ptr<DepthEncoder> depth_encoder_;
+    // Stays true until a keyframe gets encoded with the new encoders, which can be frames later since frames can be skipped.
+    bool codec_changed_;
+    // The last frame that became the long-term reference of both color and depth. Receivers that reported it
+    // or a later frame have it.
+    int long_term_reference_frame_id_;
+    // Reused for every frame to keep the depth path from allocating.
+    std::vector<std::byte> depth_encoder_buffer_;
+    // Lossy depth gets quantized here instead of in place, since the color chain reads the depth image at the same time.
+    std::vector<std::int16_t> quantized_depth_image_;
+    // Takes one of the color and depth chains while the calling thread takes the other.
+    std::unique_ptr<ThreadPool> encoder_thread_pool_;
+    DepthClipper depth_clipper_;
     OcclusionRemover occlusion_remover_;
+    DepthTemporalFilter depth_filter_;
     Samples::PointCloudGenerator point_cloud_generator_;
     int last_frame_id_;
     TimePoint last_frame_time_;
+    // Guards the copy of the receivers the main thread hands over and color_bitrate_controller_,
+    // which gets reports from the main thread and counts of sent packets from the network stage.
+    std::mutex control_mutex_;
+    std::unordered_map<int, RemoteReceiver> remote_receivers_;
+    std::mutex summary_mutex_;
+    KinectVideoSenderSummary summary_;
+    SpscRingBuffer<CapturedVideoFrame> captured_frames_;
+    SpscRingBuffer<CapturedVideoFrame> preprocessed_frames_;
+    SpscRingBuffer<EncodedVideoFrame> encoded_frames_;
+    SpscRingBuffer<PacketizedVideoFrame> packetized_frames_;
+    // From the network stage to the main thread, for retransmission.
+    SpscRingBuffer<PacketizedVideoFrame> sent_frames_;
+    std::atomic<bool> stopped_;
+    // Guarded by control_mutex_.
+    std::exception_ptr stage_exception_;
+    std::vector<std::thread> stage_threads_;
 };
 }
\ No newline at end of file
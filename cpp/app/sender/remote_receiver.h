@@ -14,15 +14,20 @@ struct RemoteReceiver
     bool video_requested;
     bool audio_requested;
     bool floor_requested;
+    const std::vector<DepthCodecId> depth_codec_ids;
+    const std::vector<ColorCodecId> color_codec_ids;
     int video_frame_id;
     TimePoint last_packet_time;
 
-    RemoteReceiver(asio::ip::udp::endpoint endpoint, int session_id, bool video_requested, bool audio_requested, bool floor_requested)
+    RemoteReceiver(asio::ip::udp::endpoint endpoint, int session_id, bool video_requested, bool audio_requested, bool floor_requested,
+                   std::vector<DepthCodecId> depth_codec_ids, std::vector<ColorCodecId> color_codec_ids)
         : endpoint{endpoint}
         , session_id{session_id}
         , video_requested{video_requested}
         , audio_requested{audio_requested}
         , floor_requested{floor_requested}
+        , depth_codec_ids{std::move(depth_codec_ids)}
+        , color_codec_ids{std::move(color_codec_ids)}
         , video_frame_id{INITIAL_VIDEO_FRAME_ID}
         , last_packet_time{TimePoint::now()}
     {
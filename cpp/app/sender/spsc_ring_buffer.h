@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace kh
+{
+// A bounded queue between a producer thread and a consumer thread that drops its oldest item for a new one
+// when full, so the consumer gets the freshest frames instead of falling further behind.
+// Items move through without locks. Each slot has a sequence number telling whose turn it is with the slot,
+// as in the bounded queue of Dmitry Vyukov, and the producer drops the oldest item by taking it from the consumer
+// with the same compare-exchange of read_index_ the consumer takes items with.
+// Only the waits take a lock, for the consumer to sleep while the queue is empty and the producer to sleep while it is full
+// when it must not drop items (see wait_for_space()).
+template<class T>
+class SpscRingBuffer
+{
+private:
+    struct Slot
+    {
+        // Even while free for the producer and odd while holding an item for the consumer: index * 2 before
+        // the item of index gets pushed, index * 2 + 1 after, and (index + capacity) * 2 after it got popped.
+        // Doubling keeps the two apart when the capacity is 1.
+        std::atomic<std::uint64_t> sequence;
+        T item;
+    };
+
+public:
+    explicit SpscRingBuffer(int capacity)
+        : slots_(capacity), read_index_{0}, write_index_{0}, wait_mutex_{}, wait_condition_{}, space_condition_{}
+    {
+        for (std::uint64_t i{0}; i < slots_.size(); ++i)
+            slots_[i].sequence = i * 2;
+    }
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    // Only for the producer. Returns false when the oldest item got dropped for item.
+    bool push(T&& item)
+    {
+        const std::uint64_t write_index{write_index_.load(std::memory_order_relaxed)};
+        Slot& slot{slots_[write_index % slots_.size()]};
+        bool dropped{false};
+        if (slot.sequence.load(std::memory_order_acquire) != write_index * 2) {
+            // The slot still has the oldest item, unless the consumer took it just now.
+            std::uint64_t oldest_index{write_index - slots_.size()};
+            if (read_index_.compare_exchange_strong(oldest_index, oldest_index + 1, std::memory_order_acq_rel)) {
+                dropped = true;
+            } else {
+                // The consumer frees the slot right after moving the item out of it.
+                while (slot.sequence.load(std::memory_order_acquire) != write_index * 2)
+                    std::this_thread::yield();
+            }
+        }
+
+        slot.item = std::move(item);
+        slot.sequence.store(write_index * 2 + 1, std::memory_order_release);
+        write_index_.store(write_index + 1, std::memory_order_release);
+
+        // Locking before notifying keeps the notification from falling between the check and the sleep of wait().
+        {
+            std::lock_guard<std::mutex> lock{wait_mutex_};
+        }
+        wait_condition_.notify_one();
+        return !dropped;
+    }
+
+    // Only for the consumer.
+    std::optional<T> pop()
+    {
+        for (;;) {
+            std::uint64_t read_index{read_index_.load(std::memory_order_acquire)};
+            Slot& slot{slots_[read_index % slots_.size()]};
+            if (slot.sequence.load(std::memory_order_acquire) != read_index * 2 + 1) {
+                // Empty, unless the producer dropped the item in between.
+                if (read_index_.load(std::memory_order_acquire) == read_index)
+                    return std::nullopt;
+                continue;
+            }
+
+            // Fails when the producer dropped the item, which leaves the next one to try.
+            if (read_index_.compare_exchange_weak(read_index, read_index + 1, std::memory_order_acq_rel)) {
+                std::optional<T> item{std::move(slot.item)};
+                slot.sequence.store((read_index + slots_.size()) * 2, std::memory_order_release);
+                {
+                    std::lock_guard<std::mutex> lock{wait_mutex_};
+                }
+                space_condition_.notify_one();
+                return item;
+            }
+        }
+    }
+
+    // Only for the consumer. Returns false when the queue still is empty after timeout.
+    template<class Rep, class Period>
+    bool wait(std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock{wait_mutex_};
+        return wait_condition_.wait_for(lock, timeout, [this] { return size() > 0; });
+    }
+
+    // Only for the producer. Returns false when the queue still is full after timeout.
+    // A push() after this returned true does not drop an item.
+    template<class Rep, class Period>
+    bool wait_for_space(std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock{wait_mutex_};
+        return space_condition_.wait_for(lock, timeout, [this] { return size() < capacity(); });
+    }
+
+    int capacity() const noexcept
+    {
+        return static_cast<int>(slots_.size());
+    }
+
+    // The number of items in the queue, which can be off by one while the other thread pushes or pops.
+    int size() const noexcept
+    {
+        const std::uint64_t read_index{read_index_.load(std::memory_order_acquire)};
+        const std::uint64_t write_index{write_index_.load(std::memory_order_acquire)};
+        return write_index > read_index ? static_cast<int>(write_index - read_index) : 0;
+    }
+
+private:
+    std::vector<Slot> slots_;
+    std::atomic<std::uint64_t> read_index_;
+    std::atomic<std::uint64_t> write_index_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_condition_;
+    std::condition_variable space_condition_;
+};
+}
\ No newline at end of file
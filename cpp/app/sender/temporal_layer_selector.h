@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include "native/kh_native.h"
+#include "remote_receiver.h"
+
+namespace kh
+{
+// Picks the temporal layers of color (see ColorCodecConfig::temporal_layer_count) that each receiver gets
+// with how far behind the sender it is. A receiver that cannot keep up with every frame drops an upper layer
+// and gets a half of the frames, instead of making the sender skip frames and send keyframes for every receiver.
+// The layer comes back after the receiver kept up for a while, which gets longer each time the receiver
+// falls behind again with it.
+class TemporalLayerSelector
+{
+private:
+    struct ReceiverLayer
+    {
+        int max_temporal_layer_id;
+        TimePoint change_time;
+        // The last time the receiver was behind.
+        TimePoint behind_time;
+        // How long the receiver has to keep up to get a layer back.
+        float add_interval_ms;
+    };
+
+public:
+    explicit TemporalLayerSelector(int temporal_layer_count)
+        : temporal_layer_count_{temporal_layer_count}, receiver_layers_{}
+    {
+    }
+
+    // Receivers get every layer until update() finds them behind.
+    int get_max_temporal_layer_id(int receiver_session_id) const
+    {
+        const auto receiver_layer_iter{receiver_layers_.find(receiver_session_id)};
+        if (receiver_layer_iter == receiver_layers_.end())
+            return temporal_layer_count_ - 1;
+
+        return receiver_layer_iter->second.max_temporal_layer_id;
+    }
+
+    // Frames a receiver is behind the sender, not counting the frames of the layers it does not get.
+    int get_frame_lag(const RemoteReceiver& remote_receiver, int last_frame_id) const
+    {
+        const int frame_interval{1 << (temporal_layer_count_ - 1 - get_max_temporal_layer_id(remote_receiver.session_id))};
+        return last_frame_id - remote_receiver.video_frame_id - (frame_interval - 1);
+    }
+
+    void update(const std::unordered_map<int, RemoteReceiver>& remote_receivers, int last_frame_id)
+    {
+        // A receiver more frames behind than this drops a layer.
+        constexpr int MAX_FRAME_LAG{3};
+        // A receiver at most this many frames behind keeps up.
+        constexpr int KEEP_UP_FRAME_LAG{1};
+        // Dropping a layer takes frames to show up in the reports, so it does not happen again right away.
+        constexpr float DROP_INTERVAL_MS{1000.0f};
+        constexpr float MIN_ADD_INTERVAL_MS{2000.0f};
+        constexpr float MAX_ADD_INTERVAL_MS{32000.0f};
+
+        for (auto it = receiver_layers_.begin(); it != receiver_layers_.end();) {
+            if (remote_receivers.find(it->first) == remote_receivers.end()) {
+                it = receiver_layers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (auto& [receiver_session_id, remote_receiver] : remote_receivers) {
+            if (!remote_receiver.video_requested || remote_receiver.video_frame_id == RemoteReceiver::INITIAL_VIDEO_FRAME_ID)
+                continue;
+
+            const int frame_lag{get_frame_lag(remote_receiver, last_frame_id)};
+            auto receiver_layer_iter{receiver_layers_.find(receiver_session_id)};
+            if (receiver_layer_iter == receiver_layers_.end()) {
+                std::tie(receiver_layer_iter, std::ignore) = receiver_layers_.insert({receiver_session_id,
+                                                                                      ReceiverLayer{temporal_layer_count_ - 1,
+                                                                                                    TimePoint::now(),
+                                                                                                    TimePoint::now(),
+                                                                                                    MIN_ADD_INTERVAL_MS}});
+            }
+            auto& receiver_layer{receiver_layer_iter->second};
+
+            if (frame_lag > KEEP_UP_FRAME_LAG)
+                receiver_layer.behind_time = TimePoint::now();
+
+            if (frame_lag > MAX_FRAME_LAG && receiver_layer.max_temporal_layer_id > 0
+                && receiver_layer.change_time.elapsed_time().ms() > DROP_INTERVAL_MS) {
+                // Falling behind soon after getting a layer back means the receiver only barely keeps up without it.
+                if (receiver_layer.change_time.elapsed_time().ms() < receiver_layer.add_interval_ms * 2.0f)
+                    receiver_layer.add_interval_ms = std::min(receiver_layer.add_interval_ms * 2.0f, MAX_ADD_INTERVAL_MS);
+                --receiver_layer.max_temporal_layer_id;
+                receiver_layer.change_time = TimePoint::now();
+            } else if (receiver_layer.max_temporal_layer_id < temporal_layer_count_ - 1
+                       && receiver_layer.behind_time.elapsed_time().ms() > receiver_layer.add_interval_ms) {
+                ++receiver_layer.max_temporal_layer_id;
+                receiver_layer.change_time = TimePoint::now();
+            }
+        }
+    }
+
+private:
+    int temporal_layer_count_;
+    std::unordered_map<int, ReceiverLayer> receiver_layers_;
+};
+}
\ No newline at end of file
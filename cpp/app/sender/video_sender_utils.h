@@ -15,6 +15,8 @@ struct ReceiverReportSummary
     float decoder_time_ms_sum{0.0f};
     float frame_interval_ms_sum{0.0f};
     int received_report_count{0};
+    int video_packet_count{0};
+    int lost_video_packet_count{0};
 };
 
 // This class includes both video packet bytes and parity packet bytes
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_cpu.h"
+#include "kh_trvl.h"
+#include "native/kh_time.h"
+#include "helper/depth_frame_helper.h"
+
+namespace kh
+{
+constexpr int PIXEL_COUNT{SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT};
+constexpr std::int16_t CHANGE_THRESHOLD{10};
+constexpr int INVALID_THRESHOLD{2};
+
+// The state of TrvlEncoder before it got split into arrays, with the padding that made a pixel take 8 bytes.
+struct AosTrvlPixel
+{
+    std::int16_t value;
+    int invalid_count;
+};
+
+// update_pixel() of TrvlEncoder before it got split into arrays, as the baseline.
+void update_aos_pixel(AosTrvlPixel& pixel, const std::int16_t raw_value)
+{
+    if (pixel.value == 0) {
+        if (raw_value > 0)
+            pixel.value = raw_value;
+
+        return;
+    }
+
+    if (raw_value == 0) {
+        ++pixel.invalid_count;
+        if (pixel.invalid_count >= INVALID_THRESHOLD) {
+            pixel.value = 0;
+            pixel.invalid_count = 0;
+        }
+        return;
+    }
+
+    pixel.invalid_count = 0;
+
+    const std::int16_t difference{pixel.value > raw_value ? static_cast<std::int16_t>(pixel.value - raw_value)
+                                                          : static_cast<std::int16_t>(raw_value - pixel.value)};
+    if (difference > CHANGE_THRESHOLD)
+        pixel.value = raw_value;
+}
+
+// A hash of the differences of a frame, so the kernels can be compared without keeping the differences of every frame.
+std::uint64_t hash_diffs(const std::vector<std::int16_t>& diffs)
+{
+    std::uint64_t hash{14695981039346656037ull};
+    for (auto diff : diffs)
+        hash = (hash ^ static_cast<std::uint16_t>(diff)) * 1099511628211ull;
+    return hash;
+}
+
+void print_update_times(const std::string& name, std::vector<float> update_times, float baseline_mean)
+{
+    std::sort(update_times.begin(), update_times.end());
+    float update_time_sum{0.0f};
+    for (float update_time : update_times)
+        update_time_sum += update_time;
+    const float mean{update_time_sum / update_times.size()};
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "  " << name
+              << ": mean: " << mean << " ms"
+              << ", median: " << update_times[update_times.size() / 2] << " ms"
+              << ", p95: " << update_times[update_times.size() * 95 / 100] << " ms"
+              << ", speedup: " << baseline_mean / mean << "x\n";
+}
+
+// Measures how long updating the pixels of TrvlEncoder and writing their differences takes for a frame
+// with the layout and branches before the split into arrays and with each kernel of update_trvl_pixels(),
+// and checks that every kernel writes the differences of the baseline.
+bool main(int frame_count)
+{
+    std::vector<std::vector<std::int16_t>> depth_frames;
+    for (int i{0}; i < frame_count; ++i) {
+        std::vector<std::int16_t> depth_frame(PIXEL_COUNT);
+        write_synthetic_depth_frame(depth_frame, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, i);
+        depth_frames.push_back(std::move(depth_frame));
+    }
+
+    std::cout << "Updating " << frame_count << " frames of " << SYNTHETIC_DEPTH_WIDTH << "x" << SYNTHETIC_DEPTH_HEIGHT << ".\n";
+
+    std::vector<std::int16_t> diffs(PIXEL_COUNT);
+    std::vector<std::uint64_t> baseline_hashes;
+    std::vector<float> baseline_times;
+    {
+        std::vector<AosTrvlPixel> pixels(PIXEL_COUNT, AosTrvlPixel{0, 0});
+        for (auto& depth_frame : depth_frames) {
+            const TimePoint update_start{TimePoint::now()};
+            for (gsl::index i{0}; i < PIXEL_COUNT; ++i) {
+                const std::int16_t prev_value{pixels[i].value};
+                update_aos_pixel(pixels[i], depth_frame[i]);
+                diffs[i] = pixels[i].value - prev_value;
+            }
+            baseline_times.push_back(update_start.elapsed_time().ms());
+            baseline_hashes.push_back(hash_diffs(diffs));
+        }
+    }
+
+    float baseline_time_sum{0.0f};
+    for (float baseline_time : baseline_times)
+        baseline_time_sum += baseline_time;
+    const float baseline_mean{baseline_time_sum / baseline_times.size()};
+    print_update_times("array of structs", baseline_times, baseline_mean);
+
+    const auto change_thresholds{create_constant_trvl_change_thresholds(CHANGE_THRESHOLD)};
+    std::vector<std::pair<rvl::Kernel, const char*>> kernels{{rvl::Kernel::Scalar, "scalar"}};
+    if (get_cpu_features().sse41)
+        kernels.push_back({rvl::Kernel::Sse41, "SSE4.1"});
+    if (get_cpu_features().avx2)
+        kernels.push_back({rvl::Kernel::Avx2, "AVX2"});
+
+    bool matched{true};
+    for (auto& [kernel, kernel_name] : kernels) {
+        std::vector<std::int16_t> values(PIXEL_COUNT, 0);
+        std::vector<std::uint8_t> invalid_counts(PIXEL_COUNT, 0);
+        std::vector<float> update_times;
+        for (gsl::index frame_index{0}; frame_index < frame_count; ++frame_index) {
+            const TimePoint update_start{TimePoint::now()};
+            update_trvl_pixels(values.data(), invalid_counts.data(), depth_frames[frame_index].data(), diffs.data(),
+                               PIXEL_COUNT, change_thresholds, INVALID_THRESHOLD, kernel);
+            update_times.push_back(update_start.elapsed_time().ms());
+            if (hash_diffs(diffs) != baseline_hashes[frame_index]) {
+                std::cout << "  " << kernel_name << " differs from the baseline in frame " << frame_index << "\n";
+                matched = false;
+            }
+        }
+        print_update_times(kernel_name, update_times, baseline_mean);
+    }
+
+    return matched;
+}
+}
+
+// The first argument is the number of frames to update. Returns 1 when a kernel does not match the baseline.
+int main(int argc, char* argv[])
+{
+    std::ios_base::sync_with_stdio(false);
+    return kh::main(argc > 1 ? std::stoi(argv[1]) : 300) ? 0 : 1;
+}
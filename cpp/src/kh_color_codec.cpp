@@ -0,0 +1,147 @@
+#include "kh_color_codec.h"
+
+#include "kh_vp8.h"
+
+namespace kh
+{
+namespace
+{
+// Vp8Encoder and Vp8Decoder run both VP8 and VP9 since libvpx and FFmpeg take them the same way.
+template<ColorCodecId codec_id>
+class VpxColorEncoder : public ColorEncoder
+{
+public:
+    VpxColorEncoder(const ColorCodecConfig& config)
+        : encoder_{config.width, config.height, codec_id, config.target_bitrate, config.token_partition_count,
+                   config.temporal_layer_count, config.long_term_reference_recovery}
+    {
+    }
+    std::vector<std::byte> encode(const YuvImage& yuv_image, bool keyframe) override
+    {
+        return encoder_.encode(yuv_image, keyframe);
+    }
+    YuvPlanes acquire_input_planes() noexcept override
+    {
+        return encoder_.acquire_input_planes();
+    }
+    std::vector<std::byte> encode(bool keyframe) override
+    {
+        return encoder_.encode(keyframe);
+    }
+    void set_target_bitrate(int target_bitrate) override
+    {
+        encoder_.set_target_bitrate(target_bitrate);
+    }
+    ColorFrameLayer get_last_frame_layer() const noexcept override
+    {
+        return encoder_.get_last_frame_layer();
+    }
+    ColorFrameLayer get_next_frame_layer(bool keyframe, bool from_long_term_reference) const noexcept override
+    {
+        return encoder_.get_next_frame_layer(keyframe, from_long_term_reference);
+    }
+    void request_long_term_reference() override
+    {
+        encoder_.request_long_term_reference();
+    }
+    std::vector<std::byte> encode_long_term_reference() override
+    {
+        return encoder_.encode_long_term_reference();
+    }
+
+private:
+    Vp8Encoder encoder_;
+};
+
+template<ColorCodecId codec_id>
+class VpxColorDecoder : public ColorDecoder
+{
+public:
+    VpxColorDecoder(int thread_count)
+        : decoder_{codec_id, thread_count}
+    {
+    }
+    FFmpegFrame decode(gsl::span<const std::byte> frame) override
+    {
+        return decoder_.decode(frame);
+    }
+    FFmpegFrame decode_padded(gsl::span<const std::byte> frame) override
+    {
+        return decoder_.decode_padded(frame);
+    }
+
+private:
+    Vp8Decoder decoder_;
+};
+
+template<ColorCodecId codec_id>
+std::unique_ptr<ColorEncoder> create_vpx_encoder(const ColorCodecConfig& config)
+{
+    return std::make_unique<VpxColorEncoder<codec_id>>(config);
+}
+
+template<ColorCodecId codec_id>
+std::unique_ptr<ColorDecoder> create_vpx_decoder(int thread_count)
+{
+    return std::make_unique<VpxColorDecoder<codec_id>>(thread_count);
+}
+
+// Adding a codec to this table is enough for the senders and receivers to negotiate it.
+struct ColorCodecEntry
+{
+    ColorCodecId id;
+    const char* name;
+    std::unique_ptr<ColorEncoder> (*create_encoder)(const ColorCodecConfig&);
+    std::unique_ptr<ColorDecoder> (*create_decoder)(int thread_count);
+};
+
+constexpr ColorCodecEntry COLOR_CODEC_ENTRIES[]{
+    {ColorCodecId::Vp8, "VP8", create_vpx_encoder<ColorCodecId::Vp8>, create_vpx_decoder<ColorCodecId::Vp8>},
+    {ColorCodecId::Vp9, "VP9", create_vpx_encoder<ColorCodecId::Vp9>, create_vpx_decoder<ColorCodecId::Vp9>},
+};
+
+const ColorCodecEntry* find_color_codec_entry(ColorCodecId codec_id) noexcept
+{
+    for (auto& entry : COLOR_CODEC_ENTRIES) {
+        if (entry.id == codec_id)
+            return &entry;
+    }
+    return nullptr;
+}
+}
+
+std::vector<ColorCodecId> get_color_codec_ids()
+{
+    std::vector<ColorCodecId> codec_ids;
+    for (auto& entry : COLOR_CODEC_ENTRIES)
+        codec_ids.push_back(entry.id);
+    return codec_ids;
+}
+
+bool is_color_codec_supported(ColorCodecId codec_id) noexcept
+{
+    return find_color_codec_entry(codec_id) != nullptr;
+}
+
+const char* get_color_codec_name(ColorCodecId codec_id) noexcept
+{
+    const auto entry{find_color_codec_entry(codec_id)};
+    return entry ? entry->name : "Unknown";
+}
+
+std::unique_ptr<ColorEncoder> create_color_encoder(ColorCodecId codec_id, const ColorCodecConfig& config)
+{
+    const auto entry{find_color_codec_entry(codec_id)};
+    if (!entry)
+        throw std::exception("Unsupported color codec.");
+    return entry->create_encoder(config);
+}
+
+std::unique_ptr<ColorDecoder> create_color_decoder(ColorCodecId codec_id, int thread_count)
+{
+    const auto entry{find_color_codec_entry(codec_id)};
+    if (!entry)
+        throw std::exception("Unsupported color codec.");
+    return entry->create_decoder(thread_count);
+}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_yuv.h"
+
+namespace kh
+{
+// Identifies the codec of color encoder frames in video messages and in the codec lists of connect packets.
+// The values get sent through the network, so existing ones should not change.
+enum class ColorCodecId : std::uint8_t
+{
+    Vp8 = 0,
+    // VP9 in the realtime mode of libvpx, which takes fewer bits than VP8 for the same quality
+    // at the cost of more encoder time.
+    Vp9 = 1,
+};
+
+// Parameters for creating color codecs.
+struct ColorCodecConfig
+{
+    int width;
+    int height;
+    // In kilobits per second. Encoders start with this and can get another one with set_target_bitrate().
+    int target_bitrate;
+    // VP8 splits the coefficients of a frame into this many partitions (1, 2, 4, or 8) by rows of macroblocks,
+    // so decoders can decode the rows in parallel. VP9 gets its parallelism from tile columns instead.
+    int token_partition_count;
+    // 1 to 3 temporal layers of VP8 (VP9 always has 1). Every other frame goes to a higher layer, so receivers
+    // that only take the base layer get a half (or a quarter with 3 layers) of the frames.
+    int temporal_layer_count;
+    // Whether receivers that lost frames recover from the long-term reference (see encode_long_term_reference()).
+    // This and temporal layers make VP8 error resilient, so the entropy probabilities of a frame do not carry over
+    // to the next frames, which costs bitrate for every frame.
+    bool long_term_reference_recovery;
+};
+
+// Where a frame is in the temporal layers, which tells receivers whether they can decode it.
+struct ColorFrameLayer
+{
+    // 0 for the base layer, which every receiver gets. Frames of a layer only depend on frames of lower layers
+    // or the same layer.
+    int temporal_layer_id;
+    // The frame this one depends on is this many frames before it. Receivers can decode this frame
+    // when they have decoded that one. Keyframes can be decoded anyway, but the state of depth decoders
+    // only carries over them when that frame, the last one of the base layer, got decoded.
+    // For frames that reference the long-term reference, this is how far before them it is.
+    int reference_frame_distance;
+    // The frame became the long-term reference, which keyframes also do.
+    bool long_term_reference;
+    // The frame only references the long-term reference, so receivers that lost frames after the long-term
+    // reference can decode it without a keyframe.
+    bool references_long_term_reference;
+};
+
+class ColorEncoder
+{
+public:
+    virtual ~ColorEncoder() {}
+    virtual std::vector<std::byte> encode(const YuvImage& yuv_image, bool keyframe) = 0;
+    // Planes of an image owned by the encoder. Color pixels written into them get encoded
+    // by the next encode(keyframe) call.
+    virtual YuvPlanes acquire_input_planes() noexcept = 0;
+    virtual std::vector<std::byte> encode(bool keyframe) = 0;
+    // Applies from the next frame without a keyframe.
+    virtual void set_target_bitrate(int target_bitrate) = 0;
+    // The layer of the frame the last encode() returned. Keyframes start the pattern of the layers over.
+    virtual ColorFrameLayer get_last_frame_layer() const noexcept = 0;
+    // The layer the next encode() call, or encode_long_term_reference() with from_long_term_reference,
+    // gives its frame, so the depth of the frame can get encoded while the color of it does.
+    virtual ColorFrameLayer get_next_frame_layer(bool keyframe, bool from_long_term_reference) const noexcept = 0;
+    // The next frame of the base layer becomes the long-term reference.
+    virtual void request_long_term_reference() = 0;
+    // Encodes the pixels of acquire_input_planes() into a frame of the base layer that only references
+    // the long-term reference.
+    virtual std::vector<std::byte> encode_long_term_reference() = 0;
+};
+
+// Zeroed bytes that have to follow a frame passed to ColorDecoder::decode_padded().
+// FFmpeg decoders read past the end of their input (AV_INPUT_BUFFER_PADDING_SIZE) for speed.
+constexpr int COLOR_DECODER_PADDING_SIZE{64};
+
+class ColorDecoder
+{
+public:
+    virtual ~ColorDecoder() {}
+    // Copies frame into a buffer with the padding.
+    virtual FFmpegFrame decode(gsl::span<const std::byte> frame) = 0;
+    // Decodes frame in place, which requires COLOR_DECODER_PADDING_SIZE zeroed bytes after it
+    // (e.g., a reassembly buffer with space reserved at its tail).
+    virtual FFmpegFrame decode_padded(gsl::span<const std::byte> frame) = 0;
+};
+
+// The codecs of this build, which receivers report to senders.
+std::vector<ColorCodecId> get_color_codec_ids();
+bool is_color_codec_supported(ColorCodecId codec_id) noexcept;
+const char* get_color_codec_name(ColorCodecId codec_id) noexcept;
+// Throw for codecs that are not supported.
+std::unique_ptr<ColorEncoder> create_color_encoder(ColorCodecId codec_id, const ColorCodecConfig& config);
+// Decoders use up to thread_count threads for a frame, as many as the token partitions or tile columns of the frame.
+std::unique_ptr<ColorDecoder> create_color_decoder(ColorCodecId codec_id, int thread_count = 1);
+}
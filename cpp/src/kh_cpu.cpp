@@ -0,0 +1,73 @@
+#include "kh_cpu.h"
+
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace kh
+{
+namespace
+{
+void cpuid(int info[4], int function_id, int subfunction_id) noexcept
+{
+#ifdef _MSC_VER
+    __cpuidex(info, function_id, subfunction_id);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(function_id, subfunction_id, a, b, c, d);
+    info[0] = a;
+    info[1] = b;
+    info[2] = c;
+    info[3] = d;
+#endif
+}
+
+std::uint64_t xgetbv(unsigned int index) noexcept
+{
+#ifdef _MSC_VER
+    return _xgetbv(index);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (static_cast<std::uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+CpuFeatures detect_cpu_features() noexcept
+{
+    CpuFeatures features;
+
+    int info[4];
+    cpuid(info, 0, 0);
+    const int max_function_id{info[0]};
+    if (max_function_id < 1)
+        return features;
+
+    cpuid(info, 1, 0);
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+
+    // AVX2 also requires the OS to save the YMM registers during context switches.
+    const bool osxsave{(info[2] & (1 << 27)) != 0};
+    const bool avx{(info[2] & (1 << 28)) != 0};
+    if (!osxsave || !avx || max_function_id < 7)
+        return features;
+
+    if ((xgetbv(0) & 0x6) != 0x6)
+        return features;
+
+    cpuid(info, 7, 0);
+    features.avx2 = (info[1] & (1 << 5)) != 0;
+
+    return features;
+}
+}
+
+const CpuFeatures& get_cpu_features() noexcept
+{
+    static const CpuFeatures cpu_features{detect_cpu_features()};
+    return cpu_features;
+}
+}
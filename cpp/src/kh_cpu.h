@@ -0,0 +1,16 @@
+#pragma once
+
+namespace kh
+{
+// Instruction sets that SIMD kernels get dispatched to at runtime.
+// Kernels cannot be picked at compile time since the same binary runs on both
+// senders supporting AVX2 and HoloLens (v1) supporting up to SSE4.2.
+struct CpuFeatures
+{
+    bool sse41{false};
+    bool avx2{false};
+};
+
+// Detected once with cpuid and cached.
+const CpuFeatures& get_cpu_features() noexcept;
+}
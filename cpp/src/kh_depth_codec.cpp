@@ -0,0 +1,241 @@
+#include "kh_depth_codec.h"
+
+#include "kh_tmrans.h"
+#include "kh_trvl.h"
+
+namespace kh
+{
+namespace
+{
+template<TrvlFormat format>
+class TrvlDepthEncoder : public DepthEncoder
+{
+public:
+    TrvlDepthEncoder(const DepthCodecConfig& config)
+        : encoder_{config.width, config.height, config.change_thresholds, config.invalid_threshold, config.band_count,
+                   config.intra_refresh, format}
+    {
+    }
+    std::size_t encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode(depth_buffer, keyframe, output);
+    }
+    std::size_t encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode_non_reference(depth_buffer, output);
+    }
+    void save_long_term_reference() override
+    {
+        encoder_.save_long_term_reference();
+    }
+    std::size_t encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode_long_term_reference(depth_buffer, output);
+    }
+    std::size_t get_max_frame_size() const noexcept override
+    {
+        return encoder_.get_max_frame_size();
+    }
+
+private:
+    TrvlEncoder encoder_;
+};
+
+template<TrvlFormat format>
+class TrvlDepthDecoder : public DepthDecoder
+{
+public:
+    TrvlDepthDecoder(const DepthCodecConfig& config)
+        : decoder_{config.width, config.height, config.band_count, format}
+    {
+    }
+    bool decode_into(gsl::span<const std::byte> frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch,
+                     gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        return decoder_.decode_into(frame, keyframe, dst, row_pitch, dequantization_table);
+    }
+    bool decode_non_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                   gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        return decoder_.decode_non_reference_into(frame, dst, row_pitch, dequantization_table);
+    }
+    void save_long_term_reference() override
+    {
+        decoder_.save_long_term_reference();
+    }
+    bool decode_long_term_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                         gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        return decoder_.decode_long_term_reference_into(frame, dst, row_pitch, dequantization_table);
+    }
+    bool is_synchronized() const noexcept override
+    {
+        return decoder_.is_synchronized();
+    }
+
+private:
+    TrvlDecoder decoder_;
+};
+
+class TmransDepthEncoder : public DepthEncoder
+{
+public:
+    TmransDepthEncoder(const DepthCodecConfig& config)
+        : encoder_{config.width, config.height, config.change_thresholds, config.invalid_threshold}
+    {
+    }
+    std::size_t encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode(depth_buffer, keyframe, output);
+    }
+    std::size_t encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode_non_reference(depth_buffer, output);
+    }
+    void save_long_term_reference() override
+    {
+        encoder_.save_long_term_reference();
+    }
+    std::size_t encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) override
+    {
+        return encoder_.encode_long_term_reference(depth_buffer, output);
+    }
+    std::size_t get_max_frame_size() const noexcept override
+    {
+        return encoder_.get_max_frame_size();
+    }
+
+private:
+    TmransEncoder encoder_;
+};
+
+class TmransDepthDecoder : public DepthDecoder
+{
+public:
+    TmransDepthDecoder(const DepthCodecConfig& config)
+        : decoder_{config.width, config.height}, synchronized_{false}
+    {
+    }
+    bool decode_into(gsl::span<const std::byte> frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch,
+                     gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        if (!decoder_.decode_into(frame, keyframe, dst, row_pitch, dequantization_table))
+            return false;
+        synchronized_ = synchronized_ || keyframe;
+        return true;
+    }
+    bool decode_non_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                   gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        return decoder_.decode_non_reference_into(frame, dst, row_pitch, dequantization_table);
+    }
+    void save_long_term_reference() override
+    {
+        decoder_.save_long_term_reference();
+    }
+    bool decode_long_term_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                         gsl::span<const std::int16_t> dequantization_table) noexcept override
+    {
+        return decoder_.decode_long_term_reference_into(frame, dst, row_pitch, dequantization_table);
+    }
+    bool is_synchronized() const noexcept override
+    {
+        return synchronized_;
+    }
+
+private:
+    TmransDecoder decoder_;
+    bool synchronized_;
+};
+
+template<class T, class Base>
+std::unique_ptr<Base> create_codec(const DepthCodecConfig& config)
+{
+    return std::make_unique<T>(config);
+}
+
+// Adding a codec to this table is enough for the senders and receivers to negotiate it.
+struct DepthCodecEntry
+{
+    DepthCodecId id;
+    const char* name;
+    // Senders only pick these codecs when asked to explicitly.
+    bool opt_in;
+    // Whether its encoders can refresh bands instead of encoding keyframes (see DepthCodecConfig::intra_refresh).
+    bool intra_refresh;
+    std::unique_ptr<DepthEncoder> (*create_encoder)(const DepthCodecConfig&);
+    std::unique_ptr<DepthDecoder> (*create_decoder)(const DepthCodecConfig&);
+};
+
+constexpr DepthCodecEntry DEPTH_CODEC_ENTRIES[]{
+    {DepthCodecId::Trvl, "TRVL", false, true, create_codec<TrvlDepthEncoder<TrvlFormat::Rvl>, DepthEncoder>,
+     create_codec<TrvlDepthDecoder<TrvlFormat::Rvl>, DepthDecoder>},
+    // Decodes at about 165 fps per core, short of the 500 fps TMRANS is meant for, so it is opt-in.
+    // It stays for senders of which keyframes take most of the bandwidth (e.g., with receivers joining often),
+    // since MED halves keyframes of smooth depth compared to RVL, while its differences are about 25% larger.
+    // Frames of mrans cannot be split into bands, so it has no intra refresh.
+    {DepthCodecId::Tmrans, "TMRANS", true, false, create_codec<TmransDepthEncoder, DepthEncoder>,
+     create_codec<TmransDepthDecoder, DepthDecoder>},
+    {DepthCodecId::Trvl2, "TRVL2", false, true, create_codec<TrvlDepthEncoder<TrvlFormat::Rvl2>, DepthEncoder>,
+     create_codec<TrvlDepthDecoder<TrvlFormat::Rvl2>, DepthDecoder>},
+};
+
+const DepthCodecEntry* find_depth_codec_entry(DepthCodecId codec_id) noexcept
+{
+    for (auto& entry : DEPTH_CODEC_ENTRIES) {
+        if (entry.id == codec_id)
+            return &entry;
+    }
+    return nullptr;
+}
+}
+
+std::vector<DepthCodecId> get_depth_codec_ids()
+{
+    std::vector<DepthCodecId> codec_ids;
+    for (auto& entry : DEPTH_CODEC_ENTRIES)
+        codec_ids.push_back(entry.id);
+    return codec_ids;
+}
+
+bool is_depth_codec_supported(DepthCodecId codec_id) noexcept
+{
+    return find_depth_codec_entry(codec_id) != nullptr;
+}
+
+const char* get_depth_codec_name(DepthCodecId codec_id) noexcept
+{
+    const auto entry{find_depth_codec_entry(codec_id)};
+    return entry ? entry->name : "Unknown";
+}
+
+bool is_depth_codec_opt_in(DepthCodecId codec_id) noexcept
+{
+    const auto entry{find_depth_codec_entry(codec_id)};
+    return entry && entry->opt_in;
+}
+
+bool is_depth_intra_refresh_supported(DepthCodecId codec_id) noexcept
+{
+    const auto entry{find_depth_codec_entry(codec_id)};
+    return entry && entry->intra_refresh;
+}
+
+std::unique_ptr<DepthEncoder> create_depth_encoder(DepthCodecId codec_id, const DepthCodecConfig& config)
+{
+    const auto entry{find_depth_codec_entry(codec_id)};
+    if (!entry)
+        throw std::exception("Unsupported depth codec.");
+    if (config.intra_refresh && !entry->intra_refresh)
+        throw std::exception("Depth codec without intra refresh.");
+    return entry->create_encoder(config);
+}
+
+std::unique_ptr<DepthDecoder> create_depth_decoder(DepthCodecId codec_id, const DepthCodecConfig& config)
+{
+    const auto entry{find_depth_codec_entry(codec_id)};
+    if (!entry)
+        throw std::exception("Unsupported depth codec.");
+    return entry->create_decoder(config);
+}
+}
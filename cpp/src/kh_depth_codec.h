@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <gsl/gsl>
+#include "kh_trvl.h"
+
+namespace kh
+{
+// Identifies the codec of depth encoder frames in video messages and in the codec lists of connect packets.
+// The values get sent through the network, so existing ones should not change.
+enum class DepthCodecId : std::uint8_t
+{
+    Trvl = 0,
+    Tmrans = 1,
+    // TRVL with bands in RVL2 instead of RVL.
+    Trvl2 = 2,
+};
+
+// Parameters for creating depth codecs. Each codec uses the ones it needs.
+struct DepthCodecConfig
+{
+    int width;
+    int height;
+    TrvlChangeThresholds change_thresholds;
+    int invalid_threshold;
+    // Only for codecs that split frames into bands (i.e., TRVL and TRVL2).
+    int band_count;
+    // Refreshing a band per frame instead of encoding keyframes. Only for encoders of TRVL and TRVL2,
+    // since its decoders follow the refreshes in the frames. Encoders of other codecs do not get created with it
+    // (see is_depth_intra_refresh_supported()).
+    bool intra_refresh;
+};
+
+class DepthEncoder
+{
+public:
+    virtual ~DepthEncoder() {}
+    // Writes the frame into output, which should have at least get_max_frame_size() bytes,
+    // and returns its size.
+    virtual std::size_t encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output) = 0;
+    // Encodes a frame that later frames do not depend on, which receivers can skip
+    // (e.g., frames of the enhancement layers of color). Decoders take it with decode_non_reference_into().
+    virtual std::size_t encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) = 0;
+    // Keeps the state after the last encoded frame as the long-term reference (e.g., with the one of color).
+    virtual void save_long_term_reference() = 0;
+    // Encodes a frame against the long-term reference instead of the last frame and continues from it,
+    // so receivers that lost frames after the long-term reference can continue without a keyframe.
+    // Decoders take it with decode_long_term_reference_into().
+    virtual std::size_t encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output) = 0;
+    virtual std::size_t get_max_frame_size() const noexcept = 0;
+};
+
+class DepthDecoder
+{
+public:
+    virtual ~DepthDecoder() {}
+    // Writes the decoded pixels into rows of dst that are row_pitch bytes apart.
+    // dst can be nullptr for frames that only need to update the state of the decoder.
+    // For frames of DepthQuantizer codes, dequantization_table maps them to depth pixels while they get written,
+    // otherwise it should be empty. Returns false when the frame is broken.
+    virtual bool decode_into(gsl::span<const std::byte> frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch,
+                             gsl::span<const std::int16_t> dequantization_table) noexcept = 0;
+    // Decodes a frame of DepthEncoder::encode_non_reference() without changing the state of the decoder.
+    virtual bool decode_non_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                           gsl::span<const std::int16_t> dequantization_table) noexcept = 0;
+    // Keeps the state after the last decoded frame, which is the frame the encoder saved its long-term reference with.
+    virtual void save_long_term_reference() = 0;
+    // Decodes a frame of DepthEncoder::encode_long_term_reference(). Returns false when there is no long-term reference.
+    virtual bool decode_long_term_reference_into(gsl::span<const std::byte> frame, std::int16_t* dst, std::size_t row_pitch,
+                                                 gsl::span<const std::int16_t> dequantization_table) noexcept = 0;
+    // Whether the decoded depth has caught up with the encoder, which can take frames after a keyframe with intra refresh.
+    virtual bool is_synchronized() const noexcept = 0;
+};
+
+// The codecs of this build, which receivers report to senders.
+std::vector<DepthCodecId> get_depth_codec_ids();
+bool is_depth_codec_supported(DepthCodecId codec_id) noexcept;
+const char* get_depth_codec_name(DepthCodecId codec_id) noexcept;
+// Codecs that miss their performance targets, which senders should not pick unless asked to explicitly.
+bool is_depth_codec_opt_in(DepthCodecId codec_id) noexcept;
+// Codecs of which encoders can be created with DepthCodecConfig::intra_refresh.
+bool is_depth_intra_refresh_supported(DepthCodecId codec_id) noexcept;
+// Throw for codecs that are not supported, and create_depth_encoder() also for intra refresh
+// with codecs that do not support it.
+std::unique_ptr<DepthEncoder> create_depth_encoder(DepthCodecId codec_id, const DepthCodecConfig& config);
+std::unique_ptr<DepthDecoder> create_depth_decoder(DepthCodecId codec_id, const DepthCodecConfig& config);
+}
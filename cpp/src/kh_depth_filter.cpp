@@ -0,0 +1,112 @@
+#include "kh_depth_filter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <immintrin.h>
+#include "kh_cpu.h"
+
+namespace kh
+{
+namespace
+{
+// The moving averages follow new depth by 1 / 2^AVERAGE_SHIFT of the difference.
+constexpr int AVERAGE_SHIFT{2};
+
+void filter_pixels(std::int16_t* averages, std::int16_t* depth_pixels, gsl::index count, const TrvlChangeThresholds& gates) noexcept
+{
+    for (gsl::index i{0}; i < count; ++i) {
+        const int depth{depth_pixels[i]};
+        const int average{averages[i]};
+        const int difference{depth - average};
+        const int bucket{std::min(average / TRVL_CHANGE_THRESHOLD_BUCKET_SIZE, static_cast<int>(gates.size()) - 1)};
+
+        int filtered;
+        if (depth == 0) {
+            filtered = 0;
+        } else if (average == 0 || std::abs(difference) > gates[bucket]) {
+            filtered = depth;
+        } else {
+            // Rounded to the nearest, with an arithmetic shift as the SIMD versions do.
+            filtered = average + ((difference + (1 << (AVERAGE_SHIFT - 1))) >> AVERAGE_SHIFT);
+        }
+
+        averages[i] = static_cast<std::int16_t>(filtered);
+        depth_pixels[i] = static_cast<std::int16_t>(filtered);
+    }
+}
+
+// Gates get looked up with a byte shuffle as in the SIMD updates of TRVL.
+// Pixels are from 0 to INT16_MAX, so differences do not overflow 16 bits.
+void filter_pixels_sse41(std::int16_t* averages, std::int16_t* depth_pixels, gsl::index count, const TrvlChangeThresholds& gates) noexcept
+{
+    const __m128i zero{_mm_setzero_si128()};
+    const __m128i gate_table{_mm_loadu_si128(reinterpret_cast<const __m128i*>(gates.data()))};
+    const __m128i last_bucket{_mm_set1_epi16(15)};
+    const __m128i high_byte_zeroing{_mm_set1_epi16(static_cast<short>(0x8000))};
+    const __m128i rounding{_mm_set1_epi16(1 << (AVERAGE_SHIFT - 1))};
+    gsl::index i{0};
+    for (; i + 8 <= count; i += 8) {
+        const __m128i depth{_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth_pixels + i))};
+        const __m128i average{_mm_loadu_si128(reinterpret_cast<const __m128i*>(averages + i))};
+        const __m128i difference{_mm_sub_epi16(depth, average)};
+        const __m128i buckets{_mm_min_epu16(_mm_srli_epi16(average, 8), last_bucket)};
+        const __m128i gate{_mm_shuffle_epi8(gate_table, _mm_or_si128(buckets, high_byte_zeroing))};
+
+        const __m128i take_depth{_mm_or_si128(_mm_cmpeq_epi16(average, zero), _mm_cmpgt_epi16(_mm_abs_epi16(difference), gate))};
+        const __m128i moved_average{_mm_add_epi16(average, _mm_srai_epi16(_mm_add_epi16(difference, rounding), AVERAGE_SHIFT))};
+        const __m128i filtered{_mm_andnot_si128(_mm_cmpeq_epi16(depth, zero), _mm_blendv_epi8(moved_average, depth, take_depth))};
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(averages + i), filtered);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(depth_pixels + i), filtered);
+    }
+    filter_pixels(averages + i, depth_pixels + i, count - i, gates);
+}
+
+void filter_pixels_avx2(std::int16_t* averages, std::int16_t* depth_pixels, gsl::index count, const TrvlChangeThresholds& gates) noexcept
+{
+    const __m256i zero{_mm256_setzero_si256()};
+    const __m256i gate_table{_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gates.data())))};
+    const __m256i last_bucket{_mm256_set1_epi16(15)};
+    const __m256i high_byte_zeroing{_mm256_set1_epi16(static_cast<short>(0x8000))};
+    const __m256i rounding{_mm256_set1_epi16(1 << (AVERAGE_SHIFT - 1))};
+    gsl::index i{0};
+    for (; i + 16 <= count; i += 16) {
+        const __m256i depth{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth_pixels + i))};
+        const __m256i average{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(averages + i))};
+        const __m256i difference{_mm256_sub_epi16(depth, average)};
+        const __m256i buckets{_mm256_min_epu16(_mm256_srli_epi16(average, 8), last_bucket)};
+        const __m256i gate{_mm256_shuffle_epi8(gate_table, _mm256_or_si256(buckets, high_byte_zeroing))};
+
+        const __m256i take_depth{_mm256_or_si256(_mm256_cmpeq_epi16(average, zero),
+                                                 _mm256_cmpgt_epi16(_mm256_abs_epi16(difference), gate))};
+        const __m256i moved_average{_mm256_add_epi16(average, _mm256_srai_epi16(_mm256_add_epi16(difference, rounding), AVERAGE_SHIFT))};
+        const __m256i filtered{_mm256_andnot_si256(_mm256_cmpeq_epi16(depth, zero), _mm256_blendv_epi8(moved_average, depth, take_depth))};
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(averages + i), filtered);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(depth_pixels + i), filtered);
+    }
+    _mm256_zeroupper();
+    filter_pixels(averages + i, depth_pixels + i, count - i, gates);
+}
+}
+
+DepthTemporalFilter::DepthTemporalFilter(int width, int height, const TrvlChangeThresholds& gates)
+    : gates_{gates}, averages_(width * height, 0)
+{
+}
+
+void DepthTemporalFilter::filter(gsl::span<std::int16_t> depth_buffer)
+{
+    if (depth_buffer.size() != averages_.size())
+        throw std::exception("Invalid depth_buffer size for DepthTemporalFilter.");
+
+    const auto& cpu_features{get_cpu_features()};
+    if (cpu_features.avx2) {
+        filter_pixels_avx2(averages_.data(), depth_buffer.data(), depth_buffer.size(), gates_);
+    } else if (cpu_features.sse41) {
+        filter_pixels_sse41(averages_.data(), depth_buffer.data(), depth_buffer.size(), gates_);
+    } else {
+        filter_pixels(averages_.data(), depth_buffer.data(), depth_buffer.size(), gates_);
+    }
+}
+}
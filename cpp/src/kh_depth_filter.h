@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <gsl/gsl>
+#include "kh_trvl.h"
+
+namespace kh
+{
+// A temporal filter in front of depth encoders that keeps flickering depth from turning into differences for TRVL.
+// Each pixel keeps an exponential moving average of its depth, which follows a new depth by a quarter of the difference,
+// unless the difference goes over the gate of the pixel, in which case the pixel takes the new depth as it is
+// (i.e., a hysteresis for things that actually moved). Gates are by the depth buckets of TrvlChangeThresholds.
+// Invalid pixels (zeros) stay zeros and restart the average, since TRVL already holds pixels that become invalid.
+// The filter does not delay frames and runs in place.
+class DepthTemporalFilter
+{
+public:
+    DepthTemporalFilter(int width, int height, const TrvlChangeThresholds& gates);
+    // Filters depth_buffer, of which pixels are from 0 to INT16_MAX, in place.
+    void filter(gsl::span<std::int16_t> depth_buffer);
+
+private:
+    TrvlChangeThresholds gates_;
+    std::vector<std::int16_t> averages_;
+};
+}
@@ -0,0 +1,41 @@
+#include "kh_depth_quantizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace kh
+{
+DepthQuantizer::DepthQuantizer(float error_bound)
+    : error_bound_{error_bound}, codes_(UINT16_MAX + 1, 0), depths_(UINT16_MAX + 1, 0)
+{
+    if (!(error_bound > 0.0f))
+        throw std::exception("Invalid DepthQuantizer error_bound.");
+
+    int code{0};
+    int depth{1};
+    while (depth <= UINT16_MAX) {
+        // The error bound is the smallest at the beginning of the step since it grows with depth,
+        // so the whole step is within the bound when its half width is the bound at its beginning.
+        const float meters{depth / 1000.0f};
+        const int max_error{static_cast<int>(error_bound * meters * meters)};
+        const int step_end{std::min(depth + max_error * 2 + 1, UINT16_MAX + 1)};
+
+        // Codes have to stay positive int16_t values to work with TRVL.
+        if (++code > INT16_MAX)
+            throw std::exception("DepthQuantizer error_bound is too small.");
+
+        std::fill(codes_.begin() + depth, codes_.begin() + step_end, static_cast<std::int16_t>(code));
+        depths_[code] = static_cast<std::int16_t>(std::min(depth + max_error, UINT16_MAX));
+        depth = step_end;
+    }
+
+    // Codes that never get sent map to the farthest step.
+    std::fill(depths_.begin() + code + 1, depths_.end(), depths_[code]);
+}
+
+void DepthQuantizer::quantize(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::int16_t> codes) const noexcept
+{
+    for (gsl::index i{0}; i < depth_buffer.size(); ++i)
+        codes[i] = codes_[static_cast<std::uint16_t>(depth_buffer[i])];
+}
+}
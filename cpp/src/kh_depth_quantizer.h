@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <gsl/gsl>
+
+namespace kh
+{
+// An optional lossy stage in front of depth encoders.
+// Depth pixels get mapped to the steps of a non-uniform quantization that grow with the square of depth,
+// as the noise of the Azure Kinect does, so far pixels stop spending bits on noise.
+// The indices of the steps (codes) get encoded instead of millimeters and receivers map them back to millimeters.
+// A pixel comes back with an error of at most error_bound * depth^2 millimeters, with depth in meters
+// (i.e., error_bound is the error at 1 m). Invalid pixels (zeros) stay zeros.
+class DepthQuantizer
+{
+public:
+    DepthQuantizer(float error_bound);
+    float error_bound() const noexcept { return error_bound_; }
+    // depth_buffer and codes can be the same.
+    void quantize(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::int16_t> codes) const noexcept;
+    // Maps any 16-bit value, including the ones in broken frames, to millimeters, for decoders to look up pixels
+    // while writing them (see DepthDecoder::decode_into()).
+    gsl::span<const std::int16_t> get_dequantization_table() const noexcept { return depths_; }
+
+private:
+    float error_bound_;
+    // Indexed by depth pixels as uint16_t.
+    std::vector<std::int16_t> codes_;
+    // Indexed by codes as uint16_t.
+    std::vector<std::int16_t> depths_;
+};
+}
@@ -0,0 +1,314 @@
+#include "kh_mrans.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace kh
+{
+namespace mrans
+{
+namespace
+{
+// Frequencies of symbols are scaled to sum up to 2^12 to find the symbols of rANS states with a 4 KB table.
+constexpr int PROBABILITY_BITS{12};
+constexpr std::uint32_t PROBABILITY_SCALE{1u << PROBABILITY_BITS};
+// rANS states stay in [RANS_LOWER_BOUND, RANS_LOWER_BOUND * 256) and get renormalized a byte at a time.
+constexpr std::uint32_t RANS_LOWER_BOUND{1u << 23};
+// Two states take turns, so decoding a pixel does not have to wait for the state of the previous one.
+constexpr int RANS_STATE_COUNT{2};
+
+constexpr int SYMBOL_COUNT{256};
+// Zigzagged residuals below ZERO_SYMBOL are symbols themselves.
+// ZERO_SYMBOL is for invalid pixels with a valid prediction, which are common at the edges of objects.
+// Other residuals get written as uint16_t outside the rANS stream after ESCAPE_SYMBOL.
+constexpr int ZERO_SYMBOL{254};
+constexpr int ESCAPE_SYMBOL{255};
+
+// A frame starts with a bitmap of the symbols that appear in the frame and their frequencies as uint16_t.
+// Then, the number of escaped residuals as uint32_t, the residuals, and the rANS stream follow.
+constexpr std::size_t SYMBOL_BITMAP_SIZE{SYMBOL_COUNT / 8};
+constexpr std::size_t MAX_HEADER_SIZE{SYMBOL_BITMAP_SIZE + sizeof(std::uint16_t) * SYMBOL_COUNT + sizeof(std::uint32_t)};
+
+// MED is the median of the left (a), upper (b), and a + b - c where c is the upper left pixel.
+// Pixels in the first row are predicted from their left neighbors and the first column from their upper neighbors.
+int predict(const std::int16_t* row, const std::int16_t* upper_row, int x) noexcept
+{
+    if (!upper_row)
+        return x == 0 ? 0 : row[x - 1];
+    if (x == 0)
+        return upper_row[0];
+
+    const int a{row[x - 1]};
+    const int b{upper_row[x]};
+    const int c{upper_row[x - 1]};
+    return std::max(std::min(a, b), std::min(std::max(a, b), a + b - c));
+}
+
+// Residuals wrap around in 16 bits, so any int16_t pixel can be predicted from any prediction.
+std::uint16_t zigzag(std::int16_t value) noexcept
+{
+    return static_cast<std::uint16_t>((value << 1) ^ (value >> 15));
+}
+
+std::int16_t unzigzag(std::uint16_t value) noexcept
+{
+    return static_cast<std::int16_t>((value >> 1) ^ -(value & 1));
+}
+
+int get_symbol(std::int16_t pixel, int prediction, std::uint16_t& residual) noexcept
+{
+    if (pixel == 0 && prediction != 0)
+        return ZERO_SYMBOL;
+
+    residual = zigzag(static_cast<std::int16_t>(pixel - prediction));
+    return residual < ZERO_SYMBOL ? residual : ESCAPE_SYMBOL;
+}
+
+// Scales counts to frequencies summing up to PROBABILITY_SCALE while keeping every symbol that appeared.
+std::array<std::uint32_t, SYMBOL_COUNT> normalize_frequencies(const std::array<std::uint32_t, SYMBOL_COUNT>& counts,
+                                                              std::uint32_t total_count) noexcept
+{
+    std::array<std::uint32_t, SYMBOL_COUNT> frequencies{};
+    if (total_count == 0)
+        return frequencies;
+
+    std::uint32_t sum{0};
+    for (int symbol{0}; symbol < SYMBOL_COUNT; ++symbol) {
+        if (counts[symbol] == 0)
+            continue;
+        frequencies[symbol] = std::max<std::uint32_t>(1, static_cast<std::uint32_t>(
+            static_cast<std::uint64_t>(counts[symbol]) * PROBABILITY_SCALE / total_count));
+        sum += frequencies[symbol];
+    }
+
+    // Rounding down leaves part of the scale, which goes to the most frequent symbol.
+    // Rounding rare symbols up to 1 can go over the scale, which gets taken from the most frequent symbols.
+    while (sum != PROBABILITY_SCALE) {
+        auto& max_frequency{*std::max_element(frequencies.begin(), frequencies.end())};
+        if (sum < PROBABILITY_SCALE) {
+            max_frequency += PROBABILITY_SCALE - sum;
+            sum = PROBABILITY_SCALE;
+        } else {
+            const std::uint32_t reduction{std::min(sum - PROBABILITY_SCALE, max_frequency - 1)};
+            max_frequency -= reduction;
+            sum -= reduction;
+        }
+    }
+
+    return frequencies;
+}
+
+void put_symbol(std::uint32_t& state, std::uint8_t*& stream, std::uint32_t start, std::uint32_t frequency) noexcept
+{
+    const std::uint32_t max_state{((RANS_LOWER_BOUND >> PROBABILITY_BITS) << 8) * frequency};
+    while (state >= max_state) {
+        *--stream = static_cast<std::uint8_t>(state & 0xff);
+        state >>= 8;
+    }
+    state = ((state / frequency) << PROBABILITY_BITS) + (state % frequency) + start;
+}
+}
+
+// The worst case is when every pixel gets escaped, which takes 2 bytes for the residual
+// and less than 2 bytes in the rANS stream since the frequency of a symbol is at least 1 / 2^12.
+std::size_t get_max_compressed_size(int num_pixels) noexcept
+{
+    return MAX_HEADER_SIZE + static_cast<std::size_t>(num_pixels) * 4 + sizeof(std::uint32_t) * RANS_STATE_COUNT;
+}
+
+std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int width)
+{
+    std::vector<std::byte> output(get_max_compressed_size(gsl::narrow_cast<int>(input.size())));
+    output.resize(compress_into(input, width, output));
+    output.shrink_to_fit();
+    return output;
+}
+
+std::size_t compress_into(gsl::span<const std::int16_t> input, int width, gsl::span<std::byte> output)
+{
+    const int num_pixels{gsl::narrow_cast<int>(input.size())};
+    if (output.size() < get_max_compressed_size(num_pixels))
+        throw std::exception("Output of MED-rANS compression is smaller than get_max_compressed_size().");
+
+    const std::int16_t* pixels{input.data()};
+    const int height{(num_pixels + width - 1) / width};
+
+    // The first pass counts the symbols to build the frequency table.
+    std::array<std::uint32_t, SYMBOL_COUNT> counts{};
+    for (int y{0}; y < height; ++y) {
+        const std::int16_t* row{pixels + static_cast<gsl::index>(width) * y};
+        const std::int16_t* upper_row{y == 0 ? nullptr : row - width};
+        const int row_width{std::min(width, num_pixels - width * y)};
+        for (int x{0}; x < row_width; ++x) {
+            std::uint16_t residual;
+            ++counts[get_symbol(row[x], predict(row, upper_row, x), residual)];
+        }
+    }
+    const auto frequencies{normalize_frequencies(counts, num_pixels)};
+    std::array<std::uint32_t, SYMBOL_COUNT> starts{};
+    for (int symbol{1}; symbol < SYMBOL_COUNT; ++symbol)
+        starts[symbol] = starts[symbol - 1] + frequencies[symbol - 1];
+
+    std::uint8_t* output_ptr{reinterpret_cast<std::uint8_t*>(output.data())};
+    std::size_t position{SYMBOL_BITMAP_SIZE};
+    memset(output_ptr, 0, SYMBOL_BITMAP_SIZE);
+    for (int symbol{0}; symbol < SYMBOL_COUNT; ++symbol) {
+        if (frequencies[symbol] == 0)
+            continue;
+        output_ptr[symbol / 8] |= static_cast<std::uint8_t>(1 << (symbol % 8));
+        const std::uint16_t frequency{gsl::narrow_cast<std::uint16_t>(frequencies[symbol])};
+        memcpy(output_ptr + position, &frequency, sizeof(frequency));
+        position += sizeof(frequency);
+    }
+
+    const std::uint32_t escape_count{counts[ESCAPE_SYMBOL]};
+    memcpy(output_ptr + position, &escape_count, sizeof(escape_count));
+    position += sizeof(escape_count);
+    std::uint8_t* escapes{output_ptr + position};
+    position += sizeof(std::uint16_t) * escape_count;
+
+    // The second pass encodes the pixels in the reverse order since rANS works as a stack.
+    // The stream gets written backward from the end of output, then moved to the front.
+    std::uint8_t* const stream_end{output_ptr + output.size()};
+    std::uint8_t* stream{stream_end};
+    std::uint32_t states[RANS_STATE_COUNT]{RANS_LOWER_BOUND, RANS_LOWER_BOUND};
+    std::uint32_t escape_index{escape_count};
+    for (int y{height - 1}; y >= 0; --y) {
+        const std::int16_t* row{pixels + static_cast<gsl::index>(width) * y};
+        const std::int16_t* upper_row{y == 0 ? nullptr : row - width};
+        const int row_width{std::min(width, num_pixels - width * y)};
+        for (int x{row_width - 1}; x >= 0; --x) {
+            std::uint16_t residual;
+            const int symbol{get_symbol(row[x], predict(row, upper_row, x), residual)};
+            if (symbol == ESCAPE_SYMBOL)
+                memcpy(escapes + sizeof(std::uint16_t) * --escape_index, &residual, sizeof(residual));
+
+            const int pixel_index{width * y + x};
+            put_symbol(states[pixel_index % RANS_STATE_COUNT], stream, starts[symbol], frequencies[symbol]);
+        }
+    }
+
+    // The decoder reads the state of the first pixel first.
+    for (int i{RANS_STATE_COUNT - 1}; i >= 0; --i) {
+        stream -= sizeof(std::uint32_t);
+        memcpy(stream, &states[i], sizeof(std::uint32_t));
+    }
+
+    const std::size_t stream_size{static_cast<std::size_t>(stream_end - stream)};
+    memmove(output_ptr + position, stream, stream_size);
+    return position + stream_size;
+}
+
+std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int width, int num_pixels) noexcept
+{
+    std::vector<std::int16_t> output(num_pixels);
+    decompress_into(input, width, output);
+    return output;
+}
+
+// Broken frames get decoded into zeros or wrong pixels but never make the decoder read outside of input.
+bool decompress_into(gsl::span<const std::byte> input, int width, gsl::span<std::int16_t> output) noexcept
+{
+    const int num_pixels{gsl::narrow_cast<int>(output.size())};
+    const std::uint8_t* input_ptr{reinterpret_cast<const std::uint8_t*>(input.data())};
+    const std::uint8_t* const input_end{input_ptr + input.size()};
+    std::fill(output.begin(), output.end(), static_cast<std::int16_t>(0));
+    if (input.size() < SYMBOL_BITMAP_SIZE)
+        return false;
+
+    // Each slot of the probability scale maps to its symbol, the start, and the frequency minus one of the symbol
+    // in 8, 12, and 12 bits to decode a symbol with a single lookup.
+    std::array<std::uint32_t, PROBABILITY_SCALE> slots;
+    const std::uint8_t* position{input_ptr + SYMBOL_BITMAP_SIZE};
+    std::uint32_t start{0};
+    for (std::uint32_t symbol{0}; symbol < SYMBOL_COUNT; ++symbol) {
+        if (!(input_ptr[symbol / 8] & (1 << (symbol % 8))))
+            continue;
+        if (input_end - position < static_cast<std::ptrdiff_t>(sizeof(std::uint16_t)))
+            return false;
+
+        std::uint16_t frequency;
+        memcpy(&frequency, position, sizeof(frequency));
+        position += sizeof(frequency);
+        if (frequency == 0 || start + frequency > PROBABILITY_SCALE)
+            return false;
+
+        std::fill(slots.begin() + start, slots.begin() + start + frequency, symbol | (start << 8) | ((frequency - 1u) << 20));
+        start += frequency;
+    }
+    if (start != PROBABILITY_SCALE && num_pixels > 0)
+        return false;
+
+    std::uint32_t escape_count;
+    if (input_end - position < static_cast<std::ptrdiff_t>(sizeof(escape_count)))
+        return false;
+    memcpy(&escape_count, position, sizeof(escape_count));
+    position += sizeof(escape_count);
+    if (static_cast<std::size_t>(input_end - position) < sizeof(std::uint16_t) * escape_count + sizeof(std::uint32_t) * RANS_STATE_COUNT)
+        return false;
+    const std::uint8_t* escapes{position};
+    const std::uint8_t* const escapes_end{escapes + sizeof(std::uint16_t) * escape_count};
+
+    const std::uint8_t* stream{escapes_end};
+    // The states get swapped after each pixel to take turns.
+    std::uint32_t state;
+    std::uint32_t next_state;
+    memcpy(&state, stream, sizeof(state));
+    memcpy(&next_state, stream + sizeof(state), sizeof(next_state));
+    stream += sizeof(std::uint32_t) * RANS_STATE_COUNT;
+
+    auto decode_pixel{[&](int prediction) {
+        const std::uint32_t slot{state & (PROBABILITY_SCALE - 1)};
+        const std::uint32_t entry{slots[slot]};
+        state = ((entry >> 20) + 1) * (state >> PROBABILITY_BITS) + slot - ((entry >> 8) & 0xfff);
+        while (state < RANS_LOWER_BOUND && stream != input_end)
+            state = (state << 8) | *stream++;
+        std::swap(state, next_state);
+
+        const std::uint32_t symbol{entry & 0xff};
+        if (symbol < ZERO_SYMBOL)
+            return static_cast<std::int16_t>(prediction + unzigzag(static_cast<std::uint16_t>(symbol)));
+        if (symbol == ZERO_SYMBOL)
+            return static_cast<std::int16_t>(0);
+
+        std::uint16_t residual{0};
+        if (escapes != escapes_end) {
+            memcpy(&residual, escapes, sizeof(residual));
+            escapes += sizeof(residual);
+        }
+        return static_cast<std::int16_t>(prediction + unzigzag(residual));
+    }};
+
+    const int height{(num_pixels + width - 1) / width};
+    for (int y{0}; y < height; ++y) {
+        std::int16_t* row{output.data() + static_cast<gsl::index>(width) * y};
+        const int row_width{std::min(width, num_pixels - width * y)};
+        // Same as predict() with the cases of the first row and column taken out of the loop.
+        if (y == 0) {
+            int a{0};
+            for (int x{0}; x < row_width; ++x) {
+                row[x] = decode_pixel(a);
+                a = row[x];
+            }
+            continue;
+        }
+
+        const std::int16_t* upper_row{row - width};
+        row[0] = decode_pixel(upper_row[0]);
+        int a{row[0]};
+        for (int x{1}; x < row_width; ++x) {
+            const int b{upper_row[x]};
+            const int c{upper_row[x - 1]};
+            row[x] = decode_pixel(std::max(std::min(a, b), std::min(std::max(a, b), a + b - c)));
+            a = row[x];
+        }
+    }
+
+    // Decoding undoes the encoding, so a frame that is not broken uses up its escapes and its stream
+    // and leaves the states where the encoder started them.
+    return escapes == escapes_end && stream == input_end && state == RANS_LOWER_BOUND && next_state == RANS_LOWER_BOUND;
+}
+}
+}
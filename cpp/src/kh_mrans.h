@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include <gsl/gsl>
+
+// A lossless depth image codec that predicts each pixel from its neighbors with the median edge detector (MED)
+// of LOCO-I and entropy codes the residuals with rANS.
+// Weinberger, M. J., Seroussi, G., & Sapiro, G. (2000). The LOCO-I lossless image compression algorithm:
+// Principles and standardization into JPEG-LS. IEEE Transactions on Image Processing, 9(8), 1309-1324.
+// Duda, J. (2013). Asymmetric numeral systems: entropy coding combining speed of Huffman coding
+// with compression rate of arithmetic coding. arXiv preprint arXiv:1311.2540.
+namespace kh
+{
+namespace mrans
+{
+// Upper bound of the number of bytes compressing num_pixels pixels can produce.
+std::size_t get_max_compressed_size(int num_pixels) noexcept;
+
+// Frames are rows of width pixels.
+// It has to be int16_t not uint16_t, as RVL, to work with the differences of the temporal mode.
+std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int width);
+std::size_t compress_into(gsl::span<const std::int16_t> input, int width, gsl::span<std::byte> output);
+std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int width, int num_pixels) noexcept;
+// Returns false when input is broken.
+bool decompress_into(gsl::span<const std::byte> input, int width, gsl::span<std::int16_t> output) noexcept;
+}
+}
@@ -1,5 +1,14 @@
 #include "kh_rvl.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "kh_cpu.h"
+
 // Code inside this namespace is from the RVL paper (Wilson, 2017).
 // The code has been modified to be thread-safe (i.e. removed global variables).
 namespace
@@ -92,32 +101,455 @@ void DecompressRVL(char* input, short* output, int numPixels) noexcept
 }
 }
 
+
+// SIMD versions of CompressRVL() and DecompressRVL() that produce and consume the same bitstream.
+// Runs get detected 8 or 16 pixels at a time, and a run of nonzero values gets handled 8 values at a time
+// when all 8 zigzag deltas fit in a single nibble, which is the common case for smooth surfaces
+// and for the pixel differences of TRVL.
+namespace
+{
+int count_trailing_zeros(unsigned int x) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// Equivalent to calling EncodeVLE() with 8 values smaller than 8,
+// where nibbles has the first value at its highest 4 bits.
+void EncodeNibbles(std::uint32_t nibbles, int*& pBuffer, int& word, int& nibblesWritten) noexcept
+{
+    const std::uint64_t combined{(static_cast<std::uint64_t>(static_cast<std::uint32_t>(word)) << 32) | nibbles};
+    *pBuffer++ = static_cast<int>(static_cast<std::uint32_t>(combined >> (4 * nibblesWritten)));
+    word = static_cast<int>(nibbles & ((1u << (4 * nibblesWritten)) - 1u));
+}
+
+// Equivalent to calling DecodeVLE() 8 times for nonzero values,
+// but only when none of the next 8 nibbles has a continuation bit.
+// pEnd prevents reading the next word beyond the input.
+bool DecodeNibbles(int*& pBuffer, const int* pEnd, int& word, int& nibblesWritten, short& previous, short* output) noexcept
+{
+    std::uint32_t nibbles{static_cast<std::uint32_t>(word)};
+    if (nibblesWritten < 8) {
+        if (pBuffer == pEnd)
+            return false;
+        // word has zeros below its remaining nibbles, so the next word can be just ORed.
+        nibbles |= static_cast<std::uint32_t>(*pBuffer) >> (4 * nibblesWritten);
+    }
+
+    if (nibbles & 0x88888888u)
+        return false;
+
+    // Spread the nibbles into 16-bit lanes in order.
+    const __m128i bytes{_mm_shuffle_epi8(_mm_cvtsi32_si128(static_cast<int>(nibbles)),
+                                         _mm_setr_epi8(3, -1, 3, -1, 2, -1, 2, -1, 1, -1, 1, -1, 0, -1, 0, -1))};
+    const __m128i positive{_mm_blend_epi16(_mm_srli_epi16(bytes, 4), _mm_and_si128(bytes, _mm_set1_epi16(0xf)), 0xAA)};
+    // delta = (positive >> 1) ^ -(positive & 1);
+    __m128i current{_mm_xor_si128(_mm_srli_epi16(positive, 1),
+                                  _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(positive, _mm_set1_epi16(1))))};
+    // Prefix sum of the deltas starting from previous.
+    current = _mm_add_epi16(current, _mm_slli_si128(current, 2));
+    current = _mm_add_epi16(current, _mm_slli_si128(current, 4));
+    current = _mm_add_epi16(current, _mm_slli_si128(current, 8));
+    current = _mm_add_epi16(current, _mm_set1_epi16(previous));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output), current);
+    previous = output[7];
+
+    if (nibblesWritten == 8) {
+        word = 0;
+        nibblesWritten = 0;
+    } else if (nibblesWritten == 0) {
+        ++pBuffer;
+    } else {
+        word = static_cast<int>(static_cast<std::uint32_t>(*pBuffer++) << (4 * (8 - nibblesWritten)));
+    }
+
+    return true;
+}
+
+// Same as DecodeVLE() except that it does not read words from pEnd on.
+// Sets broken and returns 0 when the value would continue there.
+int DecodeVLE(int*& pBuffer, const int* pEnd, int& word, int& nibblesWritten, bool& broken) noexcept
+{
+    unsigned int nibble;
+    int value = 0, bits = 29;
+    do {
+        if (!nibblesWritten) {
+            if (pBuffer == pEnd) {
+                broken = true;
+                return 0;
+            }
+            word = *pBuffer++; // load word
+            nibblesWritten = 8;
+        }
+        nibble = word & 0xf0000000;
+        value |= (nibble << 1) >> bits;
+        word <<= 4;
+        nibblesWritten--;
+        bits -= 3;
+    } while (nibble & 0x80000000);
+    return value;
+}
+
+struct Sse41Kernel
+{
+    static int CountZeros(const short* input, const short* end) noexcept
+    {
+        const short* p{input};
+        for (; end - p >= 8; p += 8) {
+            const __m128i values{_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+            const int mask{_mm_movemask_epi8(_mm_cmpeq_epi16(values, _mm_setzero_si128()))};
+            if (mask != 0xFFFF)
+                return static_cast<int>(p - input) + count_trailing_zeros(~mask) / 2;
+        }
+        for (; (p != end) && !*p; p++);
+        return static_cast<int>(p - input);
+    }
+
+    static int CountNonzeros(const short* input, const short* end) noexcept
+    {
+        const short* p{input};
+        for (; end - p >= 8; p += 8) {
+            const __m128i values{_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+            const int mask{_mm_movemask_epi8(_mm_cmpeq_epi16(values, _mm_setzero_si128()))};
+            if (mask != 0)
+                return static_cast<int>(p - input) + count_trailing_zeros(mask) / 2;
+        }
+        for (; (p != end) && *p; p++);
+        return static_cast<int>(p - input);
+    }
+
+    // Returns false when any of the 8 zigzag deltas does not fit in a nibble.
+    static bool ZigzagNibbles(const short* input, short previous, std::uint32_t& nibbles) noexcept
+    {
+        const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i*>(input))};
+        const __m128i shifted{_mm_alignr_epi8(current, _mm_set1_epi16(previous), 14)};
+        // Deltas are in 32 bits as in CompressRVL() since they can overflow 16 bits.
+        const __m128i delta_lo{_mm_sub_epi32(_mm_cvtepi16_epi32(current), _mm_cvtepi16_epi32(shifted))};
+        const __m128i delta_hi{_mm_sub_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(current, 8)),
+                                             _mm_cvtepi16_epi32(_mm_srli_si128(shifted, 8)))};
+        const __m128i positive_lo{_mm_xor_si128(_mm_slli_epi32(delta_lo, 1), _mm_srai_epi32(delta_lo, 31))};
+        const __m128i positive_hi{_mm_xor_si128(_mm_slli_epi32(delta_hi, 1), _mm_srai_epi32(delta_hi, 31))};
+        if (!_mm_testz_si128(_mm_or_si128(positive_lo, positive_hi), _mm_set1_epi32(~0x7)))
+            return false;
+
+        // Merge pairs of values into bytes, then reverse the bytes to have the first value at the highest nibble.
+        const __m128i pairs{_mm_madd_epi16(_mm_packus_epi32(positive_lo, positive_hi), _mm_set1_epi32(0x00010010))};
+        const __m128i bytes{_mm_shuffle_epi8(pairs, _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))};
+        nibbles = static_cast<std::uint32_t>(_mm_cvtsi128_si32(bytes));
+        return true;
+    }
+};
+
+// Sticks to 256-bit instructions to avoid mixing them with non-VEX SSE instructions.
+struct Avx2Kernel
+{
+    static int CountZeros(const short* input, const short* end) noexcept
+    {
+        const short* p{input};
+        for (; end - p >= 16; p += 16) {
+            const __m256i values{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+            const unsigned int mask{static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(values, _mm256_setzero_si256())))};
+            if (mask != 0xFFFFFFFFu)
+                return static_cast<int>(p - input) + count_trailing_zeros(~mask) / 2;
+        }
+        for (; (p != end) && !*p; p++);
+        return static_cast<int>(p - input);
+    }
+
+    static int CountNonzeros(const short* input, const short* end) noexcept
+    {
+        const short* p{input};
+        for (; end - p >= 16; p += 16) {
+            const __m256i values{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+            const unsigned int mask{static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(values, _mm256_setzero_si256())))};
+            if (mask != 0)
+                return static_cast<int>(p - input) + count_trailing_zeros(mask) / 2;
+        }
+        for (; (p != end) && *p; p++);
+        return static_cast<int>(p - input);
+    }
+
+    static bool ZigzagNibbles(const short* input, short previous, std::uint32_t& nibbles) noexcept
+    {
+        const __m256i current{_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)))};
+        const __m256i shifted{_mm256_blend_epi32(_mm256_permutevar8x32_epi32(current, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6)),
+                                                 _mm256_set1_epi32(previous), 0x01)};
+        const __m256i delta{_mm256_sub_epi32(current, shifted)};
+        const __m256i positive{_mm256_xor_si256(_mm256_slli_epi32(delta, 1), _mm256_srai_epi32(delta, 31))};
+        if (!_mm256_testz_si256(positive, _mm256_set1_epi32(~0x7)))
+            return false;
+
+        // The 8 values in 16 bits are in the lower 128 bits after the permutation.
+        const __m256i packed{_mm256_permute4x64_epi64(_mm256_packus_epi32(positive, positive), 0x08)};
+        const __m256i pairs{_mm256_madd_epi16(packed, _mm256_set1_epi32(0x00010010))};
+        const __m256i bytes{_mm256_shuffle_epi8(pairs, _mm256_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))};
+        nibbles = static_cast<std::uint32_t>(_mm256_cvtsi256_si32(bytes));
+        return true;
+    }
+};
+
+template<class SimdKernel>
+int CompressRVLSimd(short* input, char* output, int numPixels) noexcept
+{
+    int* buffer = (int*)output;
+    int* pBuffer = (int*)output;
+    int word = 0;
+    int nibblesWritten = 0;
+    short* end = input + numPixels;
+    short previous = 0;
+    while (input != end) {
+        int zeros = SimdKernel::CountZeros(input, end);
+        input += zeros;
+        EncodeVLE(zeros, pBuffer, word, nibblesWritten); // number of zeros
+        int nonzeros = SimdKernel::CountNonzeros(input, end);
+        EncodeVLE(nonzeros, pBuffer, word, nibblesWritten); // number of nonzeros
+        short* runEnd = input + nonzeros;
+        while (runEnd - input >= 8) {
+            std::uint32_t nibbles;
+            if (SimdKernel::ZigzagNibbles(input, previous, nibbles)) {
+                EncodeNibbles(nibbles, pBuffer, word, nibblesWritten);
+                previous = input[7];
+                input += 8;
+                continue;
+            }
+            // Encode the 8 values one by one when any of them is too large for the shortcut.
+            for (short* p = input + 8; input != p; input++) {
+                int delta = *input - previous;
+                int positive = (delta << 1) ^ (delta >> 31);
+                EncodeVLE(positive, pBuffer, word, nibblesWritten); // nonzero value
+                previous = *input;
+            }
+        }
+        for (; input != runEnd; input++) {
+            int delta = *input - previous;
+            int positive = (delta << 1) ^ (delta >> 31);
+            EncodeVLE(positive, pBuffer, word, nibblesWritten); // nonzero value
+            previous = *input;
+        }
+    }
+
+    if (nibblesWritten) // last few values
+        *pBuffer++ = word << 4 * (8 - nibblesWritten);
+
+    return int((char*)pBuffer - (char*)buffer); // num bytes
+}
+
+int CompressRVLSse41(short* input, char* output, int numPixels) noexcept
+{
+    return CompressRVLSimd<Sse41Kernel>(input, output, numPixels);
+}
+
+int CompressRVLAvx2(short* input, char* output, int numPixels) noexcept
+{
+    const int size{CompressRVLSimd<Avx2Kernel>(input, output, numPixels)};
+    _mm256_zeroupper();
+    return size;
+}
+
+// Decompression is bound by the serial dependency between the nibbles of the bitstream,
+// so there is a single SIMD version shared by the SSE4.1 and AVX2 kernels.
+void DecompressRVLSse41(char* input, int inputSize, short* output, int numPixels) noexcept
+{
+    int* pBuffer = (int*)input;
+    const int* pEnd = pBuffer + inputSize / sizeof(int);
+    int word = 0;
+    int nibblesWritten = 0;
+    short current, previous = 0;
+    int numPixelsToDecode = numPixels;
+    while (numPixelsToDecode) {
+        int zeros = DecodeVLE(pBuffer, word, nibblesWritten); // number of zeros
+        numPixelsToDecode -= zeros;
+        memset(output, 0, zeros * sizeof(short));
+        output += zeros;
+        int nonzeros = DecodeVLE(pBuffer, word, nibblesWritten); // number of nonzeros
+        numPixelsToDecode -= nonzeros;
+        while (nonzeros >= 8) {
+            if (DecodeNibbles(pBuffer, pEnd, word, nibblesWritten, previous, output)) {
+                output += 8;
+                nonzeros -= 8;
+                continue;
+            }
+            int positive = DecodeVLE(pBuffer, word, nibblesWritten); // nonzero value
+            int delta = (positive >> 1) ^ -(positive & 1);
+            current = previous + delta;
+            *output++ = current;
+            previous = current;
+            --nonzeros;
+        }
+        for (; nonzeros; nonzeros--) {
+            int positive = DecodeVLE(pBuffer, word, nibblesWritten); // nonzero value
+            int delta = (positive >> 1) ^ -(positive & 1);
+            current = previous + delta;
+            *output++ = current;
+            previous = current;
+        }
+    }
+}
+}
+
 namespace kh
 {
 namespace rvl
 {
+Kernel get_default_kernel() noexcept
+{
+    return Kernel::Scalar;
+}
+
+Kernel get_widest_kernel() noexcept
+{
+    const auto& cpu_features{get_cpu_features()};
+    if (cpu_features.avx2)
+        return Kernel::Avx2;
+    if (cpu_features.sse41)
+        return Kernel::Sse41;
+    return Kernel::Scalar;
+}
+
+// The worst case is when every run of nonzero values has a single value and its delta takes 17 bits.
+// Then, each pixel takes at most 7 nibbles (a run length and a 6-nibble value),
+// plus a nibble for the empty first run of zeros and one for the empty last run of nonzeros.
+std::size_t get_max_compressed_size(int num_pixels) noexcept
+{
+    const std::size_t max_nibble_count{static_cast<std::size_t>(num_pixels) * 7 + 2};
+    return (max_nibble_count + 7) / 8 * sizeof(int);
+}
+
 // Compresses depth pixels using RVL.
 std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int num_pixels)
 {
-    std::vector<std::byte> output(num_pixels);
-    int size{CompressRVL(const_cast<short*>(input.data()),
-                                 reinterpret_cast<char*>(output.data()), num_pixels)};
-    // This is theoretically possible to happen since lossless compression does not guarantee reduction of size.
-    // However, it is very unlikely to happen.
-    if (size > num_pixels)
-        throw std::exception("RVL compression failed to reduce the size of its input.");
-    
+    return compress(input, num_pixels, get_default_kernel());
+}
+
+std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int num_pixels, Kernel kernel)
+{
+    std::vector<std::byte> output(get_max_compressed_size(num_pixels));
+    const std::size_t size{compress_into(input.first(num_pixels), output, kernel)};
     output.resize(size);
     output.shrink_to_fit();
     return output;
 }
 
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output)
+{
+    return compress_into(input, output, get_default_kernel());
+}
+
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output, Kernel kernel)
+{
+    const int num_pixels{gsl::narrow_cast<int>(input.size())};
+    // The kernels do not check the bounds of the output while writing into it.
+    if (output.size() < get_max_compressed_size(num_pixels))
+        throw std::exception("Output of RVL compression is smaller than get_max_compressed_size().");
+
+    short* input_ptr{const_cast<short*>(input.data())};
+    char* output_ptr{reinterpret_cast<char*>(output.data())};
+    switch (kernel) {
+    case Kernel::Avx2:
+        return CompressRVLAvx2(input_ptr, output_ptr, num_pixels);
+    case Kernel::Sse41:
+        return CompressRVLSse41(input_ptr, output_ptr, num_pixels);
+    default:
+        return CompressRVL(input_ptr, output_ptr, num_pixels);
+    }
+}
+
 std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int num_pixels) noexcept
+{
+    return decompress(input, num_pixels, get_default_kernel());
+}
+
+std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int num_pixels, Kernel kernel) noexcept
 {
     std::vector<std::int16_t> output(num_pixels);
-    DecompressRVL(const_cast<char*>(reinterpret_cast<const char*>(input.data())),
-                  reinterpret_cast<short*>(output.data()), num_pixels);
+    decompress_into(input, output, kernel);
     return output;
 }
+
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output) noexcept
+{
+    decompress_into(input, output, get_default_kernel());
+}
+
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output, Kernel kernel) noexcept
+{
+    char* input_ptr{const_cast<char*>(reinterpret_cast<const char*>(input.data()))};
+    short* output_ptr{reinterpret_cast<short*>(output.data())};
+    const int num_pixels{gsl::narrow_cast<int>(output.size())};
+    if (kernel == Kernel::Scalar) {
+        DecompressRVL(input_ptr, output_ptr, num_pixels);
+    } else {
+        DecompressRVLSse41(input_ptr, gsl::narrow_cast<int>(input.size()), output_ptr, num_pixels);
+    }
+}
+
+Decompressor::Decompressor(gsl::span<const std::byte> input) noexcept
+    : Decompressor(input, get_default_kernel())
+{
+}
+
+Decompressor::Decompressor(gsl::span<const std::byte> input, Kernel kernel) noexcept
+    : buffer_{const_cast<int*>(reinterpret_cast<const int*>(input.data()))}
+    , end_{reinterpret_cast<const int*>(input.data()) + input.size() / sizeof(int)}
+    , word_{0}, nibbles_written_{0}, previous_{0}, zeros_{0}, nonzeros_{0}, simd_{kernel != Kernel::Scalar}
+    , broken_{input.empty() || input.size() % sizeof(int) != 0}
+{
+}
+
+// Same as DecompressRVL() and DecompressRVLSse41() except that runs can continue in the next call
+// and that the input does not get read beyond its end.
+void Decompressor::decompress_next(gsl::span<std::int16_t> output) noexcept
+{
+    short* output_ptr{reinterpret_cast<short*>(output.data())};
+    int num_pixels_to_decode{gsl::narrow_cast<int>(output.size())};
+    while (num_pixels_to_decode) {
+        if (zeros_ == 0 && nonzeros_ == 0) {
+            zeros_ = DecodeVLE(buffer_, end_, word_, nibbles_written_, broken_); // number of zeros
+            nonzeros_ = DecodeVLE(buffer_, end_, word_, nibbles_written_, broken_); // number of nonzeros
+            // Runs are empty only at the end of a frame, so only broken frames have them before their pixels.
+            if (broken_ || (zeros_ == 0 && nonzeros_ == 0)) {
+                memset(output_ptr, 0, num_pixels_to_decode * sizeof(short));
+                zeros_ = 0;
+                nonzeros_ = 0;
+                broken_ = true;
+                return;
+            }
+        }
+
+        const int zeros{std::min(zeros_, num_pixels_to_decode)};
+        memset(output_ptr, 0, zeros * sizeof(short));
+        output_ptr += zeros;
+        zeros_ -= zeros;
+        num_pixels_to_decode -= zeros;
+
+        int nonzeros{std::min(nonzeros_, num_pixels_to_decode)};
+        nonzeros_ -= nonzeros;
+        num_pixels_to_decode -= nonzeros;
+        while (simd_ && nonzeros >= 8) {
+            if (DecodeNibbles(buffer_, end_, word_, nibbles_written_, previous_, output_ptr)) {
+                output_ptr += 8;
+                nonzeros -= 8;
+                continue;
+            }
+            int positive = DecodeVLE(buffer_, end_, word_, nibbles_written_, broken_); // nonzero value
+            int delta = (positive >> 1) ^ -(positive & 1);
+            previous_ = static_cast<short>(previous_ + delta);
+            *output_ptr++ = previous_;
+            --nonzeros;
+        }
+        for (; nonzeros; nonzeros--) {
+            int positive = DecodeVLE(buffer_, end_, word_, nibbles_written_, broken_); // nonzero value
+            int delta = (positive >> 1) ^ -(positive & 1);
+            previous_ = static_cast<short>(previous_ + delta);
+            *output_ptr++ = previous_;
+        }
+    }
+}
+}
 }
-}
\ No newline at end of file
@@ -10,8 +10,67 @@ namespace kh
 {
 namespace rvl
 {
+// Implementations of RVL that produce the exact same bitstream.
+// Scalar is the reference implementation from the paper and
+// the others vectorize the run detection, zigzag deltas, and nibble packing.
+// A kernel has to be supported by the CPU (see get_cpu_features()).
+enum class Kernel
+{
+    Scalar,
+    Sse41,
+    Avx2,
+};
+
+// The kernel compress() and decompress() use by default, which is Scalar since the vectorized kernels
+// of RVL decode depth frames slower than it (see Rvl2Benchmark): the nibbles of RVL get decoded one after another.
+Kernel get_default_kernel() noexcept;
+// The kernel with the widest vectors the CPU supports, for vectorized code that is faster than the scalar one
+// such as update_trvl_pixels() and RVL2.
+Kernel get_widest_kernel() noexcept;
+
+// Upper bound of the number of bytes compressing num_pixels pixels can produce.
+std::size_t get_max_compressed_size(int num_pixels) noexcept;
+
 // It has to be int16_t not uint16_t to work with TRVL.
 std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int num_pixels);
+std::vector<std::byte> compress(gsl::span<const std::int16_t> input, int num_pixels, Kernel kernel);
 std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int num_pixels) noexcept;
+std::vector<std::int16_t> decompress(gsl::span<const std::byte> input, int num_pixels, Kernel kernel) noexcept;
+
+// Versions that do not allocate for the sender and receiver loops that reuse their buffers.
+// compress_into() compresses all pixels of input and returns the number of bytes written to output,
+// which should have at least get_max_compressed_size() bytes.
+// decompress_into() fills all pixels of output.
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output);
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output, Kernel kernel);
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output) noexcept;
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output, Kernel kernel) noexcept;
+
+// Decompresses a frame a few pixels at a time for callers that use the pixels while they are in the cache,
+// such as TrvlDecoder adding differences row by row.
+// Input gets read only up to its end, so broken frames (e.g., cut ones) do not get read beyond it,
+// and the pixels after the run where a broken frame ends get filled with zeros.
+class Decompressor
+{
+public:
+    Decompressor(gsl::span<const std::byte> input) noexcept;
+    Decompressor(gsl::span<const std::byte> input, Kernel kernel) noexcept;
+    // Fills output with the next pixels of the frame.
+    void decompress_next(gsl::span<std::int16_t> output) noexcept;
+    // Whether the input is not a whole number of words or ended before the pixels decompressed so far.
+    bool broken() const noexcept { return broken_; }
+
+private:
+    int* buffer_;
+    const int* end_;
+    int word_;
+    int nibbles_written_;
+    short previous_;
+    // Pixels left in the current runs.
+    int zeros_;
+    int nonzeros_;
+    bool simd_;
+    bool broken_;
+};
 }
 }
\ No newline at end of file
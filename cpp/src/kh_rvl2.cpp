@@ -0,0 +1,437 @@
+#include "kh_rvl2.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+using kh::rvl2::ValueStream;
+
+// The numbers of run lengths and their data bytes, then the ones of deltas.
+constexpr std::size_t HEADER_SIZE{sizeof(int) * 4};
+constexpr int MAX_RUN_LENGTH{0xFFFF};
+// Bytes after each region of the encoder that its unaligned writes can touch.
+constexpr std::size_t WRITE_SLACK{8};
+// The SIMD decoder loads 16 bytes for each half of 8 values, which start up to 8 bytes apart.
+constexpr std::ptrdiff_t SIMD_LOAD_SIZE{24};
+// Data bytes of each code. Encoders do not write code 3.
+constexpr int CODE_LENGTHS[4]{0, 1, 2, 2};
+
+int count_trailing_zeros(unsigned int x) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+std::size_t get_control_size(std::size_t count) noexcept
+{
+    return (count + 3) / 4;
+}
+
+// Where the encoder writes each part of a frame before packing them next to each other.
+// Every iteration of runs except the first starts with a zero and every one except the last has a nonzero,
+// so there are at most num_pixels / 2 + 1 of them, plus the ones from splitting long runs.
+struct Layout
+{
+    std::size_t run_controls;
+    std::size_t run_data;
+    std::size_t delta_controls;
+    std::size_t delta_data;
+    std::size_t end;
+};
+
+Layout get_layout(int num_pixels) noexcept
+{
+    const std::size_t pixel_count{static_cast<std::size_t>(num_pixels)};
+    const std::size_t max_run_count{2 * (pixel_count / 2 + pixel_count / MAX_RUN_LENGTH + 2)};
+    Layout layout;
+    layout.run_controls = HEADER_SIZE;
+    layout.run_data = layout.run_controls + get_control_size(max_run_count) + WRITE_SLACK;
+    layout.delta_controls = layout.run_data + sizeof(std::uint16_t) * max_run_count + WRITE_SLACK;
+    layout.delta_data = layout.delta_controls + get_control_size(pixel_count) + WRITE_SLACK;
+    layout.end = layout.delta_data + sizeof(std::uint16_t) * pixel_count + WRITE_SLACK;
+    return layout;
+}
+
+// Lookup tables indexed by the control byte of 4 values.
+struct Tables
+{
+    // Shuffles that spread the data bytes of 4 values into 16-bit lanes.
+    std::array<__m128i, 256> decode_shuffles;
+    // Shuffles that gather 4 values in 16-bit lanes into their data bytes.
+    std::array<__m128i, 256> encode_shuffles;
+    std::array<std::uint8_t, 256> lengths;
+    // Moves 8 bits to the even bits of 16 bits, which turns 8 bit masks into 8 codes.
+    std::array<std::uint16_t, 256> spread_bits;
+};
+
+Tables create_tables() noexcept
+{
+    Tables tables;
+    for (int control{0}; control < 256; ++control) {
+        std::int8_t decode_shuffle[16];
+        std::int8_t encode_shuffle[16];
+        std::fill(std::begin(decode_shuffle), std::end(decode_shuffle), static_cast<std::int8_t>(-1));
+        std::fill(std::begin(encode_shuffle), std::end(encode_shuffle), static_cast<std::int8_t>(-1));
+        int length{0};
+        for (int i{0}; i < 4; ++i) {
+            const int code_length{CODE_LENGTHS[(control >> (2 * i)) & 3]};
+            for (int j{0}; j < code_length; ++j) {
+                decode_shuffle[2 * i + j] = static_cast<std::int8_t>(length + j);
+                encode_shuffle[length + j] = static_cast<std::int8_t>(2 * i + j);
+            }
+            length += code_length;
+        }
+        tables.decode_shuffles[control] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(decode_shuffle));
+        tables.encode_shuffles[control] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(encode_shuffle));
+        tables.lengths[control] = static_cast<std::uint8_t>(length);
+
+        std::uint16_t spread_bits{0};
+        for (int i{0}; i < 8; ++i)
+            spread_bits |= static_cast<std::uint16_t>(((control >> i) & 1) << (2 * i));
+        tables.spread_bits[control] = spread_bits;
+    }
+    return tables;
+}
+
+const Tables& get_tables() noexcept
+{
+    static const Tables tables{create_tables()};
+    return tables;
+}
+
+// Deltas wrap around in 16 bits, so their zigzag values fit in 16 bits.
+std::uint16_t zigzag(short current, short previous) noexcept
+{
+    const std::int16_t delta{static_cast<std::int16_t>(current - previous)};
+    return static_cast<std::uint16_t>((static_cast<std::uint16_t>(delta) << 1) ^ (delta >> 15));
+}
+
+short unzigzag(std::uint16_t positive, short previous) noexcept
+{
+    return static_cast<short>(previous + ((positive >> 1) ^ -(positive & 1)));
+}
+
+struct ValueWriter
+{
+    std::uint8_t* controls;
+    std::uint8_t* data;
+    int count;
+};
+
+// Writes both data bytes even for shorter values, which the next value overwrites.
+void write_value(ValueWriter& writer, std::uint16_t value) noexcept
+{
+    const int code{value == 0 ? 0 : value < 256 ? 1 : 2};
+    const int shift{(writer.count & 3) * 2};
+    std::uint8_t& control{writer.controls[writer.count >> 2]};
+    control = static_cast<std::uint8_t>((shift == 0 ? 0 : control) | (code << shift));
+    writer.data[0] = static_cast<std::uint8_t>(value);
+    writer.data[1] = static_cast<std::uint8_t>(value >> 8);
+    writer.data += code;
+    ++writer.count;
+}
+
+// Same as calling write_value() for the 8 values in 16-bit lanes.
+void write_values_sse41(ValueWriter& writer, __m128i values, const Tables& tables) noexcept
+{
+    const __m128i zero{_mm_setzero_si128()};
+    const int zero_mask{_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(values, zero), zero))};
+    const int small_mask{_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(_mm_srli_epi16(values, 8), zero), zero))};
+    const int one_byte_mask{~zero_mask & small_mask};
+    const int two_byte_mask{~small_mask & 0xFF};
+    const std::uint32_t controls{static_cast<std::uint32_t>(tables.spread_bits[one_byte_mask]) |
+                                 (static_cast<std::uint32_t>(tables.spread_bits[two_byte_mask]) << 1)};
+
+    // Keeps the codes before the values in the first control byte and clears the ones after.
+    const int shift{(writer.count & 3) * 2};
+    std::uint8_t* control_ptr{writer.controls + (writer.count >> 2)};
+    std::uint32_t control_word;
+    memcpy(&control_word, control_ptr, sizeof(control_word));
+    control_word = (control_word & ((1u << shift) - 1u)) | (controls << shift);
+    memcpy(control_ptr, &control_word, sizeof(control_word));
+
+    const std::uint32_t low_control{controls & 0xFF};
+    const std::uint32_t high_control{controls >> 8};
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(writer.data), _mm_shuffle_epi8(values, tables.encode_shuffles[low_control]));
+    writer.data += tables.lengths[low_control];
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(writer.data),
+                     _mm_shuffle_epi8(_mm_srli_si128(values, 8), tables.encode_shuffles[high_control]));
+    writer.data += tables.lengths[high_control];
+    writer.count += 8;
+}
+
+template<bool Simd, bool Zeros>
+int count_run(const short* input, const short* end) noexcept
+{
+    const short* p{input};
+    if constexpr (Simd) {
+        for (; end - p >= 8; p += 8) {
+            const __m128i values{_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+            const int mask{_mm_movemask_epi8(_mm_cmpeq_epi16(values, _mm_setzero_si128()))};
+            if (Zeros ? mask != 0xFFFF : mask != 0)
+                return static_cast<int>(p - input) + count_trailing_zeros(Zeros ? ~mask : mask) / 2;
+        }
+    }
+    for (; (p != end) && ((*p == 0) == Zeros); p++);
+    return static_cast<int>(p - input);
+}
+
+template<bool Simd>
+void write_deltas(ValueWriter& writer, const short* input, int count, short& previous, const Tables& tables) noexcept
+{
+    const short* end{input + count};
+    if constexpr (Simd) {
+        for (; end - input >= 8; input += 8) {
+            const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i*>(input))};
+            const __m128i delta{_mm_sub_epi16(current, _mm_alignr_epi8(current, _mm_set1_epi16(previous), 14))};
+            write_values_sse41(writer, _mm_xor_si128(_mm_slli_epi16(delta, 1), _mm_srai_epi16(delta, 15)), tables);
+            previous = input[7];
+        }
+    }
+    for (; input != end; ++input) {
+        write_value(writer, zigzag(*input, previous));
+        previous = *input;
+    }
+}
+
+// Writes the run lengths and the deltas at the regions of get_layout(), then packs them after the header.
+template<bool Simd>
+std::size_t compress_rvl2(const short* input, int num_pixels, std::byte* output) noexcept
+{
+    const auto& tables{get_tables()};
+    const Layout layout{get_layout(num_pixels)};
+    std::uint8_t* bytes{reinterpret_cast<std::uint8_t*>(output)};
+    ValueWriter runs{bytes + layout.run_controls, bytes + layout.run_data, 0};
+    ValueWriter deltas{bytes + layout.delta_controls, bytes + layout.delta_data, 0};
+    const short* end{input + num_pixels};
+    short previous{0};
+    while (input != end) {
+        int zeros{count_run<Simd, true>(input, end)};
+        input += zeros;
+        for (; zeros > MAX_RUN_LENGTH; zeros -= MAX_RUN_LENGTH) {
+            write_value(runs, MAX_RUN_LENGTH);
+            write_value(runs, 0);
+        }
+        write_value(runs, static_cast<std::uint16_t>(zeros));
+
+        int nonzeros{count_run<Simd, false>(input, end)};
+        for (; nonzeros > MAX_RUN_LENGTH; nonzeros -= MAX_RUN_LENGTH) {
+            write_value(runs, MAX_RUN_LENGTH);
+            write_value(runs, 0);
+            write_deltas<Simd>(deltas, input, MAX_RUN_LENGTH, previous, tables);
+            input += MAX_RUN_LENGTH;
+        }
+        write_value(runs, static_cast<std::uint16_t>(nonzeros));
+        write_deltas<Simd>(deltas, input, nonzeros, previous, tables);
+        input += nonzeros;
+    }
+
+    const std::size_t run_data_size{static_cast<std::size_t>(runs.data - (bytes + layout.run_data))};
+    const std::size_t delta_control_size{get_control_size(deltas.count)};
+    const std::size_t delta_data_size{static_cast<std::size_t>(deltas.data - (bytes + layout.delta_data))};
+    std::uint8_t* position{bytes + layout.run_controls + get_control_size(runs.count)};
+    memmove(position, bytes + layout.run_data, run_data_size);
+    position += run_data_size;
+    memmove(position, bytes + layout.delta_controls, delta_control_size);
+    position += delta_control_size;
+    memmove(position, bytes + layout.delta_data, delta_data_size);
+    position += delta_data_size;
+
+    const int header[4]{runs.count, static_cast<int>(run_data_size), deltas.count, static_cast<int>(delta_data_size)};
+    memcpy(bytes, header, sizeof(header));
+
+    return static_cast<std::size_t>(position - bytes);
+}
+
+// Returns zeros after the values of the stream or its data run out, which happens only with broken frames.
+std::uint16_t read_value(ValueStream& stream) noexcept
+{
+    if (stream.index >= stream.count)
+        return 0;
+
+    const int code{(stream.controls[stream.index >> 2] >> ((stream.index & 3) * 2)) & 3};
+    const int length{CODE_LENGTHS[code]};
+    if (stream.data_end - stream.data < length) {
+        stream.index = stream.count;
+        return 0;
+    }
+
+    std::uint16_t value{0};
+    if (length > 0)
+        value = stream.data[0];
+    if (length > 1)
+        value |= static_cast<std::uint16_t>(stream.data[1] << 8);
+    stream.data += length;
+    ++stream.index;
+    return value;
+}
+
+// The 4 bytes of controls read_values_sse41() loads stay before the end of the data,
+// since SIMD_LOAD_SIZE bytes of data are left.
+bool can_read_values_sse41(const ValueStream& stream) noexcept
+{
+    return stream.count - stream.index >= 8 && stream.data_end - stream.data >= SIMD_LOAD_SIZE;
+}
+
+// Same as calling read_value() 8 times, returning the values in 16-bit lanes.
+__m128i read_values_sse41(ValueStream& stream, const Tables& tables) noexcept
+{
+    std::uint32_t control_word;
+    memcpy(&control_word, stream.controls + (stream.index >> 2), sizeof(control_word));
+    const std::uint32_t controls{control_word >> ((stream.index & 3) * 2)};
+    const std::uint32_t low_control{controls & 0xFF};
+    const std::uint32_t high_control{(controls >> 8) & 0xFF};
+
+    const __m128i low_values{_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data)),
+                                              tables.decode_shuffles[low_control])};
+    stream.data += tables.lengths[low_control];
+    const __m128i high_values{_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data)),
+                                               tables.decode_shuffles[high_control])};
+    stream.data += tables.lengths[high_control];
+    stream.index += 8;
+
+    return _mm_unpacklo_epi64(low_values, high_values);
+}
+}
+
+namespace kh
+{
+namespace rvl2
+{
+Kernel get_default_kernel() noexcept
+{
+    return rvl::get_widest_kernel();
+}
+
+std::size_t get_max_compressed_size(int num_pixels) noexcept
+{
+    return get_layout(num_pixels).end;
+}
+
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output)
+{
+    return rvl2::compress_into(input, output, rvl2::get_default_kernel());
+}
+
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output, Kernel kernel)
+{
+    const int num_pixels{gsl::narrow_cast<int>(input.size())};
+    // The kernels do not check the bounds of the output while writing into it.
+    if (output.size() < get_max_compressed_size(num_pixels))
+        throw std::exception("Output of RVL2 compression is smaller than get_max_compressed_size().");
+
+    if (kernel == Kernel::Scalar)
+        return compress_rvl2<false>(input.data(), num_pixels, output.data());
+
+    return compress_rvl2<true>(input.data(), num_pixels, output.data());
+}
+
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output) noexcept
+{
+    rvl2::decompress_into(input, output, rvl2::get_default_kernel());
+}
+
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output, Kernel kernel) noexcept
+{
+    Decompressor{input, kernel}.decompress_next(output);
+}
+
+Decompressor::Decompressor(gsl::span<const std::byte> input) noexcept
+    : Decompressor(input, rvl2::get_default_kernel())
+{
+}
+
+// Frames with a header that does not match their size get decompressed as zeros.
+Decompressor::Decompressor(gsl::span<const std::byte> input, Kernel kernel) noexcept
+    : runs_{}, deltas_{}, previous_{0}, zeros_{0}, nonzeros_{0}, simd_{kernel != Kernel::Scalar}, broken_{true}
+{
+    int header[4];
+    if (input.size() < sizeof(header))
+        return;
+
+    memcpy(header, input.data(), sizeof(header));
+    const int run_count{header[0]};
+    const int run_data_size{header[1]};
+    const int delta_count{header[2]};
+    const int delta_data_size{header[3]};
+    if (run_count < 0 || run_data_size < 0 || delta_count < 0 || delta_data_size < 0)
+        return;
+
+    // In 64 bits not to overflow with broken headers in 32-bit builds.
+    const std::uint64_t frame_size{HEADER_SIZE + get_control_size(run_count) + static_cast<std::uint64_t>(run_data_size) +
+                                   get_control_size(delta_count) + static_cast<std::uint64_t>(delta_data_size)};
+    if (frame_size > input.size())
+        return;
+
+    const std::uint8_t* position{reinterpret_cast<const std::uint8_t*>(input.data()) + HEADER_SIZE};
+    const std::uint8_t* run_data{position + get_control_size(run_count)};
+    runs_ = {position, run_data, run_data + run_data_size, 0, run_count};
+    const std::uint8_t* delta_controls{run_data + run_data_size};
+    const std::uint8_t* delta_data{delta_controls + get_control_size(delta_count)};
+    deltas_ = {delta_controls, delta_data, delta_data + delta_data_size, 0, delta_count};
+    broken_ = false;
+}
+
+// Same as rvl::Decompressor::decompress_next() except that deltas get decoded 8 at a time
+// regardless of their sizes.
+void Decompressor::decompress_next(gsl::span<std::int16_t> output) noexcept
+{
+    const auto& tables{get_tables()};
+    short* output_ptr{reinterpret_cast<short*>(output.data())};
+    int num_pixels_to_decode{gsl::narrow_cast<int>(output.size())};
+    while (num_pixels_to_decode) {
+        if (zeros_ == 0 && nonzeros_ == 0) {
+            // Only broken frames run out of runs before their pixels.
+            if (runs_.index >= runs_.count) {
+                memset(output_ptr, 0, num_pixels_to_decode * sizeof(short));
+                broken_ = true;
+                return;
+            }
+            zeros_ = read_value(runs_); // number of zeros
+            nonzeros_ = read_value(runs_); // number of nonzeros
+        }
+
+        const int zeros{std::min(zeros_, num_pixels_to_decode)};
+        memset(output_ptr, 0, zeros * sizeof(short));
+        output_ptr += zeros;
+        zeros_ -= zeros;
+        num_pixels_to_decode -= zeros;
+
+        int nonzeros{std::min(nonzeros_, num_pixels_to_decode)};
+        nonzeros_ -= nonzeros;
+        num_pixels_to_decode -= nonzeros;
+        if (simd_) {
+            for (; nonzeros >= 8 && can_read_values_sse41(deltas_); nonzeros -= 8) {
+                const __m128i positive{read_values_sse41(deltas_, tables)};
+                // delta = (positive >> 1) ^ -(positive & 1);
+                __m128i current{_mm_xor_si128(_mm_srli_epi16(positive, 1),
+                                              _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(positive, _mm_set1_epi16(1))))};
+                // Prefix sum of the deltas starting from previous.
+                current = _mm_add_epi16(current, _mm_slli_si128(current, 2));
+                current = _mm_add_epi16(current, _mm_slli_si128(current, 4));
+                current = _mm_add_epi16(current, _mm_slli_si128(current, 8));
+                current = _mm_add_epi16(current, _mm_set1_epi16(previous_));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output_ptr), current);
+                previous_ = output_ptr[7];
+                output_ptr += 8;
+            }
+        }
+        for (; nonzeros; nonzeros--) {
+            previous_ = unzigzag(read_value(deltas_), previous_); // nonzero value
+            *output_ptr++ = previous_;
+        }
+    }
+}
+}
+}
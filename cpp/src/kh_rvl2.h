@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <gsl/gsl>
+#include "kh_rvl.h"
+
+// RVL2 keeps the runs of zeros and nonzeros and the zigzag deltas of RVL,
+// but stores them as in
+// Lemire, D., Kurz, N., & Rupp, C. (2018). Stream VByte: Faster byte-oriented integer compression.
+// Information Processing Letters, 130, 38-42.
+// Each value takes 0, 1, or 2 bytes that get told by a 2-bit code in separate control bytes,
+// so the position of a value does not depend on decoding the values before it
+// and 8 values get decoded at once with shuffles. Frames are larger than the ones of RVL
+// since a small value takes a byte instead of a nibble.
+//
+// A frame starts with 4 ints: the numbers of run lengths and their data bytes,
+// then the numbers of deltas and their data bytes. The run lengths and the deltas follow,
+// each as control bytes (codes from the lowest bits of each byte) followed by data bytes (little endian).
+// Runs longer than 0xFFFF get split with empty runs in between, and deltas wrap around in 16 bits,
+// so every value fits in 2 bytes.
+namespace kh
+{
+namespace rvl2
+{
+// Scalar and Sse41 produce the exact same bitstream. Avx2 runs the SSE4.1 kernels,
+// since shuffles of 8 values only use 128 bits.
+using rvl::Kernel;
+
+// The kernel the functions without one use, which is the widest one the CPU supports
+// since the kernels of RVL2 are faster than the scalar one, unlike the ones of RVL.
+Kernel get_default_kernel() noexcept;
+
+// Upper bound of the number of bytes compressing num_pixels pixels can produce.
+std::size_t get_max_compressed_size(int num_pixels) noexcept;
+
+// compress_into() compresses all pixels of input and returns the number of bytes written to output,
+// which should have at least get_max_compressed_size() bytes.
+// decompress_into() fills all pixels of output. Pixels beyond a broken frame get filled with zeros.
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output);
+std::size_t compress_into(gsl::span<const std::int16_t> input, gsl::span<std::byte> output, Kernel kernel);
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output) noexcept;
+void decompress_into(gsl::span<const std::byte> input, gsl::span<std::int16_t> output, Kernel kernel) noexcept;
+
+// The run lengths or the deltas of a frame.
+struct ValueStream
+{
+    const std::uint8_t* controls;
+    const std::uint8_t* data;
+    const std::uint8_t* data_end;
+    int index;
+    int count;
+};
+
+// Same as rvl::Decompressor for RVL2 frames.
+class Decompressor
+{
+public:
+    Decompressor(gsl::span<const std::byte> input) noexcept;
+    Decompressor(gsl::span<const std::byte> input, Kernel kernel) noexcept;
+    // Fills output with the next pixels of the frame.
+    void decompress_next(gsl::span<std::int16_t> output) noexcept;
+    // Whether the header does not match the size of the input or the runs ended before the pixels decompressed so far.
+    bool broken() const noexcept { return broken_; }
+
+private:
+    ValueStream runs_;
+    ValueStream deltas_;
+    short previous_;
+    // Pixels left in the current runs.
+    int zeros_;
+    int nonzeros_;
+    bool simd_;
+    bool broken_;
+};
+}
+}
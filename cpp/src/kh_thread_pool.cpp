@@ -0,0 +1,89 @@
+#include "kh_thread_pool.h"
+
+#include <gsl/gsl>
+
+namespace kh
+{
+ThreadPool::ThreadPool(int thread_count)
+    : threads_{}, mutex_{}, work_condition_{}, done_condition_{}, task_{nullptr}, context_{nullptr}, count_{0}
+    , next_index_{0}, generation_{0}, working_thread_count_{0}, stopped_{false}
+{
+    for (int i{0}; i < thread_count; ++i)
+        threads_.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopped_ = true;
+    }
+    work_condition_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void ThreadPool::run(int count, Task task, void* context)
+{
+    if (threads_.empty() || count < 2) {
+        for (int i{0}; i < count; ++i)
+            task(context, i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        task_ = task;
+        context_ = context;
+        count_ = count;
+        next_index_ = 0;
+        working_thread_count_ = gsl::narrow_cast<int>(threads_.size());
+        ++generation_;
+    }
+    work_condition_.notify_all();
+
+    run_tasks(task, context, count);
+
+    // Wait for every worker, not only for the tasks, so no worker is left behind with this generation
+    // when the next call to run() changes task_ and context_.
+    std::unique_lock<std::mutex> lock{mutex_};
+    done_condition_.wait(lock, [this] { return working_thread_count_ == 0; });
+}
+
+void ThreadPool::run_tasks(Task task, void* context, int count) noexcept
+{
+    for (int index{next_index_++}; index < count; index = next_index_++)
+        task(context, index);
+}
+
+void ThreadPool::work()
+{
+    int generation{0};
+    for (;;) {
+        Task task;
+        void* context;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            work_condition_.wait(lock, [this, generation] { return stopped_ || generation_ != generation; });
+            if (stopped_)
+                return;
+
+            generation = generation_;
+            task = task_;
+            context = context_;
+            count = count_;
+        }
+
+        run_tasks(task, context, count);
+
+        bool last{false};
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            last = --working_thread_count_ == 0;
+        }
+        if (last)
+            done_condition_.notify_one();
+    }
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace kh
+{
+// Worker threads that run the iterations of parallel_for() together with the calling thread.
+// This is for splitting a frame into a few similar sized pieces of work, such as the bands of TRVL,
+// not for general task scheduling.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int thread_count);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Calls function(i) for every i in [0, count) and returns after all of the calls return.
+    // function should not throw. Does not allocate, so it can be called for every frame.
+    template<class Function>
+    void parallel_for(int count, Function&& function)
+    {
+        using FunctionType = std::remove_reference_t<Function>;
+        run(count, [](void* context, int index) { (*static_cast<FunctionType*>(context))(index); },
+            const_cast<void*>(static_cast<const void*>(&function)));
+    }
+
+private:
+    using Task = void (*)(void* context, int index);
+
+    void run(int count, Task task, void* context);
+    void run_tasks(Task task, void* context, int count) noexcept;
+    void work();
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_condition_;
+    std::condition_variable done_condition_;
+    Task task_;
+    void* context_;
+    int count_;
+    std::atomic<int> next_index_;
+    int generation_;
+    int working_thread_count_;
+    bool stopped_;
+};
+}
@@ -0,0 +1,180 @@
+#include "kh_tmrans.h"
+
+#include <cstring>
+#include "kh_mrans.h"
+
+namespace kh
+{
+namespace
+{
+// Frames of the size of the raw pixels are the raw pixels, since mrans frames only get sent when smaller.
+bool decompress_frame(gsl::span<const std::byte> tmrans_frame, int width, gsl::span<std::int16_t> output) noexcept
+{
+    if (tmrans_frame.size() == sizeof(std::int16_t) * output.size()) {
+        memcpy(output.data(), tmrans_frame.data(), tmrans_frame.size());
+        return true;
+    }
+    return mrans::decompress_into(tmrans_frame, width, output);
+}
+}
+
+TmransEncoder::TmransEncoder(int width, int height, const TrvlChangeThresholds& change_thresholds, int invalid_threshold)
+    : width_{width}, height_{height}, values_(width * height), invalid_counts_(width * height)
+    , pixel_diffs_(width * height), change_thresholds_{change_thresholds}, invalid_threshold_{invalid_threshold}
+    , mrans_buffer_(mrans::get_max_compressed_size(width * height))
+{
+    // Invalid counts do not go over invalid_threshold since they get reset there.
+    if (invalid_threshold < 1 || invalid_threshold > UINT8_MAX)
+        throw std::exception("Invalid TMRANS invalid_threshold.");
+}
+
+std::vector<std::byte> TmransEncoder::encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe)
+{
+    std::vector<std::byte> output(get_max_frame_size());
+    output.resize(encode(depth_buffer, keyframe, output));
+    output.shrink_to_fit();
+    return output;
+}
+
+std::size_t TmransEncoder::encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output)
+{
+    if (depth_buffer.size() != values_.size())
+        throw std::exception("Invalid size of depth_buffer for TMRANS encoding.");
+    if (output.size() < get_max_frame_size())
+        throw std::exception("Output of TMRANS encoding is smaller than get_max_frame_size().");
+
+    if (keyframe) {
+        for (gsl::index i{0}; i < depth_buffer.size(); ++i) {
+            values_[i] = depth_buffer[i];
+            // equivalent to depth_buffer[i] == 0 ? 1: 0
+            invalid_counts_[i] = static_cast<std::uint8_t>(depth_buffer[i] == 0);
+        }
+
+        return write_frame(depth_buffer, output);
+    }
+
+    update_trvl_pixels(values_.data(), invalid_counts_.data(), depth_buffer.data(), pixel_diffs_.data(),
+                       depth_buffer.size(), change_thresholds_, invalid_threshold_);
+
+    return write_frame(pixel_diffs_, output);
+}
+
+std::size_t TmransEncoder::encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output)
+{
+    saved_values_ = values_;
+    saved_invalid_counts_ = invalid_counts_;
+
+    const auto frame_size{encode(depth_buffer, false, output)};
+
+    values_.swap(saved_values_);
+    invalid_counts_.swap(saved_invalid_counts_);
+    return frame_size;
+}
+
+void TmransEncoder::save_long_term_reference()
+{
+    long_term_values_ = values_;
+    long_term_invalid_counts_ = invalid_counts_;
+}
+
+std::size_t TmransEncoder::encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output)
+{
+    if (long_term_values_.empty())
+        throw std::exception("TMRANS encoding against a long-term reference that was not saved.");
+
+    values_ = long_term_values_;
+    invalid_counts_ = long_term_invalid_counts_;
+    return encode(depth_buffer, false, output);
+}
+
+std::size_t TmransEncoder::get_max_frame_size() const noexcept
+{
+    return sizeof(std::int16_t) * values_.size();
+}
+
+// Compresses into mrans_buffer_ first, so pixels that mrans does not make smaller
+// (e.g., dense noise or a faulty sensor) get written as they are.
+std::size_t TmransEncoder::write_frame(gsl::span<const std::int16_t> pixels, gsl::span<std::byte> output)
+{
+    const std::size_t size{mrans::compress_into(pixels, width_, mrans_buffer_)};
+    const std::size_t raw_size{sizeof(std::int16_t) * pixels.size()};
+    if (size >= raw_size) {
+        memcpy(output.data(), pixels.data(), raw_size);
+        return raw_size;
+    }
+
+    memcpy(output.data(), mrans_buffer_.data(), size);
+    return size;
+}
+
+TmransDecoder::TmransDecoder(int width, int height)
+    : width_{width}, height_{height}, prev_pixel_values_(width * height, 0), pixel_diffs_(width * height, 0)
+{
+}
+
+std::vector<std::int16_t> TmransDecoder::decode(gsl::span<const std::byte> tmrans_frame, bool keyframe) noexcept
+{
+    std::vector<std::int16_t> depth_pixels(prev_pixel_values_.size());
+    decode_into(tmrans_frame, keyframe, depth_pixels.data(), sizeof(std::int16_t) * width_);
+    return depth_pixels;
+}
+
+bool TmransDecoder::decode_into(gsl::span<const std::byte> tmrans_frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch) noexcept
+{
+    return decode_into(tmrans_frame, keyframe, dst, row_pitch, {});
+}
+
+bool TmransDecoder::decode_into(gsl::span<const std::byte> tmrans_frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch,
+                                gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    if (keyframe) {
+        if (!decompress_frame(tmrans_frame, width_, prev_pixel_values_))
+            return false;
+    } else {
+        // The differences of a broken frame do not get added, so the decoder stays at the previous frame.
+        if (!decompress_frame(tmrans_frame, width_, pixel_diffs_))
+            return false;
+        for (gsl::index i{0}; i < prev_pixel_values_.size(); ++i)
+            prev_pixel_values_[i] += pixel_diffs_[i];
+    }
+
+    if (!dst)
+        return true;
+
+    for (int y{0}; y < height_; ++y) {
+        const std::int16_t* row{prev_pixel_values_.data() + static_cast<gsl::index>(width_) * y};
+        std::int16_t* dst_row{reinterpret_cast<std::int16_t*>(reinterpret_cast<std::byte*>(dst) + row_pitch * y)};
+        if (dequantization_table.empty()) {
+            memcpy(dst_row, row, sizeof(std::int16_t) * width_);
+        } else {
+            for (gsl::index x{0}; x < width_; ++x)
+                dst_row[x] = dequantization_table[static_cast<std::uint16_t>(row[x])];
+        }
+    }
+    return true;
+}
+
+bool TmransDecoder::decode_non_reference_into(gsl::span<const std::byte> tmrans_frame, std::int16_t* dst, std::size_t row_pitch,
+                                              gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    saved_pixel_values_ = prev_pixel_values_;
+    const bool decoded{decode_into(tmrans_frame, false, dst, row_pitch, dequantization_table)};
+    prev_pixel_values_.swap(saved_pixel_values_);
+    return decoded;
+}
+
+void TmransDecoder::save_long_term_reference()
+{
+    long_term_pixel_values_ = prev_pixel_values_;
+}
+
+bool TmransDecoder::decode_long_term_reference_into(gsl::span<const std::byte> tmrans_frame, std::int16_t* dst, std::size_t row_pitch,
+                                                    gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    if (long_term_pixel_values_.empty())
+        return false;
+
+    prev_pixel_values_ = long_term_pixel_values_;
+    return decode_into(tmrans_frame, false, dst, row_pitch, dequantization_table);
+}
+}
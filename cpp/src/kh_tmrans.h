@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <gsl/gsl>
+#include "kh_trvl.h"
+
+namespace kh
+{
+// The temporal mode of kh::mrans that encodes the same differences as TRVL.
+// Keyframes are mrans frames of the depth image and the other frames are mrans frames of the differences.
+// Frames that mrans does not make smaller are the raw pixels instead, which decoders tell from the size of the frame,
+// so no frame gets larger than the raw pixels.
+class TmransEncoder
+{
+public:
+    TmransEncoder(int width, int height, const TrvlChangeThresholds& change_thresholds, int invalid_threshold);
+    std::vector<std::byte> encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe);
+    // Writes the frame into output, which should have at least get_max_frame_size() bytes,
+    // and returns its size. Does not allocate.
+    std::size_t encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output);
+    // Encodes a frame that the next frame does not depend on (see TrvlEncoder::encode_non_reference()).
+    std::size_t encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output);
+    // See TrvlEncoder::save_long_term_reference() and TrvlEncoder::encode_long_term_reference().
+    void save_long_term_reference();
+    std::size_t encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output);
+    std::size_t get_max_frame_size() const noexcept;
+
+private:
+    std::size_t write_frame(gsl::span<const std::int16_t> pixels, gsl::span<std::byte> output);
+
+    int width_;
+    int height_;
+    std::vector<std::int16_t> values_;
+    std::vector<std::uint8_t> invalid_counts_;
+    std::vector<std::int16_t> pixel_diffs_;
+    TrvlChangeThresholds change_thresholds_;
+    int invalid_threshold_;
+    // Frames get compressed here to be written into the output only when smaller than the raw pixels.
+    std::vector<std::byte> mrans_buffer_;
+    std::vector<std::int16_t> saved_values_;
+    std::vector<std::uint8_t> saved_invalid_counts_;
+    std::vector<std::int16_t> long_term_values_;
+    std::vector<std::uint8_t> long_term_invalid_counts_;
+};
+
+class TmransDecoder
+{
+public:
+    TmransDecoder(int width, int height);
+    std::vector<std::int16_t> decode(gsl::span<const std::byte> tmrans_frame, bool keyframe) noexcept;
+    // Writes the decoded pixels into rows of dst that are row_pitch bytes apart.
+    // Returns false when the frame is broken, without touching dst. Broken keyframes leave the decoder
+    // without a frame to add differences to, while other broken frames leave it at the previous frame.
+    // dst can be nullptr for frames that only need to update the state of the decoder.
+    bool decode_into(gsl::span<const std::byte> tmrans_frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch) noexcept;
+    // Writes dequantization_table[pixel] instead of each pixel into dst for frames of DepthQuantizer codes.
+    bool decode_into(gsl::span<const std::byte> tmrans_frame, bool keyframe, std::int16_t* dst, std::size_t row_pitch,
+                     gsl::span<const std::int16_t> dequantization_table) noexcept;
+    // Decodes a frame of TmransEncoder::encode_non_reference(), leaving the state of the decoder as it was.
+    bool decode_non_reference_into(gsl::span<const std::byte> tmrans_frame, std::int16_t* dst, std::size_t row_pitch,
+                                   gsl::span<const std::int16_t> dequantization_table) noexcept;
+    // See TrvlDecoder::save_long_term_reference() and TrvlDecoder::decode_long_term_reference_into().
+    void save_long_term_reference();
+    // Also returns false when the frame is broken.
+    bool decode_long_term_reference_into(gsl::span<const std::byte> tmrans_frame, std::int16_t* dst, std::size_t row_pitch,
+                                         gsl::span<const std::int16_t> dequantization_table) noexcept;
+
+private:
+    int width_;
+    int height_;
+    std::vector<std::int16_t> prev_pixel_values_;
+    std::vector<std::int16_t> pixel_diffs_;
+    std::vector<std::int16_t> saved_pixel_values_;
+    std::vector<std::int16_t> long_term_pixel_values_;
+};
+}
@@ -1,6 +1,12 @@
 #include "kh_trvl.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
 #include "kh_rvl.h"
+#include "kh_rvl2.h"
 
 namespace kh
 {
@@ -14,78 +20,558 @@ std::int16_t absolute_difference(std::int16_t x, std::int16_t y)
         return y - x;
 }
 
-void update_pixel(TrvlPixel& pixel, const std::int16_t raw_value, const std::int16_t change_threshold, const int invalidation_threshold)
+// Bucket of the change threshold of a pixel, where negative values, which are not valid depth, fall into the last one.
+std::uint8_t get_change_threshold(const TrvlChangeThresholds& change_thresholds, std::int16_t value) noexcept
 {
-    if (pixel.value == 0) {
+    const int bucket{static_cast<std::uint16_t>(value) / TRVL_CHANGE_THRESHOLD_BUCKET_SIZE};
+    return change_thresholds[std::min(bucket, static_cast<int>(change_thresholds.size()) - 1)];
+}
+
+void update_pixel(std::int16_t& value, std::uint8_t& invalid_count, const std::int16_t raw_value,
+                  const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold)
+{
+    if (value == 0) {
         if (raw_value > 0)
-            pixel.value = raw_value;
+            value = raw_value;
 
         return;
     }
 
     // Reset the pixel if the depth value indicates the input was invalid two times in a row.
     if (raw_value == 0) {
-        ++pixel.invalid_count;
-        if (pixel.invalid_count >= invalidation_threshold) {
-            pixel.value = 0;
-            pixel.invalid_count = 0;
+        ++invalid_count;
+        if (invalid_count >= invalidation_threshold) {
+            value = 0;
+            invalid_count = 0;
         }
         return;
     }
 
-    pixel.invalid_count = 0;
+    invalid_count = 0;
 
     // Update pixel value when change is detected.
-    if (absolute_difference(pixel.value, raw_value) > change_threshold)
-        pixel.value = raw_value;
+    if (absolute_difference(value, raw_value) > get_change_threshold(change_thresholds, value))
+        value = raw_value;
+}
+
+// Updates pixels with update_pixel() and writes how much the values changed into diffs.
+void update_pixels(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                   gsl::index count, const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold) noexcept
+{
+    for (gsl::index i{0}; i < count; ++i) {
+        const std::int16_t prev_value{values[i]};
+        update_pixel(values[i], invalid_counts[i], raw_values[i], change_thresholds, invalidation_threshold);
+        diffs[i] = values[i] - prev_value;
+    }
+}
+
+// Branchless versions of update_pixels() that select among the cases of update_pixel() with masks.
+// Differences get computed in 16 bits, wrapping around the same way as the int16_t of absolute_difference().
+// Change thresholds get looked up with a byte shuffle of the table, using the bucket of each pixel as the index
+// of its low byte and 0x80 as the one of its high byte for the shuffle to zero it.
+static_assert(TRVL_CHANGE_THRESHOLD_BUCKET_SIZE == 1 << 8, "The SIMD updates shift values by 8 bits for their buckets.");
+static_assert(std::tuple_size<TrvlChangeThresholds>::value == 16, "The SIMD updates look up thresholds with a 16-byte shuffle.");
+
+void update_pixels_sse41(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                         gsl::index count, const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold) noexcept
+{
+    const __m128i zero{_mm_setzero_si128()};
+    const __m128i change_threshold_table{_mm_loadu_si128(reinterpret_cast<const __m128i*>(change_thresholds.data()))};
+    const __m128i last_bucket{_mm_set1_epi16(15)};
+    const __m128i high_byte_zeroing{_mm_set1_epi16(static_cast<short>(0x8000))};
+    const __m128i invalidation_threshold_vector{_mm_set1_epi16(gsl::narrow_cast<short>(invalidation_threshold - 1))};
+    gsl::index i{0};
+    for (; i + 8 <= count; i += 8) {
+        const __m128i prev_values{_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i))};
+        const __m128i prev_counts{_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(invalid_counts + i)))};
+        const __m128i raw{_mm_loadu_si128(reinterpret_cast<const __m128i*>(raw_values + i))};
+
+        const __m128i value_zero{_mm_cmpeq_epi16(prev_values, zero)};
+        const __m128i raw_value_zero{_mm_cmpeq_epi16(raw, zero)};
+        const __m128i raw_value_positive{_mm_cmpgt_epi16(raw, zero)};
+        const __m128i buckets{_mm_min_epu16(_mm_srli_epi16(prev_values, 8), last_bucket)};
+        const __m128i change_threshold_vector{_mm_shuffle_epi8(change_threshold_table, _mm_or_si128(buckets, high_byte_zeroing))};
+        const __m128i changed{_mm_cmpgt_epi16(_mm_sub_epi16(_mm_max_epi16(prev_values, raw), _mm_min_epi16(prev_values, raw)),
+                                              change_threshold_vector)};
+        const __m128i incremented_counts{_mm_sub_epi16(prev_counts, _mm_cmpeq_epi16(zero, zero))};
+        const __m128i invalidated{_mm_cmpgt_epi16(incremented_counts, invalidation_threshold_vector)};
+        // An invalid pixel takes a positive raw value, and a valid pixel takes a valid raw value that changed enough.
+        const __m128i take_raw_value{_mm_blendv_epi8(_mm_andnot_si128(raw_value_zero, changed), raw_value_positive, value_zero)};
+        // A valid pixel becomes invalid after enough invalid raw values in a row.
+        const __m128i clear{_mm_andnot_si128(value_zero, _mm_and_si128(raw_value_zero, invalidated))};
+        const __m128i updated_values{_mm_andnot_si128(clear, _mm_blendv_epi8(prev_values, raw, take_raw_value))};
+        // Counts of invalid pixels stay, and counts of valid pixels increase with invalid raw values and reset otherwise.
+        const __m128i valid_counts{_mm_and_si128(raw_value_zero, _mm_andnot_si128(invalidated, incremented_counts))};
+        const __m128i updated_counts{_mm_blendv_epi8(valid_counts, prev_counts, value_zero)};
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), updated_values);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(invalid_counts + i), _mm_packus_epi16(updated_counts, updated_counts));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(diffs + i), _mm_sub_epi16(updated_values, prev_values));
+    }
+    update_pixels(values + i, invalid_counts + i, raw_values + i, diffs + i, count - i, change_thresholds, invalidation_threshold);
+}
+
+void update_pixels_avx2(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                        gsl::index count, const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold) noexcept
+{
+    const __m256i zero{_mm256_setzero_si256()};
+    // Shuffles work within 128-bit lanes, so both lanes get the table.
+    const __m256i change_threshold_table{_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(change_thresholds.data())))};
+    const __m256i last_bucket{_mm256_set1_epi16(15)};
+    const __m256i high_byte_zeroing{_mm256_set1_epi16(static_cast<short>(0x8000))};
+    const __m256i invalidation_threshold_vector{_mm256_set1_epi16(gsl::narrow_cast<short>(invalidation_threshold - 1))};
+    gsl::index i{0};
+    for (; i + 16 <= count; i += 16) {
+        const __m256i prev_values{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i))};
+        const __m256i prev_counts{_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(invalid_counts + i)))};
+        const __m256i raw{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(raw_values + i))};
+
+        // Same as update_pixels_sse41().
+        const __m256i value_zero{_mm256_cmpeq_epi16(prev_values, zero)};
+        const __m256i raw_value_zero{_mm256_cmpeq_epi16(raw, zero)};
+        const __m256i raw_value_positive{_mm256_cmpgt_epi16(raw, zero)};
+        const __m256i buckets{_mm256_min_epu16(_mm256_srli_epi16(prev_values, 8), last_bucket)};
+        const __m256i change_threshold_vector{_mm256_shuffle_epi8(change_threshold_table, _mm256_or_si256(buckets, high_byte_zeroing))};
+        const __m256i changed{_mm256_cmpgt_epi16(_mm256_sub_epi16(_mm256_max_epi16(prev_values, raw), _mm256_min_epi16(prev_values, raw)),
+                                                 change_threshold_vector)};
+        const __m256i incremented_counts{_mm256_sub_epi16(prev_counts, _mm256_cmpeq_epi16(zero, zero))};
+        const __m256i invalidated{_mm256_cmpgt_epi16(incremented_counts, invalidation_threshold_vector)};
+        const __m256i take_raw_value{_mm256_blendv_epi8(_mm256_andnot_si256(raw_value_zero, changed), raw_value_positive, value_zero)};
+        const __m256i clear{_mm256_andnot_si256(value_zero, _mm256_and_si256(raw_value_zero, invalidated))};
+        const __m256i updated_values{_mm256_andnot_si256(clear, _mm256_blendv_epi8(prev_values, raw, take_raw_value))};
+        const __m256i valid_counts{_mm256_and_si256(raw_value_zero, _mm256_andnot_si256(invalidated, incremented_counts))};
+        const __m256i updated_counts{_mm256_blendv_epi8(valid_counts, prev_counts, value_zero)};
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), updated_values);
+        // Packing works within 128-bit lanes, so the 8 bytes from the upper lane get moved next to the ones from the lower lane.
+        const __m256i packed_counts{_mm256_permute4x64_epi64(_mm256_packus_epi16(updated_counts, updated_counts), 0x08)};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(invalid_counts + i), _mm256_castsi256_si128(packed_counts));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(diffs + i), _mm256_sub_epi16(updated_values, prev_values));
+    }
+    _mm256_zeroupper();
+    update_pixels(values + i, invalid_counts + i, raw_values + i, diffs + i, count - i, change_thresholds, invalidation_threshold);
+}
+
+// Bands are split at rows so receivers can handle them row by row.
+int get_band_first_row(int height, int band_count, int band) noexcept
+{
+    return height * band / band_count;
+}
+
+gsl::index get_band_begin(int width, int height, int band_count, int band) noexcept
+{
+    return static_cast<gsl::index>(get_band_first_row(height, band_count, band)) * width;
+}
+
+std::size_t get_max_compressed_size(TrvlFormat format, int num_pixels) noexcept
+{
+    if (format == TrvlFormat::Rvl2)
+        return rvl2::get_max_compressed_size(num_pixels);
+    return rvl::get_max_compressed_size(num_pixels);
+}
+
+std::size_t compress_into(TrvlFormat format, gsl::span<const std::int16_t> input, gsl::span<std::byte> output)
+{
+    if (format == TrvlFormat::Rvl2)
+        return rvl2::compress_into(input, output);
+    return rvl::compress_into(input, output);
+}
+
+// Whether a band has a size its format can have, which tells frames that got cut without decoding them.
+bool is_band_size_valid(TrvlFormat format, gsl::span<const std::byte> band_frame) noexcept
+{
+    if (format == TrvlFormat::Rvl2)
+        return !rvl2::Decompressor{band_frame}.broken();
+    return !rvl::Decompressor{band_frame}.broken();
+}
+
+std::unique_ptr<ThreadPool> create_band_thread_pool(int band_count)
+{
+    // The calling thread also takes a band.
+    if (band_count < 2)
+        return nullptr;
+    return std::make_unique<ThreadPool>(band_count - 1);
+}
+}
+
+TrvlChangeThresholds create_constant_trvl_change_thresholds(std::int16_t change_threshold)
+{
+    if (change_threshold < 0 || change_threshold > UINT8_MAX)
+        throw std::exception("Invalid TRVL change_threshold.");
+
+    TrvlChangeThresholds change_thresholds;
+    change_thresholds.fill(static_cast<std::uint8_t>(change_threshold));
+    return change_thresholds;
+}
+
+TrvlChangeThresholds create_quadratic_trvl_change_thresholds(float base_threshold, float threshold_per_square_meter)
+{
+    if (base_threshold < 0.0f || threshold_per_square_meter < 0.0f)
+        throw std::exception("Invalid TRVL change thresholds.");
+
+    TrvlChangeThresholds change_thresholds;
+    for (gsl::index bucket{0}; bucket < gsl::narrow_cast<gsl::index>(change_thresholds.size()); ++bucket) {
+        const float depth{(bucket + 0.5f) * TRVL_CHANGE_THRESHOLD_BUCKET_SIZE / 1000.0f};
+        const float threshold{std::round(base_threshold + threshold_per_square_meter * depth * depth)};
+        change_thresholds[bucket] = static_cast<std::uint8_t>(std::min(threshold, static_cast<float>(UINT8_MAX)));
+    }
+    return change_thresholds;
+}
+
+void update_trvl_pixels(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                        gsl::index count, const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold) noexcept
+{
+    update_trvl_pixels(values, invalid_counts, raw_values, diffs, count, change_thresholds, invalidation_threshold,
+                       rvl::get_widest_kernel());
 }
+
+void update_trvl_pixels(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                        gsl::index count, const TrvlChangeThresholds& change_thresholds, const int invalidation_threshold,
+                        rvl::Kernel kernel) noexcept
+{
+    switch (kernel) {
+    case rvl::Kernel::Avx2:
+        update_pixels_avx2(values, invalid_counts, raw_values, diffs, count, change_thresholds, invalidation_threshold);
+        break;
+    case rvl::Kernel::Sse41:
+        update_pixels_sse41(values, invalid_counts, raw_values, diffs, count, change_thresholds, invalidation_threshold);
+        break;
+    default:
+        update_pixels(values, invalid_counts, raw_values, diffs, count, change_thresholds, invalidation_threshold);
+        break;
+    }
 }
 
-TrvlEncoder::TrvlEncoder(int pixel_count, int16_t change_threshold, int invalid_threshold)
-    : pixels_(pixel_count), change_threshold_{change_threshold}, invalid_threshold_{invalid_threshold}
+TrvlEncoder::TrvlEncoder(int width, int height, int16_t change_threshold, int invalid_threshold, int band_count,
+                         bool intra_refresh, TrvlFormat format)
+    : TrvlEncoder{width, height, create_constant_trvl_change_thresholds(change_threshold), invalid_threshold, band_count,
+                  intra_refresh, format}
 {
 }
 
+TrvlEncoder::TrvlEncoder(int width, int height, const TrvlChangeThresholds& change_thresholds, int invalid_threshold, int band_count,
+                         bool intra_refresh, TrvlFormat format)
+    : width_{width}, height_{height}, band_count_{band_count}, format_{format}, values_(width * height), invalid_counts_(width * height)
+    , pixel_diffs_(width * height), change_thresholds_{change_thresholds}, invalid_threshold_{invalid_threshold}
+    , band_offsets_(band_count), band_sizes_(band_count), intra_refresh_{intra_refresh}, refresh_band_{0}
+    , band_refreshes_(band_count), band_refreshed_(band_count, static_cast<std::uint8_t>(!intra_refresh))
+    , thread_pool_{create_band_thread_pool(band_count)}
+{
+    if (band_count < 1 || band_count > height)
+        throw std::exception("Invalid number of TRVL bands.");
+    // With a single band, every frame would be a keyframe.
+    if (intra_refresh && band_count < 2)
+        throw std::exception("TRVL intra refresh requires multiple bands.");
+    // Invalid counts do not go over invalid_threshold since they get reset there.
+    if (invalid_threshold < 1 || invalid_threshold > UINT8_MAX)
+        throw std::exception("Invalid TRVL invalid_threshold.");
+
+    std::size_t band_offset{0};
+    for (int band{0}; band < band_count; ++band) {
+        band_offsets_[band] = band_offset;
+        const gsl::index band_pixel_count{get_band_begin(width_, height_, band_count_, band + 1) -
+                                          get_band_begin(width_, height_, band_count_, band)};
+        band_offset += get_max_compressed_size(format_, gsl::narrow_cast<int>(band_pixel_count));
+    }
+    band_buffer_.resize(band_offset);
+}
+
 std::vector<std::byte> TrvlEncoder::encode(gsl::span<const int16_t> depth_buffer, bool keyframe)
 {
-    const int frame_size{gsl::narrow_cast<int>(pixels_.size())};
-    if (keyframe) {
-        for (gsl::index i{0}; i < frame_size; ++i) {
-            pixels_[i].value = depth_buffer[i];
+    std::vector<std::byte> output(get_max_frame_size());
+    output.resize(encode(depth_buffer, keyframe, output));
+    output.shrink_to_fit();
+    return output;
+}
+
+std::size_t TrvlEncoder::encode(gsl::span<const int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output)
+{
+    // Checking here since exceptions should not get thrown from the bands.
+    if (output.size() < get_max_frame_size())
+        throw std::exception("Output of TRVL encoding is smaller than get_max_frame_size().");
+
+    // A frame that compression did not make smaller gets sent as the raw pixels that got compressed.
+    if (band_count_ == 1) {
+        const std::size_t band_size{encode_band(depth_buffer, keyframe, 0, band_buffer_)};
+        const std::size_t raw_size{sizeof(int16_t) * values_.size()};
+        if (band_size >= raw_size) {
+            memcpy(output.data(), keyframe ? depth_buffer.data() : pixel_diffs_.data(), raw_size);
+            return raw_size;
+        }
+
+        memcpy(output.data(), band_buffer_.data(), band_size);
+        return band_size;
+    }
+
+    if (intra_refresh_) {
+        for (int band{0}; band < band_count_; ++band)
+            band_refreshes_[band] = static_cast<std::uint8_t>(band == refresh_band_);
+        refresh_band_ = (refresh_band_ + 1) % band_count_;
+    } else {
+        std::fill(band_refreshes_.begin(), band_refreshes_.end(), static_cast<std::uint8_t>(keyframe));
+    }
+
+    thread_pool_->parallel_for(band_count_, [&](int band) {
+        band_sizes_[band] = encode_band(depth_buffer, band_refreshes_[band] != 0, band, gsl::span<std::byte>{band_buffer_}.subspan(band_offsets_[band]));
+    });
+
+    // Pack the bands next to each other after the band sizes.
+    // Bands that compression did not make smaller get packed as the raw pixels that got compressed.
+    std::size_t position{sizeof(int) * band_count_};
+    for (int band{0}; band < band_count_; ++band) {
+        const gsl::index band_begin{get_band_begin(width_, height_, band_count_, band)};
+        const gsl::index band_end{get_band_begin(width_, height_, band_count_, band + 1)};
+        const std::size_t raw_band_size{sizeof(int16_t) * (band_end - band_begin)};
+        const bool raw{band_sizes_[band] >= raw_band_size};
+        const std::byte* band_bytes{raw ? reinterpret_cast<const std::byte*>((band_refreshes_[band] ? depth_buffer.data() : pixel_diffs_.data()) + band_begin)
+                                        : band_buffer_.data() + band_offsets_[band]};
+        const std::size_t band_size{raw ? raw_band_size : band_sizes_[band]};
+
+        const int band_header{gsl::narrow_cast<int>(band_size) | (band_refreshes_[band] ? TRVL_BAND_REFRESH_FLAG : 0) | (raw ? TRVL_BAND_RAW_FLAG : 0)};
+        memcpy(output.data() + sizeof(int) * band, &band_header, sizeof(band_header));
+        memcpy(output.data() + position, band_bytes, band_size);
+        position += band_size;
+    }
+
+    return position;
+}
+
+std::size_t TrvlEncoder::encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output)
+{
+    // Only allocates for the first frame.
+    saved_values_ = values_;
+    saved_invalid_counts_ = invalid_counts_;
+    saved_band_refreshed_ = band_refreshed_;
+    const int refresh_band{refresh_band_};
+
+    const auto frame_size{encode(depth_buffer, false, output)};
+
+    values_.swap(saved_values_);
+    invalid_counts_.swap(saved_invalid_counts_);
+    band_refreshed_.swap(saved_band_refreshed_);
+    refresh_band_ = refresh_band;
+    return frame_size;
+}
+
+void TrvlEncoder::save_long_term_reference()
+{
+    long_term_values_ = values_;
+    long_term_invalid_counts_ = invalid_counts_;
+    long_term_band_refreshed_ = band_refreshed_;
+}
+
+std::size_t TrvlEncoder::encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output)
+{
+    if (long_term_values_.empty())
+        throw std::exception("TRVL encoding against a long-term reference that was not saved.");
+
+    // The long-term reference stays for later frames, so it gets copied instead of swapped.
+    values_ = long_term_values_;
+    invalid_counts_ = long_term_invalid_counts_;
+    band_refreshed_ = long_term_band_refreshed_;
+    return encode(depth_buffer, false, output);
+}
+
+// A frame is at most the raw pixels, and the band sizes with multiple bands.
+std::size_t TrvlEncoder::get_max_frame_size() const noexcept
+{
+    if (band_count_ == 1)
+        return sizeof(int16_t) * width_ * height_;
+
+    return sizeof(int) * band_count_ + sizeof(int16_t) * width_ * height_;
+}
+
+std::size_t TrvlEncoder::encode_band(gsl::span<const int16_t> depth_buffer, bool refresh, int band, gsl::span<std::byte> output)
+{
+    const gsl::index band_begin{get_band_begin(width_, height_, band_count_, band)};
+    const gsl::index band_end{get_band_begin(width_, height_, band_count_, band + 1)};
+    if (refresh) {
+        for (gsl::index i{band_begin}; i < band_end; ++i) {
+            values_[i] = depth_buffer[i];
             // equivalent to depth_buffer[i] == 0 ? 1: 0
-            pixels_[i].invalid_count = static_cast<int>(depth_buffer[i] == 0);
+            invalid_counts_[i] = static_cast<std::uint8_t>(depth_buffer[i] == 0);
         }
+        band_refreshed_[band] = 1;
 
-        return rvl::compress(depth_buffer, frame_size);
+        return compress_into(format_, depth_buffer.subspan(band_begin, band_end - band_begin), output);
     }
 
-    std::vector<short> pixel_diffs(frame_size);
-    for (gsl::index i{0}; i < frame_size; ++i) {
-        pixel_diffs[i] = pixels_[i].value;
-        update_pixel(pixels_[i], depth_buffer[i], change_threshold_, invalid_threshold_);
-        pixel_diffs[i] = pixels_[i].value - pixel_diffs[i];
+    // Differences from the initial state would be as large as a refresh, so the band waits for its turn to be refreshed.
+    if (!band_refreshed_[band]) {
+        std::fill(pixel_diffs_.begin() + band_begin, pixel_diffs_.begin() + band_end, static_cast<int16_t>(0));
+        return compress_into(format_, gsl::span<const int16_t>{pixel_diffs_}.subspan(band_begin, band_end - band_begin), output);
     }
 
-    return rvl::compress(pixel_diffs, frame_size);
+    update_trvl_pixels(values_.data() + band_begin, invalid_counts_.data() + band_begin, depth_buffer.data() + band_begin,
+                       pixel_diffs_.data() + band_begin, band_end - band_begin, change_thresholds_, invalid_threshold_);
+
+    return compress_into(format_, gsl::span<const int16_t>{pixel_diffs_}.subspan(band_begin, band_end - band_begin), output);
 }
 
-TrvlDecoder::TrvlDecoder(int pixel_count)
-    : prev_pixel_values_(pixel_count, 0)
+TrvlDecoder::TrvlDecoder(int width, int height, int band_count, TrvlFormat format)
+    : width_{width}, height_{height}, band_count_{band_count}, format_{format}, prev_pixel_values_(width * height, 0)
+    , row_diffs_(width * band_count, 0), band_frames_(band_count), band_flags_(band_count), band_decoded_(band_count), band_synchronized_(band_count, 0)
+    , thread_pool_{create_band_thread_pool(band_count)}
 {
+    if (band_count < 1 || band_count > height)
+        throw std::exception("Invalid number of TRVL bands.");
 }
 
 std::vector<int16_t> TrvlDecoder::decode(gsl::span<const std::byte> trvl_frame, bool keyframe) noexcept
 {
-    const int pixel_count{gsl::narrow_cast<int>(prev_pixel_values_.size())};
-    if (keyframe) {
-        prev_pixel_values_ = rvl::decompress(trvl_frame, pixel_count);
+    std::vector<int16_t> depth_pixels(prev_pixel_values_.size());
+    if (!decode_into(trvl_frame, keyframe, depth_pixels.data(), sizeof(int16_t) * width_))
         return prev_pixel_values_;
+
+    return depth_pixels;
+}
+
+bool TrvlDecoder::decode_into(gsl::span<const std::byte> trvl_frame, bool keyframe, int16_t* dst, std::size_t row_pitch) noexcept
+{
+    return decode_into(trvl_frame, keyframe, dst, row_pitch, {});
+}
+
+bool TrvlDecoder::decode_into(gsl::span<const std::byte> trvl_frame, bool keyframe, int16_t* dst, std::size_t row_pitch,
+                              gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    if (band_count_ == 1) {
+        // Frames of the size of the raw pixels are the raw pixels, since RVL or RVL2 frames only get sent when smaller.
+        const bool raw{trvl_frame.size() == sizeof(int16_t) * prev_pixel_values_.size()};
+        // Skip frames with a size an RVL or RVL2 frame cannot have, which cannot get decoded.
+        if (!raw && !is_band_size_valid(format_, trvl_frame))
+            return false;
+
+        const int band_flags{(keyframe ? TRVL_BAND_REFRESH_FLAG : 0) | (raw ? TRVL_BAND_RAW_FLAG : 0)};
+        return decode_band(trvl_frame, band_flags, 0, dst, row_pitch, dequantization_table);
     }
 
-    const auto pixel_diffs{rvl::decompress(trvl_frame, pixel_count)};
-    for (gsl::index i{0}; i < pixel_count; ++i)
-        prev_pixel_values_[i] += pixel_diffs[i];
+    // Skip frames with band sizes that do not match the frame, which cannot get decoded.
+    std::size_t position{sizeof(int) * band_count_};
+    if (trvl_frame.size() < position)
+        return false;
+
+    for (int band{0}; band < band_count_; ++band) {
+        int band_size;
+        memcpy(&band_size, trvl_frame.data() + sizeof(int) * band, sizeof(band_size));
+        band_flags_[band] = band_size & TRVL_BAND_FLAGS;
+        band_size &= ~TRVL_BAND_FLAGS;
+        if (band_size < 0 || trvl_frame.size() - position < static_cast<std::size_t>(band_size))
+            return false;
+
+        // Raw bands have to have every pixel of the band.
+        const gsl::index band_pixel_count{get_band_begin(width_, height_, band_count_, band + 1) -
+                                          get_band_begin(width_, height_, band_count_, band)};
+        if ((band_flags_[band] & TRVL_BAND_RAW_FLAG) && static_cast<std::size_t>(band_size) != sizeof(int16_t) * band_pixel_count)
+            return false;
+
+        band_frames_[band] = trvl_frame.subspan(position, band_size);
+        position += band_size;
+    }
+
+    thread_pool_->parallel_for(band_count_, [&](int band) {
+        band_decoded_[band] = static_cast<std::uint8_t>(decode_band(band_frames_[band], band_flags_[band], band, dst, row_pitch, dequantization_table));
+    });
+
+    return std::all_of(band_decoded_.begin(), band_decoded_.end(), [](std::uint8_t decoded) { return decoded != 0; });
+}
+
+bool TrvlDecoder::decode_non_reference_into(gsl::span<const std::byte> trvl_frame, int16_t* dst, std::size_t row_pitch,
+                                            gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    saved_pixel_values_ = prev_pixel_values_;
+    saved_band_synchronized_ = band_synchronized_;
+
+    const bool decoded{decode_into(trvl_frame, false, dst, row_pitch, dequantization_table)};
+
+    prev_pixel_values_.swap(saved_pixel_values_);
+    band_synchronized_.swap(saved_band_synchronized_);
+    return decoded;
+}
+
+void TrvlDecoder::save_long_term_reference()
+{
+    long_term_pixel_values_ = prev_pixel_values_;
+    long_term_band_synchronized_ = band_synchronized_;
+}
+
+bool TrvlDecoder::decode_long_term_reference_into(gsl::span<const std::byte> trvl_frame, int16_t* dst, std::size_t row_pitch,
+                                                  gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    if (long_term_pixel_values_.empty())
+        return false;
+
+    // Same sizes, so this does not allocate.
+    prev_pixel_values_ = long_term_pixel_values_;
+    band_synchronized_ = long_term_band_synchronized_;
+    return decode_into(trvl_frame, false, dst, row_pitch, dequantization_table);
+}
+
+bool TrvlDecoder::is_synchronized() const noexcept
+{
+    return std::all_of(band_synchronized_.begin(), band_synchronized_.end(), [](std::uint8_t synchronized) { return synchronized != 0; });
+}
+
+// Decompresses a row at a time to add the differences and copy the pixels to dst while the row is in the cache.
+// Returns false when the RVL or RVL2 data of the band ended before its pixels.
+bool TrvlDecoder::decode_band(gsl::span<const std::byte> band_frame, int band_flags, int band, int16_t* dst, std::size_t row_pitch,
+                              gsl::span<const std::int16_t> dequantization_table) noexcept
+{
+    const int first_row{get_band_first_row(height_, band_count_, band)};
+    const int last_row{get_band_first_row(height_, band_count_, band + 1)};
+    const bool refresh{(band_flags & TRVL_BAND_REFRESH_FLAG) != 0};
+    const bool raw{(band_flags & TRVL_BAND_RAW_FLAG) != 0};
+    if (refresh)
+        band_synchronized_[band] = 1;
+
+    if (!band_synchronized_[band]) {
+        if (!dst)
+            return true;
+
+        for (int row{first_row}; row < last_row; ++row)
+            memset(reinterpret_cast<std::byte*>(dst) + row_pitch * row, 0, sizeof(int16_t) * width_);
+        return true;
+    }
+
+    const gsl::span<int16_t> row_diffs(row_diffs_.data() + static_cast<gsl::index>(width_) * band, width_);
+    // Only the decompressor of the format gets used.
+    rvl::Decompressor rvl_decompressor{format_ == TrvlFormat::Rvl ? band_frame : gsl::span<const std::byte>{}};
+    rvl2::Decompressor rvl2_decompressor{format_ == TrvlFormat::Rvl2 ? band_frame : gsl::span<const std::byte>{}};
+    const std::byte* raw_row{band_frame.data()};
+    // Raw rows get copied with memcpy since they are not aligned to int16_t after odd band sizes.
+    auto read_row = [&](gsl::span<int16_t> row_pixels) {
+        if (raw) {
+            memcpy(row_pixels.data(), raw_row, sizeof(int16_t) * row_pixels.size());
+            raw_row += sizeof(int16_t) * row_pixels.size();
+        } else if (format_ == TrvlFormat::Rvl2) {
+            rvl2_decompressor.decompress_next(row_pixels);
+        } else {
+            rvl_decompressor.decompress_next(row_pixels);
+        }
+    };
+    for (int row{first_row}; row < last_row; ++row) {
+        int16_t* prev_row{prev_pixel_values_.data() + static_cast<gsl::index>(width_) * row};
+        if (refresh) {
+            read_row(gsl::span<int16_t>(prev_row, width_));
+        } else {
+            read_row(row_diffs);
+            for (gsl::index i{0}; i < width_; ++i)
+                prev_row[i] += row_diffs[i];
+        }
+
+        if (!dst)
+            continue;
+
+        int16_t* dst_row{reinterpret_cast<int16_t*>(reinterpret_cast<std::byte*>(dst) + row_pitch * row)};
+        if (dequantization_table.empty()) {
+            memcpy(dst_row, prev_row, sizeof(int16_t) * width_);
+        } else {
+            for (gsl::index i{0}; i < width_; ++i)
+                dst_row[i] = dequantization_table[static_cast<std::uint16_t>(prev_row[i])];
+        }
+    }
 
-    return prev_pixel_values_;
+    if (raw)
+        return true;
+    return format_ == TrvlFormat::Rvl2 ? !rvl2_decompressor.broken() : !rvl_decompressor.broken();
 }
 }
@@ -1,36 +1,173 @@
 #pragma once
 
+#include <array>
+#include <memory>
 #include <vector>
 #include <gsl/gsl>
+#include "kh_rvl.h"
+#include "kh_thread_pool.h"
 
 namespace kh
 {
-struct TrvlPixel
+// A pixel gets updated when its depth changes more than a threshold that depends on its depth,
+// since the noise of depth cameras grows with depth.
+// Pixels kept with depth d use the threshold of bucket d / TRVL_CHANGE_THRESHOLD_BUCKET_SIZE,
+// and the ones beyond the last bucket use the last one.
+constexpr int TRVL_CHANGE_THRESHOLD_BUCKET_SIZE{256};
+using TrvlChangeThresholds = std::array<std::uint8_t, 16>;
+
+// Thresholds that do not depend on depth, which TRVL used before thresholds depended on depth.
+TrvlChangeThresholds create_constant_trvl_change_thresholds(std::int16_t change_threshold);
+// Thresholds that grow with the square of depth as its noise does: base_threshold + threshold_per_square_meter * depth^2
+// in millimeters, with depth in meters at the middle of each bucket.
+TrvlChangeThresholds create_quadratic_trvl_change_thresholds(float base_threshold, float threshold_per_square_meter);
+
+// Updates the pixels an encoder keeps (values and invalid_counts) with a new depth frame (raw_values)
+// and writes the differences receivers need to follow the update into diffs.
+// Shared with other codecs that encode the same temporal differences as TRVL.
+void update_trvl_pixels(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                        gsl::index count, const TrvlChangeThresholds& change_thresholds, int invalidation_threshold) noexcept;
+// Same as above with a kernel of the same kinds as the ones of RVL, all of which give the same pixels and diffs.
+// The one above uses rvl::get_widest_kernel().
+void update_trvl_pixels(std::int16_t* values, std::uint8_t* invalid_counts, const std::int16_t* raw_values, std::int16_t* diffs,
+                        gsl::index count, const TrvlChangeThresholds& change_thresholds, int invalidation_threshold,
+                        rvl::Kernel kernel) noexcept;
+
+// A frame can be split into horizontal bands that get encoded and decoded in parallel.
+// With more than one band, a frame starts with the byte sizes of the bands as ints
+// that are followed by the RVL frame of each band. A band size with TRVL_BAND_REFRESH_FLAG
+// has the band in absolute values (i.e., as in a keyframe) instead of differences,
+// so multi-band frames tell which bands refresh the state of decoders by themselves.
+// A band size with TRVL_BAND_RAW_FLAG has the band as raw int16_t pixels instead of RVL,
+// which happens when RVL does not make the band smaller (e.g., dense noise or a faulty sensor),
+// so a multi-band frame never gets larger than the band sizes and the raw pixels.
+// With a single band, a frame is an RVL frame of the whole depth image as before bands were added,
+// or the raw pixels when RVL does not make them smaller, which decoders tell from the size of the frame
+// since RVL frames only get sent when smaller. So no frame gets larger than the band sizes and the raw pixels.
+constexpr int TRVL_BAND_REFRESH_FLAG{1 << 30};
+constexpr int TRVL_BAND_RAW_FLAG{1 << 29};
+constexpr int TRVL_BAND_FLAGS{TRVL_BAND_REFRESH_FLAG | TRVL_BAND_RAW_FLAG};
+
+// The format bands (or frames with a single band) get compressed with.
+// RVL2 frames are larger than RVL ones, but get decoded faster (see kh_rvl2.h).
+enum class TrvlFormat
 {
-    std::int16_t value{0};
-    int invalid_count{0};
+    Rvl,
+    Rvl2,
 };
 
+// With intra_refresh, keyframes do not get encoded. Instead, each frame refreshes a band in rotation,
+// so a new decoder gets synchronized within band_count frames without a frame as large as a keyframe.
+// Bands that have not been refreshed since the encoder got created get sent without changes.
 class TrvlEncoder
 {
 public:
-    TrvlEncoder(int pixel_count, std::int16_t change_threshold, int invalid_threshold);
+    TrvlEncoder(int width, int height, std::int16_t change_threshold, int invalid_threshold, int band_count = 1,
+                bool intra_refresh = false, TrvlFormat format = TrvlFormat::Rvl);
+    TrvlEncoder(int width, int height, const TrvlChangeThresholds& change_thresholds, int invalid_threshold, int band_count = 1,
+                bool intra_refresh = false, TrvlFormat format = TrvlFormat::Rvl);
     std::vector<std::byte> encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe);
+    // Writes the frame into output, which should have at least get_max_frame_size() bytes,
+    // and returns its size. Does not allocate.
+    std::size_t encode(gsl::span<const std::int16_t> depth_buffer, bool keyframe, gsl::span<std::byte> output);
+    // Encodes a frame against the current state without keeping it, so the next frame does not depend on this one
+    // and decoders can skip it if they do not need it. Decoders take it with decode_non_reference_into().
+    std::size_t encode_non_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output);
+    // Keeps the current state as the long-term reference, which is the state after the last encoded frame.
+    void save_long_term_reference();
+    // Encodes a frame against the long-term reference instead of the last frame and continues from it,
+    // for decoders that lost the frames since. Decoders take it with decode_long_term_reference_into().
+    std::size_t encode_long_term_reference(gsl::span<const std::int16_t> depth_buffer, gsl::span<std::byte> output);
+    std::size_t get_max_frame_size() const noexcept;
+    int band_count() const noexcept { return band_count_; }
+    bool intra_refresh() const noexcept { return intra_refresh_; }
 
 private:
-    std::vector<TrvlPixel> pixels_;
-    std::int16_t change_threshold_;
+    std::size_t encode_band(gsl::span<const std::int16_t> depth_buffer, bool refresh, int band, gsl::span<std::byte> output);
+
+    int width_;
+    int height_;
+    int band_count_;
+    TrvlFormat format_;
+    // The state of pixels is kept in separate arrays for the update of the pixels to be vectorized.
+    std::vector<std::int16_t> values_;
+    std::vector<std::uint8_t> invalid_counts_;
+    std::vector<std::int16_t> pixel_diffs_;
+    TrvlChangeThresholds change_thresholds_;
     int invalid_threshold_;
+    // Bands get compressed at band_offsets_ of band_buffer_ in parallel, then get packed next to each other into the output.
+    std::vector<std::byte> band_buffer_;
+    std::vector<std::size_t> band_offsets_;
+    std::vector<std::size_t> band_sizes_;
+    const bool intra_refresh_;
+    // The band to refresh in the next frame with intra_refresh.
+    int refresh_band_;
+    // Bytes instead of bools since bands get written from different threads.
+    std::vector<std::uint8_t> band_refreshes_;
+    std::vector<std::uint8_t> band_refreshed_;
+    // The state before a frame of encode_non_reference(), which gets swapped back in after it.
+    std::vector<std::int16_t> saved_values_;
+    std::vector<std::uint8_t> saved_invalid_counts_;
+    std::vector<std::uint8_t> saved_band_refreshed_;
+    // The state of save_long_term_reference().
+    std::vector<std::int16_t> long_term_values_;
+    std::vector<std::uint8_t> long_term_invalid_counts_;
+    std::vector<std::uint8_t> long_term_band_refreshed_;
+    std::unique_ptr<ThreadPool> thread_pool_;
 };
 
+// Bands of multi-band frames get decoded as refreshes or differences following their flags, so keyframe only matters
+// for single-band frames. Bands that have not been refreshed since the decoder got created get written as zeros
+// (i.e., invalid depth) since their differences are from values the decoder does not have.
 class TrvlDecoder
 {
 public:
-    TrvlDecoder(int pixel_count);
+    TrvlDecoder(int width, int height, int band_count = 1, TrvlFormat format = TrvlFormat::Rvl);
     std::vector<int16_t> decode(gsl::span<const std::byte> trvl_frame, bool keyframe) noexcept;
+    // Writes the decoded pixels into rows of dst that are row_pitch bytes apart (e.g., a mapped texture)
+    // without copying the frame elsewhere. Returns false when the frame is broken, without touching dst
+    // when its sizes tell it (i.e., band sizes that do not match the frame or a size RVL or RVL2 frames cannot have).
+    // Frames that get found broken while decoding them (e.g., RVL cut at a word) leave zeros in dst after where they end.
+    // dst can be nullptr for frames that only need to update the state of the decoder.
+    bool decode_into(gsl::span<const std::byte> trvl_frame, bool keyframe, int16_t* dst, std::size_t row_pitch) noexcept;
+    // Writes dequantization_table[pixel] instead of each pixel into dst for frames of DepthQuantizer codes.
+    bool decode_into(gsl::span<const std::byte> trvl_frame, bool keyframe, int16_t* dst, std::size_t row_pitch,
+                     gsl::span<const std::int16_t> dequantization_table) noexcept;
+    // Decodes a frame of TrvlEncoder::encode_non_reference(), leaving the state of the decoder as it was.
+    bool decode_non_reference_into(gsl::span<const std::byte> trvl_frame, int16_t* dst, std::size_t row_pitch,
+                                   gsl::span<const std::int16_t> dequantization_table) noexcept;
+    // Keeps the current state for decode_long_term_reference_into(), after the frame the encoder saved it with.
+    void save_long_term_reference();
+    // Decodes a frame of TrvlEncoder::encode_long_term_reference() from the saved state and continues from it.
+    bool decode_long_term_reference_into(gsl::span<const std::byte> trvl_frame, int16_t* dst, std::size_t row_pitch,
+                                         gsl::span<const std::int16_t> dequantization_table) noexcept;
+    // Whether every band has been refreshed, which means the decoded depth matches the one of the encoder.
+    bool is_synchronized() const noexcept;
 
 private:
+    bool decode_band(gsl::span<const std::byte> band_frame, int band_flags, int band, int16_t* dst, std::size_t row_pitch,
+                     gsl::span<const std::int16_t> dequantization_table) noexcept;
+
+    int width_;
+    int height_;
+    int band_count_;
+    TrvlFormat format_;
     // Using int16_t to be compatible with the differences that can have negative values.
     std::vector<int16_t> prev_pixel_values_;
+    // A row of differences for each band.
+    std::vector<int16_t> row_diffs_;
+    std::vector<gsl::span<const std::byte>> band_frames_;
+    // TRVL_BAND_FLAGS of the band sizes.
+    std::vector<int> band_flags_;
+    // Bytes instead of bools since bands get decoded from different threads.
+    std::vector<std::uint8_t> band_decoded_;
+    std::vector<std::uint8_t> band_synchronized_;
+    // The state before a frame of decode_non_reference_into().
+    std::vector<int16_t> saved_pixel_values_;
+    std::vector<std::uint8_t> saved_band_synchronized_;
+    // The state of save_long_term_reference().
+    std::vector<int16_t> long_term_pixel_values_;
+    std::vector<std::uint8_t> long_term_band_synchronized_;
+    std::unique_ptr<ThreadPool> thread_pool_;
 };
 }
\ No newline at end of file
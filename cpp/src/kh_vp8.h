@@ -7,40 +7,92 @@ extern "C" {
 #include <vpx/vp8cx.h>
 #include <vpx/vpx_codec.h>
 #include <gsl/gsl>
-#include "kh_yuv.h"
+#include "kh_color_codec.h"
 
 namespace kh
 {
 
-// A wrapper class for libvpx, encoding color pixels into the VP8 codec.
+// A wrapper class for libvpx, encoding color pixels into the VP8 codec,
+// or into VP9 with codec_id since libvpx takes both the same way.
 class Vp8Encoder
 {
 public:
-    Vp8Encoder(int width, int height);
+    // target_bitrate is in kilobits per second.
+    // token_partition_count is 1, 2, 4, or 8 and temporal_layer_count is 1 to 3.
+    // Both only apply to VP8 (see ColorCodecConfig).
+    // encode_long_term_reference() only gives frames receivers that lost frames can decode
+    // with long_term_reference_recovery.
+    Vp8Encoder(int width, int height, ColorCodecId codec_id = ColorCodecId::Vp8, int target_bitrate = 4000,
+               int token_partition_count = 1, int temporal_layer_count = 1, bool long_term_reference_recovery = false);
     ~Vp8Encoder();
     std::vector<std::byte> encode(const YuvImage& yuv_image, bool keyframe);
+    // Planes of the image allocated by the encoder, with 32-byte aligned rows.
+    // Color pixels written into them get encoded by the next encode(keyframe) call
+    // without allocating a YuvImage every frame.
+    YuvPlanes acquire_input_planes() noexcept;
+    std::vector<std::byte> encode(bool keyframe);
+    // Changes the bitrate of the rate control of libvpx between frames, without restarting the stream.
+    void set_target_bitrate(int target_bitrate);
+    ColorFrameLayer get_last_frame_layer() const noexcept { return last_frame_layer_; }
+    // The layer the next encode() call, or encode_long_term_reference() with from_long_term_reference,
+    // gives its frame. Requests for a long-term reference in between change it.
+    ColorFrameLayer get_next_frame_layer(bool keyframe, bool from_long_term_reference) const noexcept
+    {
+        return get_frame_setting(keyframe, from_long_term_reference).layer;
+    }
+    // The next frame of the base layer gets kept in the altref frame as the long-term reference,
+    // which keyframes also replace.
+    void request_long_term_reference() noexcept { long_term_reference_requested_ = true; }
+    // Encodes the image of acquire_input_planes() into a frame of the base layer that only references
+    // the long-term reference, for receivers that lost frames after it to continue without a keyframe.
+    std::vector<std::byte> encode_long_term_reference();
 
 private:
+    struct FrameSetting
+    {
+        vpx_enc_frame_flags_t flags;
+        ColorFrameLayer layer;
+    };
+
+    // The flags of libvpx and the layer of the next frame, which encode_image() uses.
+    FrameSetting get_frame_setting(bool keyframe, bool from_long_term_reference) const noexcept;
+    std::vector<std::byte> encode_image(vpx_image_t* image, bool keyframe, bool from_long_term_reference);
+
     vpx_codec_ctx_t codec_context_;
+    vpx_codec_enc_cfg_t configuration_;
     vpx_image_t image_;
     int frame_index_;
+    const int temporal_layer_count_;
+    // The position of the next frame in the pattern of the temporal layers.
+    int layer_frame_index_;
+    ColorFrameLayer last_frame_layer_;
+    bool long_term_reference_requested_;
+    // How many frames before the next frame the long-term reference is.
+    int long_term_reference_distance_;
 };
 
-// A wrapper class for FFMpeg, decoding colors pixels in the VP8 codec.
+// A wrapper class for FFMpeg, decoding colors pixels in the VP8 codec, or in VP9 with codec_id.
+// Takes whole frames of Vp8Encoder, as in video messages, without av_parser_parse2()
+// and decodes them into AVFrames of a FFmpegFramePool.
 class Vp8Decoder
 {
 private:
     class CodecContext;
-    class CodecParserContext;
     class Packet;
 
 public:
-    Vp8Decoder();
+    // With thread_count above 1, FFmpeg decodes the token partitions of VP8 or the tile columns of VP9
+    // in slice threads. Frame threads are not used since they delay frames.
+    Vp8Decoder(ColorCodecId codec_id = ColorCodecId::Vp8, int thread_count = 1);
+    // Copies vp8_frame into padded_buffer_, which only allocates when a frame is larger than the previous ones.
     FFmpegFrame decode(gsl::span<const std::byte> vp8_frame);
+    // Decodes vp8_frame without copying it. COLOR_DECODER_PADDING_SIZE zeroed bytes have to follow vp8_frame.
+    FFmpegFrame decode_padded(gsl::span<const std::byte> vp8_frame);
 
 private:
     std::shared_ptr<CodecContext> codec_context_;
-    std::shared_ptr<CodecParserContext> codec_parser_context_;
     std::shared_ptr<Packet> packet_;
+    std::shared_ptr<FFmpegFramePool> frame_pool_;
+    std::vector<std::byte> padded_buffer_;
 };
 }
\ No newline at end of file
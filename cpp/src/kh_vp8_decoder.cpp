@@ -1,5 +1,6 @@
 #include "kh_vp8.h"
 
+#include <cstring>
 #include <iostream>
 #include <libavformat/avformat.h>
 
@@ -29,30 +30,6 @@ private:
     AVCodecContext* codec_context_;
 };
 
-class Vp8Decoder::CodecParserContext
-{
-public:
-    CodecParserContext(int codec_id)
-        : codec_parser_context_{av_parser_init(codec_id)}
-    {
-        if (!codec_parser_context_)
-            throw std::exception("Failed to construct Vp8Decoder::CodecParserContext...");
-    }
-    CodecParserContext(const CodecParserContext&) = delete;
-    CodecParserContext& operator=(const CodecParserContext&) = delete;
-
-    ~CodecParserContext()
-    {
-        if (codec_parser_context_)
-            av_parser_close(codec_parser_context_);
-    }
-
-    AVCodecParserContext* get() noexcept { return codec_parser_context_; }
-
-private:
-    AVCodecParserContext* codec_parser_context_;
-};
-
 class Vp8Decoder::Packet
 {
 public:
@@ -79,83 +56,75 @@ private:
 
 namespace
 {
-AVCodec* find_vp8_codec()
+static_assert(COLOR_DECODER_PADDING_SIZE >= AV_INPUT_BUFFER_PADDING_SIZE,
+              "COLOR_DECODER_PADDING_SIZE is smaller than the padding of FFmpeg.");
+
+AVCodec* find_vp8_codec(ColorCodecId codec_id)
 {
-    auto codec = avcodec_find_decoder(AV_CODEC_ID_VP8);
+    auto codec = avcodec_find_decoder(codec_id == ColorCodecId::Vp9 ? AV_CODEC_ID_VP9 : AV_CODEC_ID_VP8);
     if (!codec)
         throw std::exception("find_codec for Vp8Decoder failed...");
     return codec;
 }
 
-// A helper function for Vp8Decoder::decode() that feeds frames of packet into decoder_frames.
-void decode_packet(AVCodecContext* codec_context, AVPacket* packet, std::vector<FFmpegFrame>& decoder_frames)
+// The buffers of the packets of Vp8Decoder::decode_padded() borrow the frames of its callers.
+void free_nothing(void*, uint8_t*)
 {
-    if (avcodec_send_packet(codec_context, packet) < 0)
-        throw std::exception("Error from avcodec_send_packet.");
-
-    while (true) {
-        auto av_frame = av_frame_alloc();
-        if (!av_frame)
-            throw std::exception("Error from av_frame_alloc.");
-
-        av_frame->format = AV_PIX_FMT_YUV420P;
-
-        int receive_frame_result = avcodec_receive_frame(codec_context, av_frame);
-        if (receive_frame_result == AVERROR(EAGAIN) || receive_frame_result == AVERROR_EOF) {
-            return;
-        } else if (receive_frame_result < 0) {
-            throw std::exception("Error from avcodec_receive_frame.");
-        }
-
-        fflush(stdout);
-        decoder_frames.emplace_back(av_frame);
-    }
 }
 }
 
-Vp8Decoder::Vp8Decoder()
-    : codec_context_{std::make_shared<CodecContext>(find_vp8_codec())}
-    , codec_parser_context_{std::make_shared<CodecParserContext>(codec_context_->get()->codec->id)}
+Vp8Decoder::Vp8Decoder(ColorCodecId codec_id, int thread_count)
+    : codec_context_{std::make_shared<CodecContext>(find_vp8_codec(codec_id))}
     , packet_{std::make_shared<Packet>()}
+    , frame_pool_{std::make_shared<FFmpegFramePool>()}
+    , padded_buffer_{}
 {
+    // FFmpeg decodes as many rows of macroblocks in parallel as the token partitions of a VP8 frame,
+    // up to thread_count.
+    codec_context_->get()->thread_count = thread_count;
+    codec_context_->get()->thread_type = FF_THREAD_SLICE;
     if (avcodec_open2(codec_context_->get(), codec_context_->get()->codec, nullptr) < 0)
         throw std::exception("Error from avcodec_open2.");
 }
 
-
-// Decode frames in vp8_frame_data.
 FFmpegFrame Vp8Decoder::decode(gsl::span<const std::byte> vp8_frame)
 {
-    std::vector<FFmpegFrame> decoder_frames;
-    /* use the parser to split the data into frames */
-    size_t data_size = vp8_frame.size();
-    // Adding buffer padding is important!
-    // Removing this will result in crashes in some cases.
-    // When the crash happens, it happens in av_parser_parse2().
-    std::unique_ptr<uint8_t> padded_data(new uint8_t[data_size + AV_INPUT_BUFFER_PADDING_SIZE]);
-    memcpy(padded_data.get(), vp8_frame.data(), data_size);
-    memset(padded_data.get() + data_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-    uint8_t* data = padded_data.get();
-
-    while (data_size > 0) {
-        // Returns the number of bytes used.
-        const int size = av_parser_parse2(codec_parser_context_->get(),
-            codec_context_->get(), &packet_->get()->data, &packet_->get()->size,
-            data, gsl::narrow_cast<int>(data_size), AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
-
-        if (size < 0)
-            throw std::exception("Error from av_parser_parse2.");
-        
-        data += size;
-        data_size -= size;
-
-        if (packet_->get()->size)
-            decode_packet(codec_context_->get(), packet_->get(), decoder_frames);
-    }
+    const size_t padded_size{vp8_frame.size() + AV_INPUT_BUFFER_PADDING_SIZE};
+    if (padded_buffer_.size() < padded_size)
+        padded_buffer_.resize(padded_size);
 
-    if (decoder_frames.size() != 1)
-        throw std::exception("More or less than one frame found in Vp8Decoder::decode.");
+    memcpy(padded_buffer_.data(), vp8_frame.data(), vp8_frame.size());
+    memset(padded_buffer_.data() + vp8_frame.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    return decode_padded({padded_buffer_.data(), vp8_frame.size()});
+}
+
+// Frames of Vp8Encoder arrive whole, so they go to the decoder as packets without av_parser_parse2().
+FFmpegFrame Vp8Decoder::decode_padded(gsl::span<const std::byte> vp8_frame)
+{
+    auto data{reinterpret_cast<uint8_t*>(const_cast<std::byte*>(vp8_frame.data()))};
+    const int size{gsl::narrow_cast<int>(vp8_frame.size())};
+
+    // avcodec_send_packet() copies packets without buffers, so vp8_frame gets wrapped into one that does not own it.
+    // The decoder has no frame threads and is done with the packet once avcodec_receive_frame() returns.
+    AVPacket* packet{packet_->get()};
+    packet->buf = av_buffer_create(data, size + AV_INPUT_BUFFER_PADDING_SIZE, free_nothing, nullptr, AV_BUFFER_FLAG_READONLY);
+    if (!packet->buf)
+        throw std::exception("Error from av_buffer_create.");
+    packet->data = data;
+    packet->size = size;
+
+    const int send_packet_result{avcodec_send_packet(codec_context_->get(), packet)};
+    av_packet_unref(packet);
+    if (send_packet_result < 0)
+        throw std::exception("Error from avcodec_send_packet.");
+
+    AVFrame* av_frame{frame_pool_->acquire()};
+    if (avcodec_receive_frame(codec_context_->get(), av_frame) < 0) {
+        frame_pool_->release(av_frame);
+        throw std::exception("No frame from avcodec_receive_frame in Vp8Decoder::decode.");
+    }
 
-    return std::move(decoder_frames[0]);
+    return FFmpegFrame{av_frame, frame_pool_};
 }
 }
\ No newline at end of file
@@ -4,39 +4,145 @@
 
 namespace kh
 {
-Vp8Encoder::Vp8Encoder(int width, int height)
-    : codec_context_{}, image_{}, frame_index_{0}
+namespace
 {
-    vpx_codec_iface_t* (*const codec_interface)() = &vpx_codec_vp8_cx;
-    vpx_codec_enc_cfg_t configuration;
+// VP8E_SET_TOKEN_PARTITIONS takes the log2 of the partition count.
+vp8e_token_partitions get_token_partitions(int token_partition_count)
+{
+    switch (token_partition_count) {
+    case 1:
+        return VP8_ONE_TOKENPARTITION;
+    case 2:
+        return VP8_TWO_TOKENPARTITION;
+    case 4:
+        return VP8_FOUR_TOKENPARTITION;
+    case 8:
+        return VP8_EIGHT_TOKENPARTITION;
+    default:
+        throw std::exception("Invalid token_partition_count for Vp8Encoder.");
+    }
+}
+
+struct TemporalLayerFrame
+{
+    int layer_id;
+    vpx_enc_frame_flags_t flags;
+    int reference_frame_distance;
+};
+
+// Frames of the base layer only reference and update the last frame, which frames of the other layers never update,
+// so receivers can skip the other layers. The altref frame only gets updated with long-term references.
+constexpr vpx_enc_frame_flags_t BASE_LAYER_FLAGS{VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF};
+// Frames no other frame references. Keeping the entropy probabilities also keeps them out of later frames.
+constexpr vpx_enc_frame_flags_t NON_REFERENCE_FLAGS{VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF
+                                                    | VP8_EFLAG_NO_UPD_ENTROPY};
+
+// Without other layers, frames reference and update the golden frame as libvpx decides, for the prediction
+// from older frames that saves bits, and only keep the altref frame for long-term references.
+constexpr TemporalLayerFrame ONE_LAYER_PATTERN[]{
+    {0, VP8_EFLAG_NO_UPD_ARF, 1},
+};
+constexpr TemporalLayerFrame TWO_LAYER_PATTERN[]{
+    {0, BASE_LAYER_FLAGS, 2},
+    {1, NON_REFERENCE_FLAGS | VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF, 1},
+};
+// The middle layer keeps its frames in the golden frame for the second frame of the top layer to reference.
+constexpr TemporalLayerFrame THREE_LAYER_PATTERN[]{
+    {0, BASE_LAYER_FLAGS, 4},
+    {2, NON_REFERENCE_FLAGS | VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF, 1},
+    {1, VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY, 2},
+    {2, NON_REFERENCE_FLAGS | VP8_EFLAG_NO_REF_ARF, 1},
+};
+
+gsl::span<const TemporalLayerFrame> get_temporal_layer_pattern(int temporal_layer_count)
+{
+    switch (temporal_layer_count) {
+    case 1:
+        return ONE_LAYER_PATTERN;
+    case 2:
+        return TWO_LAYER_PATTERN;
+    case 3:
+        return THREE_LAYER_PATTERN;
+    default:
+        throw std::exception("Invalid temporal_layer_count for Vp8Encoder.");
+    }
+}
+
+// Splits rc_target_bitrate into the layers, which libvpx takes as the sums of the layers up to each one.
+// The base layer gets more than its share of frames since the other layers get predicted from it.
+void set_temporal_layer_bitrates(vpx_codec_enc_cfg_t& configuration)
+{
+    constexpr float TWO_LAYER_RATIOS[]{0.6f, 1.0f};
+    constexpr float THREE_LAYER_RATIOS[]{0.4f, 0.6f, 1.0f};
+
+    const float* ratios{configuration.ts_number_layers == 2 ? TWO_LAYER_RATIOS : THREE_LAYER_RATIOS};
+    for (unsigned int layer{0}; layer < configuration.ts_number_layers; ++layer)
+        configuration.ts_target_bitrate[layer] = static_cast<unsigned int>(configuration.rc_target_bitrate * ratios[layer]);
+}
+}
+
+Vp8Encoder::Vp8Encoder(int width, int height, ColorCodecId codec_id, int target_bitrate, int token_partition_count,
+                       int temporal_layer_count, bool long_term_reference_recovery)
+    : codec_context_{}, configuration_{}, image_{}, frame_index_{0}
+    , temporal_layer_count_{codec_id == ColorCodecId::Vp9 ? 1 : temporal_layer_count}, layer_frame_index_{0}
+    , last_frame_layer_{0, 1, false, false}, long_term_reference_requested_{false}, long_term_reference_distance_{1}
+{
+    vpx_codec_iface_t* (*const codec_interface)() = codec_id == ColorCodecId::Vp9 ? &vpx_codec_vp9_cx : &vpx_codec_vp8_cx;
 
-    vpx_codec_err_t res = vpx_codec_enc_config_default(codec_interface(), &configuration, 0);
+    vpx_codec_err_t res = vpx_codec_enc_config_default(codec_interface(), &configuration_, 0);
     if (res != VPX_CODEC_OK)
         throw std::exception("Error from vpx_codec_enc_config_default.");
 
     // From https://developers.google.com/media/vp9/live-encoding
     // See also https://www.webmproject.org/docs/encoder-parameters/
-    configuration.g_w = width;
-    configuration.g_h = height;
-    configuration.rc_target_bitrate = 4000;
+    configuration_.g_w = width;
+    configuration_.g_h = height;
+    configuration_.rc_target_bitrate = target_bitrate;
 
-    configuration.g_threads = 4;
-    configuration.g_lag_in_frames = 0;
-    configuration.rc_min_quantizer = 4;
-    configuration.rc_max_quantizer = 48;
-    //configuration.rc_max_quantizer = 56;
+    configuration_.g_threads = 4;
+    configuration_.g_lag_in_frames = 0;
+    configuration_.rc_min_quantizer = 4;
+    configuration_.rc_max_quantizer = 48;
+    //configuration_.rc_max_quantizer = 56;
 
-    configuration.rc_end_usage = VPX_CBR;
+    configuration_.rc_end_usage = VPX_CBR;
+    // Frames do not carry their entropy probabilities over to the next frames, so receivers that skip the upper layers
+    // or lost frames can still decode the frames they get. This costs bitrate, so streams without either stay as they are.
+    if (temporal_layer_count_ > 1 || long_term_reference_recovery)
+        configuration_.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
 
-    res = vpx_codec_enc_init(&codec_context_, codec_interface(), &configuration, 0);
+    // The pattern of the layers repeats every ts_periodicity frames with the layers of ts_layer_id.
+    const auto layer_pattern{get_temporal_layer_pattern(temporal_layer_count_)};
+    if (temporal_layer_count_ > 1) {
+        configuration_.ts_number_layers = temporal_layer_count_;
+        configuration_.ts_periodicity = gsl::narrow_cast<unsigned int>(layer_pattern.size());
+        for (gsl::index i{0}; i < layer_pattern.size(); ++i)
+            configuration_.ts_layer_id[i] = layer_pattern[i].layer_id;
+        for (int layer{0}; layer < temporal_layer_count_; ++layer)
+            configuration_.ts_rate_decimator[layer] = 1 << (temporal_layer_count_ - 1 - layer);
+        set_temporal_layer_bitrates(configuration_);
+    }
+
+    res = vpx_codec_enc_init(&codec_context_, codec_interface(), &configuration_, 0);
     if (res != VPX_CODEC_OK)
         throw std::exception("Error from vpx_codec_enc_init.");
 
-    vpx_codec_control(&codec_context_, VP8E_SET_CPUUSED, 6);
     vpx_codec_control(&codec_context_, VP8E_SET_STATIC_THRESHOLD, 0);
     vpx_codec_control(&codec_context_, VP8E_SET_MAX_INTRA_BITRATE_PCT, 300);
+    if (codec_id == ColorCodecId::Vp9) {
+        // Speeds from 5 run VP9 in its realtime mode. Tile columns are at least 256 pixels wide,
+        // so a depth frame gets two of them (in log2 below), and row based multithreading
+        // lets g_threads go beyond that.
+        vpx_codec_control(&codec_context_, VP8E_SET_CPUUSED, 7);
+        vpx_codec_control(&codec_context_, VP9E_SET_ROW_MT, 1);
+        vpx_codec_control(&codec_context_, VP9E_SET_TILE_COLUMNS, 1);
+        vpx_codec_control(&codec_context_, VP9E_SET_AQ_MODE, 3);
+    } else {
+        vpx_codec_control(&codec_context_, VP8E_SET_CPUUSED, 6);
+        vpx_codec_control(&codec_context_, VP8E_SET_TOKEN_PARTITIONS, get_token_partitions(token_partition_count));
+    }
 
-    if (!vpx_img_alloc(&image_, VPX_IMG_FMT_I420, configuration.g_w, configuration.g_h, 32))
+    if (!vpx_img_alloc(&image_, VPX_IMG_FMT_I420, configuration_.g_w, configuration_.g_h, 32))
         throw std::exception("Error from vpx_img_alloc.");
 }
 
@@ -50,18 +156,96 @@ Vp8Encoder::~Vp8Encoder()
 // Encoding YuvImage with the color pixels with libvpx.
 std::vector<std::byte> Vp8Encoder::encode(const YuvImage& yuv_image, bool keyframe)
 {
+    // A copy of image_ points to yuv_image to keep the planes of image_ for acquire_input_planes().
     // Const casts here is sends yuv image to image planes which will not
     // modify the YUV images, but will just be encoded.
-    image_.planes[VPX_PLANE_Y] = const_cast<unsigned char*>(yuv_image.y_channel().data());
-    image_.planes[VPX_PLANE_U] = const_cast<unsigned char*>(yuv_image.u_channel().data());
-    image_.planes[VPX_PLANE_V] = const_cast<unsigned char*>(yuv_image.v_channel().data());
+    vpx_image_t image{image_};
+    image.planes[VPX_PLANE_Y] = const_cast<unsigned char*>(yuv_image.y_channel().data());
+    image.planes[VPX_PLANE_U] = const_cast<unsigned char*>(yuv_image.u_channel().data());
+    image.planes[VPX_PLANE_V] = const_cast<unsigned char*>(yuv_image.v_channel().data());
+
+    image.stride[VPX_PLANE_Y] = yuv_image.width();
+    image.stride[VPX_PLANE_U] = yuv_image.width() / 2;
+    image.stride[VPX_PLANE_V] = yuv_image.width() / 2;
+
+    return encode_image(&image, keyframe, false);
+}
 
-    image_.stride[VPX_PLANE_Y] = yuv_image.width();
-    image_.stride[VPX_PLANE_U] = yuv_image.width() / 2;
-    image_.stride[VPX_PLANE_V] = yuv_image.width() / 2;
+YuvPlanes Vp8Encoder::acquire_input_planes() noexcept
+{
+    return YuvPlanes{image_.planes[VPX_PLANE_Y], image_.planes[VPX_PLANE_U], image_.planes[VPX_PLANE_V],
+                     image_.stride[VPX_PLANE_Y], image_.stride[VPX_PLANE_U], image_.stride[VPX_PLANE_V]};
+}
+
+// Encoding the color pixels written into the planes from acquire_input_planes().
+std::vector<std::byte> Vp8Encoder::encode(bool keyframe)
+{
+    return encode_image(&image_, keyframe, false);
+}
+
+std::vector<std::byte> Vp8Encoder::encode_long_term_reference()
+{
+    return encode_image(&image_, false, true);
+}
+
+void Vp8Encoder::set_target_bitrate(int target_bitrate)
+{
+    if (configuration_.rc_target_bitrate == static_cast<unsigned int>(target_bitrate))
+        return;
+
+    configuration_.rc_target_bitrate = target_bitrate;
+    if (temporal_layer_count_ > 1)
+        set_temporal_layer_bitrates(configuration_);
+    if (vpx_codec_enc_config_set(&codec_context_, &configuration_) != VPX_CODEC_OK)
+        throw std::exception("Error from vpx_codec_enc_config_set.");
+}
+
+Vp8Encoder::FrameSetting Vp8Encoder::get_frame_setting(bool keyframe, bool from_long_term_reference) const noexcept
+{
+    // Keyframes and frames from the long-term reference start the pattern of the temporal layers over.
+    // The depth of keyframes still depends on the last frame of the base layer when only a band of it gets refreshed.
+    const auto layer_pattern{get_temporal_layer_pattern(temporal_layer_count_)};
+    const int base_layer_frame_distance{layer_frame_index_ == 0 ? gsl::narrow_cast<int>(layer_pattern.size()) : layer_frame_index_};
+    const TemporalLayerFrame& layer_frame{layer_pattern[keyframe || from_long_term_reference ? 0 : layer_frame_index_]};
+
+    FrameSetting frame_setting{layer_frame.flags,
+                               ColorFrameLayer{layer_frame.layer_id, layer_frame.reference_frame_distance, false, false}};
+    if (keyframe) {
+        // Keyframes replace every reference frame, including the altref frame.
+        frame_setting.flags = VPX_EFLAG_FORCE_KF;
+        frame_setting.layer = ColorFrameLayer{0, base_layer_frame_distance, true, false};
+    } else if (from_long_term_reference) {
+        // Only the altref frame gets referenced and the last frame continues from this frame. The golden frame
+        // does as well, since frames of a single layer reference it and the receivers that lost frames may not have it.
+        frame_setting.flags = VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_UPD_ARF;
+        frame_setting.layer = ColorFrameLayer{0, long_term_reference_distance_, false, true};
+    }
+
+    if (!keyframe && long_term_reference_requested_ && frame_setting.layer.temporal_layer_id == 0) {
+        frame_setting.flags = (frame_setting.flags & ~VP8_EFLAG_NO_UPD_ARF) | VP8_EFLAG_FORCE_ARF;
+        frame_setting.layer.long_term_reference = true;
+    }
+
+    return frame_setting;
+}
+
+std::vector<std::byte> Vp8Encoder::encode_image(vpx_image_t* image, bool keyframe, bool from_long_term_reference)
+{
+    const FrameSetting frame_setting{get_frame_setting(keyframe, from_long_term_reference)};
+    if (temporal_layer_count_ > 1)
+        vpx_codec_control(&codec_context_, VP8E_SET_TEMPORAL_LAYER_ID, frame_setting.layer.temporal_layer_id);
+
+    if (frame_setting.layer.long_term_reference) {
+        long_term_reference_requested_ = false;
+        long_term_reference_distance_ = 1;
+    } else {
+        ++long_term_reference_distance_;
+    }
+    last_frame_layer_ = frame_setting.layer;
+    const int layer_pattern_size{gsl::narrow_cast<int>(get_temporal_layer_pattern(temporal_layer_count_).size())};
+    layer_frame_index_ = ((keyframe || from_long_term_reference ? 0 : layer_frame_index_) + 1) % layer_pattern_size;
 
-    const int flags{keyframe ? VPX_EFLAG_FORCE_KF : 0};
-    const vpx_codec_err_t res{vpx_codec_encode(&codec_context_, &image_, frame_index_++, 1, flags, VPX_DL_REALTIME)};
+    const vpx_codec_err_t res{vpx_codec_encode(&codec_context_, image, frame_index_++, 1, frame_setting.flags, VPX_DL_REALTIME)};
 
     if (res != VPX_CODEC_OK)
         throw std::exception("Error from vpx_codec_encode in Vp8Encoder::encode()...");
@@ -1,5 +1,9 @@
 #include "kh_yuv.h"
 
+#include <cstring>
+#include <immintrin.h>
+#include "kh_cpu.h"
+
 namespace kh
 {
 YuvImage createYuvImageFromAzureKinectYuy2Buffer(const uint8_t* buffer, int width, int height, int stride)
@@ -38,45 +42,252 @@ YuvImage createYuvImageFromAzureKinectYuy2Buffer(const uint8_t* buffer, int widt
 }
 
 // Reference: https://docs.microsoft.com/en-us/windows/win32/medfound/recommended-8-bit-yuv-formats-for-video-rendering
+// U and V come from the sums of the 4 pixels of each 2x2 block instead of its top-left pixel,
+// so they take the same formulas with 4 times larger inputs and a 2 bits longer shift.
+// Point sampling aliased edges into the chroma planes and VP8 spent bits on them.
+namespace
+{
+// Converts the pixel pairs of two rows from column begin.
+void convertBgraRowsScalar(const uint8_t* row0, const uint8_t* row1, int begin, int width,
+                           uint8_t* y_row0, uint8_t* y_row1, uint8_t* u_row, uint8_t* v_row) noexcept
+{
+    for (int i = begin; i < width; i += 2) {
+        int b_sum = 0;
+        int g_sum = 0;
+        int r_sum = 0;
+        for (int k = 0; k < 4; ++k) {
+            const uint8_t* pixel = (k < 2 ? row0 : row1) + (i + k % 2) * 4;
+            uint8_t* y_row = k < 2 ? y_row0 : y_row1;
+            uint8_t b = pixel[0];
+            uint8_t g = pixel[1];
+            uint8_t r = pixel[2];
+            y_row[i + k % 2] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            b_sum += b;
+            g_sum += g;
+            r_sum += r;
+        }
+        u_row[i / 2] = ((-38 * r_sum - 74 * g_sum + 112 * b_sum + 512) >> 10) + 128;
+        v_row[i / 2] = ((112 * r_sum - 94 * g_sum - 18 * b_sum + 512) >> 10) + 128;
+    }
+}
+
+// The coefficients in the order of B, G, R, and A for _mm_madd_epi16().
+__m128i getYCoefficientsSse41() noexcept
+{
+    return _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+}
+
+__m128i getUCoefficientsSse41() noexcept
+{
+    return _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+}
+
+__m128i getVCoefficientsSse41() noexcept
+{
+    return _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+}
+
+// Y of 4 pixels from two vectors with 2 pixels in 16 bits.
+__m128i convertYSse41(__m128i pixels0, __m128i pixels1) noexcept
+{
+    const __m128i coefficients{getYCoefficientsSse41()};
+    const __m128i sums{_mm_hadd_epi32(_mm_madd_epi16(pixels0, coefficients), _mm_madd_epi16(pixels1, coefficients))};
+    return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+}
+
+// U or V of 4 blocks from two vectors with the sums of 2 blocks in 16 bits.
+__m128i convertUvSse41(__m128i sums0, __m128i sums1, __m128i coefficients) noexcept
+{
+    const __m128i products{_mm_hadd_epi32(_mm_madd_epi16(sums0, coefficients), _mm_madd_epi16(sums1, coefficients))};
+    return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(products, _mm_set1_epi32(512)), 10), _mm_set1_epi32(128));
+}
+
+// Sums of the 2x2 blocks of 4 pixels from 4 vectors with 2 pixels in 16 bits, the first two from each row.
+__m128i sumBlocksSse41(__m128i row0_pixels0, __m128i row0_pixels1, __m128i row1_pixels0, __m128i row1_pixels1) noexcept
+{
+    const __m128i sums0{_mm_add_epi16(row0_pixels0, row1_pixels0)};
+    const __m128i sums1{_mm_add_epi16(row0_pixels1, row1_pixels1)};
+    return _mm_add_epi16(_mm_unpacklo_epi64(sums0, sums1), _mm_unpackhi_epi64(sums0, sums1));
+}
+
+void convertBgraRowsSse41(const uint8_t* row0, const uint8_t* row1, int width,
+                          uint8_t* y_row0, uint8_t* y_row1, uint8_t* u_row, uint8_t* v_row) noexcept
+{
+    const __m128i zero{_mm_setzero_si128()};
+    int i = 0;
+    for (; width - i >= 8; i += 8) {
+        const __m128i a0{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i * 4))};
+        const __m128i a1{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i * 4 + 16))};
+        const __m128i b0{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i * 4))};
+        const __m128i b1{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i * 4 + 16))};
+        // Pixels i to i + 7 in 16 bits, two at a time.
+        const __m128i a00{_mm_cvtepu8_epi16(a0)};
+        const __m128i a01{_mm_unpackhi_epi8(a0, zero)};
+        const __m128i a10{_mm_cvtepu8_epi16(a1)};
+        const __m128i a11{_mm_unpackhi_epi8(a1, zero)};
+        const __m128i b00{_mm_cvtepu8_epi16(b0)};
+        const __m128i b01{_mm_unpackhi_epi8(b0, zero)};
+        const __m128i b10{_mm_cvtepu8_epi16(b1)};
+        const __m128i b11{_mm_unpackhi_epi8(b1, zero)};
+
+        const __m128i y0{_mm_packs_epi32(convertYSse41(a00, a01), convertYSse41(a10, a11))};
+        const __m128i y1{_mm_packs_epi32(convertYSse41(b00, b01), convertYSse41(b10, b11))};
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y_row0 + i), _mm_packus_epi16(y0, y0));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y_row1 + i), _mm_packus_epi16(y1, y1));
+
+        const __m128i sums0{sumBlocksSse41(a00, a01, b00, b01)};
+        const __m128i sums1{sumBlocksSse41(a10, a11, b10, b11)};
+        const __m128i uv{_mm_packs_epi32(convertUvSse41(sums0, sums1, getUCoefficientsSse41()),
+                                         convertUvSse41(sums0, sums1, getVCoefficientsSse41()))};
+        const __m128i uv_bytes{_mm_packus_epi16(uv, uv)};
+        const int u{_mm_cvtsi128_si32(uv_bytes)};
+        const int v{_mm_extract_epi32(uv_bytes, 1)};
+        memcpy(u_row + i / 2, &u, sizeof(u));
+        memcpy(v_row + i / 2, &v, sizeof(v));
+    }
+    convertBgraRowsScalar(row0, row1, i, width, y_row0, y_row1, u_row, v_row);
+}
+
+__m256i getYCoefficientsAvx2() noexcept
+{
+    return _mm256_broadcastsi128_si256(getYCoefficientsSse41());
+}
+
+__m256i getUCoefficientsAvx2() noexcept
+{
+    return _mm256_broadcastsi128_si256(getUCoefficientsSse41());
+}
+
+__m256i getVCoefficientsAvx2() noexcept
+{
+    return _mm256_broadcastsi128_si256(getVCoefficientsSse41());
+}
+
+// The AVX2 versions work on each 128-bit lane like the SSE4.1 ones,
+// with the pixels of the upper lanes 4 pixels after the ones of the lower lanes.
+__m256i convertYAvx2(__m256i pixels0, __m256i pixels1) noexcept
+{
+    const __m256i coefficients{getYCoefficientsAvx2()};
+    const __m256i sums{_mm256_hadd_epi32(_mm256_madd_epi16(pixels0, coefficients), _mm256_madd_epi16(pixels1, coefficients))};
+    return _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(sums, _mm256_set1_epi32(128)), 8), _mm256_set1_epi32(16));
+}
+
+__m256i convertUvAvx2(__m256i sums0, __m256i sums1, __m256i coefficients) noexcept
+{
+    const __m256i products{_mm256_hadd_epi32(_mm256_madd_epi16(sums0, coefficients), _mm256_madd_epi16(sums1, coefficients))};
+    const __m256i uv{_mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(products, _mm256_set1_epi32(512)), 10), _mm256_set1_epi32(128))};
+    // The lanes have blocks 0, 1, 4, 5 and 2, 3, 6, 7.
+    return _mm256_permute4x64_epi64(uv, 0xD8);
+}
+
+__m256i sumBlocksAvx2(__m256i row0_pixels0, __m256i row0_pixels1, __m256i row1_pixels0, __m256i row1_pixels1) noexcept
+{
+    const __m256i sums0{_mm256_add_epi16(row0_pixels0, row1_pixels0)};
+    const __m256i sums1{_mm256_add_epi16(row0_pixels1, row1_pixels1)};
+    return _mm256_add_epi16(_mm256_unpacklo_epi64(sums0, sums1), _mm256_unpackhi_epi64(sums0, sums1));
+}
+
+// Packs two vectors with 8 values in 32 bits into 16 bytes in order.
+__m128i packBytesAvx2(__m256i values0, __m256i values1) noexcept
+{
+    const __m256i words{_mm256_packs_epi32(values0, values1)};
+    const __m256i bytes{_mm256_packus_epi16(words, words)};
+    return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+}
+
+void convertBgraRowsAvx2(const uint8_t* row0, const uint8_t* row1, int width,
+                         uint8_t* y_row0, uint8_t* y_row1, uint8_t* u_row, uint8_t* v_row) noexcept
+{
+    const __m256i zero{_mm256_setzero_si256()};
+    int i = 0;
+    for (; width - i >= 16; i += 16) {
+        const __m256i a0{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + i * 4))};
+        const __m256i a1{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + i * 4 + 32))};
+        const __m256i b0{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + i * 4))};
+        const __m256i b1{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + i * 4 + 32))};
+        const __m256i a00{_mm256_unpacklo_epi8(a0, zero)};
+        const __m256i a01{_mm256_unpackhi_epi8(a0, zero)};
+        const __m256i a10{_mm256_unpacklo_epi8(a1, zero)};
+        const __m256i a11{_mm256_unpackhi_epi8(a1, zero)};
+        const __m256i b00{_mm256_unpacklo_epi8(b0, zero)};
+        const __m256i b01{_mm256_unpackhi_epi8(b0, zero)};
+        const __m256i b10{_mm256_unpacklo_epi8(b1, zero)};
+        const __m256i b11{_mm256_unpackhi_epi8(b1, zero)};
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y_row0 + i), packBytesAvx2(convertYAvx2(a00, a01), convertYAvx2(a10, a11)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y_row1 + i), packBytesAvx2(convertYAvx2(b00, b01), convertYAvx2(b10, b11)));
+
+        const __m256i sums0{sumBlocksAvx2(a00, a01, b00, b01)};
+        const __m256i sums1{sumBlocksAvx2(a10, a11, b10, b11)};
+        const __m128i uv{packBytesAvx2(convertUvAvx2(sums0, sums1, getUCoefficientsAvx2()),
+                                       convertUvAvx2(sums0, sums1, getVCoefficientsAvx2()))};
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u_row + i / 2), uv);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v_row + i / 2), _mm_srli_si128(uv, 8));
+    }
+    convertBgraRowsScalar(row0, row1, i, width, y_row0, y_row1, u_row, v_row);
+}
+}
+
+BgraConversionKernel getDefaultBgraConversionKernel() noexcept
+{
+    const auto& cpu_features{get_cpu_features()};
+    if (cpu_features.avx2)
+        return BgraConversionKernel::Avx2;
+    if (cpu_features.sse41)
+        return BgraConversionKernel::Sse41;
+    return BgraConversionKernel::Scalar;
+}
+
 YuvImage createYuvImageFromAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride)
 {
-    // Sizes assume Kinect runs in ColorImageFormat_Yuy2.
+    return createYuvImageFromAzureKinectBgraBuffer(buffer, width, height, stride, getDefaultBgraConversionKernel());
+}
+
+YuvImage createYuvImageFromAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride,
+                                                 BgraConversionKernel kernel)
+{
     std::vector<uint8_t> y_channel(width * height);
     std::vector<uint8_t> u_channel(width * height / 4);
     std::vector<uint8_t> v_channel(width * height / 4);
 
-    // Conversion to Y channel.
-    int y_channel_index = 0;
-    for (int j = 0; j < height; ++j) {
-        int buffer_index = j * stride;
-        for (int i = 0; i < width; ++i) {
-            uint8_t b = buffer[buffer_index + 0];
-            uint8_t g = buffer[buffer_index + 1];
-            uint8_t r = buffer[buffer_index + 2];
-            y_channel[y_channel_index++] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
-            buffer_index += 4;
-        }
-    }
+    const YuvPlanes planes{y_channel.data(), u_channel.data(), v_channel.data(), width, width / 2, width / 2};
+    convertAzureKinectBgraBuffer(buffer, width, height, stride, planes, kernel);
 
-    // Calculation of the U and V channels of the pixels.
+    return YuvImage(std::move(y_channel), std::move(u_channel), std::move(v_channel), width, height);
+}
+
+void convertAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride, const YuvPlanes& planes) noexcept
+{
+    convertAzureKinectBgraBuffer(buffer, width, height, stride, planes, getDefaultBgraConversionKernel());
+}
+
+void convertAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride, const YuvPlanes& planes,
+                                  BgraConversionKernel kernel) noexcept
+{
+    // Y of two rows and U and V of the row between them get computed in one pass.
     int uv_width = width / 2;
     int uv_height = height / 2;
-
-    int uv_index = 0;
     for (int j = 0; j < uv_height; ++j) {
-        int buffer_index = j * stride * 2;
-        for (int i = 0; i < uv_width; ++i) {
-            uint8_t b = buffer[buffer_index + 0];
-            uint8_t g = buffer[buffer_index + 1];
-            uint8_t r = buffer[buffer_index + 2];
-            u_channel[uv_index] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
-            v_channel[uv_index] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
-            ++uv_index;
-            buffer_index += 8;
+        const uint8_t* row0 = buffer + j * 2 * stride;
+        const uint8_t* row1 = row0 + stride;
+        uint8_t* y_row0 = planes.y_plane + j * 2 * planes.y_stride;
+        uint8_t* y_row1 = y_row0 + planes.y_stride;
+        uint8_t* u_row = planes.u_plane + j * planes.u_stride;
+        uint8_t* v_row = planes.v_plane + j * planes.v_stride;
+        switch (kernel) {
+        case BgraConversionKernel::Avx2:
+            convertBgraRowsAvx2(row0, row1, uv_width * 2, y_row0, y_row1, u_row, v_row);
+            break;
+        case BgraConversionKernel::Sse41:
+            convertBgraRowsSse41(row0, row1, uv_width * 2, y_row0, y_row1, u_row, v_row);
+            break;
+        default:
+            convertBgraRowsScalar(row0, row1, 0, uv_width * 2, y_row0, y_row1, u_row, v_row);
+            break;
         }
     }
-
-    return YuvImage(std::move(y_channel), std::move(u_channel), std::move(v_channel), width, height);
+    if (kernel == BgraConversionKernel::Avx2)
+        _mm256_zeroupper();
 }
 
 // A helper function for createYuvImageFromAvFrame that converts a AVFrame into a std::vector.
@@ -99,4 +310,55 @@ YuvImage createYuvImageFromAvFrame(const AVFrame& av_frame)
         av_frame.width,
         av_frame.height);
 }
+
+namespace
+{
+// More than this many frames are not out at the same time unless someone holds on to them,
+// so the pool frees the rest instead of growing.
+constexpr size_t MAX_POOLED_AV_FRAME_COUNT{8};
+}
+
+FFmpegFramePool::FFmpegFramePool()
+    : mutex_{}
+    , av_frames_{}
+{
+    av_frames_.reserve(MAX_POOLED_AV_FRAME_COUNT);
+}
+
+FFmpegFramePool::~FFmpegFramePool()
+{
+    for (auto av_frame : av_frames_)
+        av_frame_free(&av_frame);
+}
+
+AVFrame* FFmpegFramePool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!av_frames_.empty()) {
+            auto av_frame{av_frames_.back()};
+            av_frames_.pop_back();
+            return av_frame;
+        }
+    }
+
+    auto av_frame{av_frame_alloc()};
+    if (!av_frame)
+        throw std::exception("Error from av_frame_alloc.");
+
+    return av_frame;
+}
+
+void FFmpegFramePool::release(AVFrame* av_frame) noexcept
+{
+    av_frame_unref(av_frame);
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (av_frames_.size() < MAX_POOLED_AV_FRAME_COUNT) {
+        av_frames_.push_back(av_frame);
+        return;
+    }
+
+    av_frame_free(&av_frame);
+}
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include <vector>
 
 extern "C"
@@ -57,43 +59,110 @@ private:
 };
 
 // A wrapper for AVFrame, the outcome of Vp8Decoder.
+// AVFrames that Vp8Decoder decodes into again and again instead of allocating one for each frame.
+// Frames come back from FFmpegFrame, which can be destructed in another thread (e.g., the render thread of Unity).
+class FFmpegFramePool
+{
+public:
+    FFmpegFramePool();
+    ~FFmpegFramePool();
+    FFmpegFramePool(const FFmpegFramePool& other) = delete;
+    FFmpegFramePool& operator=(const FFmpegFramePool& other) = delete;
+    AVFrame* acquire();
+    // Unreferences the buffers of av_frame, which go back to the buffer pool of the decoder, and keeps av_frame.
+    void release(AVFrame* av_frame) noexcept;
+
+private:
+    std::mutex mutex_;
+    std::vector<AVFrame*> av_frames_;
+};
+
 class FFmpegFrame
 {
 public:
-    FFmpegFrame(AVFrame* av_frame)
+    // av_frame goes back to pool when this gets destructed, or gets freed when pool is null.
+    FFmpegFrame(AVFrame* av_frame, std::shared_ptr<FFmpegFramePool> pool = nullptr)
         : av_frame_(av_frame)
+        , pool_(std::move(pool))
     {
     }
     ~FFmpegFrame()
     {
-        if (av_frame_)
-            av_frame_free(&av_frame_);
+        reset();
     }
     FFmpegFrame(const FFmpegFrame& other) = delete;
     FFmpegFrame& operator=(const FFmpegFrame& other) = delete;
     FFmpegFrame(FFmpegFrame&& other) noexcept
         : av_frame_(other.av_frame_)
+        , pool_(std::move(other.pool_))
     {
         other.av_frame_ = nullptr;
     }
     FFmpegFrame& operator=(FFmpegFrame&& other) noexcept
     {
-        if (av_frame_)
-            av_frame_free(&av_frame_);
+        reset();
 
         av_frame_ = other.av_frame_;
+        pool_ = std::move(other.pool_);
         other.av_frame_ = nullptr;
         return *this;
     }
     const AVFrame* av_frame() const { return av_frame_; }
 
 private:
+    void reset() noexcept
+    {
+        if (!av_frame_)
+            return;
+
+        if (pool_)
+            pool_->release(av_frame_);
+        else
+            av_frame_free(&av_frame_);
+
+        av_frame_ = nullptr;
+    }
+
     AVFrame* av_frame_;
+    std::shared_ptr<FFmpegFramePool> pool_;
+};
+
+// Writable planes of an image in the YUV420 format owned by someone else, such as Vp8Encoder,
+// so color pixels can be converted into them without allocating a YuvImage.
+struct YuvPlanes
+{
+    uint8_t* y_plane;
+    uint8_t* u_plane;
+    uint8_t* v_plane;
+    int y_stride;
+    int u_stride;
+    int v_stride;
 };
 
+// Kernels of createYuvImageFromAzureKinectBgraBuffer() that produce the same pixels.
+// Scalar is the reference implementation and the others convert 8 or 16 pixels of two rows at a time.
+// A kernel has to be supported by the CPU (see get_cpu_features()).
+enum class BgraConversionKernel
+{
+    Scalar,
+    Sse41,
+    Avx2,
+};
+
+// The fastest kernel supported by the CPU, which createYuvImageFromAzureKinectBgraBuffer() uses by default.
+BgraConversionKernel getDefaultBgraConversionKernel() noexcept;
+
 // createYuvImageFromAzureKinectYuy2Buffer(): converts color pixels to a YuvImage.
+// createYuvImageFromAzureKinectBgraBuffer(): converts color pixels to a YuvImage,
+// with U and V of each 2x2 block from the average of its 4 pixels.
 // createYuvImageFromAvFrame(): converts the outcome of Vp8Decoder to color pixels in Yuv420.
 YuvImage createYuvImageFromAzureKinectYuy2Buffer(const uint8_t* buffer, int width, int height, int stride);
 YuvImage createYuvImageFromAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride);
+YuvImage createYuvImageFromAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride,
+                                                 BgraConversionKernel kernel);
+// Converts color pixels the same way as createYuvImageFromAzureKinectBgraBuffer() into planes.
+void convertAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride, const YuvPlanes& planes) noexcept;
+void convertAzureKinectBgraBuffer(const uint8_t* buffer, int width, int height, int stride, const YuvPlanes& planes,
+                                  BgraConversionKernel kernel) noexcept;
 YuvImage createYuvImageFromAvFrame(const AVFrame& av_frame);
 }
\ No newline at end of file
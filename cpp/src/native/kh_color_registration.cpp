@@ -0,0 +1,416 @@
+#include "kh_color_registration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <immintrin.h>
+#include "kh_cpu.h"
+
+namespace kh
+{
+namespace
+{
+// The parameters of the projection of a kernel, copied to keep kernels free from ColorRegistration.
+struct Projection
+{
+    float tx;
+    float ty;
+    float tz;
+    float cx;
+    float cy;
+    float fx;
+    float fy;
+    float k1;
+    float k2;
+    float k3;
+    float k4;
+    float k5;
+    float k6;
+    float p1;
+    float p2;
+    float codx;
+    float cody;
+    float max_radius_squared;
+    int color_width;
+    int color_height;
+    // In pixels.
+    int color_stride;
+};
+
+// Rays of depth pixels in a row and where their BGRA pixels go.
+struct RowPointers
+{
+    const float* ray_x;
+    const float* ray_y;
+    const float* ray_z;
+    const std::int16_t* depth;
+    std::uint32_t* bgra;
+};
+
+// The projection of the Brown-Conrady model in the Azure Kinect SDK, with the polynomials in Horner's form.
+// The SIMD kernels follow the same order of operations, so they find the same color pixels.
+void transform_row_scalar(const Projection& projection, const RowPointers& row, int begin, int width,
+                          const std::uint32_t* color_pixels) noexcept
+{
+    for (int i = begin; i < width; ++i) {
+        row.bgra[i] = 0;
+        const int depth{static_cast<std::uint16_t>(row.depth[i])};
+        if (depth == 0)
+            continue;
+
+        const float z{static_cast<float>(depth)};
+        const float x{row.ray_x[i] * z + projection.tx};
+        const float y{row.ray_y[i] * z + projection.ty};
+        const float zz{row.ray_z[i] * z + projection.tz};
+        // Also false for the NaNs of the pixels out of the lens model of the depth camera.
+        if (!(zz > 0.0f))
+            continue;
+
+        const float z_inv{1.0f / zz};
+        const float xp{x * z_inv - projection.codx};
+        const float yp{y * z_inv - projection.cody};
+        const float xp2{xp * xp};
+        const float yp2{yp * yp};
+        const float xyp{xp * yp};
+        const float rs{xp2 + yp2};
+        if (!(rs <= projection.max_radius_squared))
+            continue;
+
+        const float a{1.0f + rs * (projection.k1 + rs * (projection.k2 + rs * projection.k3))};
+        const float b{1.0f + rs * (projection.k4 + rs * (projection.k5 + rs * projection.k6))};
+        const float d{a / b};
+        const float xp_d{xp * d + (rs + 2.0f * xp2) * projection.p2 + 2.0f * xyp * projection.p1};
+        const float yp_d{yp * d + (rs + 2.0f * yp2) * projection.p1 + 2.0f * xyp * projection.p2};
+        const float u{(xp_d + projection.codx) * projection.fx + projection.cx};
+        const float v{(yp_d + projection.cody) * projection.fy + projection.cy};
+        // Keeps lrint() away from values that do not fit in an int.
+        if (!(u > -1.0f && u < projection.color_width && v > -1.0f && v < projection.color_height))
+            continue;
+
+        // Rounds to the nearest even integer as the conversions of SSE and AVX.
+        const int ui{static_cast<int>(std::lrint(u))};
+        const int vi{static_cast<int>(std::lrint(v))};
+        if (ui < 0 || ui >= projection.color_width || vi < 0 || vi >= projection.color_height)
+            continue;
+
+        row.bgra[i] = color_pixels[vi * projection.color_stride + ui];
+    }
+}
+
+void transform_row_sse41(const Projection& projection, const RowPointers& row, int width,
+                         const std::uint32_t* color_pixels) noexcept
+{
+    const __m128 zero{_mm_setzero_ps()};
+    const __m128 one{_mm_set1_ps(1.0f)};
+    const __m128 two{_mm_set1_ps(2.0f)};
+    int i = 0;
+    for (; width - i >= 4; i += 4) {
+        const __m128i depth{_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row.depth + i)))};
+        const __m128 z{_mm_cvtepi32_ps(depth)};
+        const __m128 x{_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row.ray_x + i), z), _mm_set1_ps(projection.tx))};
+        const __m128 y{_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row.ray_y + i), z), _mm_set1_ps(projection.ty))};
+        const __m128 zz{_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row.ray_z + i), z), _mm_set1_ps(projection.tz))};
+        __m128 valid{_mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(depth, _mm_setzero_si128())), _mm_cmpgt_ps(zz, zero))};
+
+        const __m128 z_inv{_mm_div_ps(one, zz)};
+        const __m128 xp{_mm_sub_ps(_mm_mul_ps(x, z_inv), _mm_set1_ps(projection.codx))};
+        const __m128 yp{_mm_sub_ps(_mm_mul_ps(y, z_inv), _mm_set1_ps(projection.cody))};
+        const __m128 xp2{_mm_mul_ps(xp, xp)};
+        const __m128 yp2{_mm_mul_ps(yp, yp)};
+        const __m128 xyp{_mm_mul_ps(xp, yp)};
+        const __m128 rs{_mm_add_ps(xp2, yp2)};
+        valid = _mm_and_ps(valid, _mm_cmple_ps(rs, _mm_set1_ps(projection.max_radius_squared)));
+
+        const __m128 a{_mm_add_ps(one, _mm_mul_ps(rs, _mm_add_ps(_mm_set1_ps(projection.k1),
+                                                                 _mm_mul_ps(rs, _mm_add_ps(_mm_set1_ps(projection.k2),
+                                                                                           _mm_mul_ps(rs, _mm_set1_ps(projection.k3)))))))};
+        const __m128 b{_mm_add_ps(one, _mm_mul_ps(rs, _mm_add_ps(_mm_set1_ps(projection.k4),
+                                                                 _mm_mul_ps(rs, _mm_add_ps(_mm_set1_ps(projection.k5),
+                                                                                           _mm_mul_ps(rs, _mm_set1_ps(projection.k6)))))))};
+        const __m128 d{_mm_div_ps(a, b)};
+        const __m128 xyp2{_mm_mul_ps(two, xyp)};
+        const __m128 xp_d{_mm_add_ps(_mm_add_ps(_mm_mul_ps(xp, d),
+                                                _mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, xp2)), _mm_set1_ps(projection.p2))),
+                                     _mm_mul_ps(xyp2, _mm_set1_ps(projection.p1)))};
+        const __m128 yp_d{_mm_add_ps(_mm_add_ps(_mm_mul_ps(yp, d),
+                                                _mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, yp2)), _mm_set1_ps(projection.p1))),
+                                     _mm_mul_ps(xyp2, _mm_set1_ps(projection.p2)))};
+        const __m128 u{_mm_add_ps(_mm_mul_ps(_mm_add_ps(xp_d, _mm_set1_ps(projection.codx)), _mm_set1_ps(projection.fx)),
+                                  _mm_set1_ps(projection.cx))};
+        const __m128 v{_mm_add_ps(_mm_mul_ps(_mm_add_ps(yp_d, _mm_set1_ps(projection.cody)), _mm_set1_ps(projection.fy)),
+                                  _mm_set1_ps(projection.cy))};
+
+        // Values that do not fit in an int become INT_MIN, which is out of the color image.
+        const __m128i ui{_mm_cvtps_epi32(u)};
+        const __m128i vi{_mm_cvtps_epi32(v)};
+        const __m128i inside{_mm_and_si128(_mm_andnot_si128(_mm_cmplt_epi32(ui, _mm_setzero_si128()),
+                                                            _mm_cmplt_epi32(ui, _mm_set1_epi32(projection.color_width))),
+                                           _mm_andnot_si128(_mm_cmplt_epi32(vi, _mm_setzero_si128()),
+                                                            _mm_cmplt_epi32(vi, _mm_set1_epi32(projection.color_height))))};
+        const int mask{_mm_movemask_ps(_mm_and_ps(valid, _mm_castsi128_ps(inside)))};
+        alignas(16) std::int32_t indices[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices),
+                        _mm_add_epi32(_mm_mullo_epi32(vi, _mm_set1_epi32(projection.color_stride)), ui));
+        // There is no gather in SSE4.1.
+        for (int k = 0; k < 4; ++k)
+            row.bgra[i + k] = (mask & (1 << k)) ? color_pixels[indices[k]] : 0;
+    }
+    transform_row_scalar(projection, row, i, width, color_pixels);
+}
+
+void transform_row_avx2(const Projection& projection, const RowPointers& row, int width,
+                        const std::uint32_t* color_pixels) noexcept
+{
+    const __m256 zero{_mm256_setzero_ps()};
+    const __m256 one{_mm256_set1_ps(1.0f)};
+    const __m256 two{_mm256_set1_ps(2.0f)};
+    int i = 0;
+    for (; width - i >= 8; i += 8) {
+        const __m256i depth{_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row.depth + i)))};
+        const __m256 z{_mm256_cvtepi32_ps(depth)};
+        const __m256 x{_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(row.ray_x + i), z), _mm256_set1_ps(projection.tx))};
+        const __m256 y{_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(row.ray_y + i), z), _mm256_set1_ps(projection.ty))};
+        const __m256 zz{_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(row.ray_z + i), z), _mm256_set1_ps(projection.tz))};
+        __m256 valid{_mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(depth, _mm256_setzero_si256())),
+                                      _mm256_cmp_ps(zz, zero, _CMP_GT_OQ))};
+
+        const __m256 z_inv{_mm256_div_ps(one, zz)};
+        const __m256 xp{_mm256_sub_ps(_mm256_mul_ps(x, z_inv), _mm256_set1_ps(projection.codx))};
+        const __m256 yp{_mm256_sub_ps(_mm256_mul_ps(y, z_inv), _mm256_set1_ps(projection.cody))};
+        const __m256 xp2{_mm256_mul_ps(xp, xp)};
+        const __m256 yp2{_mm256_mul_ps(yp, yp)};
+        const __m256 xyp{_mm256_mul_ps(xp, yp)};
+        const __m256 rs{_mm256_add_ps(xp2, yp2)};
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(rs, _mm256_set1_ps(projection.max_radius_squared), _CMP_LE_OQ));
+
+        const __m256 a{_mm256_add_ps(one, _mm256_mul_ps(rs, _mm256_add_ps(_mm256_set1_ps(projection.k1),
+                                                                          _mm256_mul_ps(rs, _mm256_add_ps(_mm256_set1_ps(projection.k2),
+                                                                                                          _mm256_mul_ps(rs, _mm256_set1_ps(projection.k3)))))))};
+        const __m256 b{_mm256_add_ps(one, _mm256_mul_ps(rs, _mm256_add_ps(_mm256_set1_ps(projection.k4),
+                                                                          _mm256_mul_ps(rs, _mm256_add_ps(_mm256_set1_ps(projection.k5),
+                                                                                                          _mm256_mul_ps(rs, _mm256_set1_ps(projection.k6)))))))};
+        const __m256 d{_mm256_div_ps(a, b)};
+        const __m256 xyp2{_mm256_mul_ps(two, xyp)};
+        const __m256 xp_d{_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xp, d),
+                                                      _mm256_mul_ps(_mm256_add_ps(rs, _mm256_mul_ps(two, xp2)), _mm256_set1_ps(projection.p2))),
+                                        _mm256_mul_ps(xyp2, _mm256_set1_ps(projection.p1)))};
+        const __m256 yp_d{_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(yp, d),
+                                                      _mm256_mul_ps(_mm256_add_ps(rs, _mm256_mul_ps(two, yp2)), _mm256_set1_ps(projection.p1))),
+                                        _mm256_mul_ps(xyp2, _mm256_set1_ps(projection.p2)))};
+        const __m256 u{_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(xp_d, _mm256_set1_ps(projection.codx)), _mm256_set1_ps(projection.fx)),
+                                     _mm256_set1_ps(projection.cx))};
+        const __m256 v{_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(yp_d, _mm256_set1_ps(projection.cody)), _mm256_set1_ps(projection.fy)),
+                                     _mm256_set1_ps(projection.cy))};
+
+        const __m256i ui{_mm256_cvtps_epi32(u)};
+        const __m256i vi{_mm256_cvtps_epi32(v)};
+        const __m256i inside{_mm256_and_si256(_mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), ui),
+                                                                  _mm256_cmpgt_epi32(_mm256_set1_epi32(projection.color_width), ui)),
+                                              _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), vi),
+                                                                  _mm256_cmpgt_epi32(_mm256_set1_epi32(projection.color_height), vi)))};
+        const __m256i mask{_mm256_and_si256(_mm256_castps_si256(valid), inside)};
+        const __m256i indices{_mm256_add_epi32(_mm256_mullo_epi32(vi, _mm256_set1_epi32(projection.color_stride)), ui)};
+        // Lanes out of the mask keep zeros without being loaded.
+        const __m256i bgra{_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(color_pixels),
+                                                       indices, mask, 4)};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row.bgra + i), bgra);
+    }
+    transform_row_scalar(projection, row, i, width, color_pixels);
+}
+
+BgraConversionKernel get_bgra_conversion_kernel(ColorRegistrationKernel kernel) noexcept
+{
+    switch (kernel) {
+    case ColorRegistrationKernel::Avx2:
+        return BgraConversionKernel::Avx2;
+    case ColorRegistrationKernel::Sse41:
+        return BgraConversionKernel::Sse41;
+    default:
+        return BgraConversionKernel::Scalar;
+    }
+}
+
+std::unique_ptr<ThreadPool> create_band_thread_pool(int band_count)
+{
+    // The calling thread also takes a band.
+    if (band_count < 2)
+        return nullptr;
+    return std::make_unique<ThreadPool>(band_count - 1);
+}
+
+// Rotates the rays of the depth pixels, (x, y, 1), to the color camera.
+std::vector<float> rotate_rays(const ColorRegistrationCalibration& calibration, int axis)
+{
+    const auto& rotation{calibration.rotation};
+    std::vector<float> rays(calibration.x_with_unit_depth.size());
+    for (gsl::index i{0}; i < gsl::narrow_cast<gsl::index>(rays.size()); ++i) {
+        rays[i] = rotation[axis * 3] * calibration.x_with_unit_depth[i]
+                + rotation[axis * 3 + 1] * calibration.y_with_unit_depth[i]
+                + rotation[axis * 3 + 2];
+    }
+    return rays;
+}
+
+float get_max_radius_squared(float metric_radius) noexcept
+{
+    if (metric_radius <= 0.0f)
+        return std::numeric_limits<float>::infinity();
+    return metric_radius * metric_radius;
+}
+}
+
+ColorRegistrationCalibration create_color_registration_calibration(const k4a::calibration& calibration)
+{
+    const auto& color_camera_calibration{calibration.color_camera_calibration};
+    if (color_camera_calibration.intrinsics.type != K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY)
+        throw std::exception("ColorRegistration only supports the Brown-Conrady model.");
+
+    ColorRegistrationCalibration registration_calibration;
+    registration_calibration.depth_width = calibration.depth_camera_calibration.resolution_width;
+    registration_calibration.depth_height = calibration.depth_camera_calibration.resolution_height;
+
+    const int depth_pixel_count{registration_calibration.depth_width * registration_calibration.depth_height};
+    registration_calibration.x_with_unit_depth.resize(depth_pixel_count);
+    registration_calibration.y_with_unit_depth.resize(depth_pixel_count);
+    k4a_float3_t point;
+    for (int j{0}; j < registration_calibration.depth_height; ++j) {
+        for (int i{0}; i < registration_calibration.depth_width; ++i) {
+            const int index{i + j * registration_calibration.depth_width};
+            if (!calibration.convert_2d_to_3d(k4a_float2_t{gsl::narrow_cast<float>(i), gsl::narrow_cast<float>(j)},
+                                              1.0f,
+                                              K4A_CALIBRATION_TYPE_DEPTH,
+                                              K4A_CALIBRATION_TYPE_DEPTH,
+                                              &point)) {
+                registration_calibration.x_with_unit_depth[index] = std::numeric_limits<float>::quiet_NaN();
+                registration_calibration.y_with_unit_depth[index] = std::numeric_limits<float>::quiet_NaN();
+                continue;
+            }
+            registration_calibration.x_with_unit_depth[index] = point.xyz.x;
+            registration_calibration.y_with_unit_depth[index] = point.xyz.y;
+        }
+    }
+
+    const auto& extrinsics{calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR]};
+    std::copy(std::begin(extrinsics.rotation), std::end(extrinsics.rotation), registration_calibration.rotation.begin());
+    std::copy(std::begin(extrinsics.translation), std::end(extrinsics.translation), registration_calibration.translation.begin());
+
+    const auto& parameters{color_camera_calibration.intrinsics.parameters.param};
+    auto& color_intrinsics{registration_calibration.color_intrinsics};
+    color_intrinsics.width = color_camera_calibration.resolution_width;
+    color_intrinsics.height = color_camera_calibration.resolution_height;
+    color_intrinsics.cx = parameters.cx;
+    color_intrinsics.cy = parameters.cy;
+    color_intrinsics.fx = parameters.fx;
+    color_intrinsics.fy = parameters.fy;
+    color_intrinsics.k = {parameters.k1, parameters.k2, parameters.k3, parameters.k4, parameters.k5, parameters.k6};
+    color_intrinsics.p1 = parameters.p1;
+    color_intrinsics.p2 = parameters.p2;
+    color_intrinsics.codx = parameters.codx;
+    color_intrinsics.cody = parameters.cody;
+    color_intrinsics.metric_radius = color_camera_calibration.metric_radius;
+
+    return registration_calibration;
+}
+
+ColorRegistrationKernel get_default_color_registration_kernel() noexcept
+{
+    const auto& cpu_features{get_cpu_features()};
+    if (cpu_features.avx2)
+        return ColorRegistrationKernel::Avx2;
+    if (cpu_features.sse41)
+        return ColorRegistrationKernel::Sse41;
+    return ColorRegistrationKernel::Scalar;
+}
+
+ColorRegistration::ColorRegistration(const ColorRegistrationCalibration& calibration, int band_count)
+    : ColorRegistration(calibration, band_count, get_default_color_registration_kernel())
+{
+}
+
+ColorRegistration::ColorRegistration(const ColorRegistrationCalibration& calibration, int band_count,
+                                     ColorRegistrationKernel kernel)
+    : width_{calibration.depth_width}
+    , height_{calibration.depth_height}
+    , color_intrinsics_{calibration.color_intrinsics}
+    , translation_{calibration.translation}
+    , max_radius_squared_{get_max_radius_squared(calibration.color_intrinsics.metric_radius)}
+    , band_count_{band_count}
+    , kernel_{kernel}
+    , ray_x_{rotate_rays(calibration, 0)}
+    , ray_y_{rotate_rays(calibration, 1)}
+    , ray_z_{rotate_rays(calibration, 2)}
+    , bgra_buffer_(static_cast<std::size_t>(band_count) * 2 * calibration.depth_width)
+    , thread_pool_{create_band_thread_pool(band_count)}
+{
+    // Each 2x2 block of YUV420 is made from the same two rows.
+    if (width_ % 2 != 0 || height_ % 2 != 0)
+        throw std::exception("ColorRegistration needs a depth image with an even width and height.");
+    if (calibration.x_with_unit_depth.size() != static_cast<std::size_t>(width_ * height_) ||
+        calibration.y_with_unit_depth.size() != static_cast<std::size_t>(width_ * height_))
+        throw std::exception("Invalid ColorRegistrationCalibration ray sizes.");
+    if (band_count < 1 || band_count > height_ / 2)
+        throw std::exception("Invalid ColorRegistration band_count.");
+}
+
+void ColorRegistration::transform(gsl::span<const std::int16_t> depth_pixels, const std::uint8_t* color_buffer,
+                                  int color_stride, const YuvPlanes& planes)
+{
+    if (depth_pixels.size() != width_ * height_)
+        throw std::exception("Invalid depth_pixels size for ColorRegistration::transform().");
+    if (color_stride % sizeof(std::uint32_t) != 0)
+        throw std::exception("Invalid color_stride for ColorRegistration::transform().");
+
+    const int row_pair_count{height_ / 2};
+    const auto transform_band{[&](int band) {
+        std::uint32_t* bgra_rows{bgra_buffer_.data() + static_cast<std::size_t>(band) * 2 * width_};
+        const int row_pair_end{row_pair_count * (band + 1) / band_count_};
+        for (int row_pair_index{row_pair_count * band / band_count_}; row_pair_index < row_pair_end; ++row_pair_index)
+            transform_rows(depth_pixels, color_buffer, color_stride, planes, row_pair_index, bgra_rows);
+    }};
+
+    if (!thread_pool_) {
+        transform_band(0);
+        return;
+    }
+    thread_pool_->parallel_for(band_count_, transform_band);
+}
+
+void ColorRegistration::transform_rows(gsl::span<const std::int16_t> depth_pixels, const std::uint8_t* color_buffer,
+                                       int color_stride, const YuvPlanes& planes, int row_pair_index,
+                                       std::uint32_t* bgra_rows) noexcept
+{
+    const auto& k{color_intrinsics_.k};
+    const Projection projection{translation_[0], translation_[1], translation_[2],
+                                color_intrinsics_.cx, color_intrinsics_.cy, color_intrinsics_.fx, color_intrinsics_.fy,
+                                k[0], k[1], k[2], k[3], k[4], k[5],
+                                color_intrinsics_.p1, color_intrinsics_.p2, color_intrinsics_.codx, color_intrinsics_.cody,
+                                max_radius_squared_, color_intrinsics_.width, color_intrinsics_.height,
+                                color_stride / static_cast<int>(sizeof(std::uint32_t))};
+    const auto color_pixels{reinterpret_cast<const std::uint32_t*>(color_buffer)};
+
+    for (int r{0}; r < 2; ++r) {
+        const int offset{(row_pair_index * 2 + r) * width_};
+        const RowPointers row{ray_x_.data() + offset, ray_y_.data() + offset, ray_z_.data() + offset,
+                              depth_pixels.data() + offset, bgra_rows + r * width_};
+        switch (kernel_) {
+        case ColorRegistrationKernel::Avx2:
+            transform_row_avx2(projection, row, width_, color_pixels);
+            break;
+        case ColorRegistrationKernel::Sse41:
+            transform_row_sse41(projection, row, width_, color_pixels);
+            break;
+        default:
+            transform_row_scalar(projection, row, 0, width_, color_pixels);
+            break;
+        }
+    }
+
+    const YuvPlanes row_planes{planes.y_plane + row_pair_index * 2 * planes.y_stride,
+                               planes.u_plane + row_pair_index * planes.u_stride,
+                               planes.v_plane + row_pair_index * planes.v_stride,
+                               planes.y_stride, planes.u_stride, planes.v_stride};
+    convertAzureKinectBgraBuffer(reinterpret_cast<const std::uint8_t*>(bgra_rows), width_, 2,
+                                 width_ * static_cast<int>(sizeof(std::uint32_t)), row_planes,
+                                 get_bgra_conversion_kernel(kernel_));
+}
+}
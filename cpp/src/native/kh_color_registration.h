@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <gsl/gsl>
+#include <k4a/k4a.hpp>
+#include "kh_thread_pool.h"
+#include "kh_yuv.h"
+
+namespace kh
+{
+// The Brown-Conrady lens model of the color camera as in k4a_calibration_intrinsic_parameters_t,
+// in which pixel (0, 0) has its center at (0, 0).
+struct ColorCameraIntrinsics
+{
+    int width;
+    int height;
+    float cx;
+    float cy;
+    float fx;
+    float fy;
+    std::array<float, 6> k;
+    float p1;
+    float p2;
+    float codx;
+    float cody;
+    // Points further than this from the center in the normalized image plane are out of the lens model.
+    // Zero when there is no limit.
+    float metric_radius;
+};
+
+// What ColorRegistration needs from the calibration of a Kinect.
+// This can be filled without a device (e.g., with a pinhole camera for testing).
+struct ColorRegistrationCalibration
+{
+    int depth_width;
+    int depth_height;
+    // x and y of the point of each depth pixel with the depth of 1, or NaNs for the pixels out of the lens model.
+    std::vector<float> x_with_unit_depth;
+    std::vector<float> y_with_unit_depth;
+    // From the depth camera to the color camera, in row-major order and millimeters.
+    std::array<float, 9> rotation;
+    std::array<float, 3> translation;
+    ColorCameraIntrinsics color_intrinsics;
+};
+
+ColorRegistrationCalibration create_color_registration_calibration(const k4a::calibration& calibration);
+
+// Kernels of ColorRegistration that produce the same pixels.
+// Scalar is the reference implementation and the others project 4 or 8 depth pixels at a time.
+// A kernel has to be supported by the CPU (see get_cpu_features()).
+enum class ColorRegistrationKernel
+{
+    Scalar,
+    Sse41,
+    Avx2,
+};
+
+ColorRegistrationKernel get_default_color_registration_kernel() noexcept;
+
+// Maps the color pixels to the depth pixels, replacing k4a::transformation::color_image_to_depth_camera(),
+// and converts them into YUV420 in the same pass instead of making a BGRA image first.
+// Rays of the depth pixels get rotated to the color camera once, so a depth pixel only takes a translation,
+// a projection with the lens model, and a lookup of the nearest color pixel.
+// Depth pixels that are zero or map outside the color image become black as with k4a::transformation.
+// Rows are split into bands that get transformed in parallel. A band goes two rows at a time
+// through a small BGRA buffer that gets converted with the kernels of createYuvImageFromAzureKinectBgraBuffer()
+// while it is in the cache.
+class ColorRegistration
+{
+public:
+    ColorRegistration(const ColorRegistrationCalibration& calibration, int band_count = 1);
+    ColorRegistration(const ColorRegistrationCalibration& calibration, int band_count, ColorRegistrationKernel kernel);
+    // depth_pixels has a frame of the depth camera and color_buffer has a BGRA frame of the color camera
+    // with color_stride bytes per row. planes get a frame of the size of the depth camera.
+    void transform(gsl::span<const std::int16_t> depth_pixels, const std::uint8_t* color_buffer, int color_stride,
+                   const YuvPlanes& planes);
+
+private:
+    void transform_rows(gsl::span<const std::int16_t> depth_pixels, const std::uint8_t* color_buffer, int color_stride,
+                        const YuvPlanes& planes, int row_pair_index, std::uint32_t* bgra_rows) noexcept;
+
+    const int width_;
+    const int height_;
+    const ColorCameraIntrinsics color_intrinsics_;
+    const std::array<float, 3> translation_;
+    const float max_radius_squared_;
+    const int band_count_;
+    const ColorRegistrationKernel kernel_;
+    // The rays of the depth pixels with the depth of 1 rotated to the color camera.
+    std::vector<float> ray_x_;
+    std::vector<float> ray_y_;
+    std::vector<float> ray_z_;
+    // Two rows of BGRA pixels for each band.
+    std::vector<std::uint32_t> bgra_buffer_;
+    std::unique_ptr<ThreadPool> thread_pool_;
+};
+}
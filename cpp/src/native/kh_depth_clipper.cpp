@@ -0,0 +1,84 @@
+#include "kh_depth_clipper.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace kh
+{
+DepthClipper::DepthClipper(int width, int height, std::int16_t min_depth, std::int16_t max_depth)
+    : width_{width}, height_{height}, min_depth_{min_depth}, max_depth_{max_depth}, roi_mask_{}
+{
+    if (min_depth > max_depth)
+        throw std::exception("Invalid DepthClipper depth range.");
+}
+
+void DepthClipper::set_roi_mask(std::vector<std::uint8_t> roi_mask)
+{
+    if (roi_mask.size() != static_cast<std::size_t>(width_ * height_))
+        throw std::exception("Invalid DepthClipper roi_mask size.");
+
+    roi_mask_ = std::move(roi_mask);
+}
+
+// Fills the polygon row by row with the even-odd rule, using the x coordinates where the edges cross the center of each row.
+void DepthClipper::set_roi_polygon(gsl::span<const k4a_float2_t> roi_polygon)
+{
+    if (roi_polygon.size() < 3)
+        throw std::exception("DepthClipper roi_polygon needs at least three vertices.");
+
+    std::vector<std::uint8_t> roi_mask(width_ * height_, 0);
+    std::vector<float> crossings;
+    for (int j{0}; j < height_; ++j) {
+        const float y{j + 0.5f};
+        crossings.clear();
+        for (gsl::index k{0}; k < roi_polygon.size(); ++k) {
+            const auto& p{roi_polygon[k].xy};
+            const auto& q{roi_polygon[(k + 1) % roi_polygon.size()].xy};
+            // Counts an edge once at a vertex shared with the next one by excluding its upper end.
+            if ((p.y <= y) == (q.y <= y))
+                continue;
+
+            crossings.push_back(p.x + (y - p.y) * (q.x - p.x) / (q.y - p.y));
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        for (gsl::index k{0}; k + 1 < crossings.size(); k += 2) {
+            // Pixels with centers i + 0.5 within [crossings[k], crossings[k + 1]).
+            const int begin{std::clamp(static_cast<int>(std::ceil(crossings[k] - 0.5f)), 0, width_)};
+            const int end{std::clamp(static_cast<int>(std::ceil(crossings[k + 1] - 0.5f)), 0, width_)};
+            std::fill(roi_mask.begin() + j * width_ + begin, roi_mask.begin() + j * width_ + end, static_cast<std::uint8_t>(1));
+        }
+    }
+
+    roi_mask_ = std::move(roi_mask);
+}
+
+void DepthClipper::clear_roi() noexcept
+{
+    roi_mask_.clear();
+}
+
+// Written without branches inside the loops for compilers to vectorize them.
+void DepthClipper::clip_row(std::int16_t* row, int row_index) const noexcept
+{
+    if (roi_mask_.empty()) {
+        for (int i{0}; i < width_; ++i) {
+            const std::int16_t z{row[i]};
+            row[i] = (z >= min_depth_ && z <= max_depth_) ? z : 0;
+        }
+        return;
+    }
+
+    const std::uint8_t* roi_mask_row{&roi_mask_[row_index * width_]};
+    for (int i{0}; i < width_; ++i) {
+        const std::int16_t z{row[i]};
+        row[i] = (z >= min_depth_ && z <= max_depth_ && roi_mask_row[i] != 0) ? z : 0;
+    }
+}
+
+void DepthClipper::clip(gsl::span<std::int16_t> depth_pixels) const noexcept
+{
+    for (int j{0}; j < height_; ++j)
+        clip_row(&depth_pixels[j * width_], j);
+}
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <gsl/gsl>
+#include <k4a/k4a.h>
+
+namespace kh
+{
+// Zeroes depth pixels outside the capture volume before they get encoded,
+// so that walls and other backgrounds become zero runs of RVL instead of depth and color to send.
+// Pixels are kept when their depth is within [min_depth, max_depth] millimeters
+// and, when there is a region of interest, when they are inside it.
+class DepthClipper
+{
+public:
+    DepthClipper(int width, int height, std::int16_t min_depth, std::int16_t max_depth);
+    // roi_mask has a byte per pixel of the depth image, and pixels with zero bytes get zeroed.
+    void set_roi_mask(std::vector<std::uint8_t> roi_mask);
+    // Keeps the pixels whose centers are inside the polygon, which has its vertices in pixel coordinates.
+    void set_roi_polygon(gsl::span<const k4a_float2_t> roi_polygon);
+    void clear_roi() noexcept;
+    // For OcclusionRemover to clip each row right before removing occlusions from it.
+    void clip_row(std::int16_t* row, int row_index) const noexcept;
+    void clip(gsl::span<std::int16_t> depth_pixels) const noexcept;
+
+private:
+    const int width_;
+    const int height_;
+    const std::int16_t min_depth_;
+    const std::int16_t max_depth_;
+    // Empty when there is no region of interest.
+    std::vector<std::uint8_t> roi_mask_;
+};
+}
\ No newline at end of file
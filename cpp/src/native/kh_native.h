@@ -1,8 +1,15 @@
 #pragma once
 
+#include "kh_color_codec.h"
+#include "kh_depth_codec.h"
+#include "kh_depth_filter.h"
+#include "kh_depth_quantizer.h"
 #include "kh_opus.h"
+#include "kh_thread_pool.h"
 #include "kh_trvl.h"
 #include "kh_vp8.h"
+#include "native/kh_color_registration.h"
+#include "native/kh_depth_clipper.h"
 #include "native/kh_kinect_device.h"
 #include "native/kh_packet.h"
 #include "native/kh_occlusion_remover.h"
@@ -171,38 +171,50 @@ void OcclusionRemover::remove_original(gsl::span<int16_t> depth_pixels)
 // in one step with much less iterations.
 void OcclusionRemover::remove2(gsl::span<int16_t> depth_pixels)
 {
-    for (int j{0}; j < height_; ++j) {
-        // z_max contains the cutoffs for the j-th row.
-        //std::vector<float> z_max(width_, AZURE_KINECT_MAX_DISTANCE);
+    for (int j{0}; j < height_; ++j)
+        remove2_row(depth_pixels, j);
+}
 
-        for (int i{width_ - 1}; i >= 0; --i) {
-            // p stands for point.
-            const int p_index{i + j * width_};
-            const int16_t z{depth_pixels[p_index]};
+void OcclusionRemover::remove2(gsl::span<int16_t> depth_pixels, const DepthClipper& depth_clipper)
+{
+    for (int j{0}; j < height_; ++j) {
+        depth_clipper.clip_row(&depth_pixels[j * width_], j);
+        remove2_row(depth_pixels, j);
+    }
+}
 
-            // Skip invalid pixels.
-            if (z == 0)
+void OcclusionRemover::remove2_row(gsl::span<int16_t> depth_pixels, int j)
+{
+    // z_max contains the cutoffs for the j-th row.
+    //std::vector<float> z_max(width_, AZURE_KINECT_MAX_DISTANCE);
+
+    for (int i{width_ - 1}; i >= 0; --i) {
+        // p stands for point.
+        const int p_index{i + j * width_};
+        const int16_t z{depth_pixels[p_index]};
+
+        // Skip invalid pixels.
+        if (z == 0)
+            continue;
+
+        const float x{x_with_unit_depth_[p_index]};
+        for (int ii{i - 1}; ii >= 0; --ii) {
+            const int pp_index{ii + j * width_};
+            const int16_t zz{depth_pixels[pp_index]};
+            if (zz == 0)
                 continue;
 
-            const float x{x_with_unit_depth_[p_index]};
-            for (int ii{i - 1}; ii >= 0; --ii) {
-                const int pp_index{ii + j * width_};
-                const int16_t zz{depth_pixels[pp_index]};
-                if (zz == 0)
-                    continue;
-
-                const float xx{x_with_unit_depth_[pp_index]};
-                const float line_z{(color_camera_x_ * z) / ((xx - x) * z + color_camera_x_)};
-
-                // When the gap between x and xx becomes too large, (x - xx) * z > color_camera_x_,
-                // line_z becomes negative indicating that physically there can be no occlusions.
-                // And, of course, if a point is not blocked, it should not be invalidated.
-                if (line_z < 0 || (zz < line_z))
-                    break;
+            const float xx{x_with_unit_depth_[pp_index]};
+            const float line_z{(color_camera_x_ * z) / ((xx - x) * z + color_camera_x_)};
 
-                // If line_z covers an existing pixel pp, invalidate pp.
-                depth_pixels[pp_index] = 0;
-            }
+            // When the gap between x and xx becomes too large, (x - xx) * z > color_camera_x_,
+            // line_z becomes negative indicating that physically there can be no occlusions.
+            // And, of course, if a point is not blocked, it should not be invalidated.
+            if (line_z < 0 || (zz < line_z))
+                break;
+
+            // If line_z covers an existing pixel pp, invalidate pp.
+            depth_pixels[pp_index] = 0;
         }
     }
 }
@@ -3,6 +3,7 @@
 #include <vector>
 #include <gsl/gsl>
 #include <k4a/k4a.hpp>
+#include "kh_depth_clipper.h"
 
 namespace kh
 {
@@ -13,8 +14,14 @@ public:
     void remove(gsl::span<int16_t> depth_pixels);
     void remove_original(gsl::span<int16_t> depth_pixels);
     void remove2(gsl::span<int16_t> depth_pixels);
+    // remove2() with each row clipped by depth_clipper right before removing occlusions from it,
+    // so that both stages take a single pass over the frame.
+    // Clipped pixels do not occlude others since they got zeroed first.
+    void remove2(gsl::span<int16_t> depth_pixels, const DepthClipper& depth_clipper);
 
 private:
+    void remove2_row(gsl::span<int16_t> depth_pixels, int j);
+
     // 3.86 m is the operating range of NFOV unbinned mode of Azure Kinect.
     // But larger values can be detected, so modified it to 10 m...
     //constexpr static float AZURE_KINECT_MAX_DISTANCE{3860.0f};
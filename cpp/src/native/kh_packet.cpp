@@ -12,7 +12,8 @@ SenderPacketType get_packet_type_from_sender_packet_bytes(gsl::span<const std::b
     return copy_from_bytes<SenderPacketType>(packet_bytes, 4);
 }
 
-InitSenderPacketData create_init_sender_packet_data(k4a_calibration_t calibration)
+InitSenderPacketData create_init_sender_packet_data(k4a_calibration_t calibration, ColorCodecId color_codec_id,
+                                                    DepthCodecId depth_codec_id, int depth_band_count)
 {
     InitSenderPacketData init_sender_packet_data;
     init_sender_packet_data.width = calibration.depth_camera_calibration.resolution_width;
@@ -21,6 +22,9 @@ InitSenderPacketData create_init_sender_packet_data(k4a_calibration_t calibratio
     // The real metric_radius value for calibration is at color_camera_calibration.metric_radius.
     init_sender_packet_data.intrinsics = calibration.depth_camera_calibration.intrinsics.parameters.param;
     init_sender_packet_data.metric_radius = calibration.depth_camera_calibration.metric_radius;
+    init_sender_packet_data.color_codec_id = color_codec_id;
+    init_sender_packet_data.depth_codec_id = depth_codec_id;
+    init_sender_packet_data.depth_band_count = depth_band_count;
 
     return init_sender_packet_data;
 }
@@ -32,7 +36,10 @@ std::vector<std::byte> create_init_sender_packet_bytes(int session_id, const Ini
                                                     sizeof(init_sender_packet_data.width) +
                                                     sizeof(init_sender_packet_data.height) +
                                                     sizeof(init_sender_packet_data.intrinsics) +
-                                                    sizeof(init_sender_packet_data.metric_radius))};
+                                                    sizeof(init_sender_packet_data.metric_radius) +
+                                                    sizeof(init_sender_packet_data.color_codec_id) +
+                                                    sizeof(init_sender_packet_data.depth_codec_id) +
+                                                    sizeof(init_sender_packet_data.depth_band_count))};
 
     std::vector<std::byte> packet_bytes(packet_size);
     PacketCursor cursor;
@@ -42,6 +49,9 @@ std::vector<std::byte> create_init_sender_packet_bytes(int session_id, const Ini
     copy_to_bytes(init_sender_packet_data.height, packet_bytes, cursor);
     copy_to_bytes(init_sender_packet_data.intrinsics, packet_bytes, cursor);
     copy_to_bytes(init_sender_packet_data.metric_radius, packet_bytes, cursor);
+    copy_to_bytes(init_sender_packet_data.color_codec_id, packet_bytes, cursor);
+    copy_to_bytes(init_sender_packet_data.depth_codec_id, packet_bytes, cursor);
+    copy_to_bytes(init_sender_packet_data.depth_band_count, packet_bytes, cursor);
 
     return packet_bytes;
 }
@@ -54,6 +64,9 @@ InitSenderPacketData parse_init_sender_packet_bytes(gsl::span<const std::byte> p
     copy_from_bytes(init_sender_packet_data.height, packet_bytes, cursor);
     copy_from_bytes(init_sender_packet_data.intrinsics, packet_bytes, cursor);
     copy_from_bytes(init_sender_packet_data.metric_radius, packet_bytes, cursor);
+    copy_from_bytes(init_sender_packet_data.color_codec_id, packet_bytes, cursor);
+    copy_from_bytes(init_sender_packet_data.depth_codec_id, packet_bytes, cursor);
+    copy_from_bytes(init_sender_packet_data.depth_band_count, packet_bytes, cursor);
 
     return init_sender_packet_data;
 }
@@ -72,11 +85,22 @@ std::vector<std::byte> create_heartbeat_sender_packet_bytes(int session_id)
 }
 
 std::vector<std::byte> create_video_sender_message_bytes(float frame_time_stamp, bool keyframe,
+                                                         ColorCodecId color_codec_id,
+                                                         ColorFrameLayer color_frame_layer,
                                                          gsl::span<const std::byte> color_encoder_frame,
+                                                         DepthCodecId depth_codec_id,
+                                                         float depth_error_bound,
                                                          gsl::span<const std::byte> depth_encoder_frame)
 {
     const int message_size{gsl::narrow_cast<int>(sizeof(frame_time_stamp) +
                                                  sizeof(keyframe) +
+                                                 sizeof(color_codec_id) +
+                                                 sizeof(std::uint8_t) +
+                                                 sizeof(int) +
+                                                 sizeof(bool) +
+                                                 sizeof(bool) +
+                                                 sizeof(depth_codec_id) +
+                                                 sizeof(depth_error_bound) +
                                                  sizeof(int) +
                                                  sizeof(int) +
                                                  color_encoder_frame.size() +
@@ -87,6 +111,13 @@ std::vector<std::byte> create_video_sender_message_bytes(float frame_time_stamp,
 
     copy_to_bytes(frame_time_stamp, message_bytes, cursor);
     copy_to_bytes(keyframe, message_bytes, cursor);
+    copy_to_bytes(color_codec_id, message_bytes, cursor);
+    copy_to_bytes(gsl::narrow_cast<std::uint8_t>(color_frame_layer.temporal_layer_id), message_bytes, cursor);
+    copy_to_bytes(color_frame_layer.reference_frame_distance, message_bytes, cursor);
+    copy_to_bytes(color_frame_layer.long_term_reference, message_bytes, cursor);
+    copy_to_bytes(color_frame_layer.references_long_term_reference, message_bytes, cursor);
+    copy_to_bytes(depth_codec_id, message_bytes, cursor);
+    copy_to_bytes(depth_error_bound, message_bytes, cursor);
     copy_to_bytes(gsl::narrow_cast<int>(color_encoder_frame.size()), message_bytes, cursor);
     copy_to_bytes(gsl::narrow_cast<int>(depth_encoder_frame.size()), message_bytes, cursor);
 
@@ -169,8 +200,15 @@ VideoSenderMessageData parse_video_sender_message_bytes(gsl::span<const std::byt
     VideoSenderMessageData video_sender_message_data;
     copy_from_bytes(video_sender_message_data.frame_time_stamp, message_bytes, cursor);
     copy_from_bytes(video_sender_message_data.keyframe, message_bytes, cursor);
-
-    // Parsing the bytes of the message into the VP8 and TRVL frames.
+    copy_from_bytes(video_sender_message_data.color_codec_id, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.temporal_layer_id, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.reference_frame_distance, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.long_term_reference, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.references_long_term_reference, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.depth_codec_id, message_bytes, cursor);
+    copy_from_bytes(video_sender_message_data.depth_error_bound, message_bytes, cursor);
+
+    // Parsing the bytes of the message into the color and depth frames.
     int color_encoder_frame_size = copy_from_bytes<int>(message_bytes, cursor);
     int depth_encoder_frame_size = copy_from_bytes<int>(message_bytes, cursor);
 
@@ -314,13 +352,19 @@ ReceiverPacketType get_packet_type_from_receiver_packet_bytes(gsl::span<const st
 std::vector<std::byte> create_connect_receiver_packet_bytes(int session_id,
                                                             bool video_requested,
                                                             bool audio_requested,
-                                                            bool floor_requested)
+                                                            bool floor_requested,
+                                                            gsl::span<const DepthCodecId> depth_codec_ids,
+                                                            gsl::span<const ColorCodecId> color_codec_ids)
 {
-    constexpr int packet_size{gsl::narrow_cast<int>(sizeof(session_id) +
-                                                    sizeof(ReceiverPacketType) +
-                                                    sizeof(video_requested) +
-                                                    sizeof(audio_requested) +
-                                                    sizeof(floor_requested))};
+    const int packet_size{gsl::narrow_cast<int>(sizeof(session_id) +
+                                                sizeof(ReceiverPacketType) +
+                                                sizeof(video_requested) +
+                                                sizeof(audio_requested) +
+                                                sizeof(floor_requested) +
+                                                sizeof(std::uint8_t) +
+                                                sizeof(DepthCodecId) * depth_codec_ids.size() +
+                                                sizeof(std::uint8_t) +
+                                                sizeof(ColorCodecId) * color_codec_ids.size())};
 
     std::vector<std::byte> packet_bytes(packet_size);
     PacketCursor cursor;
@@ -329,6 +373,12 @@ std::vector<std::byte> create_connect_receiver_packet_bytes(int session_id,
     copy_to_bytes(video_requested, packet_bytes, cursor);
     copy_to_bytes(audio_requested, packet_bytes, cursor);
     copy_to_bytes(floor_requested, packet_bytes, cursor);
+    copy_to_bytes(gsl::narrow<std::uint8_t>(depth_codec_ids.size()), packet_bytes, cursor);
+    for (auto depth_codec_id : depth_codec_ids)
+        copy_to_bytes(depth_codec_id, packet_bytes, cursor);
+    copy_to_bytes(gsl::narrow<std::uint8_t>(color_codec_ids.size()), packet_bytes, cursor);
+    for (auto color_codec_id : color_codec_ids)
+        copy_to_bytes(color_codec_id, packet_bytes, cursor);
 
     return packet_bytes;
 }
@@ -341,6 +391,27 @@ ConnectReceiverPacketData parse_connect_receiver_packet_bytes(gsl::span<const st
     copy_from_bytes(connect_receiver_packet_data.audio_requested, packet_bytes, cursor);
     copy_from_bytes(connect_receiver_packet_data.floor_requested, packet_bytes, cursor);
 
+    // Receivers from before depth codecs became negotiable end their packets here.
+    if (cursor.position == packet_bytes.size()) {
+        connect_receiver_packet_data.depth_codec_ids.push_back(DepthCodecId::Trvl);
+        connect_receiver_packet_data.color_codec_ids.push_back(ColorCodecId::Vp8);
+        return connect_receiver_packet_data;
+    }
+
+    const auto depth_codec_count{copy_from_bytes<std::uint8_t>(packet_bytes, cursor)};
+    for (int i{0}; i < depth_codec_count && cursor.position < packet_bytes.size(); ++i)
+        connect_receiver_packet_data.depth_codec_ids.push_back(copy_from_bytes<DepthCodecId>(packet_bytes, cursor));
+
+    // Receivers from before color codecs became negotiable end their packets here.
+    if (cursor.position == packet_bytes.size()) {
+        connect_receiver_packet_data.color_codec_ids.push_back(ColorCodecId::Vp8);
+        return connect_receiver_packet_data;
+    }
+
+    const auto color_codec_count{copy_from_bytes<std::uint8_t>(packet_bytes, cursor)};
+    for (int i{0}; i < color_codec_count && cursor.position < packet_bytes.size(); ++i)
+        connect_receiver_packet_data.color_codec_ids.push_back(copy_from_bytes<ColorCodecId>(packet_bytes, cursor));
+
     return connect_receiver_packet_data;
 }
 
@@ -357,13 +428,18 @@ std::vector<std::byte> create_heartbeat_receiver_packet_bytes(int session_id)
     return packet_bytes;
 }
 
-std::vector<std::byte> create_report_receiver_packet_bytes(int session_id, int frame_id, float decoder_time_ms, float frame_time_ms)
+std::vector<std::byte> create_report_receiver_packet_bytes(int session_id, int frame_id, float decoder_time_ms, float frame_time_ms,
+                                                           int video_packet_count, int lost_video_packet_count,
+                                                           int received_packet_count)
 {
     const int packet_size{gsl::narrow_cast<int>(sizeof(session_id) +
                                                 sizeof(ReceiverPacketType) +
                                                 sizeof(frame_id) +
                                                 sizeof(decoder_time_ms) +
-                                                sizeof(frame_time_ms))};
+                                                sizeof(frame_time_ms) +
+                                                sizeof(video_packet_count) +
+                                                sizeof(lost_video_packet_count) +
+                                                sizeof(received_packet_count))};
 
     std::vector<std::byte> packet_bytes(packet_size);
     PacketCursor cursor;
@@ -372,6 +448,9 @@ std::vector<std::byte> create_report_receiver_packet_bytes(int session_id, int f
     copy_to_bytes(frame_id, packet_bytes, cursor);
     copy_to_bytes(decoder_time_ms, packet_bytes, cursor);
     copy_to_bytes(frame_time_ms, packet_bytes, cursor);
+    copy_to_bytes(video_packet_count, packet_bytes, cursor);
+    copy_to_bytes(lost_video_packet_count, packet_bytes, cursor);
+    copy_to_bytes(received_packet_count, packet_bytes, cursor);
 
     return packet_bytes;
 }
@@ -384,6 +463,18 @@ ReportReceiverPacketData parse_report_receiver_packet_bytes(gsl::span<const std:
     copy_from_bytes(report_receiver_packet_data.decoder_time_ms, packet_bytes, cursor);
     copy_from_bytes(report_receiver_packet_data.frame_time_ms, packet_bytes, cursor);
 
+    // Receivers from before the rate control end their packets here.
+    if (cursor.position == packet_bytes.size()) {
+        report_receiver_packet_data.video_packet_count = 0;
+        report_receiver_packet_data.lost_video_packet_count = 0;
+        report_receiver_packet_data.received_packet_count = 0;
+        return report_receiver_packet_data;
+    }
+
+    copy_from_bytes(report_receiver_packet_data.video_packet_count, packet_bytes, cursor);
+    copy_from_bytes(report_receiver_packet_data.lost_video_packet_count, packet_bytes, cursor);
+    copy_from_bytes(report_receiver_packet_data.received_packet_count, packet_bytes, cursor);
+
     return report_receiver_packet_data;
 }
 
@@ -5,6 +5,8 @@
 #include <vector>
 #include <gsl/gsl>
 #include <k4a/k4a.h>
+#include "kh_color_codec.h"
+#include "kh_depth_codec.h"
 
 namespace kh
 {
@@ -90,9 +92,17 @@ struct InitSenderPacketData
     int height;
     k4a_calibration_intrinsic_parameters_t::_param intrinsics;
     float metric_radius;
+    // The codec of the color frames at the time of the init packet. Changes as depth_codec_id does.
+    ColorCodecId color_codec_id;
+    // The codec of the depth frames at the time of the init packet, which can change with a keyframe
+    // since each video message carries its own codec.
+    DepthCodecId depth_codec_id;
+    // Number of bands in the frames of TrvlEncoder.
+    int depth_band_count;
 };
 
-InitSenderPacketData create_init_sender_packet_data(k4a_calibration_t calibration);
+InitSenderPacketData create_init_sender_packet_data(k4a_calibration_t calibration, ColorCodecId color_codec_id,
+                                                    DepthCodecId depth_codec_id, int depth_band_count);
 std::vector<std::byte> create_init_sender_packet_bytes(int session_id, const InitSenderPacketData& init_sender_packet_data);
 InitSenderPacketData parse_init_sender_packet_bytes(gsl::span<const std::byte> packet_bytes);
 
@@ -102,6 +112,17 @@ struct VideoSenderMessageData
 {
     float frame_time_stamp;
     bool keyframe;
+    ColorCodecId color_codec_id;
+    // See ColorFrameLayer. Receivers that only get lower layers do not get frames of higher layers at all.
+    // Depth frames of layers above the base layer are non-reference frames (see DepthEncoder::encode_non_reference()).
+    std::uint8_t temporal_layer_id;
+    int reference_frame_distance;
+    // Depth frames follow the long-term reference of color (see DepthEncoder::save_long_term_reference()).
+    bool long_term_reference;
+    bool references_long_term_reference;
+    DepthCodecId depth_codec_id;
+    // The error_bound of the DepthQuantizer of the depth frame, which is zero for lossless frames.
+    float depth_error_bound;
     std::vector<std::byte> color_encoder_frame;
     std::vector<std::byte> depth_encoder_frame;
 };
@@ -115,7 +136,11 @@ struct VideoSenderPacketData
 };
 
 std::vector<std::byte> create_video_sender_message_bytes(float frame_time_stamp, bool keyframe,
+                                                         ColorCodecId color_codec_id,
+                                                         ColorFrameLayer color_frame_layer,
                                                          gsl::span<const std::byte> color_encoder_frame,
+                                                         DepthCodecId depth_codec_id,
+                                                         float depth_error_bound,
                                                          gsl::span<const std::byte> depth_encoder_frame);
 std::vector<std::vector<std::byte>> split_video_sender_message_bytes(int session_id, int frame_id,
                                                                      gsl::span<const std::byte> video_message);
@@ -163,12 +188,18 @@ struct ConnectReceiverPacketData
     bool video_requested;
     bool audio_requested;
     bool floor_requested;
+    // The depth codecs the receiver can decode. Receivers that do not send this list only support TRVL.
+    std::vector<DepthCodecId> depth_codec_ids;
+    // The color codecs the receiver can decode. Receivers that do not send this list only support VP8.
+    std::vector<ColorCodecId> color_codec_ids;
 };
 
 std::vector<std::byte> create_connect_receiver_packet_bytes(int session_id,
                                                             bool video_requested,
                                                             bool audio_requested,
-                                                            bool floor_requested);
+                                                            bool floor_requested,
+                                                            gsl::span<const DepthCodecId> depth_codec_ids,
+                                                            gsl::span<const ColorCodecId> color_codec_ids);
 ConnectReceiverPacketData parse_connect_receiver_packet_bytes(gsl::span<const std::byte> packet_bytes);
 
 std::vector<std::byte> create_heartbeat_receiver_packet_bytes(int session_id);
@@ -177,10 +208,21 @@ struct ReportReceiverPacketData
 {
     int frame_id;
     float decoder_time_ms;
+    // The time since the previous report.
     float frame_time_ms;
+    // Counted since the previous report for the sender to follow the network.
+    // The video packets of the frames the receiver has seen all the packets of the sender sent for,
+    // and the ones among them that were missing before FEC and retransmission.
+    int video_packet_count;
+    int lost_video_packet_count;
+    // Video and parity packets that arrived, including retransmitted ones.
+    // All three are zero from receivers that do not count them.
+    int received_packet_count;
 };
 
-std::vector<std::byte> create_report_receiver_packet_bytes(int session_id, int frame_id, float decoder_time_ms, float frame_time_ms);
+std::vector<std::byte> create_report_receiver_packet_bytes(int session_id, int frame_id, float decoder_time_ms, float frame_time_ms,
+                                                           int video_packet_count, int lost_video_packet_count,
+                                                           int received_packet_count);
 ReportReceiverPacketData parse_report_receiver_packet_bytes(gsl::span<const std::byte> packet_bytes);
 
 struct RequestReceiverPacketData
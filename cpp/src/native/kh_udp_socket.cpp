@@ -5,7 +5,7 @@
 namespace kh
 {
 UdpSocket::UdpSocket(asio::ip::udp::socket&& socket)
-    : socket_{std::move(socket)}
+    : socket_{std::move(socket)}, mutex_{}
 {
     socket_.non_blocking(true);
 }
@@ -21,7 +21,11 @@ std::optional<UdpSocketPacket> UdpSocket::receive()
     std::vector<std::byte> bytes(KH_PACKET_SIZE);
     asio::ip::udp::endpoint endpoint;
     std::error_code error;
-    const size_t packet_size{socket_.receive_from(asio::buffer(bytes), endpoint, 0, error)};
+    size_t packet_size;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        packet_size = socket_.receive_from(asio::buffer(bytes), endpoint, 0, error);
+    }
 
     if (error == asio::error::would_block)
         return std::nullopt;
@@ -36,7 +40,10 @@ std::optional<UdpSocketPacket> UdpSocket::receive()
 void UdpSocket::send(gsl::span<const std::byte> bytes, asio::ip::udp::endpoint endpoint)
 {
     std::error_code error;
-    socket_.send_to(asio::buffer(bytes.data(), bytes.size()), endpoint, 0, error);
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        socket_.send_to(asio::buffer(bytes.data(), bytes.size()), endpoint, 0, error);
+    }
 
     if(error && error != asio::error::would_block)
         throw UdpSocketRuntimeError(std::string("Failed to send bytes: ") + error.message(), error, endpoint);
@@ -3,6 +3,7 @@
 // This is for asio
 #define _WIN32_WINNT _WIN32_WINNT_WIN10
 
+#include <mutex>
 #include <optional>
 #include <asio.hpp>
 #include <gsl/gsl>
@@ -40,5 +41,7 @@ public:
 
 private:
     asio::ip::udp::socket socket_;
+    // The stages of the sender send from threads of their own while the main thread receives and retransmits.
+    std::mutex mutex_;
 };
 }
\ No newline at end of file
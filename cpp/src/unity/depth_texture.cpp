@@ -1,7 +1,6 @@
 #include "depth_texture.h"
 
 #include <string>
-#include "kh_rvl.h"
 
 namespace kh
 {
@@ -43,13 +42,15 @@ ID3D11ShaderResourceView* DepthTexture::getTextureView(ID3D11Device* device)
 	return texture_view;
 }
 
-// Update the pixels of the texture with depth pixels compressed by RVL.
-// The pixels get decompressed and assigned at once for optimization.
-void DepthTexture::updatePixels(ID3D11Device* device,
-								ID3D11DeviceContext* device_context,
-								int width,
-								int height,
-								uint16_t* pixels)
+// Update the pixels of the texture with depth pixels compressed by TRVL.
+// The pixels get decoded straight into the texture for optimization.
+void DepthTexture::updatePixels(ID3D11DeviceContext* device_context,
+								DepthDecoder& depth_decoder,
+								gsl::span<const std::byte> depth_encoder_frame,
+								bool keyframe,
+								bool non_reference,
+								bool from_long_term_reference,
+								gsl::span<const std::int16_t> dequantization_table)
 {
 	D3D11_MAPPED_SUBRESOURCE mapped;
 	HRESULT hr = device_context->Map(texture_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
@@ -58,18 +59,16 @@ void DepthTexture::updatePixels(ID3D11Device* device,
 		throw std::exception(str.c_str());
 	}
 
-	// row_pitch should be divided by two to support uint16* since mapped.RowPitch is for bytes.
-	int row_pitch = mapped.RowPitch / 2;
-    auto texture_data = reinterpret_cast<uint16_t*>(mapped.pData);
-
-    //for (int i = 0; i < height; ++i)
-    //    memcpy(texture_data + i * row_pitch, frame_data + i * frame_linesize, width);
-
-    for (int c = 0; c < height; ++c) {
-        for (int r = 0; r < width; ++r) {
-            texture_data[r + c * row_pitch] = pixels[r + c * width];
-        }
-    }
+	// The texture has DXGI_FORMAT_R16_UNORM, so the depth pixels can be written as they are.
+	// Frames of the upper temporal layers leave the state of the decoder as it was.
+	// Frames from the long-term reference continue from the state the decoder saved with it.
+	if (non_reference) {
+		depth_decoder.decode_non_reference_into(depth_encoder_frame, reinterpret_cast<int16_t*>(mapped.pData), mapped.RowPitch, dequantization_table);
+	} else if (from_long_term_reference) {
+		depth_decoder.decode_long_term_reference_into(depth_encoder_frame, reinterpret_cast<int16_t*>(mapped.pData), mapped.RowPitch, dequantization_table);
+	} else {
+		depth_decoder.decode_into(depth_encoder_frame, keyframe, reinterpret_cast<int16_t*>(mapped.pData), mapped.RowPitch, dequantization_table);
+	}
 
 	device_context->Unmap(texture_, 0);
 }
@@ -3,6 +3,7 @@
 #include <memory>
 #include <vector>
 #include <d3d11.h>
+#include "kh_depth_codec.h"
 
 namespace kh
 {
@@ -15,11 +16,13 @@ public:
     int width() { return width_; }
     int height() { return height_; }
     ID3D11ShaderResourceView* getTextureView(ID3D11Device* device);
-	void updatePixels(ID3D11Device* device,
-					  ID3D11DeviceContext* device_context,
-					  int width,
-					  int height,
-                      uint16_t* pixels);
+	void updatePixels(ID3D11DeviceContext* device_context,
+					  DepthDecoder& depth_decoder,
+					  gsl::span<const std::byte> depth_encoder_frame,
+					  bool keyframe,
+					  bool non_reference,
+					  bool from_long_term_reference,
+					  gsl::span<const std::int16_t> dequantization_table);
 
 private:
     int width_;
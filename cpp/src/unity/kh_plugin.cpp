@@ -1,26 +1,26 @@
 #include <opus.h>
 #include "interfaces/IUnityInterface.h"
-#include "kh_vp8.h"
-#include "kh_trvl.h"
+#include "kh_color_codec.h"
+#include "kh_depth_codec.h"
 #include "kh_opus.h"
 
 // External functions for Unity C# scripts.
-//"C" VoidPtr UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API create_vp8_decoder()
+//"C" VoidPtr UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API create_color_decoder()
 extern "C"
 {
-    UNITY_INTERFACE_EXPORT kh::Vp8Decoder* UNITY_INTERFACE_API create_vp8_decoder()
+    UNITY_INTERFACE_EXPORT kh::ColorDecoder* UNITY_INTERFACE_API create_color_decoder(std::uint8_t codec_id, int thread_count)
     {
-        return new kh::Vp8Decoder;
+        return kh::create_color_decoder(static_cast<kh::ColorCodecId>(codec_id), thread_count).release();
     }
 
-    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API delete_vp8_decoder(kh::Vp8Decoder* ptr)
+    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API delete_color_decoder(kh::ColorDecoder* ptr)
     {
         delete ptr;
     }
 
-    UNITY_INTERFACE_EXPORT kh::FFmpegFrame* UNITY_INTERFACE_API vp8_decoder_decode
+    UNITY_INTERFACE_EXPORT kh::FFmpegFrame* UNITY_INTERFACE_API color_decoder_decode
     (
-        kh::Vp8Decoder* decoder,
+        kh::ColorDecoder* decoder,
         std::byte* frame_data,
         int frame_size
     )
@@ -28,35 +28,47 @@ extern "C"
         return new kh::FFmpegFrame(std::move(decoder->decode({frame_data, frame_size})));
     }
 
+    // frame_data has to be followed by get_color_decoder_padding_size() zeroed bytes.
+    UNITY_INTERFACE_EXPORT kh::FFmpegFrame* UNITY_INTERFACE_API color_decoder_decode_padded
+    (
+        kh::ColorDecoder* decoder,
+        std::byte* frame_data,
+        int frame_size
+    )
+    {
+        return new kh::FFmpegFrame(std::move(decoder->decode_padded({frame_data, frame_size})));
+    }
+
+    UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API get_color_decoder_padding_size()
+    {
+        return kh::COLOR_DECODER_PADDING_SIZE;
+    }
+
     UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API delete_ffmpeg_frame(kh::FFmpegFrame* ptr)
     {
         delete ptr;
     }
 
-    UNITY_INTERFACE_EXPORT kh::TrvlDecoder* UNITY_INTERFACE_API create_trvl_decoder(int frame_size)
+    // For receivers to tell senders which depth codecs this plugin can decode.
+    UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API get_depth_codec_count()
     {
-        return new kh::TrvlDecoder(frame_size);
+        return gsl::narrow_cast<int>(kh::get_depth_codec_ids().size());
     }
 
-    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API delete_trvl_decoder(kh::TrvlDecoder* ptr)
+    UNITY_INTERFACE_EXPORT std::uint8_t UNITY_INTERFACE_API get_depth_codec_id(int index)
     {
-        delete ptr;
+        return static_cast<std::uint8_t>(kh::get_depth_codec_ids()[index]);
     }
 
-    UNITY_INTERFACE_EXPORT std::vector<std::int16_t>* UNITY_INTERFACE_API trvl_decoder_decode
-    (
-        kh::TrvlDecoder* decoder,
-        std::byte* frame_data,
-        int frame_size,
-        bool keyframe
-    )
+    // For receivers to tell senders which color codecs this plugin can decode.
+    UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API get_color_codec_count()
     {
-        return new std::vector<std::int16_t>(std::move(decoder->decode({frame_data, frame_size}, keyframe)));
+        return gsl::narrow_cast<int>(kh::get_color_codec_ids().size());
     }
 
-    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API delete_depth_pixels(std::vector<int16_t>* ptr)
+    UNITY_INTERFACE_EXPORT std::uint8_t UNITY_INTERFACE_API get_color_codec_id(int index)
     {
-        delete ptr;
+        return static_cast<std::uint8_t>(kh::get_color_codec_ids()[index]);
     }
 
     UNITY_INTERFACE_EXPORT kh::AudioDecoder* UNITY_INTERFACE_API create_audio_decoder(int sample_rate, int channel_count)
@@ -1,5 +1,6 @@
 #include "texture_group.h"
 
+#include <algorithm>
 #include "interfaces/IUnityInterface.h"
 
 std::unordered_map<int, std::unique_ptr<TextureGroup>> texture_groups_;
@@ -32,7 +33,75 @@ void texture_group_update(int texture_group_id, ID3D11Device* device, ID3D11Devi
                                             texture_group->ffmpeg_frame.av_frame()->data[2],
                                             texture_group->ffmpeg_frame.av_frame()->linesize[2]);
 
-    texture_group->depth_texture->updatePixels(device, device_context, texture_group->width, texture_group->height, reinterpret_cast<uint16_t*>(texture_group->depth_pixels.data()));
+    std::vector<DepthEncoderFrame> depth_encoder_frames;
+    {
+        std::lock_guard<std::mutex> lock{texture_group->depth_encoder_frames_mutex};
+        depth_encoder_frames.swap(texture_group->depth_encoder_frames);
+    }
+
+    if (depth_encoder_frames.empty())
+        return;
+
+    // Only the last frame gets written to the texture.
+    for (gsl::index i{0}; i < gsl::narrow_cast<gsl::index>(depth_encoder_frames.size()); ++i) {
+        auto& depth_encoder_frame{depth_encoder_frames[i]};
+        const bool last{i + 1 == gsl::narrow_cast<gsl::index>(depth_encoder_frames.size())};
+        const bool non_reference{depth_encoder_frame.temporal_layer_id > 0};
+        const bool from_long_term_reference{depth_encoder_frame.references_long_term_reference};
+        // Frames of the upper layers only matter when they get shown.
+        if (non_reference && !last)
+            continue;
+
+        // Senders switch codecs with a keyframe. Skipped frames of the base layer leave the state of the decoder behind,
+        // which keyframes with intra refresh do not reset as a whole. Frames of the upper layers depend on
+        // the last one of the base layer, which TextureGroupUpdater checks before adding them.
+        // Frames from the long-term reference only need the state the decoder saved with it instead.
+        if (from_long_term_reference) {
+            if (!texture_group->depth_decoder
+                || depth_encoder_frame.frame_id - depth_encoder_frame.reference_frame_distance != texture_group->depth_long_term_reference_frame_id)
+                continue;
+        } else if (!texture_group->depth_decoder || depth_encoder_frame.codec_id != texture_group->depth_codec_id
+                   || (!non_reference && depth_encoder_frame.frame_id - depth_encoder_frame.reference_frame_distance != texture_group->depth_base_frame_id)) {
+            texture_group->depth_codec_id = depth_encoder_frame.codec_id;
+            texture_group->depth_decoder = kh::create_depth_decoder(depth_encoder_frame.codec_id,
+                                                                    kh::DepthCodecConfig{texture_group->width,
+                                                                                         texture_group->height,
+                                                                                         {}, 0,
+                                                                                         texture_group->depth_band_count,
+                                                                                         false});
+        }
+        if (!non_reference)
+            texture_group->depth_base_frame_id = depth_encoder_frame.frame_id;
+
+        if (depth_encoder_frame.error_bound == 0.0f) {
+            texture_group->depth_quantizer = std::nullopt;
+        } else if (!texture_group->depth_quantizer || texture_group->depth_quantizer->error_bound() != depth_encoder_frame.error_bound) {
+            texture_group->depth_quantizer.emplace(depth_encoder_frame.error_bound);
+        }
+
+        if (!last) {
+            if (from_long_term_reference) {
+                texture_group->depth_decoder->decode_long_term_reference_into(depth_encoder_frame.bytes, nullptr, 0, {});
+            } else {
+                texture_group->depth_decoder->decode_into(depth_encoder_frame.bytes, depth_encoder_frame.keyframe, nullptr, 0, {});
+            }
+        } else {
+            texture_group->depth_texture->updatePixels(device_context,
+                                                       *texture_group->depth_decoder,
+                                                       depth_encoder_frame.bytes,
+                                                       depth_encoder_frame.keyframe,
+                                                       non_reference,
+                                                       from_long_term_reference,
+                                                       texture_group->depth_quantizer ? texture_group->depth_quantizer->get_dequantization_table()
+                                                                                      : gsl::span<const std::int16_t>{});
+        }
+
+        if (depth_encoder_frame.long_term_reference) {
+            texture_group->depth_decoder->save_long_term_reference();
+            texture_group->depth_long_term_reference_frame_id = depth_encoder_frame.frame_id;
+        }
+    }
+    texture_group->depth_synchronized = texture_group->depth_decoder->is_synchronized();
 }
 
 extern "C"
@@ -95,8 +164,94 @@ extern "C"
         texture_group->ffmpeg_frame = std::move(*ffmpeg_frame);
     }
 
-    void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API texture_group_set_depth_pixels(TextureGroup* texture_group, std::vector<short>* depth_pixels)
+    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API texture_group_set_depth_band_count(TextureGroup* texture_group, int depth_band_count)
     {
-        texture_group->depth_pixels = std::move(*depth_pixels);
+        texture_group->depth_band_count = depth_band_count;
+    }
+
+    UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API texture_group_is_depth_synchronized(TextureGroup* texture_group)
+    {
+        return texture_group->depth_synchronized;
+    }
+
+    UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API texture_group_get_depth_decodable_frame_id(TextureGroup* texture_group)
+    {
+        return texture_group->depth_decodable_frame_id;
+    }
+
+    UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API texture_group_add_depth_encoder_frame(TextureGroup* texture_group,
+                                                                                          int frame_id,
+                                                                                          std::byte* frame_data,
+                                                                                          int frame_size,
+                                                                                          std::uint8_t codec_id,
+                                                                                          float error_bound,
+                                                                                          bool keyframe,
+                                                                                          int temporal_layer_id,
+                                                                                          int reference_frame_distance,
+                                                                                          bool long_term_reference,
+                                                                                          bool references_long_term_reference)
+    {
+        // Bounds the frames waiting for when the render thread stops taking them (e.g., Unity paused in the background).
+        constexpr std::size_t MAX_DEPTH_ENCODER_FRAME_COUNT{30};
+
+        std::lock_guard<std::mutex> lock{texture_group->depth_encoder_frames_mutex};
+        auto& depth_encoder_frames{texture_group->depth_encoder_frames};
+        if (keyframe || (references_long_term_reference && frame_id - reference_frame_distance <= texture_group->depth_decodable_frame_id))
+            texture_group->depth_frames_dropped = false;
+        // Frames following dropped ones cannot get decoded, so the texture keeps the last decoded depth instead.
+        if (texture_group->depth_frames_dropped)
+            return;
+
+        // Frames waiting before a keyframe are not needed anymore. With intra refresh, a keyframe only refreshes a band,
+        // so the decoder gets replaced and synchronizes again within the band count of frames.
+        // Frames from the long-term reference only need the frame that saved it and the ones before.
+        // Frames of the upper layers only matter when they are the last ones.
+        if (keyframe) {
+            depth_encoder_frames.clear();
+        } else if (references_long_term_reference) {
+            const int long_term_reference_frame_id{frame_id - reference_frame_distance};
+            depth_encoder_frames.erase(std::remove_if(depth_encoder_frames.begin(), depth_encoder_frames.end(),
+                                                      [long_term_reference_frame_id](const DepthEncoderFrame& depth_encoder_frame) {
+                                                          return depth_encoder_frame.frame_id > long_term_reference_frame_id;
+                                                      }),
+                                       depth_encoder_frames.end());
+        }
+        depth_encoder_frames.erase(std::remove_if(depth_encoder_frames.begin(), depth_encoder_frames.end(),
+                                                  [](const DepthEncoderFrame& depth_encoder_frame) {
+                                                      return depth_encoder_frame.temporal_layer_id > 0;
+                                                  }),
+                                   depth_encoder_frames.end());
+        // The frames left start from the newest keyframe or follow the last frame the render thread took,
+        // so each one is needed by the ones after it and a full queue gets dropped from the back.
+        // The newest frame that saves the long-term reference stays, since receivers already reported it and
+        // the sender sends frames from it. Then depth_decodable_frame_id stops at the last frame left, which receivers
+        // report, so the sender sees them fall behind and sends a keyframe or a frame from the long-term reference,
+        // which is where adding frames continues.
+        if (depth_encoder_frames.size() >= MAX_DEPTH_ENCODER_FRAME_COUNT) {
+            const auto long_term_reference_it{std::find_if(depth_encoder_frames.rbegin(), depth_encoder_frames.rend(),
+                                                           [](const DepthEncoderFrame& depth_encoder_frame) {
+                                                               return depth_encoder_frame.long_term_reference;
+                                                           })};
+            if (long_term_reference_it == depth_encoder_frames.rend()) {
+                texture_group->depth_decodable_frame_id = depth_encoder_frames.front().frame_id - 1;
+                depth_encoder_frames.clear();
+            } else {
+                texture_group->depth_decodable_frame_id = long_term_reference_it->frame_id;
+                depth_encoder_frames.erase(long_term_reference_it.base(), depth_encoder_frames.end());
+            }
+            texture_group->depth_frames_dropped = true;
+            return;
+        }
+        texture_group->depth_decodable_frame_id = frame_id;
+
+        depth_encoder_frames.push_back(DepthEncoderFrame{frame_id,
+                                                         std::vector<std::byte>(frame_data, frame_data + frame_size),
+                                                         static_cast<kh::DepthCodecId>(codec_id),
+                                                         error_bound,
+                                                         keyframe,
+                                                         temporal_layer_id,
+                                                         reference_frame_distance,
+                                                         long_term_reference,
+                                                         references_long_term_reference});
     }
 }
\ No newline at end of file
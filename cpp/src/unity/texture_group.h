@@ -1,13 +1,31 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <d3d11.h>
 #include "kh_yuv.h"
-#include "kh_trvl.h"
+#include "kh_depth_codec.h"
+#include "kh_depth_quantizer.h"
 #include "channel_texture.h"
 #include "two_channel_texture.h"
 #include "depth_texture.h"
 
+struct DepthEncoderFrame
+{
+    int frame_id;
+    std::vector<std::byte> bytes;
+    kh::DepthCodecId codec_id;
+    float error_bound;
+    bool keyframe;
+    // See kh::ColorFrameLayer. Depth frames of the layers above the base layer are non-reference frames.
+    int temporal_layer_id;
+    int reference_frame_distance;
+    bool long_term_reference;
+    bool references_long_term_reference;
+};
+
 struct TextureGroup
 {
 public:
@@ -29,8 +47,28 @@ public:
 
     // These variables get set in the main thread of Unity, then gets assigned to textures in the render thread of Unity.
     kh::FFmpegFrame ffmpeg_frame{nullptr};
-    std::unique_ptr<kh::TrvlDecoder> depth_decoder;
-    std::vector<short> depth_pixels;
+    int depth_band_count{1};
+
+    // Depth frames get decoded in the render thread of Unity straight into depth_texture.
+    // Frames wait here since every frame of the base layer is required to decode the following ones.
+    // depth_decoder gets created with the codec of the frames and replaced when the codec changes
+    // or when frames of the base layer got skipped (i.e., depth_base_frame_id is not the one a frame of the base layer follows).
+    kh::DepthCodecId depth_codec_id{kh::DepthCodecId::Trvl};
+    std::unique_ptr<kh::DepthDecoder> depth_decoder;
+    int depth_base_frame_id{-1};
+    // The frame depth_decoder last saved as its long-term reference, which frames from the long-term reference follow.
+    int depth_long_term_reference_frame_id{-1};
+    // Written in the render thread and read in the main thread.
+    std::atomic<bool> depth_synchronized{false};
+    // Reconstructs depth pixels from DepthQuantizer codes for lossy frames.
+    std::optional<kh::DepthQuantizer> depth_quantizer;
+    std::mutex depth_encoder_frames_mutex;
+    std::vector<DepthEncoderFrame> depth_encoder_frames;
+    // The last frame added whose depth can get decoded. After frames of the base layer got dropped, it stays at the one
+    // before them until a keyframe or a frame from a long-term reference up to it, and receivers report it, so the sender
+    // sees them fall behind and sends one. Only used in the main thread of Unity.
+    int depth_decodable_frame_id{-1};
+    bool depth_frames_dropped{false};
 
     TextureGroup(int id) : id{id} {};
 };
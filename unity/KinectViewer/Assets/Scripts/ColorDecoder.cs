@@ -0,0 +1,46 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+// A class that contains a pointer to a ColorDecoder in KinectToHololensPlugin.dll.
+public class ColorDecoder
+{
+    private IntPtr ptr;
+    // Unmanaged memory that frames get copied into with the zeroed padding the decoder reads past them,
+    // so the plugin decodes them in place. It only gets reallocated for a frame larger than the previous ones.
+    private IntPtr buffer;
+    private int bufferSize;
+    private byte[] padding;
+
+    // threadCount threads decode the token partitions of a frame in parallel.
+    public ColorDecoder(ColorCodecId codecId, int threadCount)
+    {
+        ptr = Plugin.create_color_decoder((byte)codecId, threadCount);
+        buffer = IntPtr.Zero;
+        bufferSize = 0;
+        padding = new byte[Plugin.get_color_decoder_padding_size()];
+    }
+
+    ~ColorDecoder()
+    {
+        Plugin.delete_color_decoder(ptr);
+        if (buffer != IntPtr.Zero)
+            Marshal.FreeHGlobal(buffer);
+    }
+
+    public FFmpegFrame Decode(byte[] frame)
+    {
+        int paddedSize = frame.Length + padding.Length;
+        if (bufferSize < paddedSize)
+        {
+            if (buffer != IntPtr.Zero)
+                Marshal.FreeHGlobal(buffer);
+            buffer = Marshal.AllocHGlobal(paddedSize);
+            bufferSize = paddedSize;
+        }
+
+        Marshal.Copy(frame, 0, buffer, frame.Length);
+        Marshal.Copy(padding, 0, buffer + frame.Length, padding.Length);
+
+        return new FFmpegFrame(Plugin.color_decoder_decode_padded(ptr, buffer, frame.Length));
+    }
+}
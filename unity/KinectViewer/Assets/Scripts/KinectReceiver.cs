@@ -20,14 +20,14 @@ public class KinectReceiver
     public int ReceiverSessionId => receiverSessionId;
     public IPEndPoint SenderEndPoint => senderEndPoint;
 
-    public KinectReceiver(int receiverSessionId, IPEndPoint senderEndPoint, KinectOrigin kinectOrigin, InitSenderPacketData initPacketData)
+    public KinectReceiver(int receiverSessionId, IPEndPoint senderEndPoint, KinectOrigin kinectOrigin, InitSenderPacketData initPacketData, int colorDecoderThreadCount)
     {
         this.receiverSessionId = receiverSessionId;
         this.senderEndPoint = senderEndPoint;
         this.kinectOrigin = kinectOrigin;
         videoMessageAssembler = new VideoMessageAssembler(receiverSessionId, senderEndPoint);
         audioPacketReceiver = new AudioPacketReceiver();
-        textureGroupUpdater = new TextureGroupUpdater(kinectOrigin.Screen.Material, initPacketData, receiverSessionId, senderEndPoint);
+        textureGroupUpdater = new TextureGroupUpdater(kinectOrigin.Screen.Material, initPacketData, colorDecoderThreadCount, receiverSessionId, senderEndPoint);
         heartbeatStopWatch = Stopwatch.StartNew();
         receivedAnyStopWatch = Stopwatch.StartNew();
     }
@@ -68,7 +68,7 @@ public class KinectReceiver
             return false;
         }
 
-        textureGroupUpdater.UpdateFrame(udpSocket, videoMessageList);
+        textureGroupUpdater.UpdateFrame(udpSocket, videoMessageAssembler, videoMessageList);
         kinectOrigin.UpdateFrame(senderPacketSet.FloorPacketDataList);
 
         return true;
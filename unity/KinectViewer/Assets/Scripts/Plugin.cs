@@ -1,4 +1,5 @@
 ﻿using System;
+using System.Collections.Generic;
 using System.Runtime.InteropServices;
 using UnityEngine;
 
@@ -16,6 +17,30 @@ public static class PluginHelper
         InvokeRenderEvent(textureGroupId * COMMAND_COUNT + 1);
     }
 
+    // The depth codecs the plugin can decode.
+    public static List<DepthCodecId> GetDepthCodecIds()
+    {
+        var depthCodecIds = new List<DepthCodecId>();
+        int depthCodecCount = Plugin.get_depth_codec_count();
+        for (int i = 0; i < depthCodecCount; ++i)
+        {
+            depthCodecIds.Add((DepthCodecId)Plugin.get_depth_codec_id(i));
+        }
+        return depthCodecIds;
+    }
+
+    // The color codecs the plugin can decode.
+    public static List<ColorCodecId> GetColorCodecIds()
+    {
+        var colorCodecIds = new List<ColorCodecId>();
+        int colorCodecCount = Plugin.get_color_codec_count();
+        for (int i = 0; i < colorCodecCount; ++i)
+        {
+            colorCodecIds.Add((ColorCodecId)Plugin.get_color_codec_id(i));
+        }
+        return colorCodecIds;
+    }
+
     private static void InvokeRenderEvent(int renderEvent)
     {
         GL.IssuePluginEvent(Plugin.get_render_event_function_pointer(), renderEvent);
@@ -73,31 +98,46 @@ public static class Plugin
     public static extern void texture_group_set_ffmpeg_frame(IntPtr textureGroup, IntPtr ffmpeg_frame_ptr);
 
     [DllImport(DllName)]
-    public static extern void texture_group_set_depth_pixels(IntPtr textureGroup, IntPtr depth_pixels_ptr);
+    public static extern void texture_group_set_depth_band_count(IntPtr textureGroup, int depth_band_count);
+
+    [DllImport(DllName)]
+    public static extern bool texture_group_is_depth_synchronized(IntPtr textureGroup);
+
+    [DllImport(DllName)]
+    public static extern int texture_group_get_depth_decodable_frame_id(IntPtr textureGroup);
+
+    [DllImport(DllName)]
+    public static extern void texture_group_add_depth_encoder_frame(IntPtr textureGroup, int frame_id, IntPtr frame_ptr, int frame_size, byte codec_id, float error_bound, bool keyframe, int temporal_layer_id, int reference_frame_distance, bool long_term_reference, bool references_long_term_reference);
+
+    [DllImport(DllName)]
+    public static extern IntPtr create_color_decoder(byte codec_id, int thread_count);
+
+    [DllImport(DllName)]
+    public static extern void delete_color_decoder(IntPtr ptr);
 
     [DllImport(DllName)]
-    public static extern IntPtr create_vp8_decoder();
+    public static extern IntPtr color_decoder_decode(IntPtr decoder_ptr, IntPtr frame_ptr, int frame_size);
 
     [DllImport(DllName)]
-    public static extern void delete_vp8_decoder(IntPtr ptr);
+    public static extern IntPtr color_decoder_decode_padded(IntPtr decoder_ptr, IntPtr frame_ptr, int frame_size);
 
     [DllImport(DllName)]
-    public static extern IntPtr vp8_decoder_decode(IntPtr decoder_ptr, IntPtr frame_ptr, int frame_size);
+    public static extern int get_color_decoder_padding_size();
 
     [DllImport(DllName)]
     public static extern void delete_ffmpeg_frame(IntPtr ptr);
 
     [DllImport(DllName)]
-    public static extern IntPtr create_trvl_decoder(int frame_size);
+    public static extern int get_depth_codec_count();
 
     [DllImport(DllName)]
-    public static extern void delete_trvl_decoder(IntPtr ptr);
+    public static extern byte get_depth_codec_id(int index);
 
     [DllImport(DllName)]
-    public static extern IntPtr trvl_decoder_decode(IntPtr decoder_ptr, IntPtr frame_ptr, int frame_size, bool keyframe);
+    public static extern int get_color_codec_count();
 
     [DllImport(DllName)]
-    public static extern void delete_depth_pixels(IntPtr ptr);
+    public static extern byte get_color_codec_id(int index);
 
     [DllImport(DllName)]
     public static extern IntPtr create_audio_decoder(int sample_rate, int channel_count);
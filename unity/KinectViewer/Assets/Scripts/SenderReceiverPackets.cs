@@ -20,6 +20,21 @@ public enum ReceiverPacketType : byte
     Request = 3,
 }
 
+// Has to match kh::DepthCodecId of the plugin.
+public enum DepthCodecId : byte
+{
+    Trvl = 0,
+    Tmrans = 1,
+    Trvl2 = 2,
+}
+
+// Has to match kh::ColorCodecId of the plugin.
+public enum ColorCodecId : byte
+{
+    Vp8 = 0,
+    Vp9 = 1,
+}
+
 public static class PacketHelper
 {
     public const int PACKET_SIZE = 1472;
@@ -39,7 +54,9 @@ public static class PacketHelper
     public static byte[] createConnectReceiverPacketBytes(int sessionId,
                                                           bool videoRequested,
                                                           bool audioRequested,
-                                                          bool floorRequested)
+                                                          bool floorRequested,
+                                                          List<DepthCodecId> depthCodecIds,
+                                                          List<ColorCodecId> colorCodecIds)
     {
         var ms = new MemoryStream();
         ms.Write(BitConverter.GetBytes(sessionId), 0, 4);
@@ -48,6 +65,16 @@ public static class PacketHelper
         ms.WriteByte(Convert.ToByte(videoRequested));
         ms.WriteByte(Convert.ToByte(audioRequested));
         ms.WriteByte(Convert.ToByte(floorRequested));
+        ms.WriteByte((byte)depthCodecIds.Count);
+        foreach (var depthCodecId in depthCodecIds)
+        {
+            ms.WriteByte((byte)depthCodecId);
+        }
+        ms.WriteByte((byte)colorCodecIds.Count);
+        foreach (var colorCodecId in colorCodecIds)
+        {
+            ms.WriteByte((byte)colorCodecId);
+        }
         return ms.ToArray();
     }
 
@@ -59,7 +86,8 @@ public static class PacketHelper
         return ms.ToArray();
     }
 
-    public static byte[] createReportReceiverPacketBytes(int sessionId, int frameId, float decoderMs, float frameMs)
+    public static byte[] createReportReceiverPacketBytes(int sessionId, int frameId, float decoderMs, float frameMs,
+                                                         VideoPacketStatistics packetStatistics)
     {
         var ms = new MemoryStream();
         ms.Write(BitConverter.GetBytes(sessionId), 0, 4);
@@ -67,6 +95,9 @@ public static class PacketHelper
         ms.Write(BitConverter.GetBytes(frameId), 0, 4);
         ms.Write(BitConverter.GetBytes(decoderMs), 0, 4);
         ms.Write(BitConverter.GetBytes(frameMs), 0, 4);
+        ms.Write(BitConverter.GetBytes(packetStatistics.videoPacketCount), 0, 4);
+        ms.Write(BitConverter.GetBytes(packetStatistics.lostVideoPacketCount), 0, 4);
+        ms.Write(BitConverter.GetBytes(packetStatistics.receivedPacketCount), 0, 4);
         return ms.ToArray();
     }
 
@@ -96,6 +127,9 @@ public class InitSenderPacketData
     public int depthHeight;
     public KinectCalibration.Intrinsics depthIntrinsics;
     public float depthMetricRadius;
+    public ColorCodecId colorCodecId;
+    public DepthCodecId depthCodecId;
+    public int depthBandCount;
 
     public static InitSenderPacketData Parse(byte[] packetBytes)
     {
@@ -125,6 +159,9 @@ public class InitSenderPacketData
         initSenderPacketData.depthIntrinsics = depthIntrinsics;
 
         initSenderPacketData.depthMetricRadius = reader.ReadSingle();
+        initSenderPacketData.colorCodecId = (ColorCodecId)reader.ReadByte();
+        initSenderPacketData.depthCodecId = (DepthCodecId)reader.ReadByte();
+        initSenderPacketData.depthBandCount = reader.ReadInt32();
 
         return initSenderPacketData;
     }
@@ -134,6 +171,18 @@ public class VideoSenderMessageData
 {
     public float frameTimeStamp;
     public bool keyframe;
+    public ColorCodecId colorCodecId;
+    // The base layer is 0. Depth frames of higher layers leave the state of depth decoders as it was.
+    public byte temporalLayerId;
+    // The frame this one depends on is this many frames before it, unless this is a keyframe.
+    public int referenceFrameDistance;
+    // The frame became the long-term reference, which keyframes also do.
+    public bool longTermReference;
+    // The frame only references the long-term reference, which is referenceFrameDistance frames before it.
+    public bool referencesLongTermReference;
+    public DepthCodecId depthCodecId;
+    // Zero for lossless depth frames.
+    public float depthErrorBound;
     public byte[] colorEncoderFrame;
     public byte[] depthEncoderFrame;
 
@@ -144,6 +193,13 @@ public class VideoSenderMessageData
         var videoSenderMessageData = new VideoSenderMessageData();
         videoSenderMessageData.frameTimeStamp = reader.ReadSingle();
         videoSenderMessageData.keyframe = reader.ReadBoolean();
+        videoSenderMessageData.colorCodecId = (ColorCodecId)reader.ReadByte();
+        videoSenderMessageData.temporalLayerId = reader.ReadByte();
+        videoSenderMessageData.referenceFrameDistance = reader.ReadInt32();
+        videoSenderMessageData.longTermReference = reader.ReadBoolean();
+        videoSenderMessageData.referencesLongTermReference = reader.ReadBoolean();
+        videoSenderMessageData.depthCodecId = (DepthCodecId)reader.ReadByte();
+        videoSenderMessageData.depthErrorBound = reader.ReadSingle();
 
         int colorEncoderFrameSize = reader.ReadInt32();
         int depthEncoderFrameSize = reader.ReadInt32();
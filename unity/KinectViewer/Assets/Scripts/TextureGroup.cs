@@ -1,4 +1,5 @@
 ﻿using System;
+using System.Runtime.InteropServices;
 using UnityEngine;
 
 public class TextureGroup
@@ -45,9 +46,37 @@ public class TextureGroup
         Plugin.texture_group_set_ffmpeg_frame(Ptr, ffmpegFrame.Ptr);
     }
 
-    public void SetTrvlFrame(TrvlFrame trvlFrame)
+    public void SetDepthBandCount(int depthBandCount)
     {
-        Plugin.texture_group_set_depth_pixels(Ptr, trvlFrame.Ptr);
+        Plugin.texture_group_set_depth_band_count(Ptr, depthBandCount);
+    }
+
+    // Depth frames get decoded by the plugin in the render thread into the depth texture.
+    // The plugin uses frameId and referenceFrameDistance to find skipped frames of the base temporal layer
+    // and the long-term reference of frames that reference it.
+    public void AddDepthEncoderFrame(int frameId, byte[] frame, DepthCodecId codecId, float errorBound, bool keyframe,
+                                     int temporalLayerId, int referenceFrameDistance,
+                                     bool longTermReference, bool referencesLongTermReference)
+    {
+        IntPtr bytes = Marshal.AllocHGlobal(frame.Length);
+        Marshal.Copy(frame, 0, bytes, frame.Length);
+        Plugin.texture_group_add_depth_encoder_frame(Ptr, frameId, bytes, frame.Length, (byte)codecId, errorBound, keyframe,
+                                                     temporalLayerId, referenceFrameDistance,
+                                                     longTermReference, referencesLongTermReference);
+        Marshal.FreeHGlobal(bytes);
+    }
+
+    // False until every band of depth got refreshed when the sender uses intra refresh.
+    public bool IsDepthSynchronized()
+    {
+        return Plugin.texture_group_is_depth_synchronized(Ptr);
+    }
+
+    // The last added frame whose depth can be decoded, which falls behind the added frames
+    // when the plugin dropped depth frames the render thread did not take in time.
+    public int GetDepthDecodableFrameId()
+    {
+        return Plugin.texture_group_get_depth_decodable_frame_id(Ptr);
     }
 
     public Texture2D GetYTexture()
@@ -6,6 +6,9 @@ using UnityEngine;
 
 public class TextureGroupUpdater
 {
+    // Frames reference frames up to this many frames before them, as the pattern of three temporal layers repeats every 4 frames.
+    private const int MaxReferenceFrameDistance = 4;
+
     private int sessionId;
     private IPEndPoint endPoint;
 
@@ -15,14 +18,20 @@ public class TextureGroupUpdater
 
     public int lastVideoFrameId;
 
-    private Vp8Decoder colorDecoder;
-    private TrvlDecoder depthDecoder;
+    private ColorCodecId colorCodecId;
+    private int colorDecoderThreadCount;
+    private ColorDecoder colorDecoder;
     private bool prepared;
+    private bool depthSynchronized;
 
     private Dictionary<int, VideoSenderMessageData> videoMessages;
+    // Recently decoded frames, which tell whether the frames that reference them can be decoded.
+    private HashSet<int> decodedFrameIds;
+    // The last decoded frame that became the long-term reference, which frames that reference it need.
+    private int longTermReferenceFrameId;
     private Stopwatch frameStopWatch;
 
-    public TextureGroupUpdater(Material azureKinectScreenMaterial, InitSenderPacketData initPacketData, int sessionId, IPEndPoint endPoint)
+    public TextureGroupUpdater(Material azureKinectScreenMaterial, InitSenderPacketData initPacketData, int colorDecoderThreadCount, int sessionId, IPEndPoint endPoint)
     {
         this.azureKinectScreenMaterial = azureKinectScreenMaterial;
         
@@ -32,22 +41,27 @@ public class TextureGroupUpdater
         lastVideoFrameId = -1;
 
         prepared = false;
+        depthSynchronized = false;
 
         videoMessages = new Dictionary<int, VideoSenderMessageData>();
+        decodedFrameIds = new HashSet<int>();
+        longTermReferenceFrameId = -1;
         frameStopWatch = Stopwatch.StartNew();
 
         textureGroup.SetWidth(initPacketData.depthWidth);
         textureGroup.SetHeight(initPacketData.depthHeight);
+        textureGroup.SetDepthBandCount(initPacketData.depthBandCount);
         PluginHelper.InitTextureGroup(textureGroup.GetId());
 
-        colorDecoder = new Vp8Decoder();
-        depthDecoder = new TrvlDecoder(initPacketData.depthWidth * initPacketData.depthHeight);
+        colorCodecId = initPacketData.colorCodecId;
+        this.colorDecoderThreadCount = colorDecoderThreadCount;
+        colorDecoder = new ColorDecoder(colorCodecId, colorDecoderThreadCount);
 
         this.sessionId = sessionId;
         this.endPoint = endPoint;
     }
 
-    public void UpdateFrame(UdpSocket udpSocket, List<Tuple<int, VideoSenderMessageData>> videoMessageList)
+    public void UpdateFrame(UdpSocket udpSocket, VideoMessageAssembler videoMessageAssembler, List<Tuple<int, VideoSenderMessageData>> videoMessageList)
     {
         // If texture is not created, create and assign them to quads.
         if (!prepared)
@@ -85,52 +99,85 @@ public class TextureGroupUpdater
         }
 
         int? beginFrameId = null;
-        // If there is a key frame, use the most recent one.
+        // If there is a key frame or a frame from the long-term reference this receiver has, use the most recent one.
         foreach (var frameMessagePair in videoMessages)
         {
             if (frameMessagePair.Key <= lastVideoFrameId)
                 continue;
 
-            if (frameMessagePair.Value.keyframe)
+            if (beginFrameId.HasValue && frameMessagePair.Key < beginFrameId.Value)
+                continue;
+
+            if (frameMessagePair.Value.keyframe || IsFromLongTermReference(frameMessagePair.Key, frameMessagePair.Value))
                 beginFrameId = frameMessagePair.Key;
         }
 
-        // When there is no key frame, go through all the frames to check
-        // if there is the one right after the previously rendered one.
-        if (!beginFrameId.HasValue)
+        // When there is no key frame, go through the frames after the previously rendered one in order.
+        // Frames of temporal layers the sender did not send never arrive, so a frame can be decoded
+        // when the frame it references got decoded.
+        var frameIds = new List<int>();
+        foreach (int frameId in videoMessages.Keys)
         {
-            if (videoMessages.ContainsKey(lastVideoFrameId + 1))
-            {
-                beginFrameId = lastVideoFrameId + 1;
-            }
-            else
-            {
-                // Wait for more frames if there is way to render without glitches.
-                return;
-            }
+            if (frameId > lastVideoFrameId && (!beginFrameId.HasValue || frameId >= beginFrameId.Value))
+                frameIds.Add(frameId);
         }
+        frameIds.Sort();
 
-        // ffmpegFrame and trvlFrame are guaranteed to be non-null
-        // since the existence of beginIndex's value.
         FFmpegFrame ffmpegFrame = null;
-        TrvlFrame trvlFrame = null;
+        // Reports tell the sender the last decoded frame, so it knows which receivers have the long-term reference.
+        int decodedFrameId = -1;
 
         var decoderStopWatch = Stopwatch.StartNew();
-        for (int i = beginFrameId.Value; ; ++i)
+        foreach (int i in frameIds)
         {
-            if (!videoMessages.ContainsKey(i))
-                break;
-
             var frameMessage = videoMessages[i];
+            int referenceFrameId = i - frameMessage.referenceFrameDistance;
+            bool decodable = frameMessage.keyframe
+                             || (frameMessage.referencesLongTermReference ? referenceFrameId == longTermReferenceFrameId
+                                                                          : decodedFrameIds.Contains(referenceFrameId));
+            if (!decodable)
+            {
+                // Wait for the referenced frame if it can still arrive.
+                if (!frameMessage.referencesLongTermReference && referenceFrameId > lastVideoFrameId)
+                    break;
+
+                // Otherwise this frame cannot be decoded until a keyframe or a frame from the long-term reference, so it gets passed.
+                lastVideoFrameId = i;
+                continue;
+            }
+
             lastVideoFrameId = i;
+            decodedFrameId = i;
+            decodedFrameIds.Add(i);
+            if (frameMessage.longTermReference)
+                longTermReferenceFrameId = i;
 
             var colorEncoderFrame = frameMessage.colorEncoderFrame;
             var depthEncoderFrame = frameMessage.depthEncoderFrame;
 
+            // The sender switches color codecs with a keyframe.
+            if (frameMessage.colorCodecId != colorCodecId)
+            {
+                colorCodecId = frameMessage.colorCodecId;
+                colorDecoder = new ColorDecoder(colorCodecId, colorDecoderThreadCount);
+            }
             ffmpegFrame = colorDecoder.Decode(colorEncoderFrame);
-            trvlFrame = depthDecoder.Decode(depthEncoderFrame, frameMessage.keyframe);
+            // Depth frames get decoded in the render thread.
+            textureGroup.AddDepthEncoderFrame(i, depthEncoderFrame, frameMessage.depthCodecId, frameMessage.depthErrorBound, frameMessage.keyframe,
+                                              frameMessage.temporalLayerId, frameMessage.referenceFrameDistance,
+                                              frameMessage.longTermReference, frameMessage.referencesLongTermReference);
         }
 
+        // Wait for more frames if there is no way to render without glitches.
+        if (ffmpegFrame == null)
+            return;
+
+        decodedFrameIds.RemoveWhere(frameId => frameId < lastVideoFrameId - MaxReferenceFrameDistance);
+
+        // After the plugin dropped depth frames, the report tells the last frame whose depth can be decoded instead,
+        // so the sender sees this receiver fall behind and sends a keyframe or a frame from the long-term reference.
+        decodedFrameId = Math.Min(decodedFrameId, textureGroup.GetDepthDecodableFrameId());
+
         decoderStopWatch.Stop();
         var decoderTime = decoderStopWatch.Elapsed;
         frameStopWatch.Stop();
@@ -138,20 +185,25 @@ public class TextureGroupUpdater
         frameStopWatch = Stopwatch.StartNew();
 
         udpSocket.Send(PacketHelper.createReportReceiverPacketBytes(sessionId,
-                                                                    lastVideoFrameId,
+                                                                    decodedFrameId,
                                                                     (float)decoderTime.TotalMilliseconds,
-                                                                    (float)frameTime.TotalMilliseconds), endPoint);
+                                                                    (float)frameTime.TotalMilliseconds,
+                                                                    videoMessageAssembler.TakePacketStatistics()), endPoint);
 
         // Invokes a function to be called in a render thread.
         if (prepared)
         {
             //Plugin.texture_group_set_ffmpeg_frame(textureGroup, ffmpegFrame.Ptr);
             textureGroup.SetFFmpegFrame(ffmpegFrame);
-            //Plugin.texture_group_set_depth_pixels(textureGroup, trvlFrame.Ptr);
-            textureGroup.SetTrvlFrame(trvlFrame);
             PluginHelper.UpdateTextureGroup(textureGroup.GetId());
         }
 
+        // The plugin decodes depth in the render thread, so this lags behind the frames by an update.
+        bool textureGroupDepthSynchronized = textureGroup.IsDepthSynchronized();
+        if (textureGroupDepthSynchronized && !depthSynchronized)
+            UnityEngine.Debug.Log($"Depth synchronized by frame {lastVideoFrameId}");
+        depthSynchronized = textureGroupDepthSynchronized;
+
         // Remove frame messages before the rendered frame.
         var frameMessageKeys = new List<int>();
         foreach (int key in videoMessages.Keys)
@@ -166,4 +218,10 @@ public class TextureGroupUpdater
             }
         }
     }
+
+    private bool IsFromLongTermReference(int frameId, VideoSenderMessageData frameMessage)
+    {
+        return frameMessage.referencesLongTermReference
+               && frameId - frameMessage.referenceFrameDistance == longTermReferenceFrameId;
+    }
 }
@@ -4,6 +4,14 @@ using System.Collections.Generic;
 using System.IO;
 using System.Net;
 
+// Counts of packets for the reports to the sender. Has to match kh::VideoPacketStatistics.
+public class VideoPacketStatistics
+{
+    public int videoPacketCount;
+    public int lostVideoPacketCount;
+    public int receivedPacketCount;
+}
+
 public class VideoMessageAssembler
 {
     private const int FEC_GROUP_SIZE = 2;
@@ -11,6 +19,9 @@ public class VideoMessageAssembler
     private IPEndPoint remoteEndPoint;
     private Dictionary<int, VideoSenderPacketData[]> videoPacketCollections;
     private Dictionary<int, ParitySenderPacketData[]> parityPacketCollections;
+    private VideoPacketStatistics packetStatistics;
+    // Frames that already are in packetStatistics.
+    private HashSet<int> countedFrameIds;
 
     public VideoMessageAssembler(int sessionId, IPEndPoint remoteEndPoint)
     {
@@ -18,6 +29,8 @@ public class VideoMessageAssembler
         this.remoteEndPoint = remoteEndPoint;
         videoPacketCollections = new Dictionary<int, VideoSenderPacketData[]>();
         parityPacketCollections = new Dictionary<int, ParitySenderPacketData[]>();
+        packetStatistics = new VideoPacketStatistics();
+        countedFrameIds = new HashSet<int>();
     }
 
     public void Assemble(UdpSocket udpSocket,
@@ -27,6 +40,8 @@ public class VideoMessageAssembler
                          List<Tuple<int, VideoSenderMessageData>> videoMessageList)
     {
         int? addedFrameId = null;
+        packetStatistics.receivedPacketCount += videoPacketDataList.Count + parityPacketDataList.Count;
+
         // Collect the received video packets.
         foreach (var videoSenderPacketData in videoPacketDataList)
         {
@@ -69,6 +84,9 @@ public class VideoMessageAssembler
                 if (frameId >= addedFrameId)
                     continue;
 
+                // The sender sends a frame after another, so the packets missing here got lost.
+                CountVideoPackets(frameId, videoPackets);
+
                 // Find the parity packet collection corresponding to the video packet collection.
                 // Skip if there is no parity packet collection for the video frame.
                 if (!parityPacketCollections.ContainsKey(frameId))
@@ -194,6 +212,7 @@ public class VideoMessageAssembler
 
             var videoMessageData = VideoSenderMessageData.Parse(ms.ToArray());
             videoMessageList.Add(new Tuple<int, VideoSenderMessageData>(fullFrameId, videoMessageData));
+            CountVideoPackets(fullFrameId, videoPacketCollections[fullFrameId]);
 
             videoPacketCollections.Remove(fullFrameId);
         }
@@ -212,5 +231,29 @@ public class VideoMessageAssembler
         {
             videoPacketCollections.Remove(obsoleteFrameId);
         }
+
+        countedFrameIds.RemoveWhere(frameId => frameId <= lastVideoFrameId);
+    }
+
+    // Returns the counts since the previous call.
+    public VideoPacketStatistics TakePacketStatistics()
+    {
+        var statistics = packetStatistics;
+        packetStatistics = new VideoPacketStatistics();
+        return statistics;
+    }
+
+    // Counts a frame once, when a newer frame arrived or when all of its packets arrived before that.
+    private void CountVideoPackets(int frameId, VideoSenderPacketData[] videoPackets)
+    {
+        if (!countedFrameIds.Add(frameId))
+            return;
+
+        packetStatistics.videoPacketCount += videoPackets.Length;
+        foreach (var videoPacket in videoPackets)
+        {
+            if (videoPacket == null)
+                ++packetStatistics.lostVideoPacketCount;
+        }
     }
 }
\ No newline at end of file
@@ -19,6 +19,8 @@ public class ViewerManager : MonoBehaviour
     // The root of the scene that includes everything else except the main camera.
     // This provides a convenient way to place everything in front of the camera.
     public SharedSpaceAnchor sharedSpaceAnchor;
+    // Threads decoding the token partitions of a color frame in parallel. HoloLens 2 has four cores.
+    public int colorDecoderThreadCount = 2;
 
 
     private UdpSocket udpSocket;
@@ -219,10 +221,12 @@ public class ViewerManager : MonoBehaviour
         var endPoint = new IPEndPoint(ipAddress, SENDER_PORT);
 
         InitSenderPacketData initPacketData;
+        var depthCodecIds = PluginHelper.GetDepthCodecIds();
+        var colorCodecIds = PluginHelper.GetColorCodecIds();
         int connectCount = 0;
         while (true)
         {
-            udpSocket.Send(PacketHelper.createConnectReceiverPacketBytes(receiverSessionId, true, true, true), endPoint);
+            udpSocket.Send(PacketHelper.createConnectReceiverPacketBytes(receiverSessionId, true, true, true, depthCodecIds, colorCodecIds), endPoint);
             ++connectCount;
             print("Sent connect packet");
 
@@ -257,6 +261,6 @@ public class ViewerManager : MonoBehaviour
 
         yield return StartCoroutine(sharedSpaceAnchor.KinectOrigin.Screen.SetupMesh(initPacketData));
         sharedSpaceAnchor.KinectOrigin.Speaker.Setup();
-        kinectReceiver = new KinectReceiver(receiverSessionId, endPoint, sharedSpaceAnchor.KinectOrigin, initPacketData);
+        kinectReceiver = new KinectReceiver(receiverSessionId, endPoint, sharedSpaceAnchor.KinectOrigin, initPacketData, colorDecoderThreadCount);
     }
 }